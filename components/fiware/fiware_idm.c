@@ -2,10 +2,15 @@
 
 #include "fiware_idm.h"
 
-#include <esp_log.h>
+#include <string.h>
 
-#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_check.h>
+#include <esp_timer.h>
+#include <nvs.h>
 
+#include "fiware_idm_parser.h"
+#include "metrics.h"
 #include "wifi.h"
 
 #define FIWARE_IDM_URI "http://" CONFIG_FIWARE_HOST
@@ -17,12 +22,17 @@
 #define FIWARE_IDM_GRANT_TYPE_PASSWORD "password"
 #define FIWARE_IDM_GRANT_TYPE_REFRESH "refresh_token"
 
+#define FIWARE_IDM_NVS_STORAGE_NAME "fiware"
+#define FIWARE_IDM_NVS_TOKEN_NAME "access_token"
+
 static const char *TAG = "FIWARE IdM";
 
 /**
  * @brief Callback function to process the http client event
  *
- * @param event the event to be processed, its user data is the FiwareAccessToken_t that needs to be parsed
+ * @details the response body is fed chunk by chunk into the fiware_idm_parser_t of the request
+ *
+ * @param event the event to be processed, its user data is the fiware_idm_parser_t of the request
  * @return esp_err_t ESP_OK
  */
 esp_err_t idm_access_token_event_handler(esp_http_client_event_handle_t event)
@@ -45,39 +55,18 @@ esp_err_t idm_access_token_event_handler(esp_http_client_event_handle_t event)
         // if the status is not OK then break from the switch
         if (esp_http_client_get_status_code(event->client) >= 300)
         {
-            ESP_LOGW(TAG, "Error while requesting access token: %s", (char *)event->data);
+            ESP_LOGW(TAG, "Error while requesting access token: %.*s", event->data_len, (char *)event->data);
             break;
         }
 
-        // cast the access token from the request user data
-        FiwareAccessToken_t *token = (FiwareAccessToken_t *)event->user_data;
+        // cast the parser from the request user data
+        fiware_idm_parser_t *parser = (fiware_idm_parser_t *)event->user_data;
 
-        // parse the json string
-        cJSON *payload = cJSON_Parse(event->data);
+        esp_err_t ret = fiware_idm_parser_feed(parser, event->data, event->data_len);
 
-        // get the attributes from the JSON object
-        cJSON *access_token = cJSON_GetObjectItem(payload, "access_token");
-        cJSON *refresh_token = cJSON_GetObjectItem(payload, "refresh_token");
-        cJSON *expires_in = cJSON_GetObjectItem(payload, "expires_in");
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to parse access token response: %s", esp_err_to_name(ret));
 
-        // initialize time
-        time_t now;
-        time(&now); // get the seconds since 1970. 01. 01.
-
-        // load the attributes into the token
-        strncpy(token->token, access_token->valuestring, FIWARE_IDM_ACCESS_TOKEN_LEN);
-        strncpy(token->refresh_token, refresh_token->valuestring, FIWARE_IDM_ACCESS_TOKEN_LEN);
-        token->expires_in = now + expires_in->valueint;
-
-        ESP_LOGI(
-            TAG,
-            "Token: %s\n\tRefresh: %s\n\tExpires in: %lld",
-            token->token,
-            token->refresh_token,
-            token->expires_in);
-
-        // free the cJSON object
-        cJSON_Delete(payload);
         break;
 
     default:
@@ -107,14 +96,20 @@ static const esp_http_client_config_t request_access_token_config = {
  *                   Use PASSWORD to request the initial token and REFRESH to refresh an expired token
  * @return esp_err_t    ESP_ERR_INVALID_ARG if the grant type was invalid,
  *                      ESP_OK if the request was successful,
+ *                      ESP_ERR_INVALID_RESPONSE if the response did not contain a complete token,
  *                      ESP_FAIL if there was an error requesting the token
  */
 esp_err_t fiware_idm_request_access_token_grant_type(FiwareAccessToken_t *token, FiwareAccessTokenGrantType grant_type)
 {
     esp_http_client_handle_t client = esp_http_client_init(&request_access_token_config);
 
-    // pass the token to be available during the callbacks
-    esp_http_client_set_user_data(client, token);
+    // the response is parsed into a scratch token so a failed request leaves the token untouched
+    FiwareAccessToken_t received;
+    fiware_idm_parser_t parser;
+    fiware_idm_parser_init(&parser, &received);
+
+    // pass the parser to be available during the callbacks
+    esp_http_client_set_user_data(client, &parser);
 
     // set the content type header
     esp_http_client_set_header(client, "Content-Type", "application/x-www-form-urlencoded");
@@ -151,18 +146,53 @@ esp_err_t fiware_idm_request_access_token_grant_type(FiwareAccessToken_t *token,
     esp_http_client_set_post_field(client, payload, strlen(payload));
 
     // execute the request
+    int64_t request_start = esp_timer_get_time();
     int ret = esp_http_client_perform(client);
 
     // free the payload variable
     free(payload);
 
+    int status_code = esp_http_client_get_status_code(client);
+
+    metrics_upload_record(METRICS_UPLOAD_IDM_TOKEN, esp_timer_get_time() - request_start, ret == ESP_OK);
+
+    // the client is not reused, release its connection and buffers
+    esp_http_client_cleanup(client);
+
     if (ret != ESP_OK)
         return ret;
 
-    int status_code = esp_http_client_get_status_code(client);
-
     if (status_code < 400)
     {
+        if (!fiware_idm_parser_is_complete(&parser))
+        {
+            ESP_LOGW(TAG, "Incomplete access token response");
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        // initialize time
+        time_t now;
+        time(&now); // get the seconds since 1970. 01. 01.
+
+        // load the attributes into the token
+        strcpy(token->token, received.token);
+        strcpy(token->refresh_token, received.refresh_token);
+        token->expires_in = now + received.expires_in;
+
+        ESP_LOGI(
+            TAG,
+            "Token: %s\n\tRefresh: %s\n\tExpires in: %lld",
+            token->token,
+            token->refresh_token,
+            token->expires_in);
+
+#ifdef CONFIG_FIWARE_IDM_PERSIST_TOKEN
+        // keep the token across reboots, a failure here only costs a new request on the next boot
+        ret = fiware_idm_store_access_token(token);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to store access token in NVS: %s", esp_err_to_name(ret));
+#endif
         return ESP_OK;
     }
 
@@ -228,3 +258,87 @@ bool fiware_idm_check_is_token_expired(FiwareAccessToken_t *token)
 
     return token->expires_in <= now;
 }
+
+/**
+ * @brief Stores the access token in the non-volatile storage (NVS)
+ *
+ * @details the token is stored as a single blob. If NVS encryption is enabled (CONFIG_NVS_ENCRYPTION)
+ *  the blob is sealed with the keys protected by flash encryption, otherwise it is stored in plaintext.
+ *
+ * @param token the token to store
+ * @return esp_err_t ESP_OK if successful, error code if there was an NVS flash error
+ */
+esp_err_t fiware_idm_store_access_token(const FiwareAccessToken_t *token)
+{
+    nvs_handle_t nvs_handle;
+    int ret;
+
+#ifndef CONFIG_NVS_ENCRYPTION
+    static bool plaintext_warned = false;
+
+    if (!plaintext_warned)
+    {
+        ESP_LOGW(TAG, "NVS encryption is disabled, the access token is stored in plaintext");
+        plaintext_warned = true;
+    }
+#endif
+
+    ret = nvs_open(FIWARE_IDM_NVS_STORAGE_NAME, NVS_READWRITE, &nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ESP_GOTO_ON_ERROR(
+        nvs_set_blob(nvs_handle, FIWARE_IDM_NVS_TOKEN_NAME, token, sizeof(FiwareAccessToken_t)),
+        cleanup,
+        TAG,
+        "Unable to set value: " FIWARE_IDM_NVS_TOKEN_NAME);
+
+    ret = nvs_commit(nvs_handle);
+
+cleanup:
+    nvs_close(nvs_handle);
+
+    return ret;
+}
+
+/**
+ * @brief Loads a previously stored access token from the non-volatile storage (NVS)
+ *
+ * @note the token might be expired, check it with fiware_idm_check_is_token_expired()
+ *
+ * @param token pointer to the FiwareAccessToken_t struct to load the token into
+ * @return esp_err_t    ESP_OK if the token was loaded,
+ *                      ESP_ERR_NVS_NOT_FOUND if there is no stored token,
+ *                      ESP_ERR_INVALID_SIZE if the stored token is malformed,
+ *                      error code if there was an NVS flash error
+ */
+esp_err_t fiware_idm_load_access_token(FiwareAccessToken_t *token)
+{
+    nvs_handle_t nvs_handle;
+    FiwareAccessToken_t stored;
+    size_t length = sizeof(FiwareAccessToken_t);
+    int ret;
+
+    ret = nvs_open(FIWARE_IDM_NVS_STORAGE_NAME, NVS_READONLY, &nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ret = nvs_get_blob(nvs_handle, FIWARE_IDM_NVS_TOKEN_NAME, &stored, &length);
+
+    nvs_close(nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    // the blob has to be a token of the current layout with terminated strings
+    if (length != sizeof(FiwareAccessToken_t) ||
+        stored.token[FIWARE_IDM_ACCESS_TOKEN_LEN] != '\0' ||
+        stored.refresh_token[FIWARE_IDM_ACCESS_TOKEN_LEN] != '\0')
+        return ESP_ERR_INVALID_SIZE;
+
+    *token = stored;
+
+    return ESP_OK;
+}
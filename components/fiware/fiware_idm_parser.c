@@ -0,0 +1,287 @@
+/// @file
+#include "fiware_idm_parser.h"
+
+#include <string.h>
+
+#define FIELD_ACCESS_TOKEN (1 << 0)
+#define FIELD_REFRESH_TOKEN (1 << 1)
+#define FIELD_EXPIRES_IN (1 << 2)
+
+#define FIELDS_ALL (FIELD_ACCESS_TOKEN | FIELD_REFRESH_TOKEN | FIELD_EXPIRES_IN)
+
+#define IS_WHITESPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/**
+ * @brief Selects the destination of the value belonging to the key that was just read
+ *
+ * @param parser pointer to the parser
+ */
+static void fiware_idm_parser_select_field(fiware_idm_parser_t *parser)
+{
+    parser->field = 0;
+    parser->value = NULL;
+    parser->value_len = 0;
+
+    // a truncated key can not be one of the fields
+    if (parser->key_len > FIWARE_IDM_PARSER_KEY_LEN)
+        return;
+
+    parser->key[parser->key_len] = '\0';
+
+    if (strcmp(parser->key, "access_token") == 0)
+    {
+        parser->field = FIELD_ACCESS_TOKEN;
+        parser->value = parser->token->token;
+    }
+    else if (strcmp(parser->key, "refresh_token") == 0)
+    {
+        parser->field = FIELD_REFRESH_TOKEN;
+        parser->value = parser->token->refresh_token;
+    }
+    else if (strcmp(parser->key, "expires_in") == 0)
+    {
+        parser->field = FIELD_EXPIRES_IN;
+        parser->token->expires_in = 0;
+    }
+}
+
+/**
+ * @brief Initializes the parser for a new response
+ *
+ * @param parser pointer to the parser
+ * @param token pointer to the token the fields are loaded into
+ */
+void fiware_idm_parser_init(fiware_idm_parser_t *parser, FiwareAccessToken_t *token)
+{
+    parser->token = token;
+    parser->state = IDM_PARSER_EXPECT_OBJECT;
+    parser->depth = 0;
+    parser->escape = false;
+    parser->key_len = 0;
+    parser->value = NULL;
+    parser->value_len = 0;
+    parser->found = 0;
+    parser->field = 0;
+}
+
+/**
+ * @brief Feeds the next chunk of the response body into the parser
+ *
+ * @details the chunk does not need to be NUL terminated and can be split at any character.
+ *
+ * @param parser pointer to the parser
+ * @param data the chunk of the response body
+ * @param length the length of the chunk
+ * @return esp_err_t    ESP_OK if the chunk was consumed,
+ *                      ESP_ERR_INVALID_SIZE if a token field does not fit into its buffer or the nesting is deeper than FIWARE_IDM_PARSER_MAX_DEPTH,
+ *                      ESP_ERR_INVALID_RESPONSE if the body is not a valid token response
+ */
+esp_err_t fiware_idm_parser_feed(fiware_idm_parser_t *parser, const char *data, size_t length)
+{
+    size_t i = 0;
+
+    while (i < length)
+    {
+        char c = data[i];
+
+        switch (parser->state)
+        {
+        case IDM_PARSER_EXPECT_OBJECT:
+            if (c == '{')
+            {
+                parser->depth = 1;
+                parser->state = IDM_PARSER_EXPECT_KEY;
+            }
+            else if (!IS_WHITESPACE(c))
+                parser->state = IDM_PARSER_ERROR;
+            break;
+
+        case IDM_PARSER_EXPECT_KEY:
+            if (c == '"')
+            {
+                parser->key_len = 0;
+                parser->escape = false;
+                parser->state = IDM_PARSER_KEY;
+            }
+            else if (c == '}')
+                parser->state = IDM_PARSER_DONE;
+            else if (!IS_WHITESPACE(c))
+                parser->state = IDM_PARSER_ERROR;
+            break;
+
+        case IDM_PARSER_KEY:
+            if (!parser->escape && c == '"')
+            {
+                fiware_idm_parser_select_field(parser);
+                parser->state = IDM_PARSER_EXPECT_COLON;
+                break;
+            }
+
+            parser->escape = !parser->escape && c == '\\';
+
+            // keep one extra character to know that the key was truncated
+            if (parser->key_len <= FIWARE_IDM_PARSER_KEY_LEN)
+            {
+                if (parser->key_len < FIWARE_IDM_PARSER_KEY_LEN)
+                    parser->key[parser->key_len] = c;
+                parser->key_len++;
+            }
+            break;
+
+        case IDM_PARSER_EXPECT_COLON:
+            if (c == ':')
+                parser->state = IDM_PARSER_EXPECT_VALUE;
+            else if (!IS_WHITESPACE(c))
+                parser->state = IDM_PARSER_ERROR;
+            break;
+
+        case IDM_PARSER_EXPECT_VALUE:
+            if (IS_WHITESPACE(c))
+                break;
+
+            parser->escape = false;
+
+            if (c == '"')
+                parser->state = parser->value != NULL ? IDM_PARSER_STRING_VALUE : IDM_PARSER_SKIP_STRING;
+            else if (c == '{' || c == '[')
+            {
+                if (parser->depth == FIWARE_IDM_PARSER_MAX_DEPTH)
+                {
+                    parser->state = IDM_PARSER_ERROR;
+                    return ESP_ERR_INVALID_SIZE;
+                }
+
+                parser->depth++;
+                parser->state = IDM_PARSER_SKIP_NESTED;
+            }
+            else if (parser->field == FIELD_EXPIRES_IN && IS_DIGIT(c))
+            {
+                parser->state = IDM_PARSER_NUMBER_VALUE;
+                // process the digit in the number state
+                continue;
+            }
+            else
+                parser->state = IDM_PARSER_SKIP_LITERAL;
+            break;
+
+        case IDM_PARSER_STRING_VALUE:
+            if (!parser->escape && c == '\\')
+            {
+                // the escaped character is kept as is
+                parser->escape = true;
+                break;
+            }
+
+            if (!parser->escape && c == '"')
+            {
+                parser->value[parser->value_len] = '\0';
+                parser->found |= parser->field;
+                parser->state = IDM_PARSER_AFTER_VALUE;
+                break;
+            }
+
+            parser->escape = false;
+
+            if (parser->value_len == FIWARE_IDM_ACCESS_TOKEN_LEN)
+            {
+                parser->state = IDM_PARSER_ERROR;
+                return ESP_ERR_INVALID_SIZE;
+            }
+
+            parser->value[parser->value_len++] = c;
+            break;
+
+        case IDM_PARSER_NUMBER_VALUE:
+            if (IS_DIGIT(c))
+            {
+                if (parser->value_len == FIWARE_IDM_PARSER_NUMBER_DIGITS)
+                {
+                    parser->state = IDM_PARSER_ERROR;
+                    return ESP_ERR_INVALID_SIZE;
+                }
+
+                parser->token->expires_in = parser->token->expires_in * 10 + (c - '0');
+                parser->value_len++;
+                break;
+            }
+
+            parser->found |= FIELD_EXPIRES_IN;
+            // a fraction or exponent is ignored, anything else ends the value
+            parser->state = IDM_PARSER_SKIP_LITERAL;
+            continue;
+
+        case IDM_PARSER_SKIP_STRING:
+            if (!parser->escape && c == '"')
+                parser->state = parser->depth > 1 ? IDM_PARSER_SKIP_NESTED : IDM_PARSER_AFTER_VALUE;
+            else
+                parser->escape = !parser->escape && c == '\\';
+            break;
+
+        case IDM_PARSER_SKIP_NESTED:
+            if (c == '"')
+            {
+                parser->escape = false;
+                parser->state = IDM_PARSER_SKIP_STRING;
+            }
+            else if (c == '{' || c == '[')
+            {
+                if (parser->depth == FIWARE_IDM_PARSER_MAX_DEPTH)
+                {
+                    parser->state = IDM_PARSER_ERROR;
+                    return ESP_ERR_INVALID_SIZE;
+                }
+
+                parser->depth++;
+            }
+            else if (c == '}' || c == ']')
+            {
+                parser->depth--;
+                if (parser->depth == 1)
+                    parser->state = IDM_PARSER_AFTER_VALUE;
+            }
+            break;
+
+        case IDM_PARSER_SKIP_LITERAL:
+            if (c == ',' || c == '}' || IS_WHITESPACE(c))
+            {
+                parser->state = IDM_PARSER_AFTER_VALUE;
+                // the delimiter belongs to the object
+                continue;
+            }
+            break;
+
+        case IDM_PARSER_AFTER_VALUE:
+            if (c == ',')
+                parser->state = IDM_PARSER_EXPECT_KEY;
+            else if (c == '}')
+                parser->state = IDM_PARSER_DONE;
+            else if (!IS_WHITESPACE(c))
+                parser->state = IDM_PARSER_ERROR;
+            break;
+
+        case IDM_PARSER_DONE:
+            // trailing data after the response object is ignored
+            break;
+
+        case IDM_PARSER_ERROR:
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        i++;
+    }
+
+    return parser->state == IDM_PARSER_ERROR ? ESP_ERR_INVALID_RESPONSE : ESP_OK;
+}
+
+/**
+ * @brief Checks if the whole response was parsed and all token fields were found
+ *
+ * @param parser pointer to the parser
+ * @return true if the token is complete
+ * @return false otherwise
+ */
+bool fiware_idm_parser_is_complete(const fiware_idm_parser_t *parser)
+{
+    return parser->state == IDM_PARSER_DONE && (parser->found & FIELDS_ALL) == FIELDS_ALL;
+}
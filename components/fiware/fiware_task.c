@@ -7,17 +7,31 @@
 #include <esp_log.h>
 #include <esp_check.h>
 #include <esp_netif_sntp.h>
+#include <esp_timer.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
 
 #include "iot_agent.h"
 #include "fiware_idm.h"
+#ifdef CONFIG_FIWARE_UPLOAD_ORION
+#include "orion.h"
+#endif
+#ifdef CONFIG_MEASUREMENT_FILTER_ENABLE
+#include "measurement_filter.h"
+#endif
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+#include "measurement_shaper.h"
+#endif
 
 #include "task_intercom.h"
 #include "wifi.h"
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
+#define MAX(a, b) ((a) > (b)) ? (a) : (b)
 
 static const char *TAG = "FIWARE Task";
 
@@ -57,6 +71,63 @@ static const char *KW_REMOTE_COMMAND = "execute";
 /// @brief The access token to FIWARE
 static FiwareAccessToken_t fiware_access_token;
 
+/// @brief Describes where the access token came from, used for the startup log
+static const char *fiware_token_source = "none";
+
+/// @brief Timer that fires when the access token needs to be refreshed
+static TimerHandle_t fiware_token_refresh_timer = NULL;
+
+/// @brief Binary semaphore given by the refresh timer, member of the FIWARE queue set
+static SemaphoreHandle_t fiware_token_refresh_semaphore = NULL;
+
+#if defined(CONFIG_MEASUREMENT_FILTER_ENABLE) && CONFIG_MEASUREMENT_FILTER_HEARTBEAT_MS > 0
+#define FIWARE_MEASUREMENT_HEARTBEAT
+
+/// @brief Periodic timer of the measurement heartbeat
+static TimerHandle_t fiware_heartbeat_timer = NULL;
+
+/// @brief Binary semaphore given by the heartbeat timer, member of the FIWARE queue set
+static SemaphoreHandle_t fiware_heartbeat_semaphore = NULL;
+
+/// @brief Payload of the heartbeat measurement
+static char fiware_heartbeat_buffer[MEASUREMENT_FILTER_HEARTBEAT_BUFFER_SIZE];
+#endif
+
+#if defined(CONFIG_MEASUREMENT_FILTER_ENABLE) && CONFIG_MEASUREMENT_FILTER_MIN_INTERVAL_MS > 0
+#define FIWARE_MEASUREMENT_FILTER_RELEASE
+
+/// @brief One-shot timer that fires when the first change held back by the minimum interval is due
+static TimerHandle_t fiware_filter_timer = NULL;
+
+/// @brief Binary semaphore given by the minimum interval timer, member of the FIWARE queue set
+static SemaphoreHandle_t fiware_filter_semaphore = NULL;
+
+/// @brief Payload of the measurement of the held back changes
+static char fiware_filter_buffer[MEASUREMENT_FILTER_HEARTBEAT_BUFFER_SIZE];
+#endif
+
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+/// @brief One-shot timer that fires when the first rate limited value can be uploaded
+static TimerHandle_t fiware_shaper_timer = NULL;
+
+/// @brief Binary semaphore given by the rate limit timer, member of the FIWARE queue set
+static SemaphoreHandle_t fiware_shaper_semaphore = NULL;
+
+/// @brief Payload of the measurement of the released values
+static char fiware_shaper_buffer[MEASUREMENT_SHAPER_FLUSH_BUFFER_SIZE];
+#endif
+
+/// @brief Measurements taken from the queue while a command was due, processed before the queue in arrival order
+static itc_message_t *fiware_deferred_measurements[CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE];
+static size_t fiware_deferred_head = 0;
+static size_t fiware_deferred_len = 0;
+
+/// @brief Set member selected while draining a batch of measurements, handled next by the task loop
+static QueueSetMemberHandle_t fiware_pending_member = NULL;
+
+/// @brief Time to wait before retrying a failed token acquisition
+#define FIWARE_TOKEN_RETRY_PERIOD_MS 30000
+
 #define FIWARE_IOT_COMMAND_PROGRAM_PARAMS 1
 
 #define FREE_CMD_PARAMS(param, param_num) \
@@ -72,11 +143,16 @@ static FiwareAccessToken_t fiware_access_token;
 /**
  * @brief Process the incoming command
  *
+ * @details if the command is forwarded to the controller, the UART task hands the message back
+ *  via the result queue once the controller answered, see fiware_handle_command_result().
+ *  The forwarded message takes the ownership of the command message, it is deleted with it.
+ *
  * @param command itc_message_t InterTask Communication message; the message to be processed
- * @return esp_err_t    ESP_OK if the command was processed successfully
+ * @return esp_err_t    ESP_OK if the command was forwarded to the controller, the command message is owned by it
+ *                      ESP_ERR_NOT_SUPPORTED if the command is unknown
  *                      ESP_FAIL if there was an error
  */
-esp_err_t fiware_process_command(const itc_message_t *command)
+esp_err_t fiware_process_command(itc_message_t *command)
 {
     esp_err_t ret = ESP_OK;
     char *command_name = NULL;
@@ -152,33 +228,781 @@ cleanup:
         FREE_CMD_PARAMS(params, param_num);
 
     // if the message is empty and allocated free it
-    if (uart_message != NULL && !task_intercom_message_is_empty(uart_message))
+    if (ret == ESP_OK && uart_message != NULL && !task_intercom_message_is_empty(uart_message))
     {
-        xQueueSend(task_itc_to_uart_queue, &uart_message, portMAX_DELAY);
+        // the UART task hands the message back with the result once the controller answered,
+        // the pooled command message is kept for the result instead of a copy of its payload
+        uart_message->iot_command = command;
+
+        task_intercom_send(task_itc_to_uart_queue, uart_message, portMAX_DELAY);
     }
     else
     {
         task_intercom_message_delete(uart_message);
+
+        // nothing was forwarded for a valid command, the command is unknown
+        if (ret == ESP_OK)
+            ret = ESP_ERR_NOT_SUPPORTED;
     }
 
     return ret;
 }
 
+/**
+ * @brief Acquires a valid access token into the @link fiware_access_token variable @endlink
+ *
+ * @details if CONFIG_FIWARE_IDM_PERSIST_TOKEN is set the token stored in the NVS is reused while it is valid.
+ *  An expired stored token is renewed with the refresh grant.
+ *  If neither works a new token is requested with the password grant.
+ *
+ * @param source pointer to a string describing where the token came from, used for the startup log
+ * @return esp_err_t ESP_OK if a token is available, see fiware_idm_request_access_token() otherwise
+ */
+static esp_err_t fiware_acquire_access_token(const char **source)
+{
+#ifdef CONFIG_FIWARE_IDM_PERSIST_TOKEN
+    if (fiware_idm_load_access_token(&fiware_access_token) == ESP_OK)
+    {
+        if (!fiware_idm_check_is_token_expired(&fiware_access_token))
+        {
+            *source = "stored";
+            return ESP_OK;
+        }
+
+        ESP_LOGI(TAG, "Stored access token expired, renewing token...");
+
+        if (fiware_idm_renew_access_token(&fiware_access_token) == ESP_OK)
+        {
+            *source = "refreshed";
+            return ESP_OK;
+        }
+
+        ESP_LOGW(TAG, "Unable to renew stored access token");
+    }
+#endif
+
+    *source = "requested";
+
+    return fiware_idm_request_access_token(&fiware_access_token);
+}
+
+/**
+ * @brief Callback of the token refresh timer, wakes up the FIWARE task
+ *
+ * @param timer the token refresh timer
+ */
+static void fiware_token_refresh_timer_callback(TimerHandle_t timer)
+{
+    xSemaphoreGive(fiware_token_refresh_semaphore);
+}
+
+/**
+ * @brief Arms the token refresh timer
+ *
+ * @details if a valid token is available the timer fires CONFIG_FIWARE_IDM_REFRESH_MARGIN seconds before it expires,
+ *  otherwise the acquisition is retried after FIWARE_TOKEN_RETRY_PERIOD_MS
+ *
+ * @param token_valid true if the @link fiware_access_token variable @endlink holds a valid token
+ */
+static void fiware_schedule_token_refresh(bool token_valid)
+{
+    TickType_t period = pdMS_TO_TICKS(FIWARE_TOKEN_RETRY_PERIOD_MS);
+
+    if (token_valid)
+    {
+        time_t now;
+        time(&now);
+
+        // long lived tokens would overflow pdMS_TO_TICKS()
+        int64_t ticks = (int64_t)(fiware_access_token.expires_in - now - CONFIG_FIWARE_IDM_REFRESH_MARGIN) * configTICK_RATE_HZ;
+
+        if (ticks <= 0)
+            period = 1;
+        else if (ticks >= portMAX_DELAY)
+            period = portMAX_DELAY - 1;
+        else
+            period = (TickType_t)ticks;
+    }
+
+    // changing the period also starts the timer
+    xTimerChangePeriod(fiware_token_refresh_timer, period, portMAX_DELAY);
+}
+
+/**
+ * @brief Renews the access token before it expires
+ *
+ * @details the token is renewed with the refresh grant, if that fails a new token is requested.
+ *  The refresh timer is rearmed afterwards.
+ */
+static void fiware_refresh_access_token()
+{
+    int ret = fiware_idm_renew_access_token(&fiware_access_token);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Unable to renew access token (%s), requesting new token", esp_err_to_name(ret));
+        ret = fiware_idm_request_access_token(&fiware_access_token);
+    }
+
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Unable to get access token");
+
+    fiware_schedule_token_refresh(ret == ESP_OK);
+}
+
+/**
+ * @brief Hands a processed measurement back to the UART task, which sends its response to the controller
+ *
+ * @details measurements generated on the MAU have no controller waiting for the response, they are deleted
+ *
+ * @param message the processed measurement message
+ */
+static void fiware_measurement_done(itc_message_t *message)
+{
+    if (message->no_reply)
+    {
+        task_intercom_message_delete(message);
+        return;
+    }
+
+    task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
+}
+
+#if defined(FIWARE_MEASUREMENT_HEARTBEAT) || defined(FIWARE_MEASUREMENT_FILTER_RELEASE) || defined(CONFIG_MEASUREMENT_SHAPER_ENABLE)
+/**
+ * @brief Uploads a measurement that was built by the FIWARE task and not received from the controller
+ *
+ * @param payload the UltraLight 2.0 payload
+ * @return esp_err_t ESP_OK if the measurement was uploaded, error code of the upload otherwise
+ */
+static esp_err_t fiware_upload_generated_measurement(const char *payload)
+{
+#ifdef CONFIG_FIWARE_UPLOAD_ORION
+    orion_batch_reset();
+
+    int ret = orion_batch_add(payload);
+
+    if (ret == ESP_OK)
+        ret = orion_batch_send(&fiware_access_token, NULL);
+
+    orion_batch_reset();
+
+    return ret;
+#else
+    return fiware_iota_make_measurement(payload, &fiware_access_token, NULL);
+#endif
+}
+#endif
+
+#ifdef FIWARE_MEASUREMENT_FILTER_RELEASE
+/**
+ * @brief Callback of the minimum interval timer, wakes up the FIWARE task
+ *
+ * @param timer the minimum interval timer
+ */
+static void fiware_filter_timer_callback(TimerHandle_t timer)
+{
+    xSemaphoreGive(fiware_filter_semaphore);
+}
+
+/**
+ * @brief Arms the minimum interval timer for the first held back change if it is not running
+ *
+ * @details changes held back while the timer runs are released when it fires, or later if their interval is not over yet
+ */
+static void fiware_schedule_filter_release()
+{
+    if (xTimerIsTimerActive(fiware_filter_timer))
+        return;
+
+    int32_t next_ms = measurement_filter_next_release_ms();
+
+    if (next_ms < 0)
+        return;
+
+    xTimerChangePeriod(fiware_filter_timer, MAX(pdMS_TO_TICKS(next_ms), 1), portMAX_DELAY);
+}
+
+/**
+ * @brief Uploads the changes whose minimum interval is over and rearms the minimum interval timer
+ *
+ * @details without it, the last change before the controller stops sending would never be uploaded
+ */
+static void fiware_release_filtered_measurements()
+{
+    size_t sent;
+
+    measurement_filter_flush(fiware_filter_buffer, sizeof(fiware_filter_buffer), &sent);
+
+    if (sent > 0)
+    {
+        int ret = fiware_upload_generated_measurement(fiware_filter_buffer);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to upload held back values: %s", esp_err_to_name(ret));
+
+        // the values of a failed upload are retried after the minimum interval
+        measurement_filter_flush_done(ret == ESP_OK);
+    }
+
+    fiware_schedule_filter_release();
+}
+#endif
+
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+/**
+ * @brief Callback of the rate limit timer, wakes up the FIWARE task
+ *
+ * @param timer the rate limit timer
+ */
+static void fiware_shaper_timer_callback(TimerHandle_t timer)
+{
+    xSemaphoreGive(fiware_shaper_semaphore);
+}
+
+/**
+ * @brief Arms the rate limit timer for the first waiting value if it is not running
+ *
+ * @details values that start waiting while the timer runs are released when it fires, or later if they have no token yet
+ */
+static void fiware_schedule_shaper_release()
+{
+    if (xTimerIsTimerActive(fiware_shaper_timer))
+        return;
+
+    int32_t next_ms = measurement_shaper_next_release_ms();
+
+    if (next_ms < 0)
+        return;
+
+    xTimerChangePeriod(fiware_shaper_timer, MAX(pdMS_TO_TICKS(next_ms), 1), portMAX_DELAY);
+}
+
+/**
+ * @brief Uploads the rate limited values that have a token again and rearms the rate limit timer
+ */
+static void fiware_release_shaped_measurements()
+{
+    size_t sent;
+
+    measurement_shaper_flush(fiware_shaper_buffer, sizeof(fiware_shaper_buffer), &sent);
+
+    if (sent > 0)
+    {
+        int ret = fiware_upload_generated_measurement(fiware_shaper_buffer);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to upload rate limited values: %s", esp_err_to_name(ret));
+
+        // the values of a failed upload keep waiting, a newer value still replaces them
+        measurement_shaper_flush_done(ret == ESP_OK);
+    }
+
+    fiware_schedule_shaper_release();
+}
+#endif
+
+/**
+ * @brief Removes the unchanged and the rate limited attributes from a measurement
+ *
+ * @details if no attribute is left the measurement is acknowledged to the controller without an upload.
+ *  Does nothing if neither CONFIG_MEASUREMENT_FILTER_ENABLE nor CONFIG_MEASUREMENT_SHAPER_ENABLE is set.
+ *
+ * @param message the incoming measurement message, its payload is filtered in place
+ * @return true if the measurement was suppressed and handed back to the UART task
+ */
+static bool fiware_filter_measurement(itc_message_t *message)
+{
+#if defined(CONFIG_MEASUREMENT_FILTER_ENABLE) || defined(CONFIG_MEASUREMENT_SHAPER_ENABLE)
+    size_t sent = 1;
+
+    // invalid measurements are passed on, the upload reports the error
+#ifdef CONFIG_MEASUREMENT_FILTER_ENABLE
+    if (measurement_filter_apply(message->payload, &sent) != ESP_OK)
+        return false;
+
+#ifdef FIWARE_MEASUREMENT_FILTER_RELEASE
+    fiware_schedule_filter_release();
+#endif
+#endif
+
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+    if (sent > 0)
+    {
+        if (measurement_shaper_apply(message->payload, &sent) != ESP_OK)
+            return false;
+
+        fiware_schedule_shaper_release();
+    }
+#endif
+
+    if (sent > 0)
+        return false;
+
+    message->response_static = "OK";
+    fiware_measurement_done(message);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef FIWARE_MEASUREMENT_HEARTBEAT
+/**
+ * @brief Callback of the heartbeat timer, wakes up the FIWARE task
+ *
+ * @param timer the heartbeat timer
+ */
+static void fiware_heartbeat_timer_callback(TimerHandle_t timer)
+{
+    xSemaphoreGive(fiware_heartbeat_semaphore);
+}
+
+/**
+ * @brief Uploads the latest value of the attributes that were not uploaded for CONFIG_MEASUREMENT_FILTER_HEARTBEAT_MS
+ *
+ * @details the timer checks every heartbeat period, so an attribute is uploaded at most twice the period late
+ */
+static void fiware_upload_heartbeat()
+{
+    size_t sent;
+
+    measurement_filter_heartbeat(fiware_heartbeat_buffer, sizeof(fiware_heartbeat_buffer), &sent);
+
+    if (sent == 0)
+        return;
+
+    int ret = fiware_upload_generated_measurement(fiware_heartbeat_buffer);
+
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Unable to upload heartbeat: %s", esp_err_to_name(ret));
+}
+#endif
+
+/**
+ * @brief Checks if a command or a command result is waiting and the measurements had their share
+ *
+ * @param measurement_streak number of measurements processed since the last command
+ * @return true if a command is processed before the next measurement
+ */
+static bool fiware_command_due(uint8_t measurement_streak)
+{
+    if (measurement_streak < CONFIG_FIWARE_TASK_MEASUREMENT_RATIO)
+        return false;
+
+    return uxQueueMessagesWaiting(task_intercom_fiware_command_queue) > 0 ||
+           uxQueueMessagesWaiting(task_intercom_fiware_result_queue) > 0;
+}
+
+/**
+ * @brief Puts a measurement aside until the due command is processed
+ *
+ * @param message the measurement message
+ * @return true if the deferred measurements are full, the oldest one has to be processed
+ */
+static bool fiware_defer_measurement(itc_message_t *message)
+{
+    fiware_deferred_measurements[(fiware_deferred_head + fiware_deferred_len) % CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE] = message;
+    fiware_deferred_len++;
+
+    return fiware_deferred_len == CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE;
+}
+
+/**
+ * @brief Takes the oldest waiting measurement without blocking
+ *
+ * @details the deferred measurements come first. A measurement is only taken from the queue
+ *  if its entry is the next one in the queue set, the entry is consumed with it.
+ *  Any other member selected is kept in fiware_pending_member for the task loop
+ *
+ * @return itc_message_t* the measurement message, NULL if none is waiting before another event
+ */
+static itc_message_t *fiware_take_waiting_measurement()
+{
+    itc_message_t *message = NULL;
+
+    if (fiware_deferred_len > 0)
+    {
+        message = fiware_deferred_measurements[fiware_deferred_head];
+        fiware_deferred_head = (fiware_deferred_head + 1) % CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE;
+        fiware_deferred_len--;
+
+        return message;
+    }
+
+    if (fiware_pending_member != NULL)
+        return NULL;
+
+    QueueSetMemberHandle_t member = xQueueSelectFromSet(task_intercom_fiware_queue_set, 0);
+
+    if (member != task_intercom_fiware_measurement_queue)
+    {
+        fiware_pending_member = member;
+        return NULL;
+    }
+
+    if (xQueueReceive(task_intercom_fiware_measurement_queue, &message, 0) != pdTRUE)
+        return NULL;
+
+    return message;
+}
+
+/**
+ * @brief Returns the result of a command handed back by the UART task
+ *
+ * @param message the message with a non NULL iot_command field
+ * @return const char* the reply of the controller in the response field, otherwise the error in the response_static field
+ */
+static const char *fiware_command_result(const itc_message_t *message)
+{
+    if (message->response != NULL)
+        return message->response;
+
+    return message->response_static != NULL ? message->response_static : "ERROR";
+}
+
+/**
+ * @brief Logs the outcome of reporting a command result and deletes the message
+ *
+ * @param message the message with a non NULL iot_command field
+ * @param ret the outcome of the report
+ */
+static void fiware_command_result_done(itc_message_t *message, esp_err_t ret)
+{
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Unable to report command result: %s", esp_err_to_name(ret));
+
+    task_intercom_publish_event(ITC_EVENT_RESPONSE, "%s -> %s", message->iot_command->payload, fiware_command_result(message));
+
+    task_intercom_message_delete(message);
+}
+
+/**
+ * @brief Logs the time of the first measurement upload accepted by the server
+ *
+ * @details a transport without errors is not enough, a stale stored token is answered with 401
+ *
+ * @param ret the outcome of the upload
+ * @param status_code the http status code of the upload
+ */
+static void fiware_log_first_upload(esp_err_t ret, int status_code)
+{
+    static bool first_upload_done = false;
+
+    if (first_upload_done || ret != ESP_OK || status_code < 200 || status_code >= 300)
+        return;
+
+    ESP_LOGI(TAG, "First upload %lld ms after boot (access token %s)", esp_timer_get_time() / 1000, fiware_token_source);
+    first_upload_done = true;
+}
+
+#ifndef CONFIG_FIWARE_UPLOAD_ORION
+/**
+ * @brief Uploads a measurement to the IoT Agent and sends the message back to the UART task
+ *
+ * @param message the incoming measurement message
+ */
+static void fiware_handle_measurement(itc_message_t *message)
+{
+    int status_code = 0;
+
+    if (fiware_filter_measurement(message))
+        return;
+
+    int ret = fiware_iota_make_measurement(message->payload, &fiware_access_token, &status_code);
+    if (ret == ESP_OK)
+        message->response_static = "OK";
+    else
+        message->response_static = "NO WIFI";
+
+    fiware_log_first_upload(ret, status_code);
+
+    fiware_measurement_done(message);
+}
+#else
+/**
+ * @brief Takes the command result without blocking if its entry is the next one in the queue set
+ *
+ * @details call after fiware_take_waiting_measurement() returned NULL, the entry selected by it is consumed
+ *
+ * @return itc_message_t* the message with the command result, NULL if another event is next
+ */
+static itc_message_t *fiware_take_waiting_result()
+{
+    itc_message_t *message = NULL;
+
+    if (fiware_pending_member != task_intercom_fiware_result_queue)
+        return NULL;
+
+    fiware_pending_member = NULL;
+
+    if (xQueueReceive(task_intercom_fiware_result_queue, &message, 0) != pdTRUE)
+        return NULL;
+
+    return message;
+}
+
+/**
+ * @brief Adds a measurement or a command result to the current Orion batch
+ *
+ * @param message the measurement message or the message with a non NULL iot_command field
+ * @return esp_err_t see orion_batch_add() and orion_batch_add_command_result()
+ */
+static esp_err_t fiware_batch_add(itc_message_t *message)
+{
+    if (message->iot_command == NULL)
+        return orion_batch_add(message->payload);
+
+    // the controller replied if the result is in the response field
+    return orion_batch_add_command_result(message->iot_command->payload, message->response != NULL ? "OK" : "ERROR", fiware_command_result(message));
+}
+
+/**
+ * @brief Finishes a message of the batch, hands a measurement back to the UART task or deletes a command result
+ *
+ * @param message the measurement message or the message with a non NULL iot_command field
+ * @param ret the outcome of the upload
+ * @param response the response to the measurement
+ */
+static void fiware_batch_done(itc_message_t *message, esp_err_t ret, const char *response)
+{
+    if (message->iot_command != NULL)
+    {
+        fiware_command_result_done(message, ret);
+        return;
+    }
+
+    message->response_static = response;
+    fiware_measurement_done(message);
+}
+
+/**
+ * @brief Sends the current Orion batch and hands the measurements back to the UART task
+ *
+ * @param batch the messages of the measurements and command results in the batch
+ * @param batch_len the number of messages
+ */
+static void fiware_flush_measurement_batch(itc_message_t **batch, size_t batch_len)
+{
+    int status_code = 0;
+    int ret = orion_batch_send(&fiware_access_token, &status_code);
+
+    fiware_log_first_upload(ret, status_code);
+
+    for (size_t i = 0; i < batch_len; i++)
+        fiware_batch_done(batch[i], ret, ret == ESP_OK ? "OK" : "NO WIFI");
+
+    orion_batch_reset();
+}
+
+/**
+ * @brief Uploads the measurement and the measurements waiting behind it to Orion in batches
+ *
+ * @details up to CONFIG_ORION_BATCH_SIZE waiting measurements are taken via fiware_take_waiting_measurement(),
+ *  so every measurement drained from the queue consumes its entry of the queue set.
+ *  Command results waiting in between are added to the same batch via fiware_take_waiting_result().
+ *  A batch is sent early if the next measurement does not fit into the request buffer.
+ *
+ * @param message the first measurement message or command result
+ * @return size_t the number of measurements processed
+ */
+static size_t fiware_handle_measurement_batch(itc_message_t *message)
+{
+    itc_message_t *batch[CONFIG_ORION_BATCH_SIZE];
+    size_t batch_len = 0;
+    size_t processed = 0;
+
+    orion_batch_reset();
+
+    while (1)
+    {
+        bool is_result = message->iot_command != NULL;
+
+        if (!is_result)
+            processed++;
+
+        if (is_result || !fiware_filter_measurement(message))
+        {
+            int ret = fiware_batch_add(message);
+
+            // the batch is full, send it and retry the message in a new one
+            if (ret == ESP_ERR_INVALID_SIZE && batch_len > 0)
+            {
+                fiware_flush_measurement_batch(batch, batch_len);
+                batch_len = 0;
+                ret = fiware_batch_add(message);
+            }
+
+            if (ret == ESP_OK)
+                batch[batch_len++] = message;
+            else
+            {
+                ESP_LOGW(TAG, "Unable to convert %s: %s", is_result ? message->iot_command->payload : message->payload, esp_err_to_name(ret));
+                fiware_batch_done(message, ret, esp_err_to_name(ret));
+            }
+        }
+
+        if (batch_len == CONFIG_ORION_BATCH_SIZE)
+            break;
+
+        message = fiware_take_waiting_measurement();
+
+        if (message == NULL)
+            message = fiware_take_waiting_result();
+
+        if (message == NULL)
+            break;
+    }
+
+    if (batch_len > 0)
+        fiware_flush_measurement_batch(batch, batch_len);
+
+    return processed;
+}
+#endif
+
+/**
+ * @brief Uploads a measurement, with the measurements waiting behind it if uploading to Orion
+ *
+ * @param message the measurement message
+ * @return size_t the number of measurements processed
+ */
+static size_t fiware_process_measurement(itc_message_t *message)
+{
+#ifdef CONFIG_FIWARE_UPLOAD_ORION
+    return fiware_handle_measurement_batch(message);
+#else
+    fiware_handle_measurement(message);
+
+    return 1;
+#endif
+}
+
+/**
+ * @brief Executes an IoT Agent command, deletes the message unless it was forwarded to the controller
+ *
+ * @param message the incoming command message
+ */
+static void fiware_handle_command(itc_message_t *message)
+{
+    // check for program update command
+    int ret = fiware_process_command(message);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGI(TAG, "Error while executing command: %s", esp_err_to_name(ret));
+
+        task_intercom_publish_event(ITC_EVENT_ERROR, "%s -> %s", message->payload, esp_err_to_name(ret));
+
+        // the command never reaches the controller, report the error right away
+        ret = fiware_iota_send_command_result(message->payload, esp_err_to_name(ret), &fiware_access_token);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to report command result: %s", esp_err_to_name(ret));
+
+        task_intercom_message_delete(message);
+    }
+}
+
+/**
+ * @brief Reports the result of a command forwarded to the controller and deletes the message
+ *
+ * @details the result is posted to the IoT Agent as <device_id>@<command>|<result>.
+ *  If CONFIG_FIWARE_UPLOAD_ORION is set the result is written to Orion in the batch of the waiting measurements instead.
+ *
+ * @param message the message handed back by the UART task, see fiware_command_result()
+ */
+static void fiware_handle_command_result(itc_message_t *message)
+{
+#ifdef CONFIG_FIWARE_UPLOAD_ORION
+    fiware_handle_measurement_batch(message);
+#else
+    int ret = fiware_iota_send_command_result(message->iot_command->payload, fiware_command_result(message), &fiware_access_token);
+
+    fiware_command_result_done(message, ret);
+#endif
+}
+
 /**
  * @brief Task code of the FIWARE task
  *
  * @details the task is suspended until WiFi connection is established and sntp network sync is achieved.
- *  Then the task requests a FIWARE access token into the @link fiware_access_token variable @endlink.
+ *  Then the task acquires a FIWARE access token into the @link fiware_access_token variable @endlink
+ *  via fiware_acquire_access_token().
+ *  The time from boot until the token is available and until the first successful upload is logged.
  *  After this the main task loop begins.
- *  The task is suspended until there are incoming IoT measurements in the queue.
- *  If there is a timeout waiting for the measurement, the process tries to get an IoT command from the queue.
- *  If there is an incoming measurement it is processed via the fiware_iota_make_measurement() method.
- *  If there is an incoming command it is processed via the fiware_process_command() method.
+ *  The task is suspended on the @link task_intercom_fiware_queue_set queue set @endlink until a measurement,
+ *  a command, a command result or a token refresh is due, and handles each event as soon as it arrives.
+ *  Every selected member is received from, so each item consumes exactly its own entry of the set.
+ *  If both measurements and commands (or command results) are waiting, a command is processed after every
+ *  CONFIG_FIWARE_TASK_MEASUREMENT_RATIO measurements, the measurements selected before it are deferred.
+ *  Measurements are processed via the fiware_iota_make_measurement() method,
+ *  or sent to Orion in batches via fiware_handle_measurement_batch() if CONFIG_FIWARE_UPLOAD_ORION is set.
+ *  If CONFIG_MEASUREMENT_FILTER_ENABLE is set, unchanged attributes are removed from the measurements before the upload
+ *  and the heartbeat timer periodically uploads the attributes that were not uploaded for a while.
+ *  Changes held back by the minimum interval are uploaded by the minimum interval timer once it is over.
+ *  If CONFIG_MEASUREMENT_SHAPER_ENABLE is set, attributes over their rate limit wait in the shaper
+ *  and the rate limit timer uploads their latest value once they have a token again.
+ *  Commands are processed via the fiware_process_command() method.
+ *  Command results are reported via the fiware_iota_send_command_result() method,
+ *  or batched with the waiting measurements if CONFIG_FIWARE_UPLOAD_ORION is set.
  */
 void fiware_task()
 {
     int ret;
 
+    // the set is created empty by task_intercom_init(), the semaphore is added before it can be given
+    fiware_token_refresh_semaphore = xSemaphoreCreateBinary();
+    fiware_token_refresh_timer = xTimerCreate("FIWARE token", 1, pdFALSE, NULL, fiware_token_refresh_timer_callback);
+
+    if (fiware_token_refresh_semaphore == NULL ||
+        fiware_token_refresh_timer == NULL ||
+        xQueueAddToSet(fiware_token_refresh_semaphore, task_intercom_fiware_queue_set) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to set up the token refresh timer");
+        abort();
+    }
+
+#ifdef FIWARE_MEASUREMENT_HEARTBEAT
+    fiware_heartbeat_semaphore = xSemaphoreCreateBinary();
+    fiware_heartbeat_timer = xTimerCreate("FIWARE heartbeat", pdMS_TO_TICKS(CONFIG_MEASUREMENT_FILTER_HEARTBEAT_MS), pdTRUE, NULL, fiware_heartbeat_timer_callback);
+
+    if (fiware_heartbeat_semaphore == NULL ||
+        fiware_heartbeat_timer == NULL ||
+        xQueueAddToSet(fiware_heartbeat_semaphore, task_intercom_fiware_queue_set) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to set up the measurement heartbeat timer");
+        abort();
+    }
+#endif
+
+#ifdef FIWARE_MEASUREMENT_FILTER_RELEASE
+    fiware_filter_semaphore = xSemaphoreCreateBinary();
+    fiware_filter_timer = xTimerCreate("FIWARE filter", 1, pdFALSE, NULL, fiware_filter_timer_callback);
+
+    if (fiware_filter_semaphore == NULL ||
+        fiware_filter_timer == NULL ||
+        xQueueAddToSet(fiware_filter_semaphore, task_intercom_fiware_queue_set) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to set up the minimum interval timer");
+        abort();
+    }
+#endif
+
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+    fiware_shaper_semaphore = xSemaphoreCreateBinary();
+    fiware_shaper_timer = xTimerCreate("FIWARE shaper", 1, pdFALSE, NULL, fiware_shaper_timer_callback);
+
+    if (fiware_shaper_semaphore == NULL ||
+        fiware_shaper_timer == NULL ||
+        xQueueAddToSet(fiware_shaper_semaphore, task_intercom_fiware_queue_set) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to set up the rate limit timer");
+        abort();
+    }
+#endif
+
     // wait for wifi to be connected
     wifi_wait_connected(portMAX_DELAY);
 
@@ -187,50 +1011,112 @@ void fiware_task()
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_sntp_sync_wait(portMAX_DELAY));
     ESP_LOGI(TAG, "Network time synchronized");
 
-    ESP_LOGI(TAG, "Requesting access token from IdM");
+    ESP_LOGI(TAG, "Acquiring access token from IdM");
 
-    ret = fiware_idm_request_access_token(&fiware_access_token);
+    ret = fiware_acquire_access_token(&fiware_token_source);
 
     if (ret != ESP_OK)
         ESP_LOGE(TAG, "Unable to get access token");
+    else
+        ESP_LOGI(TAG, "Access token %s, ready %lld ms after boot", fiware_token_source, esp_timer_get_time() / 1000);
+
+    fiware_schedule_token_refresh(ret == ESP_OK);
+
+#ifdef FIWARE_MEASUREMENT_HEARTBEAT
+    xTimerStart(fiware_heartbeat_timer, portMAX_DELAY);
+#endif
 
     itc_message_t *incoming_message;
+    QueueSetMemberHandle_t member;
+    uint8_t measurement_streak = 0;
 
     /* LOOP */
     while (1)
     {
-        // block until a measurement payload comes in
-        ret = xQueueReceive(task_intercom_fiware_measurement_queue, &incoming_message, pdMS_TO_TICKS(CONFIG_FIWARE_TASK_MEASUREMENT_TIMEOUT));
+        // the deferred measurements are older than the queued ones
+        if (fiware_deferred_len > 0 && !fiware_command_due(measurement_streak))
+        {
+            size_t processed = fiware_process_measurement(fiware_take_waiting_measurement());
 
-        // check if the queue had items
-        if (ret == pdTRUE)
+            measurement_streak = MIN(measurement_streak + processed, CONFIG_FIWARE_TASK_MEASUREMENT_RATIO);
+            continue;
+        }
+
+        if (fiware_pending_member != NULL)
         {
-            ret = fiware_iota_make_measurement(incoming_message->payload, &fiware_access_token, NULL);
-            if (ret == ESP_OK)
-                incoming_message->response_static = "OK";
-            else
-                incoming_message->response_static = "NO WIFI";
+            member = fiware_pending_member;
+            fiware_pending_member = NULL;
+        }
+        else
+        {
+            // block until any of the events arrives
+            member = xQueueSelectFromSet(task_intercom_fiware_queue_set, portMAX_DELAY);
+        }
 
-            // send the message back to the UART task
-            xQueueSend(task_itc_to_uart_queue, &incoming_message, portMAX_DELAY);
+        if (member == fiware_token_refresh_semaphore)
+        {
+            xSemaphoreTake(fiware_token_refresh_semaphore, 0);
+            fiware_refresh_access_token();
+            continue;
+        }
+
+#ifdef FIWARE_MEASUREMENT_HEARTBEAT
+        if (member == fiware_heartbeat_semaphore)
+        {
+            xSemaphoreTake(fiware_heartbeat_semaphore, 0);
+            fiware_upload_heartbeat();
+            continue;
+        }
+#endif
+
+#ifdef FIWARE_MEASUREMENT_FILTER_RELEASE
+        if (member == fiware_filter_semaphore)
+        {
+            xSemaphoreTake(fiware_filter_semaphore, 0);
+            fiware_release_filtered_measurements();
+            continue;
+        }
+#endif
 
+#ifdef CONFIG_MEASUREMENT_SHAPER_ENABLE
+        if (member == fiware_shaper_semaphore)
+        {
+            xSemaphoreTake(fiware_shaper_semaphore, 0);
+            fiware_release_shaped_measurements();
             continue;
         }
+#endif
 
-        // if there was a timeout, check the commands
-        ret = xQueueReceive(task_intercom_fiware_command_queue, &incoming_message, 0);
+        // every item in the queues has exactly one entry in the set, the item is received from the selected queue
+        if (xQueueReceive(member, &incoming_message, 0) != pdTRUE)
+            continue;
 
-        if (ret == pdFALSE)
+        if (member == task_intercom_fiware_result_queue)
+        {
+            fiware_handle_command_result(incoming_message);
+            measurement_streak = 0;
             continue;
+        }
 
-        // check for program update command
-        ret = fiware_process_command(incoming_message);
+        if (member == task_intercom_fiware_command_queue)
+        {
+            fiware_handle_command(incoming_message);
+            measurement_streak = 0;
+            continue;
+        }
 
-        if (ret != ESP_OK)
+        // keep the ratio, the measurement waits until the command selected after it is processed
+        if (fiware_command_due(measurement_streak))
         {
-            ESP_LOGI(TAG, "Error while executing command: %s", esp_err_to_name(ret));
+            if (!fiware_defer_measurement(incoming_message))
+                continue;
+
+            // no room for another one, the oldest measurements go first after all
+            incoming_message = fiware_take_waiting_measurement();
         }
 
-        task_intercom_message_delete(incoming_message);
+        size_t processed = fiware_process_measurement(incoming_message);
+
+        measurement_streak = MIN(measurement_streak + processed, CONFIG_FIWARE_TASK_MEASUREMENT_RATIO);
     }
 }
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#include "fiware_idm_token.h"
+
+/// @brief Longest object key the parser keeps, longer keys can not match a token field
+#define FIWARE_IDM_PARSER_KEY_LEN 16
+
+/// @brief Maximum number of digits accepted in the expires_in field
+#define FIWARE_IDM_PARSER_NUMBER_DIGITS 10
+
+/// @brief Deepest nesting of objects and arrays accepted, the response object is depth 1
+#define FIWARE_IDM_PARSER_MAX_DEPTH 16
+
+/**
+ * @brief State of the token response tokenizer
+ * @internal
+ */
+typedef enum
+{
+    IDM_PARSER_EXPECT_OBJECT,
+    IDM_PARSER_EXPECT_KEY,
+    IDM_PARSER_KEY,
+    IDM_PARSER_EXPECT_COLON,
+    IDM_PARSER_EXPECT_VALUE,
+    IDM_PARSER_STRING_VALUE,
+    IDM_PARSER_NUMBER_VALUE,
+    IDM_PARSER_SKIP_STRING,
+    IDM_PARSER_SKIP_NESTED,
+    IDM_PARSER_SKIP_LITERAL,
+    IDM_PARSER_AFTER_VALUE,
+    IDM_PARSER_DONE,
+    IDM_PARSER_ERROR,
+} fiware_idm_parser_state_t;
+
+/**
+ * @brief Incremental parser of the KeyRock IdM token response
+ *
+ * @details the parser consumes the response body in arbitrary chunks and extracts the
+ *  access_token, refresh_token and expires_in fields into a FiwareAccessToken_t.
+ *  Every other field is skipped. The parser does not allocate memory.
+ */
+typedef struct
+{
+    /// @brief token to load the fields into, expires_in is stored in seconds relative to the response
+    FiwareAccessToken_t *token;
+    /// @brief current state of the tokenizer
+    fiware_idm_parser_state_t state;
+    /// @brief nesting depth of objects and arrays, the response object is depth 1, at most FIWARE_IDM_PARSER_MAX_DEPTH
+    uint8_t depth;
+    /// @brief true if the previous character inside a string was a backslash
+    bool escape;
+    /// @brief buffer of the current key
+    char key[FIWARE_IDM_PARSER_KEY_LEN + 1];
+    /// @brief length of the current key, FIWARE_IDM_PARSER_KEY_LEN + 1 if the key was too long
+    uint8_t key_len;
+    /// @brief destination of the current string value, NULL if the value is skipped
+    char *value;
+    /// @brief length of the current string value or number of digits of the current number
+    uint8_t value_len;
+    /// @brief bit mask of the fields found so far
+    uint8_t found;
+    /// @brief bit of the field the current value belongs to, 0 if the value is skipped
+    uint8_t field;
+} fiware_idm_parser_t;
+
+void fiware_idm_parser_init(fiware_idm_parser_t *parser, FiwareAccessToken_t *token);
+
+esp_err_t fiware_idm_parser_feed(fiware_idm_parser_t *parser, const char *data, size_t length);
+
+bool fiware_idm_parser_is_complete(const fiware_idm_parser_t *parser);
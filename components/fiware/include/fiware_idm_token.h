@@ -0,0 +1,18 @@
+#pragma once
+
+#include <time.h>
+
+#define FIWARE_IDM_ACCESS_TOKEN_LEN 40
+
+/**
+ * @brief FIWARE access token used to access and modify data in the context broker
+ */
+typedef struct
+{
+    /// @brief Char array of the access token
+    char token[FIWARE_IDM_ACCESS_TOKEN_LEN + 1];
+    /// @brief Char array of the refresh token
+    char refresh_token[FIWARE_IDM_ACCESS_TOKEN_LEN + 1];
+    /// @brief time in seconds after which the token will expire
+    time_t expires_in;
+} FiwareAccessToken_t;
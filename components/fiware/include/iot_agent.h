@@ -22,6 +22,8 @@ typedef struct
 
 esp_err_t fiware_iota_make_measurement(const char *payload, FiwareAccessToken_t *token, int *status_code);
 
+esp_err_t fiware_iota_send_command_result(const char *raw_command, const char *result, FiwareAccessToken_t *token);
+
 esp_err_t fiware_iota_command_get_command_name(const char *raw_command, char **command_name);
 
 esp_err_t fiware_iota_command_get_device_name(const char *raw_command, char **device_name);
@@ -30,4 +32,6 @@ esp_err_t fiware_iota_command_get_params(const char *raw_command, char ***params
 
 esp_err_t fiware_iota_command_get_param_string(const char *raw_command, char **param_string);
 
-esp_err_t fiware_iota_command_make_response(const char *raw_command, const char *response, char **response_formatted);
\ No newline at end of file
+esp_err_t fiware_iota_command_make_response(const char *raw_command, const char *response, char **response_formatted);
+
+esp_err_t fiware_iota_command_format_response(const char *raw_command, const char *response, char *buffer, size_t buffer_len);
\ No newline at end of file
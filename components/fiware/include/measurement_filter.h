@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+/// @brief Size of a buffer that holds the heartbeat of every tracked attribute, including the terminating NUL
+#define MEASUREMENT_FILTER_HEARTBEAT_BUFFER_SIZE \
+    (CONFIG_MEASUREMENT_FILTER_MAX_ATTRIBUTES * (CONFIG_MEASUREMENT_FILTER_NAME_LEN + CONFIG_MEASUREMENT_FILTER_VALUE_LEN + 2) + 1)
+
+esp_err_t measurement_filter_apply(char *measurement, size_t *sent);
+
+esp_err_t measurement_filter_heartbeat(char *buffer, size_t buffer_len, size_t *sent);
+
+esp_err_t measurement_filter_flush(char *buffer, size_t buffer_len, size_t *sent);
+
+void measurement_filter_flush_done(bool uploaded);
+
+int32_t measurement_filter_next_release_ms();
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+/**
+ * @brief Decides if an attribute of a measurement is kept, see measurement_payload_compact()
+ *
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @param value the value of the attribute, not NUL terminated
+ * @param value_len the length of the value
+ * @param now_us the time the measurement is processed at
+ * @return true if the attribute is kept
+ */
+typedef bool (*measurement_payload_keep_t)(const char *name, size_t name_len, const char *value, size_t value_len, int64_t now_us);
+
+esp_err_t measurement_payload_compact(char *measurement, measurement_payload_keep_t keep, size_t *pairs, size_t *kept);
+
+size_t measurement_payload_find(const void *table, size_t entry_size, size_t entries, const char *name, size_t name_len);
+
+bool measurement_payload_append(char *buffer, size_t buffer_len, size_t *length, const char *name, const char *value);
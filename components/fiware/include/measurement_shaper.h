@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+/// @brief Size of a buffer that holds the pending value of every tracked attribute, including the terminating NUL
+#define MEASUREMENT_SHAPER_FLUSH_BUFFER_SIZE \
+    (CONFIG_MEASUREMENT_SHAPER_MAX_ATTRIBUTES * (CONFIG_MEASUREMENT_SHAPER_NAME_LEN + CONFIG_MEASUREMENT_SHAPER_VALUE_LEN + 2) + 1)
+
+esp_err_t measurement_shaper_apply(char *measurement, size_t *sent);
+
+esp_err_t measurement_shaper_flush(char *buffer, size_t buffer_len, size_t *sent);
+
+void measurement_shaper_flush_done(bool uploaded);
+
+int32_t measurement_shaper_next_release_ms();
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#include "fiware_idm.h"
+
+void orion_batch_reset();
+
+esp_err_t orion_batch_add(const char *measurement);
+
+esp_err_t orion_batch_add_command_result(const char *raw_command, const char *status, const char *info);
+
+size_t orion_batch_count();
+
+esp_err_t orion_batch_send(FiwareAccessToken_t *token, int *status_code);
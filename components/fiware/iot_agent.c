@@ -1,11 +1,14 @@
 /// @file
 #include "iot_agent.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #include <esp_http_client.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
+#include "metrics.h"
 #include "wifi.h"
 
 #define FIWARE_IOTA_MEAS_QUERY "?i=" CONFIG_IOT_AGENT_DEVICE_ID "&k=" CONFIG_IOT_AGENT_APIKEY
@@ -43,17 +46,28 @@ static const esp_http_client_config_t measurement_config = {
     .path = CONFIG_IOT_AGENT_RESOURCE FIWARE_IOTA_MEAS_QUERY,
     .method = HTTP_METHOD_POST,
     .event_handler = fiware_iota_http_event_handler,
+    .keep_alive_enable = true,
     .cert_pem = NULL,
 };
 
+/// @brief Client kept open between uploads so measurements and command results share one connection
+static esp_http_client_handle_t fiware_iota_client = NULL;
+
 /**
- * @brief Upload an IoT Device measurement to the IoT Agent
+ * @brief Posts an UltraLight 2.0 payload to the south port of the IoT Agent
+ *
+ * @details the connection is kept alive between calls and reopened after an error
  *
  * @param payload the payload formatted in Ultralight 2.0
- * @return esp_err_t    ESP_OK if the operation was successful,
- *                      ESP_ERR_INVALID_STATE if wifi connection is not available
+ * @param token the access token to attach, set to NULL if not needed
+ * @param status_code pointer to store the http status code, set to NULL if not needed
+ * @param upload the type of the upload the latency is recorded for
+ * @return esp_err_t    ESP_OK if the request was sent,
+ *                      ESP_ERR_INVALID_STATE if wifi connection is not available,
+ *                      ESP_ERR_NO_MEM if the client could not be created,
+ *                      error code of esp_http_client_perform() otherwise
  */
-esp_err_t fiware_iota_make_measurement(const char *payload, FiwareAccessToken_t *token, int *status_code)
+static esp_err_t fiware_iota_post(const char *payload, FiwareAccessToken_t *token, int *status_code, metrics_upload_t upload)
 {
     // check if wifi is not connected
     if (!is_wifi_connected())
@@ -61,40 +75,48 @@ esp_err_t fiware_iota_make_measurement(const char *payload, FiwareAccessToken_t
         return ESP_ERR_INVALID_STATE;
     }
 
-    // create a new client with the request
-    esp_http_client_handle_t client = esp_http_client_init(&measurement_config);
+    // create the client on first use or after an error
+    if (fiware_iota_client == NULL)
+    {
+        fiware_iota_client = esp_http_client_init(&measurement_config);
+
+        if (fiware_iota_client == NULL)
+            return ESP_ERR_NO_MEM;
+
+        // set the content type header
+        esp_http_client_set_header(fiware_iota_client, "Content-Type", "text/plain");
+    }
 
     // if the token is not null, attach the auth values to the request
     if (token != NULL)
     {
-        // check if the token is expired
+        // the token refresh timer of the FIWARE task renews the token, the upload is not delayed by it
         if (fiware_idm_check_is_token_expired(token))
-        {
-            ESP_LOGW(TAG, "FIWARE Auth token expired, renewing token...");
-            fiware_idm_renew_access_token(token);
-        }
+            ESP_LOGW(TAG, "FIWARE Auth token expired, waiting for the refresh timer to renew it");
 
-        fiware_idm_attach_auth_data_to_request(token, client);
+        fiware_idm_attach_auth_data_to_request(token, fiware_iota_client);
     }
 
     // put the payload in the post field
-    esp_http_client_set_post_field(client, payload, strlen(payload));
-
-    // set the content type header
-    esp_http_client_set_header(client, "Content-Type", "text/plain");
+    esp_http_client_set_post_field(fiware_iota_client, payload, strlen(payload));
 
     // process the request itself
-    int ret = esp_http_client_perform(client);
+    int64_t request_start = esp_timer_get_time();
+    int ret = esp_http_client_perform(fiware_iota_client);
+
+    metrics_upload_record(upload, esp_timer_get_time() - request_start, ret == ESP_OK);
 
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Error sending request.");
-        esp_http_client_cleanup(client);
+        // drop the connection, it is reopened by the next request
+        esp_http_client_cleanup(fiware_iota_client);
+        fiware_iota_client = NULL;
         return ret;
     }
 
     // get the status code of the event
-    ret = esp_http_client_get_status_code(client);
+    ret = esp_http_client_get_status_code(fiware_iota_client);
 
     if (ret == 404)
     {
@@ -118,11 +140,53 @@ esp_err_t fiware_iota_make_measurement(const char *payload, FiwareAccessToken_t
         *status_code = ret;
     }
 
-    esp_http_client_cleanup(client);
-
     return ESP_OK;
 }
 
+/**
+ * @brief Upload an IoT Device measurement to the IoT Agent
+ *
+ * @param payload the payload formatted in Ultralight 2.0
+ * @param token the access token to attach, set to NULL if not needed
+ * @param status_code pointer to store the http status code, set to NULL if not needed
+ * @return esp_err_t    ESP_OK if the operation was successful,
+ *                      ESP_ERR_INVALID_STATE if wifi connection is not available
+ */
+esp_err_t fiware_iota_make_measurement(const char *payload, FiwareAccessToken_t *token, int *status_code)
+{
+    return fiware_iota_post(payload, token, status_code, METRICS_UPLOAD_IOTA_MEASUREMENT);
+}
+
+/**
+ * @brief Reports the result of an IoT Agent command back to the IoT Agent
+ *
+ * @details the result is sent as <device_id>@<command>|<result> over the same connection as the measurements
+ *
+ * @param raw_command the raw command payload -> <device_id>@<command>|<param1>|<param2>
+ * @param result the result of the command
+ * @param token the access token to attach, set to NULL if not needed
+ * @return esp_err_t    ESP_OK if the operation was successful,
+ *                      ESP_ERR_NO_MEM if the result could not be formatted,
+ *                      see fiware_iota_make_measurement() for the rest
+ */
+esp_err_t fiware_iota_send_command_result(const char *raw_command, const char *result, FiwareAccessToken_t *token)
+{
+    char *payload = NULL;
+
+    int ret = fiware_iota_command_make_response(raw_command, result, &payload);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ESP_LOGI(TAG, "Command result: %s", payload);
+
+    ret = fiware_iota_post(payload, token, NULL, METRICS_UPLOAD_IOTA_COMMAND_RESULT);
+
+    free(payload);
+
+    return ret;
+}
+
 esp_err_t fiware_iota_command_get_command_name(const char *raw_command, char **command_name)
 {
     char *command = strdup(raw_command);
@@ -303,3 +367,25 @@ esp_err_t fiware_iota_command_make_response(const char *raw_command, const char
 
     return ESP_OK;
 }
+
+/**
+ * @brief Formats the response for the FIWARE UltraLight 2.0 command into a caller provided buffer
+ *
+ * @param raw_command the raw command payload -> <device_id>@<command>|<param1>|<param2>
+ * @param response the response to the command
+ * @param buffer the buffer to write the formatted response into
+ * @param buffer_len the size of the buffer
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_SIZE if the response does not fit into the buffer
+ */
+esp_err_t fiware_iota_command_format_response(const char *raw_command, const char *response, char *buffer, size_t buffer_len)
+{
+    // the header is everything before the first parameter
+    int header_len = strcspn(raw_command, "|");
+
+    int ret = snprintf(buffer, buffer_len, "%.*s|%s", header_len, raw_command, response);
+
+    if (ret < 0 || (size_t)ret >= buffer_len)
+        return ESP_ERR_INVALID_SIZE;
+
+    return ESP_OK;
+}
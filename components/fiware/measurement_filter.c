@@ -0,0 +1,343 @@
+/// @file
+#include "measurement_filter.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include <esp_timer.h>
+
+#include "measurement_payload.h"
+#include "metrics.h"
+
+#define MEASUREMENT_FILTER_DEADBAND_ABSOLUTE (CONFIG_MEASUREMENT_FILTER_DEADBAND_ABSOLUTE / 1000.0f)
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/// @brief Filter state of one attribute
+typedef struct
+{
+    /// @brief the name of the attribute, the first member, see measurement_payload_find()
+    char name[CONFIG_MEASUREMENT_FILTER_NAME_LEN + 1];
+    /// @brief the last received value, sent by the heartbeat
+    char latest[CONFIG_MEASUREMENT_FILTER_VALUE_LEN + 1];
+    /// @brief the last uploaded value, the deadband is measured from this
+    char sent[CONFIG_MEASUREMENT_FILTER_VALUE_LEN + 1];
+    /// @brief time of the last upload
+    int64_t sent_at_us;
+    /// @brief the latest value changed within the minimum interval, measurement_filter_flush() uploads it
+    bool pending;
+    /// @brief the pending value is in the measurement built by measurement_filter_flush()
+    bool flushed;
+} measurement_filter_entry_t;
+
+/// @brief The attribute table, entries are assigned in the order the attributes first appear
+static measurement_filter_entry_t measurement_filter_table[CONFIG_MEASUREMENT_FILTER_MAX_ATTRIBUTES];
+
+static size_t measurement_filter_entries = 0;
+
+/**
+ * @brief Finds the entry of an attribute, a new entry is assigned to unknown attributes
+ *
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @param created pointer to store if the entry was just assigned
+ * @return measurement_filter_entry_t* the entry, NULL if the name is too long or the table is full
+ */
+static measurement_filter_entry_t *measurement_filter_find(const char *name, size_t name_len, bool *created)
+{
+    *created = false;
+
+    if (name_len > CONFIG_MEASUREMENT_FILTER_NAME_LEN)
+        return NULL;
+
+    size_t index = measurement_payload_find(measurement_filter_table, sizeof(*measurement_filter_table), measurement_filter_entries, name, name_len);
+
+    if (index < measurement_filter_entries)
+        return &measurement_filter_table[index];
+
+    if (measurement_filter_entries == CONFIG_MEASUREMENT_FILTER_MAX_ATTRIBUTES)
+        return NULL;
+
+    measurement_filter_entry_t *entry = &measurement_filter_table[measurement_filter_entries++];
+
+    memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+    entry->pending = false;
+    entry->flushed = false;
+    *created = true;
+
+    return entry;
+}
+
+/**
+ * @brief Parses a value as a number
+ *
+ * @param value the NUL terminated value
+ * @param number pointer to store the number
+ * @return true if the whole value is a number
+ */
+static bool measurement_filter_parse_number(const char *value, float *number)
+{
+    char *end;
+
+    *number = strtof(value, &end);
+
+    return end != value && *end == '\0';
+}
+
+/**
+ * @brief Checks if the value differs from the last uploaded value by more than the deadband
+ *
+ * @param entry the entry of the attribute
+ * @param value the NUL terminated new value
+ * @return true if the value changed
+ */
+static bool measurement_filter_changed(const measurement_filter_entry_t *entry, const char *value)
+{
+    float previous, current;
+
+    if (!measurement_filter_parse_number(entry->sent, &previous) || !measurement_filter_parse_number(value, &current))
+        return strcmp(entry->sent, value) != 0;
+
+    float deadband = MAX(MEASUREMENT_FILTER_DEADBAND_ABSOLUTE, fabsf(previous) * CONFIG_MEASUREMENT_FILTER_DEADBAND_PERCENT / 100.0f);
+
+    return fabsf(current - previous) > deadband;
+}
+
+/**
+ * @brief Decides if an attribute value is uploaded and updates its entry
+ *
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @param value the value of the attribute, not NUL terminated
+ * @param value_len the length of the value
+ * @param now_us the current time
+ * @return true if the value is uploaded
+ */
+static bool measurement_filter_check(const char *name, size_t name_len, const char *value, size_t value_len, int64_t now_us)
+{
+    bool created;
+
+    // values that cannot be tracked are never filtered
+    if (value_len > CONFIG_MEASUREMENT_FILTER_VALUE_LEN)
+        return true;
+
+    measurement_filter_entry_t *entry = measurement_filter_find(name, name_len, &created);
+
+    if (entry == NULL)
+        return true;
+
+    memcpy(entry->latest, value, value_len);
+    entry->latest[value_len] = '\0';
+
+    int64_t elapsed_ms = (now_us - entry->sent_at_us) / 1000;
+
+    bool upload;
+
+    if (created)
+        upload = true;
+    else if (CONFIG_MEASUREMENT_FILTER_MAX_INTERVAL_MS > 0 && elapsed_ms >= CONFIG_MEASUREMENT_FILTER_MAX_INTERVAL_MS)
+        upload = true;
+    else if (elapsed_ms < CONFIG_MEASUREMENT_FILTER_MIN_INTERVAL_MS)
+    {
+        // the change is uploaded once the interval is over, unless the value returns
+        entry->pending = measurement_filter_changed(entry, entry->latest);
+        upload = false;
+    }
+    else
+        upload = measurement_filter_changed(entry, entry->latest);
+
+    if (upload)
+    {
+        strcpy(entry->sent, entry->latest);
+        entry->sent_at_us = now_us;
+        entry->pending = false;
+    }
+
+    return upload;
+}
+
+/**
+ * @brief Removes the attributes of a measurement that do not need to be uploaded
+ *
+ * @details the UltraLight 2.0 payload is compacted in place, see measurement_payload_compact().
+ *  An attribute is kept if it is seen for the first time, if it was not uploaded for CONFIG_MEASUREMENT_FILTER_MAX_INTERVAL_MS,
+ *  or if it changed by more than the deadband and was not uploaded for CONFIG_MEASUREMENT_FILTER_MIN_INTERVAL_MS.
+ *  Kept attributes are considered uploaded. A change within the minimum interval waits for measurement_filter_flush().
+ *
+ * @note the filter is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param measurement the measurement payload
+ * @param sent pointer to store the number of attributes kept
+ * @return esp_err_t    ESP_OK if the measurement was filtered,
+ *                      ESP_ERR_INVALID_ARG if the measurement is not a list of attribute-value pairs, it is left unchanged
+ */
+esp_err_t measurement_filter_apply(char *measurement, size_t *sent)
+{
+    size_t received;
+
+    if (measurement_payload_compact(measurement, measurement_filter_check, &received, sent) != ESP_OK)
+        return ESP_ERR_INVALID_ARG;
+
+    metrics_attribute_count(METRICS_ATTRIBUTE_SENT, *sent);
+    metrics_attribute_count(METRICS_ATTRIBUTE_SUPPRESSED, received - *sent);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Builds a measurement of the latest values of the attributes that were not uploaded for the heartbeat period
+ *
+ * @details the attributes in the measurement are considered uploaded.
+ *  Attributes that do not fit into the buffer are left for the next heartbeat.
+ *
+ * @note the filter is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param buffer the buffer to build the UltraLight 2.0 payload into
+ * @param buffer_len the size of the buffer, see MEASUREMENT_FILTER_HEARTBEAT_BUFFER_SIZE
+ * @param sent pointer to store the number of attributes in the measurement
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the buffer is empty
+ */
+esp_err_t measurement_filter_heartbeat(char *buffer, size_t buffer_len, size_t *sent)
+{
+    if (buffer == NULL || buffer_len == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    int64_t now_us = esp_timer_get_time();
+    size_t length = 0;
+    size_t kept = 0;
+
+    buffer[0] = '\0';
+
+    for (size_t i = 0; i < measurement_filter_entries; i++)
+    {
+        measurement_filter_entry_t *entry = &measurement_filter_table[i];
+
+        if ((now_us - entry->sent_at_us) / 1000 < CONFIG_MEASUREMENT_FILTER_HEARTBEAT_MS)
+            continue;
+
+        if (!measurement_payload_append(buffer, buffer_len, &length, entry->name, entry->latest))
+            continue;
+
+        strcpy(entry->sent, entry->latest);
+        entry->sent_at_us = now_us;
+        entry->pending = false;
+        kept++;
+    }
+
+    metrics_attribute_count(METRICS_ATTRIBUTE_HEARTBEAT, kept);
+
+    *sent = kept;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Builds a measurement of the changes that were held back by the minimum interval and are due now
+ *
+ * @details values that do not fit into the buffer keep waiting.
+ *  The values stay pending until measurement_filter_flush_done() reports the upload
+ *
+ * @note the filter is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param buffer the buffer to build the UltraLight 2.0 payload into
+ * @param buffer_len the size of the buffer, see MEASUREMENT_FILTER_HEARTBEAT_BUFFER_SIZE
+ * @param sent pointer to store the number of attributes in the measurement
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the buffer is empty
+ */
+esp_err_t measurement_filter_flush(char *buffer, size_t buffer_len, size_t *sent)
+{
+    if (buffer == NULL || buffer_len == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    int64_t now_us = esp_timer_get_time();
+    size_t length = 0;
+    size_t kept = 0;
+
+    buffer[0] = '\0';
+
+    for (size_t i = 0; i < measurement_filter_entries; i++)
+    {
+        measurement_filter_entry_t *entry = &measurement_filter_table[i];
+
+        if (!entry->pending || (now_us - entry->sent_at_us) / 1000 < CONFIG_MEASUREMENT_FILTER_MIN_INTERVAL_MS)
+            continue;
+
+        if (!measurement_payload_append(buffer, buffer_len, &length, entry->name, entry->latest))
+            continue;
+
+        entry->flushed = true;
+        kept++;
+    }
+
+    *sent = kept;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Reports the upload of the measurement built by measurement_filter_flush()
+ *
+ * @details the uploaded values are considered uploaded. The values of a failed upload keep waiting
+ *  and are retried once the minimum interval has passed again
+ *
+ * @note the filter is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param uploaded true if the measurement was uploaded
+ */
+void measurement_filter_flush_done(bool uploaded)
+{
+    int64_t now_us = esp_timer_get_time();
+    size_t kept = 0;
+
+    for (size_t i = 0; i < measurement_filter_entries; i++)
+    {
+        measurement_filter_entry_t *entry = &measurement_filter_table[i];
+
+        if (!entry->flushed)
+            continue;
+
+        if (uploaded)
+        {
+            strcpy(entry->sent, entry->latest);
+            entry->pending = false;
+            kept++;
+        }
+
+        entry->sent_at_us = now_us;
+        entry->flushed = false;
+    }
+
+    metrics_attribute_count(METRICS_ATTRIBUTE_SENT, kept);
+}
+
+/**
+ * @brief Calculates the time until the first held back change is due
+ *
+ * @return int32_t the time in milliseconds, 0 if a change can be sent now, -1 if no change is waiting
+ */
+int32_t measurement_filter_next_release_ms()
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_ms = -1;
+
+    for (size_t i = 0; i < measurement_filter_entries; i++)
+    {
+        const measurement_filter_entry_t *entry = &measurement_filter_table[i];
+
+        if (!entry->pending)
+            continue;
+
+        int64_t wait_ms = CONFIG_MEASUREMENT_FILTER_MIN_INTERVAL_MS - (now_us - entry->sent_at_us) / 1000;
+
+        if (wait_ms < 0)
+            wait_ms = 0;
+
+        if (next_ms < 0 || wait_ms < next_ms)
+            next_ms = wait_ms;
+    }
+
+    return (int32_t)next_ms;
+}
@@ -0,0 +1,132 @@
+/// @file
+#include "measurement_payload.h"
+
+#include <string.h>
+
+#include <esp_timer.h>
+
+/**
+ * @brief Removes the attributes of a measurement the callback does not keep
+ *
+ * @details the measurement is an UltraLight 2.0 payload: <attr1>|<value1>|<attr2>|<value2>.
+ *  The payload is validated first, then compacted in place, the remaining attributes keep their order.
+ *  The callback is called once for every attribute in order.
+ *
+ * @param measurement the measurement payload
+ * @param keep the callback deciding if an attribute is kept
+ * @param pairs pointer to store the number of attributes in the measurement, set to NULL if not needed
+ * @param kept pointer to store the number of attributes kept
+ * @return esp_err_t    ESP_OK if the measurement was compacted,
+ *                      ESP_ERR_INVALID_ARG if the measurement is not a list of attribute-value pairs, it is left unchanged
+ */
+esp_err_t measurement_payload_compact(char *measurement, measurement_payload_keep_t keep, size_t *pairs, size_t *kept)
+{
+    size_t fields = 0;
+
+    // validate the payload before it is modified
+    for (const char *cursor = measurement;; cursor++)
+    {
+        size_t field_len = strcspn(cursor, "|");
+
+        if (field_len == 0 && fields % 2 == 0)
+            return ESP_ERR_INVALID_ARG;
+
+        fields++;
+        cursor += field_len;
+
+        if (*cursor == '\0')
+            break;
+    }
+
+    if (fields % 2 != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    int64_t now_us = esp_timer_get_time();
+
+    const char *read = measurement;
+    char *write = measurement;
+
+    *kept = 0;
+
+    for (size_t pair = 0; pair < fields / 2; pair++)
+    {
+        size_t name_len = strcspn(read, "|");
+        const char *value = read + name_len + 1;
+        size_t value_len = strcspn(value, "|");
+        size_t pair_len = name_len + 1 + value_len;
+
+        if (keep(read, name_len, value, value_len, now_us))
+        {
+            if (*kept > 0)
+                *write++ = '|';
+
+            memmove(write, read, pair_len);
+            write += pair_len;
+            (*kept)++;
+        }
+
+        read += pair_len + 1;
+    }
+
+    *write = '\0';
+
+    if (pairs != NULL)
+        *pairs = fields / 2;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Finds an attribute in a table whose entries start with the NUL terminated name of their attribute
+ *
+ * @param table the first entry of the table
+ * @param entry_size the size of an entry
+ * @param entries the number of entries in use
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @return size_t the index of the entry, entries if the attribute is not in the table
+ */
+size_t measurement_payload_find(const void *table, size_t entry_size, size_t entries, const char *name, size_t name_len)
+{
+    for (size_t i = 0; i < entries; i++)
+    {
+        const char *entry_name = (const char *)table + i * entry_size;
+
+        if (strncmp(entry_name, name, name_len) == 0 && entry_name[name_len] == '\0')
+            return i;
+    }
+
+    return entries;
+}
+
+/**
+ * @brief Appends an attribute to an UltraLight 2.0 payload being built
+ *
+ * @param buffer the buffer of the payload, NUL terminated
+ * @param buffer_len the size of the buffer
+ * @param length pointer to the length of the payload, updated
+ * @param name the name of the attribute
+ * @param value the value of the attribute
+ * @return true if the attribute was appended, false if it does not fit into the buffer
+ */
+bool measurement_payload_append(char *buffer, size_t buffer_len, size_t *length, const char *name, const char *value)
+{
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    size_t pair_len = (*length > 0 ? 1 : 0) + name_len + 1 + value_len;
+
+    if (*length + pair_len >= buffer_len)
+        return false;
+
+    if (*length > 0)
+        buffer[(*length)++] = '|';
+
+    memcpy(buffer + *length, name, name_len);
+    *length += name_len;
+    buffer[(*length)++] = '|';
+    memcpy(buffer + *length, value, value_len);
+    *length += value_len;
+    buffer[*length] = '\0';
+
+    return true;
+}
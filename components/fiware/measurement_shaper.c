@@ -0,0 +1,328 @@
+/// @file
+#include "measurement_shaper.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "measurement_payload.h"
+#include "metrics.h"
+
+/// @brief One token in milli-tokens, the buckets count in milli-tokens so slow rates do not need fractions
+#define MEASUREMENT_SHAPER_TOKEN 1000
+
+static const char *TAG = "Measurement Shaper";
+
+/// @brief Token bucket and pending value of one attribute
+typedef struct
+{
+    /// @brief the name of the attribute, the first member, see measurement_payload_find()
+    char name[CONFIG_MEASUREMENT_SHAPER_NAME_LEN + 1];
+    /// @brief the latest value waiting for a token, overwritten by newer values
+    char pending[CONFIG_MEASUREMENT_SHAPER_VALUE_LEN + 1];
+    bool has_pending;
+    /// @brief the pending value is in the measurement built by measurement_shaper_flush()
+    bool flushed;
+    /// @brief refill rate in milli-tokens per second
+    uint32_t rate;
+    /// @brief capacity of the bucket in milli-tokens
+    uint32_t burst;
+    /// @brief tokens in the bucket in milli-tokens
+    uint32_t tokens;
+    /// @brief time the bucket was last refilled
+    int64_t refilled_at_us;
+} measurement_shaper_entry_t;
+
+/// @brief The attribute table, entries are assigned in the order the attributes first appear
+static measurement_shaper_entry_t measurement_shaper_table[CONFIG_MEASUREMENT_SHAPER_MAX_ATTRIBUTES];
+
+static size_t measurement_shaper_entries = 0;
+
+/**
+ * @brief Looks up the limits of an attribute in CONFIG_MEASUREMENT_SHAPER_ATTRIBUTE_LIMITS
+ *
+ * @details the option is a comma separated list of <name>:<rate>:<burst> items,
+ *  attributes that are not listed get CONFIG_MEASUREMENT_SHAPER_RATE and CONFIG_MEASUREMENT_SHAPER_BURST
+ *
+ * @param entry the entry to set the limits of, its name is already set
+ */
+static void measurement_shaper_set_limits(measurement_shaper_entry_t *entry)
+{
+    const char *item = CONFIG_MEASUREMENT_SHAPER_ATTRIBUTE_LIMITS;
+    size_t name_len = strlen(entry->name);
+
+    entry->rate = CONFIG_MEASUREMENT_SHAPER_RATE;
+    entry->burst = CONFIG_MEASUREMENT_SHAPER_BURST * MEASUREMENT_SHAPER_TOKEN;
+
+    while (*item != '\0')
+    {
+        size_t item_len = strcspn(item, ",");
+
+        if (item_len > name_len && item[name_len] == ':' && strncmp(item, entry->name, name_len) == 0)
+        {
+            char *end;
+            long rate = strtol(item + name_len + 1, &end, 10);
+            long burst = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+
+            if (rate > 0 && burst > 0 && (*end == ',' || *end == '\0'))
+            {
+                entry->rate = rate;
+                entry->burst = burst * MEASUREMENT_SHAPER_TOKEN;
+            }
+            else
+                ESP_LOGW(TAG, "Invalid limits for attribute %s: %.*s", entry->name, (int)item_len, item);
+
+            return;
+        }
+
+        item += item_len;
+
+        if (*item == ',')
+            item++;
+    }
+}
+
+/**
+ * @brief Finds the entry of an attribute, a new entry with a full bucket is assigned to unknown attributes
+ *
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @param now_us the current time
+ * @return measurement_shaper_entry_t* the entry, NULL if the name is too long or the table is full
+ */
+static measurement_shaper_entry_t *measurement_shaper_find(const char *name, size_t name_len, int64_t now_us)
+{
+    if (name_len > CONFIG_MEASUREMENT_SHAPER_NAME_LEN)
+        return NULL;
+
+    size_t index = measurement_payload_find(measurement_shaper_table, sizeof(*measurement_shaper_table), measurement_shaper_entries, name, name_len);
+
+    if (index < measurement_shaper_entries)
+        return &measurement_shaper_table[index];
+
+    if (measurement_shaper_entries == CONFIG_MEASUREMENT_SHAPER_MAX_ATTRIBUTES)
+        return NULL;
+
+    measurement_shaper_entry_t *entry = &measurement_shaper_table[measurement_shaper_entries++];
+
+    memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+    entry->has_pending = false;
+    entry->flushed = false;
+
+    measurement_shaper_set_limits(entry);
+
+    entry->tokens = entry->burst;
+    entry->refilled_at_us = now_us;
+
+    return entry;
+}
+
+/**
+ * @brief Adds the tokens earned since the last refill to the bucket
+ *
+ * @details the time of the refill only advances by the time the added tokens were earned in,
+ *  so the fractions of a milli-token are not lost between frequent refills
+ *
+ * @param entry the entry of the attribute
+ * @param now_us the current time
+ */
+static void measurement_shaper_refill(measurement_shaper_entry_t *entry, int64_t now_us)
+{
+    int64_t earned = (now_us - entry->refilled_at_us) * entry->rate / 1000000;
+
+    if (entry->tokens + earned >= entry->burst)
+    {
+        entry->tokens = entry->burst;
+        entry->refilled_at_us = now_us;
+        return;
+    }
+
+    entry->tokens += earned;
+    entry->refilled_at_us += earned * 1000000 / entry->rate;
+}
+
+/**
+ * @brief Takes a token for an attribute value or keeps the value until a token is available
+ *
+ * @param name the name of the attribute, not NUL terminated
+ * @param name_len the length of the name
+ * @param value the value of the attribute, not NUL terminated
+ * @param value_len the length of the value
+ * @param now_us the current time
+ * @return true if the value is uploaded now
+ */
+static bool measurement_shaper_check(const char *name, size_t name_len, const char *value, size_t value_len, int64_t now_us)
+{
+    // values that cannot be kept are never limited
+    if (value_len > CONFIG_MEASUREMENT_SHAPER_VALUE_LEN)
+        return true;
+
+    measurement_shaper_entry_t *entry = measurement_shaper_find(name, name_len, now_us);
+
+    if (entry == NULL)
+        return true;
+
+    measurement_shaper_refill(entry, now_us);
+
+    if (entry->tokens >= MEASUREMENT_SHAPER_TOKEN)
+    {
+        entry->tokens -= MEASUREMENT_SHAPER_TOKEN;
+
+        // the new value is fresher than the one waiting
+        if (entry->has_pending)
+        {
+            entry->has_pending = false;
+            metrics_attribute_count(METRICS_ATTRIBUTE_COALESCED, 1);
+        }
+
+        return true;
+    }
+
+    if (entry->has_pending)
+        metrics_attribute_count(METRICS_ATTRIBUTE_COALESCED, 1);
+    else
+        metrics_attribute_count(METRICS_ATTRIBUTE_DEFERRED, 1);
+
+    memcpy(entry->pending, value, value_len);
+    entry->pending[value_len] = '\0';
+    entry->has_pending = true;
+
+    return false;
+}
+
+/**
+ * @brief Removes the attributes of a measurement that exceed their rate limit
+ *
+ * @details the UltraLight 2.0 payload is compacted in place, see measurement_payload_compact().
+ *  Every attribute has a token bucket, a value is kept if its bucket has a token.
+ *  Otherwise the value waits in the table until measurement_shaper_flush() finds a token for it,
+ *  a newer value of the same attribute replaces the waiting one.
+ *
+ * @note the shaper is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param measurement the measurement payload
+ * @param sent pointer to store the number of attributes kept
+ * @return esp_err_t    ESP_OK if the measurement was shaped,
+ *                      ESP_ERR_INVALID_ARG if the measurement is not a list of attribute-value pairs, it is left unchanged
+ */
+esp_err_t measurement_shaper_apply(char *measurement, size_t *sent)
+{
+    return measurement_payload_compact(measurement, measurement_shaper_check, NULL, sent);
+}
+
+/**
+ * @brief Builds a measurement of the waiting values whose bucket has a token again
+ *
+ * @details values that do not fit into the buffer keep waiting.
+ *  The values stay pending until measurement_shaper_flush_done() reports the upload,
+ *  a failed upload is retried once the attribute has a token again
+ *
+ * @note the shaper is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param buffer the buffer to build the UltraLight 2.0 payload into
+ * @param buffer_len the size of the buffer, see MEASUREMENT_SHAPER_FLUSH_BUFFER_SIZE
+ * @param sent pointer to store the number of attributes in the measurement
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the buffer is empty
+ */
+esp_err_t measurement_shaper_flush(char *buffer, size_t buffer_len, size_t *sent)
+{
+    if (buffer == NULL || buffer_len == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    int64_t now_us = esp_timer_get_time();
+    size_t length = 0;
+    size_t kept = 0;
+
+    buffer[0] = '\0';
+
+    for (size_t i = 0; i < measurement_shaper_entries; i++)
+    {
+        measurement_shaper_entry_t *entry = &measurement_shaper_table[i];
+
+        if (!entry->has_pending)
+            continue;
+
+        measurement_shaper_refill(entry, now_us);
+
+        if (entry->tokens < MEASUREMENT_SHAPER_TOKEN)
+            continue;
+
+        if (!measurement_payload_append(buffer, buffer_len, &length, entry->name, entry->pending))
+            continue;
+
+        entry->tokens -= MEASUREMENT_SHAPER_TOKEN;
+        entry->flushed = true;
+        kept++;
+    }
+
+    *sent = kept;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Reports the upload of the measurement built by measurement_shaper_flush()
+ *
+ * @details the uploaded values stop waiting, the values of a failed upload keep waiting for the next token
+ *
+ * @note the shaper is not thread safe, it is meant to be used by the FIWARE task only
+ *
+ * @param uploaded true if the measurement was uploaded
+ */
+void measurement_shaper_flush_done(bool uploaded)
+{
+    for (size_t i = 0; i < measurement_shaper_entries; i++)
+    {
+        measurement_shaper_entry_t *entry = &measurement_shaper_table[i];
+
+        if (!entry->flushed)
+            continue;
+
+        if (uploaded)
+            entry->has_pending = false;
+
+        entry->flushed = false;
+    }
+}
+
+/**
+ * @brief Calculates the time until the first waiting value gets a token
+ *
+ * @return int32_t the time in milliseconds, 0 if a value can be sent now, -1 if no value is waiting
+ */
+int32_t measurement_shaper_next_release_ms()
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_us = -1;
+
+    for (size_t i = 0; i < measurement_shaper_entries; i++)
+    {
+        measurement_shaper_entry_t *entry = &measurement_shaper_table[i];
+
+        if (!entry->has_pending)
+            continue;
+
+        measurement_shaper_refill(entry, now_us);
+
+        int64_t wait_us = 0;
+
+        if (entry->tokens < MEASUREMENT_SHAPER_TOKEN)
+            wait_us = ((int64_t)(MEASUREMENT_SHAPER_TOKEN - entry->tokens) * 1000000 + entry->rate - 1) / entry->rate -
+                      (now_us - entry->refilled_at_us);
+
+        if (wait_us < 0)
+            wait_us = 0;
+
+        if (next_us < 0 || wait_us < next_us)
+            next_us = wait_us;
+    }
+
+    if (next_us < 0)
+        return -1;
+
+    return (int32_t)((next_us + 999) / 1000);
+}
@@ -0,0 +1,509 @@
+/// @file
+#include "orion.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <esp_http_client.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "metrics.h"
+#include "wifi.h"
+
+#ifdef CONFIG_FIWARE_UPLOAD_NGSI_LD
+#define ORION_PATH "/ngsi-ld/v1/entityOperations/upsert?options=update"
+#define ORION_CONTENT_TYPE "application/ld+json"
+#define ORION_SERVICE_HEADER "NGSILD-Tenant"
+#define ORION_BATCH_PREFIX "["
+#define ORION_BATCH_SUFFIX "]"
+#define ORION_ATTRIBUTE_TYPE_NUMBER "Property"
+#define ORION_ATTRIBUTE_TYPE_TEXT "Property"
+#else
+#define ORION_PATH "/v2/op/update"
+#define ORION_CONTENT_TYPE "application/json"
+#define ORION_SERVICE_HEADER "Fiware-Service"
+#define ORION_BATCH_PREFIX "{\"actionType\":\"append\",\"entities\":["
+#define ORION_BATCH_SUFFIX "]}"
+#define ORION_ATTRIBUTE_TYPE_NUMBER "Number"
+#define ORION_ATTRIBUTE_TYPE_TEXT "Text"
+#endif
+
+/// @brief Length of an ISO 8601 UTC timestamp: 2000-01-01T00:00:00Z
+#define ORION_TIMESTAMP_LEN 20
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+static const char *TAG = "Orion";
+
+/// @brief Streaming JSON writer over the request buffer
+typedef struct
+{
+    char *buffer;
+    /// @brief usable size, the space of the batch suffix and the terminating NUL is reserved
+    size_t size;
+    size_t length;
+    /// @brief true if the last write did not fit into the buffer
+    bool overflow;
+} orion_writer_t;
+
+/// @brief The request body, reused by every batch
+static char orion_buffer[CONFIG_ORION_BUFFER_SIZE];
+
+static orion_writer_t orion_writer = {
+    .buffer = orion_buffer,
+    .size = CONFIG_ORION_BUFFER_SIZE - sizeof(ORION_BATCH_SUFFIX),
+    .length = 0,
+    .overflow = false,
+};
+
+/// @brief Number of measurements in the current batch
+static size_t orion_batch_measurements = 0;
+
+static const esp_http_client_config_t orion_config = {
+    .host = CONFIG_FIWARE_HOST,
+    .port = CONFIG_ORION_PORT,
+    .path = ORION_PATH,
+    .method = HTTP_METHOD_POST,
+    .keep_alive_enable = true,
+    .cert_pem = NULL,
+};
+
+/// @brief Client kept open between batches
+static esp_http_client_handle_t orion_client = NULL;
+
+/**
+ * @brief Appends raw data to the request body
+ *
+ * @param data the data to append
+ * @param length the length of the data
+ */
+static void orion_write(const char *data, size_t length)
+{
+    if (orion_writer.overflow)
+        return;
+
+    if (length > orion_writer.size - orion_writer.length)
+    {
+        orion_writer.overflow = true;
+        return;
+    }
+
+    memcpy(orion_writer.buffer + orion_writer.length, data, length);
+    orion_writer.length += length;
+}
+
+/**
+ * @brief Appends a NUL terminated string to the request body as is
+ *
+ * @param data the string to append
+ */
+static void orion_write_raw(const char *data)
+{
+    orion_write(data, strlen(data));
+}
+
+/**
+ * @brief Appends a JSON string to the request body, the characters are escaped as needed
+ *
+ * @param data the characters of the string
+ * @param length the number of characters
+ */
+static void orion_write_string(const char *data, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    orion_write("\"", 1);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+
+        if (c == '"' || c == '\\')
+        {
+            char escaped[2] = {'\\', c};
+            orion_write(escaped, sizeof(escaped));
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF]};
+            orion_write(escaped, sizeof(escaped));
+        }
+        else
+            orion_write(&c, 1);
+    }
+
+    orion_write("\"", 1);
+}
+
+/**
+ * @brief Checks if a measurement value is a valid JSON number
+ *
+ * @param value the characters of the value
+ * @param length the number of characters
+ * @return true if the value can be written as a JSON number
+ * @return false if the value has to be written as a string
+ */
+static bool orion_is_number(const char *value, size_t length)
+{
+    size_t i = 0;
+
+    if (i < length && value[i] == '-')
+        i++;
+
+    // integer part, no leading zeros
+    if (i < length && value[i] == '0')
+        i++;
+    else if (i < length && IS_DIGIT(value[i]))
+        while (i < length && IS_DIGIT(value[i]))
+            i++;
+    else
+        return false;
+
+    // fraction
+    if (i < length && value[i] == '.')
+    {
+        i++;
+
+        if (i == length || !IS_DIGIT(value[i]))
+            return false;
+
+        while (i < length && IS_DIGIT(value[i]))
+            i++;
+    }
+
+    // exponent
+    if (i < length && (value[i] == 'e' || value[i] == 'E'))
+    {
+        i++;
+
+        if (i < length && (value[i] == '+' || value[i] == '-'))
+            i++;
+
+        if (i == length || !IS_DIGIT(value[i]))
+            return false;
+
+        while (i < length && IS_DIGIT(value[i]))
+            i++;
+    }
+
+    return i == length;
+}
+
+/**
+ * @brief Starts a new, empty batch
+ */
+void orion_batch_reset()
+{
+    orion_writer.length = 0;
+    orion_writer.overflow = false;
+    orion_batch_measurements = 0;
+
+    orion_write_raw(ORION_BATCH_PREFIX);
+}
+
+/**
+ * @brief Appends the start of an entity update to the batch, the id and the type of the entity
+ */
+static void orion_write_entity_start()
+{
+    if (orion_batch_measurements > 0)
+        orion_write_raw(",");
+
+    orion_write_raw("{\"id\":");
+    orion_write_string(CONFIG_ORION_ENTITY_ID, strlen(CONFIG_ORION_ENTITY_ID));
+    orion_write_raw(",\"type\":");
+    orion_write_string(CONFIG_ORION_ENTITY_TYPE, strlen(CONFIG_ORION_ENTITY_TYPE));
+}
+
+/**
+ * @brief Appends a text attribute to the current entity update
+ *
+ * @param name the characters of the attribute name
+ * @param name_len the number of characters of the name
+ * @param value the characters of the value
+ * @param value_len the number of characters of the value
+ * @param timestamp the time the value was observed at
+ */
+static void orion_write_text_attribute(const char *name, size_t name_len, const char *value, size_t value_len, const char *timestamp)
+{
+    orion_write_raw(",");
+    orion_write_string(name, name_len);
+    orion_write_raw(":{\"type\":\"" ORION_ATTRIBUTE_TYPE_TEXT "\",\"value\":");
+    orion_write_string(value, value_len);
+
+#ifdef CONFIG_FIWARE_UPLOAD_NGSI_LD
+    orion_write_raw(",\"observedAt\":\"");
+    orion_write_raw(timestamp);
+    orion_write_raw("\"");
+#endif
+    orion_write_raw("}");
+}
+
+/**
+ * @brief Closes the current entity update, adds the timestamp in NGSI v2 or the context in NGSI-LD
+ *
+ * @param timestamp the time the update was observed at
+ * @param rollback the length of the batch before the entity update, restored if the update did not fit
+ * @return esp_err_t ESP_OK if the entity update was added, ESP_ERR_INVALID_SIZE if it did not fit
+ */
+static esp_err_t orion_write_entity_end(const char *timestamp, size_t rollback)
+{
+#ifdef CONFIG_FIWARE_UPLOAD_NGSI_LD
+    orion_write_raw(",\"@context\":");
+    orion_write_string(CONFIG_ORION_LD_CONTEXT, strlen(CONFIG_ORION_LD_CONTEXT));
+#else
+    orion_write_raw(",\"TimeInstant\":{\"type\":\"DateTime\",\"value\":\"");
+    orion_write_raw(timestamp);
+    orion_write_raw("\"}");
+#endif
+    orion_write_raw("}");
+
+    if (orion_writer.overflow)
+    {
+        orion_writer.length = rollback;
+        orion_writer.overflow = false;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    orion_batch_measurements++;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Formats the current time as an ISO 8601 UTC timestamp
+ *
+ * @param timestamp buffer of at least ORION_TIMESTAMP_LEN + 1 characters
+ */
+static void orion_format_timestamp(char *timestamp)
+{
+    time_t now;
+    struct tm now_utc;
+
+    time(&now);
+    gmtime_r(&now, &now_utc);
+    strftime(timestamp, ORION_TIMESTAMP_LEN + 1, "%Y-%m-%dT%H:%M:%SZ", &now_utc);
+}
+
+/**
+ * @brief Appends a measurement to the batch as an entity update
+ *
+ * @details the measurement is an UltraLight 2.0 payload: <attr1>|<value1>|<attr2>|<value2>.
+ *  Values that are valid JSON numbers are sent as numbers, everything else as text.
+ *  The measurement is timestamped with the current time.
+ *
+ * @param measurement the measurement payload
+ * @return esp_err_t    ESP_OK if the measurement was added,
+ *                      ESP_ERR_INVALID_SIZE if the measurement does not fit into the batch, the batch is left unchanged,
+ *                      ESP_ERR_INVALID_ARG if the measurement is not a list of attribute-value pairs
+ */
+esp_err_t orion_batch_add(const char *measurement)
+{
+    size_t rollback = orion_writer.length;
+
+    char timestamp[ORION_TIMESTAMP_LEN + 1];
+
+    orion_format_timestamp(timestamp);
+    orion_write_entity_start();
+
+    const char *cursor = measurement;
+    int attributes = 0;
+
+    while (*cursor != '\0')
+    {
+        size_t name_len = strcspn(cursor, "|");
+
+        // every attribute needs a value
+        if (name_len == 0 || cursor[name_len] != '|')
+        {
+            orion_writer.length = rollback;
+            orion_writer.overflow = false;
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        const char *value = cursor + name_len + 1;
+        size_t value_len = strcspn(value, "|");
+
+        if (orion_is_number(value, value_len))
+        {
+            orion_write_raw(",");
+            orion_write_string(cursor, name_len);
+            orion_write_raw(":{\"type\":\"" ORION_ATTRIBUTE_TYPE_NUMBER "\",\"value\":");
+            orion_write(value, value_len);
+
+#ifdef CONFIG_FIWARE_UPLOAD_NGSI_LD
+            orion_write_raw(",\"observedAt\":\"");
+            orion_write_raw(timestamp);
+            orion_write_raw("\"");
+#endif
+            orion_write_raw("}");
+        }
+        else
+            orion_write_text_attribute(cursor, name_len, value, value_len, timestamp);
+
+        attributes++;
+
+        cursor = value + value_len;
+
+        if (*cursor == '|')
+            cursor++;
+    }
+
+    if (attributes == 0)
+    {
+        orion_writer.length = rollback;
+        orion_writer.overflow = false;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return orion_write_entity_end(timestamp, rollback);
+}
+
+/**
+ * @brief Appends the result of an IoT Agent command to the batch as an entity update
+ *
+ * @details the result is written to the <command>_status and <command>_info attributes,
+ *  the attributes the IoT Agent updates when it receives a command result.
+ *  The update counts as a measurement of the batch.
+ *
+ * @param raw_command the raw command payload -> <device_id>@<command>|<param1>|<param2>
+ * @param status the status of the command, OK if the controller executed it
+ * @param info the result of the command
+ * @return esp_err_t    ESP_OK if the result was added,
+ *                      ESP_ERR_INVALID_SIZE if the result does not fit into the batch, the batch is left unchanged,
+ *                      ESP_ERR_INVALID_ARG if the command has no name
+ */
+esp_err_t orion_batch_add_command_result(const char *raw_command, const char *status, const char *info)
+{
+    // the command name is between the device id and the first parameter
+    const char *command = strchr(raw_command, '@');
+
+    if (command == NULL || command[1] == '\0' || command[1] == '|')
+        return ESP_ERR_INVALID_ARG;
+
+    command++;
+
+    size_t command_len = strcspn(command, "|");
+
+    if (command_len > CONFIG_IOT_AGENT_COMMAND_NAME_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    // the attribute names are <command>_status and <command>_info
+    char name[CONFIG_IOT_AGENT_COMMAND_NAME_LEN + sizeof("_status")];
+
+    size_t rollback = orion_writer.length;
+
+    char timestamp[ORION_TIMESTAMP_LEN + 1];
+
+    orion_format_timestamp(timestamp);
+    orion_write_entity_start();
+
+    int name_len = snprintf(name, sizeof(name), "%.*s_status", (int)command_len, command);
+    orion_write_text_attribute(name, name_len, status, strlen(status), timestamp);
+
+    name_len = snprintf(name, sizeof(name), "%.*s_info", (int)command_len, command);
+    orion_write_text_attribute(name, name_len, info, strlen(info), timestamp);
+
+    return orion_write_entity_end(timestamp, rollback);
+}
+
+/**
+ * @brief Returns the number of measurements in the current batch
+ *
+ * @return size_t the number of measurements
+ */
+size_t orion_batch_count()
+{
+    return orion_batch_measurements;
+}
+
+/**
+ * @brief Sends the current batch to Orion
+ *
+ * @details the connection is kept alive between batches and reopened after an error.
+ *  The batch is not reset, call orion_batch_reset() before adding new measurements.
+ *
+ * @param token the access token to attach, set to NULL if not needed
+ * @param status_code pointer to store the http status code, set to NULL if not needed
+ * @return esp_err_t    ESP_OK if the request was sent,
+ *                      ESP_ERR_INVALID_STATE if the batch is empty or wifi connection is not available,
+ *                      ESP_ERR_NO_MEM if the client could not be created,
+ *                      error code of esp_http_client_perform() otherwise
+ */
+esp_err_t orion_batch_send(FiwareAccessToken_t *token, int *status_code)
+{
+    if (orion_batch_measurements == 0)
+        return ESP_ERR_INVALID_STATE;
+
+    // check if wifi is not connected
+    if (!is_wifi_connected())
+        return ESP_ERR_INVALID_STATE;
+
+    // create the client on first use or after an error
+    if (orion_client == NULL)
+    {
+        orion_client = esp_http_client_init(&orion_config);
+
+        if (orion_client == NULL)
+            return ESP_ERR_NO_MEM;
+
+        esp_http_client_set_header(orion_client, "Content-Type", ORION_CONTENT_TYPE);
+
+        if (strlen(CONFIG_ORION_FIWARE_SERVICE) > 0)
+            esp_http_client_set_header(orion_client, ORION_SERVICE_HEADER, CONFIG_ORION_FIWARE_SERVICE);
+
+#ifdef CONFIG_FIWARE_UPLOAD_NGSI_V2
+        esp_http_client_set_header(orion_client, "Fiware-ServicePath", CONFIG_ORION_FIWARE_SERVICE_PATH);
+#endif
+    }
+
+    // if the token is not null, attach the auth values to the request
+    if (token != NULL)
+    {
+        // the token refresh timer of the FIWARE task renews the token, the upload is not delayed by it
+        if (fiware_idm_check_is_token_expired(token))
+            ESP_LOGW(TAG, "FIWARE Auth token expired, waiting for the refresh timer to renew it");
+
+        fiware_idm_attach_auth_data_to_request(token, orion_client);
+    }
+
+    // close the batch, the space of the suffix is always reserved
+    size_t length = orion_writer.length;
+    memcpy(orion_buffer + length, ORION_BATCH_SUFFIX, sizeof(ORION_BATCH_SUFFIX));
+    length += sizeof(ORION_BATCH_SUFFIX) - 1;
+
+    esp_http_client_set_post_field(orion_client, orion_buffer, length);
+
+    int64_t request_start = esp_timer_get_time();
+    int ret = esp_http_client_perform(orion_client);
+
+    metrics_upload_record(METRICS_UPLOAD_ORION_BATCH, esp_timer_get_time() - request_start, ret == ESP_OK);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error sending batch of %zu measurements.", orion_batch_measurements);
+        // drop the connection, it is reopened by the next request
+        esp_http_client_cleanup(orion_client);
+        orion_client = NULL;
+        return ret;
+    }
+
+    ret = esp_http_client_get_status_code(orion_client);
+
+    if (ret == 401)
+        ESP_LOGW(TAG, "Unauthorized.");
+    else if (ret == 207)
+        ESP_LOGW(TAG, "Some entities of the batch were not updated.");
+    else if (ret >= 300)
+        ESP_LOGW(TAG, "Unexpected status from Orion: %d", ret);
+    else
+        ESP_LOGD(TAG, "Batch of %zu measurements sent (%zu bytes)", orion_batch_measurements, length);
+
+    if (status_code != NULL)
+        *status_code = ret;
+
+    return ESP_OK;
+}
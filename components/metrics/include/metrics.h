@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+/// @brief Counters of the UART communication with the Kawasaki Controller
+typedef enum
+{
+    METRICS_UART_FRAME_RECEIVED,
+    METRICS_UART_FRAME_SENT,
+    METRICS_UART_ERROR_TIMEOUT,
+    METRICS_UART_ERROR_INVALID_RESPONSE,
+    METRICS_UART_ERROR_COLLISION,
+    METRICS_UART_ERROR_TRANSMISSION,
+    METRICS_UART_ERROR_INVALID_HEADER,
+    METRICS_UART_ERROR_QUEUE_FULL,
+    METRICS_UART_COUNTER_MAX,
+} metrics_uart_counter_t;
+
+/// @brief HTTP uploads whose latency is recorded
+typedef enum
+{
+    METRICS_UPLOAD_IOTA_MEASUREMENT,
+    METRICS_UPLOAD_IOTA_COMMAND_RESULT,
+    METRICS_UPLOAD_IDM_TOKEN,
+    METRICS_UPLOAD_ORION_BATCH,
+    METRICS_UPLOAD_MAX,
+} metrics_upload_t;
+
+/// @brief Counters of the measurement attributes handled by the FIWARE task
+typedef enum
+{
+    METRICS_ATTRIBUTE_SENT,
+    METRICS_ATTRIBUTE_SUPPRESSED,
+    METRICS_ATTRIBUTE_HEARTBEAT,
+    METRICS_ATTRIBUTE_DEFERRED,
+    METRICS_ATTRIBUTE_COALESCED,
+    METRICS_ATTRIBUTE_COUNTER_MAX,
+} metrics_attribute_counter_t;
+
+/// @brief Counters of the VOLTAGE setpoints handled by the voltage regulator task
+typedef enum
+{
+    METRICS_VREG_SETPOINT_SENT,
+    METRICS_VREG_SETPOINT_COALESCED,
+    METRICS_VREG_COUNTER_MAX,
+} metrics_vreg_counter_t;
+
+/// @brief Number of buckets of the upload latency histograms, the last bucket is +Inf
+#define METRICS_LATENCY_BUCKETS 11
+
+void metrics_uart_count(metrics_uart_counter_t counter);
+
+void metrics_attribute_count(metrics_attribute_counter_t counter, uint32_t count);
+
+void metrics_vreg_count(metrics_vreg_counter_t counter);
+
+void metrics_upload_record(metrics_upload_t upload, int64_t latency_us, bool success);
+
+esp_err_t metrics_render_prometheus(char *buffer, size_t buffer_len, size_t *length);
+
+esp_err_t metrics_render_json(char *buffer, size_t buffer_len, size_t *length);
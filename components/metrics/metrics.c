@@ -0,0 +1,586 @@
+/// @file
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "task_intercom.h"
+#include "wifi.h"
+
+#ifndef configRUN_TIME_COUNTER_TYPE
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+#endif
+
+#define METRICS_PREFIX "eci_"
+
+/// @brief Output buffer of a page being rendered
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+    /// @brief true if the page did not fit into the buffer
+    bool overflow;
+} metrics_writer_t;
+
+/// @brief Latency histogram of one upload type, the buckets are not cumulative
+typedef struct
+{
+    uint32_t buckets[METRICS_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t failures;
+    uint64_t sum_us;
+} metrics_histogram_t;
+
+/// @brief Upper bounds of the latency buckets in milliseconds, the last bucket has no bound
+static const uint32_t metrics_latency_bounds_ms[METRICS_LATENCY_BUCKETS - 1] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+
+static const char *metrics_upload_names[METRICS_UPLOAD_MAX] = {
+    "iota_measurement",
+    "iota_command_result",
+    "idm_token",
+    "orion_batch",
+};
+
+static const char *metrics_uart_error_names[METRICS_UART_COUNTER_MAX] = {
+    [METRICS_UART_ERROR_TIMEOUT] = "timeout",
+    [METRICS_UART_ERROR_INVALID_RESPONSE] = "invalid_response",
+    [METRICS_UART_ERROR_COLLISION] = "collision",
+    [METRICS_UART_ERROR_TRANSMISSION] = "transmission",
+    [METRICS_UART_ERROR_INVALID_HEADER] = "invalid_header",
+    [METRICS_UART_ERROR_QUEUE_FULL] = "queue_full",
+};
+
+static const char *metrics_attribute_names[METRICS_ATTRIBUTE_COUNTER_MAX] = {
+    "sent",
+    "suppressed",
+    "heartbeat",
+    "deferred",
+    "coalesced",
+};
+
+static const char *metrics_vreg_names[METRICS_VREG_COUNTER_MAX] = {
+    "sent",
+    "coalesced",
+};
+
+static uint32_t metrics_uart_counters[METRICS_UART_COUNTER_MAX] = {0};
+
+static uint32_t metrics_attribute_counters[METRICS_ATTRIBUTE_COUNTER_MAX] = {0};
+
+static uint32_t metrics_vreg_counters[METRICS_VREG_COUNTER_MAX] = {0};
+
+static metrics_histogram_t metrics_upload_histograms[METRICS_UPLOAD_MAX] = {0};
+
+/// @brief Protects the histograms, an update touches more than one field
+static portMUX_TYPE metrics_histogram_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_METRICS_TASK_STATS
+/// @brief Task snapshot used by the renderers
+static TaskStatus_t metrics_task_status[CONFIG_METRICS_MAX_TASKS];
+#endif
+
+/**
+ * @brief Increments a UART counter
+ *
+ * @param counter the counter to increment
+ */
+void metrics_uart_count(metrics_uart_counter_t counter)
+{
+    if (counter >= METRICS_UART_COUNTER_MAX)
+        return;
+
+    __atomic_fetch_add(&metrics_uart_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Adds to a measurement attribute counter
+ *
+ * @param counter the counter to increment
+ * @param count the number of attributes
+ */
+void metrics_attribute_count(metrics_attribute_counter_t counter, uint32_t count)
+{
+    if (counter >= METRICS_ATTRIBUTE_COUNTER_MAX || count == 0)
+        return;
+
+    __atomic_fetch_add(&metrics_attribute_counters[counter], count, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Increments a voltage setpoint counter
+ *
+ * @param counter the counter to increment
+ */
+void metrics_vreg_count(metrics_vreg_counter_t counter)
+{
+    if (counter >= METRICS_VREG_COUNTER_MAX)
+        return;
+
+    __atomic_fetch_add(&metrics_vreg_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records the latency of an HTTP upload
+ *
+ * @param upload the type of the upload
+ * @param latency_us the time from the start of the request to the response in microseconds
+ * @param success false if the request failed, failed requests are counted but not added to the histogram
+ */
+void metrics_upload_record(metrics_upload_t upload, int64_t latency_us, bool success)
+{
+    if (upload >= METRICS_UPLOAD_MAX)
+        return;
+
+    metrics_histogram_t *histogram = &metrics_upload_histograms[upload];
+
+    if (!success)
+    {
+        __atomic_fetch_add(&histogram->failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (latency_us < 0)
+        latency_us = 0;
+
+    int bucket = 0;
+
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && latency_us > (int64_t)metrics_latency_bounds_ms[bucket] * 1000)
+        bucket++;
+
+    taskENTER_CRITICAL(&metrics_histogram_lock);
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += latency_us;
+    taskEXIT_CRITICAL(&metrics_histogram_lock);
+}
+
+/**
+ * @brief Appends formatted text to the page
+ *
+ * @details once the page overflows the writer ignores further writes
+ *
+ * @param writer pointer to the writer
+ * @param format printf style format string
+ */
+static void metrics_write(metrics_writer_t *writer, const char *format, ...)
+{
+    if (writer->overflow)
+        return;
+
+    size_t available = writer->size - writer->length;
+
+    va_list args;
+    va_start(args, format);
+    int ret = vsnprintf(writer->buffer + writer->length, available, format, args);
+    va_end(args);
+
+    if (ret < 0 || (size_t)ret >= available)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    writer->length += ret;
+}
+
+/**
+ * @brief Finishes the page
+ *
+ * @param writer pointer to the writer
+ * @param length pointer to store the length of the page
+ * @return esp_err_t ESP_OK if the page fits into the buffer, ESP_ERR_INVALID_SIZE otherwise
+ */
+static esp_err_t metrics_finish(metrics_writer_t *writer, size_t *length)
+{
+    if (writer->overflow)
+        return ESP_ERR_INVALID_SIZE;
+
+    *length = writer->length;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Copies a histogram so it can be rendered without holding the lock
+ *
+ * @param upload the type of the upload
+ * @param histogram pointer to store the copy
+ */
+static void metrics_histogram_snapshot(metrics_upload_t upload, metrics_histogram_t *histogram)
+{
+    taskENTER_CRITICAL(&metrics_histogram_lock);
+    *histogram = metrics_upload_histograms[upload];
+    taskEXIT_CRITICAL(&metrics_histogram_lock);
+
+    histogram->failures = __atomic_load_n(&metrics_upload_histograms[upload].failures, __ATOMIC_RELAXED);
+}
+
+#ifdef CONFIG_METRICS_TASK_STATS
+/**
+ * @brief Takes a snapshot of the tasks into metrics_task_status
+ *
+ * @details uxTaskGetSystemState() reports no task at all if the array is too small for every task
+ *
+ * @param total_run_time pointer to store the total run time
+ * @param task_num pointer to store the number of tasks in the snapshot
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_SIZE if there are more than CONFIG_METRICS_MAX_TASKS tasks
+ */
+static esp_err_t metrics_task_snapshot(configRUN_TIME_COUNTER_TYPE *total_run_time, UBaseType_t *task_num)
+{
+    *total_run_time = 0;
+    *task_num = 0;
+
+    if (uxTaskGetNumberOfTasks() > CONFIG_METRICS_MAX_TASKS)
+        return ESP_ERR_INVALID_SIZE;
+
+    *task_num = uxTaskGetSystemState(metrics_task_status, CONFIG_METRICS_MAX_TASKS, total_run_time);
+
+    // a task was created since the check
+    return *task_num > 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/**
+ * @brief Calculates the CPU use of a task since boot
+ *
+ * @details the run time counter of every core advances with the total run time,
+ *  the result is divided by the number of cores so the tasks add up to 100%
+ *
+ * @param task the task status
+ * @param total_run_time the total run time of the snapshot
+ * @return uint32_t the CPU use in percent
+ */
+static uint32_t metrics_task_cpu_percent(const TaskStatus_t *task, configRUN_TIME_COUNTER_TYPE total_run_time)
+{
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    if (total_run_time == 0)
+        return 0;
+
+    return (uint64_t)task->ulRunTimeCounter * 100 / ((uint64_t)total_run_time * portNUM_PROCESSORS);
+#else
+    return 0;
+#endif
+}
+#endif
+
+/**
+ * @brief Renders the runtime metrics in the Prometheus text exposition format
+ *
+ * @note the function is not reentrant, it is meant to be called from the http server task
+ *
+ * @param buffer the buffer to render into
+ * @param buffer_len the size of the buffer
+ * @param length pointer to store the length of the page
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_SIZE if the page does not fit into the buffer
+ */
+esp_err_t metrics_render_prometheus(char *buffer, size_t buffer_len, size_t *length)
+{
+    metrics_writer_t writer = {.buffer = buffer, .size = buffer_len, .length = 0, .overflow = false};
+
+    metrics_write(&writer,
+                  "# TYPE " METRICS_PREFIX "uptime_seconds gauge\n" METRICS_PREFIX "uptime_seconds %" PRId64 "\n",
+                  esp_timer_get_time() / 1000000);
+
+    // heap
+    metrics_write(&writer,
+                  "# TYPE " METRICS_PREFIX "heap_free_bytes gauge\n" METRICS_PREFIX "heap_free_bytes %zu\n"
+                  "# TYPE " METRICS_PREFIX "heap_min_free_bytes gauge\n" METRICS_PREFIX "heap_min_free_bytes %zu\n"
+                  "# TYPE " METRICS_PREFIX "heap_largest_free_block_bytes gauge\n" METRICS_PREFIX "heap_largest_free_block_bytes %zu\n",
+                  heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                  heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                  heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    // inter task communication queues, the samples of a metric have to be contiguous
+    itc_queue_stats_t queues[TASK_INTERCOM_QUEUE_COUNT];
+    bool queue_valid[TASK_INTERCOM_QUEUE_COUNT];
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+        queue_valid[i] = task_intercom_get_queue_stats(i, &queues[i]) == ESP_OK;
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "itc_queue_depth gauge\n");
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+        if (queue_valid[i])
+            metrics_write(&writer, METRICS_PREFIX "itc_queue_depth{queue=\"%s\"} %u\n", queues[i].name, queues[i].depth);
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "itc_queue_capacity gauge\n");
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+        if (queue_valid[i])
+            metrics_write(&writer, METRICS_PREFIX "itc_queue_capacity{queue=\"%s\"} %u\n", queues[i].name, queues[i].capacity);
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "itc_queue_high_water gauge\n");
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+        if (queue_valid[i])
+            metrics_write(&writer, METRICS_PREFIX "itc_queue_high_water{queue=\"%s\"} %u\n", queues[i].name, queues[i].high_water);
+
+#ifdef CONFIG_METRICS_TASK_STATS
+    // tasks
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    UBaseType_t task_num;
+    esp_err_t task_ret = metrics_task_snapshot(&total_run_time, &task_num);
+
+    metrics_write(&writer,
+                  "# TYPE " METRICS_PREFIX "tasks gauge\n" METRICS_PREFIX "tasks %u\n"
+                  "# TYPE " METRICS_PREFIX "task_array_too_small gauge\n" METRICS_PREFIX "task_array_too_small %d\n"
+                  "# TYPE " METRICS_PREFIX "task_stack_high_water_bytes gauge\n",
+                  uxTaskGetNumberOfTasks(), task_ret == ESP_ERR_INVALID_SIZE);
+
+    for (UBaseType_t i = 0; i < task_num; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "task_stack_high_water_bytes{task=\"%s\"} %u\n",
+                      metrics_task_status[i].pcTaskName, (unsigned)metrics_task_status[i].usStackHighWaterMark);
+    }
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "task_cpu_percent gauge\n");
+
+    for (UBaseType_t i = 0; i < task_num; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "task_cpu_percent{task=\"%s\"} %" PRIu32 "\n",
+                      metrics_task_status[i].pcTaskName, metrics_task_cpu_percent(&metrics_task_status[i], total_run_time));
+    }
+#endif
+
+    // uart
+    metrics_write(&writer,
+                  "# TYPE " METRICS_PREFIX "uart_frames_total counter\n"
+                  METRICS_PREFIX "uart_frames_total{direction=\"rx\"} %" PRIu32 "\n"
+                  METRICS_PREFIX "uart_frames_total{direction=\"tx\"} %" PRIu32 "\n"
+                  "# TYPE " METRICS_PREFIX "uart_errors_total counter\n",
+                  __atomic_load_n(&metrics_uart_counters[METRICS_UART_FRAME_RECEIVED], __ATOMIC_RELAXED),
+                  __atomic_load_n(&metrics_uart_counters[METRICS_UART_FRAME_SENT], __ATOMIC_RELAXED));
+
+    for (int i = METRICS_UART_ERROR_TIMEOUT; i < METRICS_UART_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "uart_errors_total{type=\"%s\"} %" PRIu32 "\n",
+                      metrics_uart_error_names[i],
+                      __atomic_load_n(&metrics_uart_counters[i], __ATOMIC_RELAXED));
+    }
+
+    // measurement attributes
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "measurement_attributes_total counter\n");
+
+    for (int i = 0; i < METRICS_ATTRIBUTE_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "measurement_attributes_total{result=\"%s\"} %" PRIu32 "\n",
+                      metrics_attribute_names[i],
+                      __atomic_load_n(&metrics_attribute_counters[i], __ATOMIC_RELAXED));
+    }
+
+    // voltage setpoints
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "vreg_setpoints_total counter\n");
+
+    for (int i = 0; i < METRICS_VREG_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "vreg_setpoints_total{result=\"%s\"} %" PRIu32 "\n",
+                      metrics_vreg_names[i],
+                      __atomic_load_n(&metrics_vreg_counters[i], __ATOMIC_RELAXED));
+    }
+
+    // uploads
+    metrics_histogram_t histograms[METRICS_UPLOAD_MAX];
+
+    for (int i = 0; i < METRICS_UPLOAD_MAX; i++)
+        metrics_histogram_snapshot(i, &histograms[i]);
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "upload_latency_ms histogram\n");
+
+    for (int i = 0; i < METRICS_UPLOAD_MAX; i++)
+    {
+        const char *name = metrics_upload_names[i];
+        uint32_t cumulative = 0;
+
+        for (int bucket = 0; bucket < METRICS_LATENCY_BUCKETS - 1; bucket++)
+        {
+            cumulative += histograms[i].buckets[bucket];
+
+            metrics_write(&writer,
+                          METRICS_PREFIX "upload_latency_ms_bucket{upload=\"%s\",le=\"%" PRIu32 "\"} %" PRIu32 "\n",
+                          name, metrics_latency_bounds_ms[bucket], cumulative);
+        }
+
+        metrics_write(&writer,
+                      METRICS_PREFIX "upload_latency_ms_bucket{upload=\"%s\",le=\"+Inf\"} %" PRIu32 "\n"
+                      METRICS_PREFIX "upload_latency_ms_sum{upload=\"%s\"} %" PRIu64 "\n"
+                      METRICS_PREFIX "upload_latency_ms_count{upload=\"%s\"} %" PRIu32 "\n",
+                      name, histograms[i].count,
+                      name, histograms[i].sum_us / 1000,
+                      name, histograms[i].count);
+    }
+
+    metrics_write(&writer, "# TYPE " METRICS_PREFIX "upload_failures_total counter\n");
+
+    for (int i = 0; i < METRICS_UPLOAD_MAX; i++)
+    {
+        metrics_write(&writer,
+                      METRICS_PREFIX "upload_failures_total{upload=\"%s\"} %" PRIu32 "\n",
+                      metrics_upload_names[i], histograms[i].failures);
+    }
+
+    // wifi, only reported while connected
+    int rssi;
+
+    if (wifi_get_rssi(&rssi) == ESP_OK)
+    {
+        metrics_write(&writer,
+                      "# TYPE " METRICS_PREFIX "wifi_rssi_dbm gauge\n" METRICS_PREFIX "wifi_rssi_dbm %d\n",
+                      rssi);
+    }
+
+    return metrics_finish(&writer, length);
+}
+
+/**
+ * @brief Renders the runtime metrics as a JSON object
+ *
+ * @note the function is not reentrant, it is meant to be called from the http server task
+ *
+ * @param buffer the buffer to render into
+ * @param buffer_len the size of the buffer
+ * @param length pointer to store the length of the page
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_SIZE if the page does not fit into the buffer
+ */
+esp_err_t metrics_render_json(char *buffer, size_t buffer_len, size_t *length)
+{
+    metrics_writer_t writer = {.buffer = buffer, .size = buffer_len, .length = 0, .overflow = false};
+
+    metrics_write(&writer,
+                  "{\"uptime_s\":%" PRId64 ",\"heap\":{\"free\":%zu,\"min_free\":%zu,\"largest_free_block\":%zu}",
+                  esp_timer_get_time() / 1000000,
+                  heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                  heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                  heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    // inter task communication queues
+    metrics_write(&writer, ",\"queues\":[");
+
+    bool first = true;
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+    {
+        itc_queue_stats_t stats;
+
+        if (task_intercom_get_queue_stats(i, &stats) != ESP_OK)
+            continue;
+
+        metrics_write(&writer,
+                      "%s{\"name\":\"%s\",\"depth\":%u,\"capacity\":%u,\"high_water\":%u}",
+                      first ? "" : ",", stats.name, stats.depth, stats.capacity, stats.high_water);
+
+        first = false;
+    }
+
+    metrics_write(&writer, "]");
+
+#ifdef CONFIG_METRICS_TASK_STATS
+    // tasks
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    UBaseType_t task_num;
+    esp_err_t task_ret = metrics_task_snapshot(&total_run_time, &task_num);
+
+    metrics_write(&writer, ",\"task_array_too_small\":%s,\"tasks\":[", task_ret == ESP_ERR_INVALID_SIZE ? "true" : "false");
+
+    for (UBaseType_t i = 0; i < task_num; i++)
+    {
+        const TaskStatus_t *task = &metrics_task_status[i];
+
+        metrics_write(&writer,
+                      "%s{\"name\":\"%s\",\"stack_high_water\":%u,\"cpu_percent\":%" PRIu32 "}",
+                      i == 0 ? "" : ",", task->pcTaskName, (unsigned)task->usStackHighWaterMark,
+                      metrics_task_cpu_percent(task, total_run_time));
+    }
+
+    metrics_write(&writer, "]");
+#endif
+
+    // uart
+    metrics_write(&writer,
+                  ",\"uart\":{\"frames_received\":%" PRIu32 ",\"frames_sent\":%" PRIu32 ",\"errors\":{",
+                  __atomic_load_n(&metrics_uart_counters[METRICS_UART_FRAME_RECEIVED], __ATOMIC_RELAXED),
+                  __atomic_load_n(&metrics_uart_counters[METRICS_UART_FRAME_SENT], __ATOMIC_RELAXED));
+
+    for (int i = METRICS_UART_ERROR_TIMEOUT; i < METRICS_UART_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      "%s\"%s\":%" PRIu32,
+                      i == METRICS_UART_ERROR_TIMEOUT ? "" : ",",
+                      metrics_uart_error_names[i],
+                      __atomic_load_n(&metrics_uart_counters[i], __ATOMIC_RELAXED));
+    }
+
+    metrics_write(&writer, "}}");
+
+    // measurement attributes
+    metrics_write(&writer, ",\"attributes\":{");
+
+    for (int i = 0; i < METRICS_ATTRIBUTE_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      "%s\"%s\":%" PRIu32,
+                      i == 0 ? "" : ",",
+                      metrics_attribute_names[i],
+                      __atomic_load_n(&metrics_attribute_counters[i], __ATOMIC_RELAXED));
+    }
+
+    metrics_write(&writer, "}");
+
+    // voltage setpoints
+    metrics_write(&writer, ",\"vreg_setpoints\":{");
+
+    for (int i = 0; i < METRICS_VREG_COUNTER_MAX; i++)
+    {
+        metrics_write(&writer,
+                      "%s\"%s\":%" PRIu32,
+                      i == 0 ? "" : ",",
+                      metrics_vreg_names[i],
+                      __atomic_load_n(&metrics_vreg_counters[i], __ATOMIC_RELAXED));
+    }
+
+    metrics_write(&writer, "}");
+
+    // uploads
+    metrics_write(&writer, ",\"uploads\":{");
+
+    for (int i = 0; i < METRICS_UPLOAD_MAX; i++)
+    {
+        metrics_histogram_t histogram;
+        metrics_histogram_snapshot(i, &histogram);
+
+        metrics_write(&writer,
+                      "%s\"%s\":{\"count\":%" PRIu32 ",\"failures\":%" PRIu32 ",\"sum_ms\":%" PRIu64 ",\"buckets\":[",
+                      i == 0 ? "" : ",", metrics_upload_names[i],
+                      histogram.count, histogram.failures, histogram.sum_us / 1000);
+
+        // the buckets are not cumulative, the last one has no upper bound
+        for (int bucket = 0; bucket < METRICS_LATENCY_BUCKETS; bucket++)
+            metrics_write(&writer, "%s%" PRIu32, bucket == 0 ? "" : ",", histogram.buckets[bucket]);
+
+        metrics_write(&writer, "]}");
+    }
+
+    metrics_write(&writer, "}");
+
+    // wifi
+    int rssi;
+
+    if (wifi_get_rssi(&rssi) == ESP_OK)
+        metrics_write(&writer, ",\"wifi\":{\"rssi\":%d}}", rssi);
+    else
+        metrics_write(&writer, ",\"wifi\":{\"rssi\":null}}");
+
+    return metrics_finish(&writer, length);
+}
@@ -0,0 +1,136 @@
+/// @file
+#include "filter.h"
+
+#include <string.h>
+
+// the chain runs in the ADC interrupt on the target and in the benchmark harness on the host
+#ifdef ESP_PLATFORM
+#include <esp_attr.h>
+#define PH_FILTER_ATTR IRAM_ATTR
+#else
+#define PH_FILTER_ATTR
+#endif
+
+#define PH_FILTER_DECIMATION (1 << CONFIG_PH_FILTER_DECIMATION_SHIFT)
+
+#if CONFIG_PH_FILTER_DECIMATION_SHIFT > PH_FILTER_Q
+#error "The decimation shift cannot exceed the number of fractional bits"
+#endif
+
+#if PH_FILTER_MEDIAN_SIZE % 2 == 0
+#error "The median size has to be odd"
+#endif
+
+/**
+ * @brief Resets the filter chain
+ *
+ * @param filter the filter to reset
+ */
+void ph_filter_init(ph_filter_t *filter)
+{
+    memset(filter, 0, sizeof(ph_filter_t));
+}
+
+/**
+ * @brief Takes the median of the decimated values in the window
+ *
+ * @details the window is copied and insertion sorted, the window is at most 9 values
+ *
+ * @param filter the filter
+ * @return int32_t the median, the latest value while the window is filling up
+ */
+static int32_t PH_FILTER_ATTR ph_filter_median(const ph_filter_t *filter)
+{
+    int32_t sorted[PH_FILTER_MEDIAN_SIZE];
+    uint8_t count = filter->median_count;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        int32_t value = filter->median_window[i];
+        uint8_t j = i;
+
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+
+        sorted[j] = value;
+    }
+
+    return sorted[count / 2];
+}
+
+/**
+ * @brief Smooths the output of the median stage
+ *
+ * @details with CONFIG_PH_FILTER_EMA the output follows the input by 2^-CONFIG_PH_FILTER_EMA_SHIFT per value,
+ *  with CONFIG_PH_FILTER_MOVING_AVERAGE the output is the average of the last 2^CONFIG_PH_FILTER_AVERAGE_SHIFT values.
+ *  The first value initializes the output.
+ *
+ * @param filter the filter
+ * @param value the output of the median stage in Q16
+ */
+static void PH_FILTER_ATTR ph_filter_smooth(ph_filter_t *filter, int32_t value)
+{
+#if defined(CONFIG_PH_FILTER_EMA)
+    if (!filter->output_valid)
+        filter->output = value;
+    else
+        filter->output += (value - filter->output) >> CONFIG_PH_FILTER_EMA_SHIFT;
+#elif defined(CONFIG_PH_FILTER_MOVING_AVERAGE)
+    if (filter->average_count == PH_FILTER_AVERAGE_SIZE)
+        filter->average_sum -= filter->average_window[filter->average_index];
+    else
+        filter->average_count++;
+
+    filter->average_window[filter->average_index] = value;
+    filter->average_sum += value;
+    filter->average_index = (filter->average_index + 1) % PH_FILTER_AVERAGE_SIZE;
+
+    // a full window is divided by a shift, a filling one by its length
+    if (filter->average_count == PH_FILTER_AVERAGE_SIZE)
+        filter->output = filter->average_sum >> CONFIG_PH_FILTER_AVERAGE_SHIFT;
+    else
+        filter->output = filter->average_sum / filter->average_count;
+#else
+    filter->output = value;
+#endif
+
+    filter->output_valid = true;
+}
+
+/**
+ * @brief Feeds a raw ADC sample into the filter chain
+ *
+ * @details every 2^CONFIG_PH_FILTER_DECIMATION_SHIFT samples are summed into one decimated value,
+ *  the oversampling adds the shift as fractional bits of resolution.
+ *  The decimated value passes the median-of-CONFIG_PH_FILTER_MEDIAN_SIZE spike rejection and the smoothing stage.
+ *  The chain is integer only, the values are raw ADC counts in Q16.
+ *
+ * @param filter the filter
+ * @param sample the raw ADC sample
+ * @return true if the output of the chain was updated
+ */
+bool PH_FILTER_ATTR ph_filter_push(ph_filter_t *filter, uint16_t sample)
+{
+    filter->decimation_sum += sample;
+
+    if (++filter->decimation_count < PH_FILTER_DECIMATION)
+        return false;
+
+    int32_t value = (int32_t)(filter->decimation_sum << (PH_FILTER_Q - CONFIG_PH_FILTER_DECIMATION_SHIFT));
+
+    filter->decimation_sum = 0;
+    filter->decimation_count = 0;
+
+    filter->median_window[filter->median_index] = value;
+    filter->median_index = (filter->median_index + 1) % PH_FILTER_MEDIAN_SIZE;
+
+    if (filter->median_count < PH_FILTER_MEDIAN_SIZE)
+        filter->median_count++;
+
+    ph_filter_smooth(filter, ph_filter_median(filter));
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// @brief Number of fractional bits of the filter values, the values are raw ADC counts in Q16
+#define PH_FILTER_Q 16
+
+/// @brief Number of decimated values the median is taken of, 1 disables the median stage
+#define PH_FILTER_MEDIAN_SIZE CONFIG_PH_FILTER_MEDIAN_SIZE
+
+#ifdef CONFIG_PH_FILTER_MOVING_AVERAGE
+#define PH_FILTER_AVERAGE_SIZE (1 << CONFIG_PH_FILTER_AVERAGE_SHIFT)
+#endif
+
+/// @brief State of the pH filter chain: oversample-and-decimate, median, smoothing
+typedef struct
+{
+    /// @brief sum of the raw samples of the current decimation block
+    uint32_t decimation_sum;
+    /// @brief number of raw samples in the current decimation block
+    uint32_t decimation_count;
+
+    /// @brief the last decimated values, the median is taken of them
+    int32_t median_window[PH_FILTER_MEDIAN_SIZE];
+    uint8_t median_index;
+    uint8_t median_count;
+
+#ifdef CONFIG_PH_FILTER_MOVING_AVERAGE
+    int32_t average_window[PH_FILTER_AVERAGE_SIZE];
+    int64_t average_sum;
+    uint16_t average_index;
+    uint16_t average_count;
+#endif
+
+    /// @brief the output of the chain in Q16 raw ADC counts
+    int32_t output;
+    /// @brief true once the chain produced an output
+    bool output_valid;
+} ph_filter_t;
+
+void ph_filter_init(ph_filter_t *filter);
+
+bool ph_filter_push(ph_filter_t *filter, uint16_t sample);
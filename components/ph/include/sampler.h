@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+#include "sensor.h"
+
+esp_err_t ph_sampler_start(ph_sensor_t *sensor);
+
+esp_err_t ph_sampler_read(uint32_t max_age_ms, sensor_unit_t *ph, uint32_t *age_ms);
+
+esp_err_t ph_sampler_set_period(uint32_t period_ms);
+
+esp_err_t ph_sampler_calibrate(ph_calibration_t calibration, sensor_unit_t control_ph);
@@ -8,18 +8,46 @@
 /// @brief 32 bit integer value to store either mV or mpH (pH / 1000)
 typedef uint32_t sensor_unit_t;
 
+/// @brief Highest voltage covered by the lookup table in mV, the full scale of the ADC at 12 dB attenuation.
+///  Higher voltages read the last entry
+#define PH_SENSOR_TABLE_MAX_MV 3300
+
+/// @brief Number of entries of the lookup table, one every 2^CONFIG_PH_CALIBRATION_TABLE_SHIFT mV
+#define PH_SENSOR_TABLE_SIZE ((PH_SENSOR_TABLE_MAX_MV >> CONFIG_PH_CALIBRATION_TABLE_SHIFT) + 2)
+
+/// @brief A buffer solution of known pH and the voltage measured in it
+typedef struct
+{
+    /// @brief voltage in mV
+    sensor_unit_t voltage;
+    /// @brief pH value in mpH
+    sensor_unit_t ph;
+} ph_calibration_point_t;
+
+/// @brief Calibration commands, see ph_sensor_calibrate()
+typedef enum
+{
+    /// @brief replaces the point with the lowest pH
+    PH_CALIBRATION_LOW,
+    /// @brief replaces the point with the highest pH
+    PH_CALIBRATION_HIGH,
+    /// @brief adds a point or replaces the point of the same pH
+    PH_CALIBRATION_POINT,
+    /// @brief removes every point
+    PH_CALIBRATION_CLEAR,
+} ph_calibration_t;
+
 /// @brief pH sensor calibration data
-/// @details uses linear interpolation to measure pH based on voltage values
+/// @details the calibration points are interpolated piecewise linearly or fitted with a line,
+///  the result is precomputed into a mV to mpH lookup table
 typedef struct
 {
-    /// @brief lower voltage point
-    sensor_unit_t voltage_low;
-    /// @brief higher voltage point
-    sensor_unit_t voltage_high;
-    /// @brief lower pH value
-    sensor_unit_t ph_low;
-    /// @brief higher pH value
-    sensor_unit_t ph_high;
+    /// @brief calibration points sorted by voltage
+    ph_calibration_point_t points[CONFIG_PH_CALIBRATION_MAX_POINTS];
+    /// @brief number of calibration points, at least 2 are needed to measure
+    uint8_t point_count;
+    /// @brief pH in mpH at every 2^CONFIG_PH_CALIBRATION_TABLE_SHIFT mV, built from the points
+    int32_t table[PH_SENSOR_TABLE_SIZE];
     /// @brief sensor_unit_t to store the measured value
     sensor_unit_t ph_measurement;
 } ph_sensor_t;
@@ -28,4 +56,4 @@ esp_err_t ph_sensor_init(ph_sensor_t *sensor);
 
 esp_err_t ph_sensor_make_measurement(ph_sensor_t *sensor, sensor_unit_t *measurement);
 
-esp_err_t ph_sensor_calibrate(ph_sensor_t *sensor, bool high_point, sensor_unit_t control_ph);
\ No newline at end of file
+esp_err_t ph_sensor_calibrate(ph_sensor_t *sensor, ph_calibration_t calibration, sensor_unit_t control_ph);
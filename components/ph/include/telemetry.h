@@ -0,0 +1,5 @@
+#pragma once
+
+#include "sensor.h"
+
+void ph_telemetry_publish(sensor_unit_t ph);
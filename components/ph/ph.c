@@ -9,6 +9,7 @@
 #include "task_intercom.h"
 
 #include "sensor.h"
+#include "sampler.h"
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
 
@@ -18,6 +19,10 @@ static const char *KW_PH = "PH";
 static const char *KW_MEASURE = "MEASURE";
 static const char *KW_CALIBRATE = "CALIBRATE";
 static const char *KW_HIGH = "HIGH";
+static const char *KW_LOW = "LOW";
+static const char *KW_POINT = "POINT";
+static const char *KW_CLEAR = "CLEAR";
+static const char *KW_RATE = "RATE";
 
 static TaskHandle_t ph_task_handle = NULL;
 
@@ -26,10 +31,13 @@ void ph_task()
 {
     int ret;
     sensor_unit_t measurement;
-    ph_sensor_t sensor;
+    uint32_t age_ms;
+    // the lookup table of the sensor does not fit on the stack
+    static ph_sensor_t sensor;
     itc_message_t *message;
 
     ESP_ERROR_CHECK(ph_sensor_init(&sensor));
+    ESP_ERROR_CHECK(ph_sampler_start(&sensor));
 
     while (1)
     {
@@ -40,6 +48,9 @@ void ph_task()
         // PH | MEASURE
         // PH | CALIBRATE | HIGH | <ph value>
         // PH | CALIBRATE | LOW  | <ph value>
+        // PH | CALIBRATE | POINT | <ph value>
+        // PH | CALIBRATE | CLEAR
+        // PH | RATE      | <period in ms>
 
         if (message->token_num < 2)
             continue;
@@ -58,13 +69,12 @@ void ph_task()
         //* pH Measurement
         if (task_itc_message_token_match(message, 1, KW_MEASURE) == ESP_OK)
         {
-            ESP_LOGI(TAG, "Measuring pH value...");
-
-            ret = ph_sensor_make_measurement(&sensor, &measurement);
+            // the sampler keeps the latest value, this only blocks if it is too old
+            ret = ph_sampler_read(CONFIG_PH_SAMPLER_MAX_AGE_MS, &measurement, &age_ms);
 
             if (ret == ESP_OK)
             {
-                ESP_LOGI(TAG, "Measured pH: %lu", measurement);
+                ESP_LOGI(TAG, "Measured pH: %lu (%lu ms ago)", measurement, age_ms);
                 asprintf(&message->response, "%lu", measurement);
             }
             else
@@ -80,13 +90,40 @@ void ph_task()
         {
             ESP_LOGI(TAG, "Starting calibration...");
 
-            sensor_unit_t control_ph = atoi(message->tokens[3]);
+            sensor_unit_t control_ph = message->token_num > 3 ? atoi(message->tokens[3]) : 0;
+
+            if (task_itc_message_token_match(message, 2, KW_CLEAR) == ESP_OK)
+                ret = ph_sampler_calibrate(PH_CALIBRATION_CLEAR, 0);
+
+            // the pH of the buffer is required, 0 is a valid buffer
+            else if (message->token_num < 4)
+                ret = ESP_ERR_INVALID_ARG;
+
+            else if (task_itc_message_token_match(message, 2, KW_HIGH) == ESP_OK)
+                ret = ph_sampler_calibrate(PH_CALIBRATION_HIGH, control_ph);
+
+            else if (task_itc_message_token_match(message, 2, KW_LOW) == ESP_OK)
+                ret = ph_sampler_calibrate(PH_CALIBRATION_LOW, control_ph);
+
+            else if (task_itc_message_token_match(message, 2, KW_POINT) == ESP_OK)
+                ret = ph_sampler_calibrate(PH_CALIBRATION_POINT, control_ph);
+
+            else
+                ret = ESP_ERR_INVALID_ARG;
 
-            if (task_itc_message_token_match(message, 2, KW_HIGH) == ESP_OK)
-                ret = ph_sensor_calibrate(&sensor, true, control_ph);
+            if (ret == ESP_OK)
+                message->response_static = "OK";
 
             else
-                ret = ph_sensor_calibrate(&sensor, false, control_ph);
+                message->response_static = esp_err_to_name(ret);
+        }
+        //* sampling period
+        else if (task_itc_message_token_match(message, 1, KW_RATE) == ESP_OK)
+        {
+            if (message->token_num < 3)
+                ret = ESP_ERR_INVALID_ARG;
+            else
+                ret = ph_sampler_set_period(atoi(message->tokens[2]));
 
             if (ret == ESP_OK)
                 message->response_static = "OK";
@@ -95,7 +132,7 @@ void ph_task()
                 message->response_static = esp_err_to_name(ret);
         }
 
-        xQueueSend(task_itc_to_uart_queue, &message, portMAX_DELAY);
+        task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
     }
 }
 
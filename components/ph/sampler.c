@@ -0,0 +1,311 @@
+/// @file
+#include "sampler.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_check.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#ifdef CONFIG_PH_TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
+
+#define MIN(a, b) ((a) < (b)) ? (a) : (b)
+
+#define PH_SAMPLER_PERIOD_MIN_MS 10
+#define PH_SAMPLER_PERIOD_MAX_MS 60000
+
+static const char *TAG = "pH Sampler";
+
+/// @brief The latest pH value, protected by a sequence lock
+/// @details the sampler task is the only writer, the sequence is odd while it writes.
+///  Readers retry until they read the same even sequence before and after the value.
+///  The write is a critical section, a reader of higher priority can not preempt it on the same core
+typedef struct
+{
+    uint32_t sequence;
+    sensor_unit_t ph;
+    /// @brief time of the sample in milliseconds since boot, wraps around
+    uint32_t sampled_at_ms;
+    /// @brief calibration generation the value was converted with
+    uint32_t calibration;
+    bool valid;
+} ph_sampler_slot_t;
+
+static ph_sampler_slot_t ph_sampler_slot;
+
+static portMUX_TYPE ph_sampler_slot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Incremented by every calibration, values of an older generation are stale
+static uint32_t ph_sampler_calibration = 0;
+
+static uint32_t ph_sampler_period_ms = CONFIG_PH_SAMPLER_PERIOD_MS;
+
+static ph_sensor_t *ph_sampler_sensor = NULL;
+
+/// @brief Serializes the measurements of the sampler task and the calibration
+static SemaphoreHandle_t ph_sampler_sensor_mutex = NULL;
+
+/// @brief Given by the sampler task after every published value
+static SemaphoreHandle_t ph_sampler_published = NULL;
+
+static TaskHandle_t ph_sampler_task_handle = NULL;
+
+static uint32_t ph_sampler_now_ms()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/**
+ * @brief Writes a new value into the slot, called by the sampler task only
+ *
+ * @param ph the pH value
+ * @param calibration the calibration generation the value was converted with
+ */
+static void ph_sampler_publish(sensor_unit_t ph, uint32_t calibration)
+{
+    uint32_t sampled_at_ms = ph_sampler_now_ms();
+
+    portENTER_CRITICAL(&ph_sampler_slot_lock);
+
+    uint32_t sequence = ph_sampler_slot.sequence;
+
+    __atomic_store_n(&ph_sampler_slot.sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&ph_sampler_slot.ph, ph, __ATOMIC_RELAXED);
+    __atomic_store_n(&ph_sampler_slot.sampled_at_ms, sampled_at_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&ph_sampler_slot.calibration, calibration, __ATOMIC_RELAXED);
+    __atomic_store_n(&ph_sampler_slot.valid, true, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&ph_sampler_slot.sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    portEXIT_CRITICAL(&ph_sampler_slot_lock);
+}
+
+/**
+ * @brief Reads a consistent copy of the slot without locking
+ *
+ * @param slot pointer to store the copy
+ */
+static void ph_sampler_load(ph_sampler_slot_t *slot)
+{
+    while (1)
+    {
+        uint32_t begin = __atomic_load_n(&ph_sampler_slot.sequence, __ATOMIC_ACQUIRE);
+
+        // the writer is in its critical section on the other core
+        if (begin & 1)
+        {
+            taskYIELD();
+            continue;
+        }
+
+        slot->ph = __atomic_load_n(&ph_sampler_slot.ph, __ATOMIC_RELAXED);
+        slot->sampled_at_ms = __atomic_load_n(&ph_sampler_slot.sampled_at_ms, __ATOMIC_RELAXED);
+        slot->calibration = __atomic_load_n(&ph_sampler_slot.calibration, __ATOMIC_RELAXED);
+        slot->valid = __atomic_load_n(&ph_sampler_slot.valid, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&ph_sampler_slot.sequence, __ATOMIC_RELAXED) == begin)
+            return;
+    }
+}
+
+/**
+ * @brief Checks the cached value against the maximum age and the calibration
+ *
+ * @param slot the copy of the slot
+ * @param max_age_ms the maximum age, 0 accepts any age
+ * @param age_ms pointer to store the age of the value
+ * @return true if the value can be returned
+ */
+static bool ph_sampler_fresh(const ph_sampler_slot_t *slot, uint32_t max_age_ms, uint32_t *age_ms)
+{
+    if (!slot->valid || slot->calibration != __atomic_load_n(&ph_sampler_calibration, __ATOMIC_ACQUIRE))
+        return false;
+
+    *age_ms = ph_sampler_now_ms() - slot->sampled_at_ms;
+
+    return max_age_ms == 0 || *age_ms <= max_age_ms;
+}
+
+/// @brief Task code of the pH sampler task
+static void ph_sampler_task()
+{
+    int ret;
+    sensor_unit_t ph;
+
+    while (1)
+    {
+        xSemaphoreTake(ph_sampler_sensor_mutex, portMAX_DELAY);
+
+        uint32_t calibration = __atomic_load_n(&ph_sampler_calibration, __ATOMIC_ACQUIRE);
+        ret = ph_sensor_make_measurement(ph_sampler_sensor, &ph);
+
+        xSemaphoreGive(ph_sampler_sensor_mutex);
+
+        if (ret == ESP_OK)
+        {
+            ph_sampler_publish(ph, calibration);
+            xSemaphoreGive(ph_sampler_published);
+
+#ifdef CONFIG_PH_TELEMETRY_ENABLE
+            ph_telemetry_publish(ph);
+#endif
+        }
+        else
+            ESP_LOGD(TAG, "Error while measuring pH: (%d) %s", ret, esp_err_to_name(ret));
+
+        // a notification requests a sample before the period ends
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(__atomic_load_n(&ph_sampler_period_ms, __ATOMIC_RELAXED)));
+    }
+}
+
+/**
+ * @brief Starts the pH sampler task
+ *
+ * @details the task measures the pH every CONFIG_PH_SAMPLER_PERIOD_MS and keeps the latest value,
+ *  see ph_sampler_read()
+ *
+ * @param sensor the initialized sensor, it is used by the sampler task from now on
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the task is already running,
+ *                      ESP_ERR_NO_MEM otherwise
+ */
+esp_err_t ph_sampler_start(ph_sensor_t *sensor)
+{
+    if (ph_sampler_task_handle != NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    ph_sampler_sensor = sensor;
+
+    ph_sampler_sensor_mutex = xSemaphoreCreateMutex();
+    ph_sampler_published = xSemaphoreCreateBinary();
+
+    ESP_RETURN_ON_FALSE(ph_sampler_sensor_mutex != NULL && ph_sampler_published != NULL, ESP_ERR_NO_MEM, TAG, "Unable to create semaphores");
+
+    int ret = xTaskCreate(
+        ph_sampler_task,
+        TAG,
+        CONFIG_PH_SAMPLER_STACK_DEPTH,
+        NULL,
+        MIN(CONFIG_PH_SAMPLER_PRIO, configMAX_PRIORITIES - 1),
+        &ph_sampler_task_handle);
+
+    return ret == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/**
+ * @brief Returns the latest pH value of the sampler
+ *
+ * @details the cached value is returned immediately if it is not older than max_age_ms.
+ *  Otherwise the sampler task is woken up and the caller blocks until it publishes a new value,
+ *  for at most CONFIG_PH_SAMPLER_TIMEOUT_MS
+ *
+ * @param max_age_ms the maximum age of the value, 0 returns the cached value whatever its age
+ * @param ph pointer to store the pH value in mpH
+ * @param age_ms pointer to store the age of the value, set to NULL if not needed
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the sampler is not running,
+ *                      ESP_ERR_TIMEOUT if no fresh value was published in time
+ */
+esp_err_t ph_sampler_read(uint32_t max_age_ms, sensor_unit_t *ph, uint32_t *age_ms)
+{
+    ph_sampler_slot_t slot;
+    uint32_t age;
+
+    if (ph_sampler_task_handle == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    ph_sampler_load(&slot);
+
+    if (!ph_sampler_fresh(&slot, max_age_ms, &age))
+    {
+        TickType_t timeout = pdMS_TO_TICKS(CONFIG_PH_SAMPLER_TIMEOUT_MS);
+        TimeOut_t time_out;
+
+        // drop the notice of an earlier value, then ask for a new one
+        xSemaphoreTake(ph_sampler_published, 0);
+        xTaskNotifyGive(ph_sampler_task_handle);
+
+        vTaskSetTimeOutState(&time_out);
+
+        do
+        {
+            if (xTaskCheckForTimeOut(&time_out, &timeout) == pdTRUE || xSemaphoreTake(ph_sampler_published, timeout) != pdTRUE)
+                return ESP_ERR_TIMEOUT;
+
+            ph_sampler_load(&slot);
+
+            // a value sampled before a calibration is not accepted
+        } while (!ph_sampler_fresh(&slot, max_age_ms, &age));
+    }
+
+    *ph = slot.ph;
+
+    if (age_ms != NULL)
+        *age_ms = age;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sets the sampling period of the sampler task
+ *
+ * @details the task is woken up so the new period starts immediately
+ *
+ * @param period_ms the period in milliseconds
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_ARG if the period is out of range,
+ *                      ESP_ERR_INVALID_STATE if the sampler is not running
+ */
+esp_err_t ph_sampler_set_period(uint32_t period_ms)
+{
+    if (period_ms < PH_SAMPLER_PERIOD_MIN_MS || period_ms > PH_SAMPLER_PERIOD_MAX_MS)
+        return ESP_ERR_INVALID_ARG;
+
+    if (ph_sampler_task_handle == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    __atomic_store_n(&ph_sampler_period_ms, period_ms, __ATOMIC_RELAXED);
+
+    xTaskNotifyGive(ph_sampler_task_handle);
+
+    ESP_LOGI(TAG, "Sampling period set to %lu ms", period_ms);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Calibrates the sensor used by the sampler
+ *
+ * @details the cached value is stale after the calibration, the next read waits for a new sample
+ *
+ * @see ph_sensor_calibrate()
+ *
+ * @param calibration the calibration command
+ * @param control_ph sensor_unit_t value of the known pH
+ * @return esp_err_t ESP_ERR_INVALID_STATE if the sampler is not running, see ph_sensor_calibrate() otherwise
+ */
+esp_err_t ph_sampler_calibrate(ph_calibration_t calibration, sensor_unit_t control_ph)
+{
+    if (ph_sampler_task_handle == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(ph_sampler_sensor_mutex, portMAX_DELAY);
+
+    esp_err_t ret = ph_sensor_calibrate(ph_sampler_sensor, calibration, control_ph);
+
+    // the points may have changed even if they could not be stored
+    if (ret != ESP_ERR_INVALID_ARG && ret != ESP_ERR_NO_MEM)
+        __atomic_add_fetch(&ph_sampler_calibration, 1, __ATOMIC_RELEASE);
+
+    xSemaphoreGive(ph_sampler_sensor_mutex);
+
+    return ret;
+}
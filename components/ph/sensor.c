@@ -1,31 +1,253 @@
 /// @file
 #include "sensor.h"
 
+#include <string.h>
+#include <stddef.h>
+
 #include <esp_log.h>
 #include <esp_check.h>
-#include <esp_adc/adc_oneshot.h>
+#include <esp_attr.h>
+#include <esp_idf_version.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 
+#include <freertos/FreeRTOS.h>
+
+#include "filter.h"
+
 #define PH_SENSOR_NVS_STORAGE_NAME "storage"
 #define PH_SENSOR_NVS_V_LOW_NAME "voltage_low"
 #define PH_SENSOR_NVS_V_HIGH_NAME "voltage_high"
 #define PH_SENSOR_NVS_PH_LOW_NAME "ph_low"
 #define PH_SENSOR_NVS_PH_HIGH_NAME "ph_high"
+#define PH_SENSOR_NVS_CALIBRATION_NAME "ph_calibration"
+
+/// @brief Highest pH in mpH
+#define PH_SENSOR_PH_MAX 14000
 
 #define ADC_BIT_WIDTH ADC_BITWIDTH_12
 #define ADC_RESOLUTION ((1 << ADC_BIT_WIDTH) - 1)
-#define ADC_VOLTAGE_MV 3300
+/// @brief Nominal full scale of the ADC at ADC_ATTENUATION, the range of the lookup table
+#define ADC_VOLTAGE_MV PH_SENSOR_TABLE_MAX_MV
+
+// the full range attenuation was renamed when its nominal attenuation was corrected
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+#define ADC_ATTENUATION ADC_ATTEN_DB_12
+#else
+#define ADC_ATTENUATION ADC_ATTEN_DB_11
+#endif
+
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_GET_CHANNEL(data) ((data)->type1.channel)
+#define ADC_GET_DATA(data) ((data)->type1.data)
+#else
+#define ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_GET_CHANNEL(data) ((data)->type2.channel)
+#define ADC_GET_DATA(data) ((data)->type2.data)
+#endif
+
+/// @brief Size of a conversion frame in bytes
+#define ADC_FRAME_SIZE (CONFIG_PH_ADC_FRAME_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
 
 static const char *TAG = "pH Sensor";
 
+/// @brief Layout of the calibration points in the NVS, only the used points are stored
+typedef struct
+{
+    uint32_t point_count;
+    ph_calibration_point_t points[CONFIG_PH_CALIBRATION_MAX_POINTS];
+} ph_sensor_calibration_blob_t;
+
+/// @brief Handle of the continuous ADC driver, created once by ph_sensor_init()
+static adc_continuous_handle_t ph_sensor_adc = NULL;
+
+/// @brief Handle of the ADC calibration scheme, NULL if the chip has no calibration data
+static adc_cali_handle_t ph_sensor_adc_cali = NULL;
+
+/// @brief Filter chain of the samples, fed by the conversion done callback
+static ph_filter_t ph_sensor_filter;
+
+/// @brief Protects the filter, it is fed from the ADC interrupt
+static portMUX_TYPE ph_sensor_filter_lock = portMUX_INITIALIZER_UNLOCKED;
+
 /**
- * @brief Loads the sensor configuration data from the non-volatile storage (NVS)
+ * @brief Conversion done callback of the continuous ADC driver, called from the ADC interrupt
  *
- * @param sensor ph_sensor_t handle to load the data into
+ * @details the samples of the pH channel in the frame are fed into the filter chain, see ph_filter_push()
+ *
+ * @param handle the ADC driver handle
+ * @param edata the finished conversion frame
+ * @param user_data not used
+ * @return false, no task needs to be woken up
+ */
+static bool IRAM_ATTR ph_sensor_conversion_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    taskENTER_CRITICAL_ISR(&ph_sensor_filter_lock);
+
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= edata->size; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        adc_digi_output_data_t *data = (adc_digi_output_data_t *)&edata->conv_frame_buffer[i];
+
+        if (ADC_GET_CHANNEL(data) == CONFIG_PH_ADC_CHANNEL)
+            ph_filter_push(&ph_sensor_filter, ADC_GET_DATA(data));
+    }
+
+    taskEXIT_CRITICAL_ISR(&ph_sensor_filter_lock);
+
+    return false;
+}
+
+/**
+ * @brief Creates the ADC calibration scheme supported by the chip
+ *
+ * @details curve fitting is preferred, line fitting is used on chips without curve fitting (ESP32)
+ *
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_NOT_SUPPORTED if the chip has no calibration scheme or data
+ */
+static esp_err_t ph_sensor_adc_calibration_init()
+{
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTENUATION,
+        .bitwidth = ADC_BIT_WIDTH,
+    };
+
+    return adc_cali_create_scheme_curve_fitting(&config, &ph_sensor_adc_cali);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_line_fitting_config_t config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTENUATION,
+        .bitwidth = ADC_BIT_WIDTH,
+    };
+
+    return adc_cali_create_scheme_line_fitting(&config, &ph_sensor_adc_cali);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Starts continuous sampling of the pH channel
+ *
+ * @details the driver converts CONFIG_PH_ADC_SAMPLE_FREQ_HZ samples per second via DMA,
+ *  every frame of CONFIG_PH_ADC_FRAME_SAMPLES samples is filtered by ph_sensor_conversion_done()
+ *
+ * @return esp_err_t ESP_OK if successful, error code of the ADC driver otherwise
+ */
+static esp_err_t ph_sensor_adc_init()
+{
+    int ret;
+
+    if (ph_sensor_adc != NULL)
+        return ESP_OK;
+
+    ph_filter_init(&ph_sensor_filter);
+
+    // the frames are consumed in the callback, the pool of the driver only needs to hold one
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC_FRAME_SIZE,
+        .conv_frame_size = ADC_FRAME_SIZE,
+    };
+
+    ESP_RETURN_ON_ERROR(
+        adc_continuous_new_handle(&handle_config, &ph_sensor_adc),
+        TAG,
+        "Error while initializing ADC");
+
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_ATTENUATION,
+        .channel = CONFIG_PH_ADC_CHANNEL,
+        .unit = ADC_UNIT_1,
+        .bit_width = ADC_BIT_WIDTH,
+    };
+
+    adc_continuous_config_t config = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = CONFIG_PH_ADC_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_OUTPUT_TYPE,
+    };
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = ph_sensor_conversion_done,
+    };
+
+    ESP_GOTO_ON_ERROR(adc_continuous_config(ph_sensor_adc, &config), error, TAG, "Error while configuring ADC channel");
+    ESP_GOTO_ON_ERROR(adc_continuous_register_event_callbacks(ph_sensor_adc, &callbacks, NULL), error, TAG, "Error while registering ADC callback");
+
+    ret = ph_sensor_adc_calibration_init();
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "ADC calibration not available (%s), using the nominal conversion", esp_err_to_name(ret));
+        ph_sensor_adc_cali = NULL;
+    }
+
+    ESP_GOTO_ON_ERROR(adc_continuous_start(ph_sensor_adc), error, TAG, "Error while starting ADC");
+
+    return ESP_OK;
+
+error:
+    adc_continuous_deinit(ph_sensor_adc);
+    ph_sensor_adc = NULL;
+
+    return ret;
+}
+
+/**
+ * @brief Sorts the calibration points by voltage and checks that they describe an electrode
+ *
+ * @details the voltages have to differ and the pH has to be strictly monotonic in the voltage,
+ *  rising or falling depending on the front end, so every buffer is a distinct pH
+ *
+ * @param sensor the sensor to sort the points of
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if two points have the same voltage or pH,
+ *  or the pH does not follow the voltage in one direction
+ */
+static esp_err_t ph_sensor_sort_points(ph_sensor_t *sensor)
+{
+    ph_calibration_point_t *points = sensor->points;
+
+    for (uint8_t i = 1; i < sensor->point_count; i++)
+    {
+        ph_calibration_point_t point = points[i];
+        uint8_t j = i;
+
+        while (j > 0 && points[j - 1].voltage > point.voltage)
+        {
+            points[j] = points[j - 1];
+            j--;
+        }
+
+        points[j] = point;
+    }
+
+    for (uint8_t i = 1; i < sensor->point_count; i++)
+    {
+        if (points[i].voltage == points[i - 1].voltage || points[i].ph == points[i - 1].ph)
+            return ESP_ERR_INVALID_ARG;
+
+        // the direction is set by the first two points
+        if (i > 1 && (points[i].ph > points[i - 1].ph) != (points[1].ph > points[0].ph))
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Loads the calibration points stored by firmware versions before the calibration blob
+ *
+ * @param sensor ph_sensor_t handle to load the points into
  * @return esp_err_t ESP_OK if successful, error code if there was an NVS flash error
  */
-esp_err_t ph_sensor_load_from_nvs(ph_sensor_t *sensor)
+static esp_err_t ph_sensor_load_legacy_from_nvs(ph_sensor_t *sensor)
 {
     nvs_handle_t nvs_handle;
     int ret;
@@ -39,26 +261,28 @@ esp_err_t ph_sensor_load_from_nvs(ph_sensor_t *sensor)
     ret = ESP_OK;
 
     ESP_GOTO_ON_ERROR(
-        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_V_LOW_NAME, &sensor->voltage_low),
+        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_V_LOW_NAME, &sensor->points[0].voltage),
         cleanup,
         TAG,
         "Unable to get value: " PH_SENSOR_NVS_V_LOW_NAME);
     ESP_GOTO_ON_ERROR(
-        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_V_HIGH_NAME, &sensor->voltage_high),
+        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_V_HIGH_NAME, &sensor->points[1].voltage),
         cleanup,
         TAG,
         "Unable to get value: " PH_SENSOR_NVS_V_HIGH_NAME);
     ESP_GOTO_ON_ERROR(
-        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_PH_LOW_NAME, &sensor->ph_low),
+        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_PH_LOW_NAME, &sensor->points[0].ph),
         cleanup,
         TAG,
         "Unable to get value: " PH_SENSOR_NVS_PH_LOW_NAME);
     ESP_GOTO_ON_ERROR(
-        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_PH_HIGH_NAME, &sensor->ph_high),
+        nvs_get_u32(nvs_handle, PH_SENSOR_NVS_PH_HIGH_NAME, &sensor->points[1].ph),
         cleanup,
         TAG,
         "Unable to get value: " PH_SENSOR_NVS_PH_HIGH_NAME);
 
+    sensor->point_count = 2;
+
 cleanup:
     nvs_close(nvs_handle);
 
@@ -66,7 +290,55 @@ cleanup:
 }
 
 /**
- * @brief Stores the sensor configuration in the non-volatile storage (NVS)
+ * @brief Loads the calibration points from the non-volatile storage (NVS)
+ *
+ * @details the points are stored as one blob of ph_sensor_calibration_blob_t,
+ *  only the used points are stored so the blob stays valid if CONFIG_PH_CALIBRATION_MAX_POINTS grows
+ *
+ * @param sensor ph_sensor_t handle to load the data into
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_NVS_NOT_FOUND if there is no stored calibration,
+ *                      ESP_ERR_INVALID_SIZE if the stored calibration is malformed,
+ *                      error code if there was an NVS flash error
+ */
+esp_err_t ph_sensor_load_from_nvs(ph_sensor_t *sensor)
+{
+    nvs_handle_t nvs_handle;
+    ph_sensor_calibration_blob_t blob;
+    size_t length = sizeof(ph_sensor_calibration_blob_t);
+    int ret;
+
+    ret = nvs_open(PH_SENSOR_NVS_STORAGE_NAME, NVS_READONLY, &nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ret = nvs_get_blob(nvs_handle, PH_SENSOR_NVS_CALIBRATION_NAME, &blob, &length);
+
+    nvs_close(nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    if (length < offsetof(ph_sensor_calibration_blob_t, points) ||
+        blob.point_count > CONFIG_PH_CALIBRATION_MAX_POINTS ||
+        length != offsetof(ph_sensor_calibration_blob_t, points) + blob.point_count * sizeof(ph_calibration_point_t))
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(sensor->points, blob.points, blob.point_count * sizeof(ph_calibration_point_t));
+    sensor->point_count = blob.point_count;
+
+    if (ph_sensor_sort_points(sensor) != ESP_OK)
+    {
+        sensor->point_count = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stores the calibration points in the non-volatile storage (NVS)
  *
  * @param sensor ph_sensor_t handle to load the data from
  * @return esp_err_t ESP_OK if successful, error code if there was an NVS flash error
@@ -74,48 +346,115 @@ cleanup:
 esp_err_t ph_sensor_store_in_nvs(ph_sensor_t *sensor)
 {
     nvs_handle_t nvs_handle;
+    ph_sensor_calibration_blob_t blob;
     int ret;
 
+    blob.point_count = sensor->point_count;
+    memcpy(blob.points, sensor->points, sensor->point_count * sizeof(ph_calibration_point_t));
+
     ret = nvs_open(PH_SENSOR_NVS_STORAGE_NAME, NVS_READWRITE, &nvs_handle);
 
     if (ret != ESP_OK)
         return ret;
 
-    ret = ESP_OK;
-
-    ESP_GOTO_ON_ERROR(
-        nvs_set_u32(nvs_handle, PH_SENSOR_NVS_V_LOW_NAME, sensor->voltage_low),
-        cleanup,
-        TAG,
-        "Unable to set value: " PH_SENSOR_NVS_V_LOW_NAME);
     ESP_GOTO_ON_ERROR(
-        nvs_set_u32(nvs_handle, PH_SENSOR_NVS_V_HIGH_NAME, sensor->voltage_high),
+        nvs_set_blob(
+            nvs_handle,
+            PH_SENSOR_NVS_CALIBRATION_NAME,
+            &blob,
+            offsetof(ph_sensor_calibration_blob_t, points) + blob.point_count * sizeof(ph_calibration_point_t)),
         cleanup,
         TAG,
-        "Unable to set value: " PH_SENSOR_NVS_V_HIGH_NAME);
-    ESP_GOTO_ON_ERROR(
-        nvs_set_u32(nvs_handle, PH_SENSOR_NVS_PH_LOW_NAME, sensor->ph_low),
-        cleanup,
-        TAG,
-        "Unable to set value: " PH_SENSOR_NVS_PH_LOW_NAME);
-    ESP_GOTO_ON_ERROR(
-        nvs_set_u32(nvs_handle, PH_SENSOR_NVS_PH_HIGH_NAME, sensor->ph_high),
-        cleanup,
-        TAG,
-        "Unable to set value: " PH_SENSOR_NVS_PH_HIGH_NAME);
+        "Unable to set value: " PH_SENSOR_NVS_CALIBRATION_NAME);
 
-cleanup:
-    if (ret == ESP_OK)
-        nvs_commit(nvs_handle);
+    ret = nvs_commit(nvs_handle);
 
+cleanup:
     nvs_close(nvs_handle);
 
     return ret;
 }
 
+/**
+ * @brief Calculates the pH of a voltage from the calibration points
+ *
+ * @details with CONFIG_PH_CALIBRATION_LEAST_SQUARES the points are fitted with a line,
+ *  otherwise the neighbouring points are interpolated and the outer segments are extrapolated.
+ *  Only used to build the lookup table, the measurements read the table
+ *
+ * @param sensor the sensor with at least 2 calibration points
+ * @param voltage the voltage in mV
+ * @return int64_t the pH in mpH
+ */
+static int64_t ph_sensor_calibration_evaluate(const ph_sensor_t *sensor, int64_t voltage)
+{
+    const ph_calibration_point_t *points = sensor->points;
+
+#ifdef CONFIG_PH_CALIBRATION_LEAST_SQUARES
+    int64_t n = sensor->point_count;
+    int64_t sum_v = 0, sum_p = 0, sum_vv = 0, sum_vp = 0;
+
+    for (uint8_t i = 0; i < sensor->point_count; i++)
+    {
+        sum_v += points[i].voltage;
+        sum_p += points[i].ph;
+        sum_vv += (int64_t)points[i].voltage * points[i].voltage;
+        sum_vp += (int64_t)points[i].voltage * points[i].ph;
+    }
+
+    // ph = (sum_p + slope * (n * v - sum_v)) / n, slope = numerator / denominator
+    int64_t numerator = n * sum_vp - sum_v * sum_p;
+    int64_t denominator = n * sum_vv - sum_v * sum_v;
+
+    return (sum_p * denominator + numerator * (n * voltage - sum_v)) / (n * denominator);
+#else
+    uint8_t segment = 0;
+
+    // the points are sorted by voltage, find the segment of the voltage or the outer segment
+    while (segment + 2 < sensor->point_count && voltage >= points[segment + 1].voltage)
+        segment++;
+
+    const ph_calibration_point_t *a = &points[segment];
+    const ph_calibration_point_t *b = &points[segment + 1];
+
+    return (int64_t)a->ph + ((int64_t)b->ph - a->ph) * (voltage - a->voltage) / ((int64_t)b->voltage - a->voltage);
+#endif
+}
+
+/**
+ * @brief Precomputes the mV to mpH lookup table from the calibration points
+ *
+ * @details the table has an entry every 2^CONFIG_PH_CALIBRATION_TABLE_SHIFT mV, clamped to 0 - 14 pH
+ *
+ * @param sensor the sensor to build the table of
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if there are less than 2 calibration points
+ */
+static esp_err_t ph_sensor_build_table(ph_sensor_t *sensor)
+{
+    if (sensor->point_count < 2)
+        return ESP_ERR_INVALID_STATE;
+
+    for (size_t i = 0; i < PH_SENSOR_TABLE_SIZE; i++)
+    {
+        int64_t ph = ph_sensor_calibration_evaluate(sensor, (int64_t)i << CONFIG_PH_CALIBRATION_TABLE_SHIFT);
+
+        if (ph < 0)
+            ph = 0;
+        else if (ph > PH_SENSOR_PH_MAX)
+            ph = PH_SENSOR_PH_MAX;
+
+        sensor->table[i] = ph;
+    }
+
+    return ESP_OK;
+}
+
 /**
  * @brief Initializes the pH sensor trying to load the configuration from the NVS flash
  *
+ * @details the continuous sampling of the sensor is started on the first call.
+ *  Calibrations stored by earlier firmware versions are migrated to the calibration blob
+ *
  * @param sensor ph_sensor_t handle to initialize
  * @return esp_err_t ESP_OK if successful
  */
@@ -124,26 +463,87 @@ esp_err_t ph_sensor_init(ph_sensor_t *sensor)
     int ret;
 
     sensor->ph_measurement = 0;
+    sensor->point_count = 0;
+
+    ESP_RETURN_ON_ERROR(ph_sensor_adc_init(), TAG, "Unable to start ADC sampling");
 
     // load the data (if any) from the NVS
     ret = ph_sensor_load_from_nvs(sensor);
 
+    if (ret == ESP_ERR_NVS_NOT_FOUND && ph_sensor_load_legacy_from_nvs(sensor) == ESP_OK && ph_sensor_sort_points(sensor) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Migrating the calibration data to the calibration blob");
+
+        ret = ph_sensor_store_in_nvs(sensor);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to store settings in NVS: %s", esp_err_to_name(ret));
+
+        ret = ESP_OK;
+    }
+
     if (ret == ESP_OK)
     {
         ESP_LOGI(TAG, "Calibration data loaded from NVS");
-        ESP_LOGI(TAG, "Low voltage: %lu, high voltage: %lu", sensor->voltage_low, sensor->voltage_high);
-        ESP_LOGI(TAG, "Low pH: %lu, high pH: %lu", sensor->ph_low, sensor->ph_high);
+
+        for (uint8_t i = 0; i < sensor->point_count; i++)
+            ESP_LOGI(TAG, "Calibration point %u: %lu mV, %lu mpH", i, sensor->points[i].voltage, sensor->points[i].ph);
+    }
+    else
+    {
+        if (ret != ESP_ERR_NVS_NOT_FOUND)
+            ESP_LOGW(TAG, "Unknown NVS error: (%d) %s", ret, esp_err_to_name(ret));
+
+        // both points in mpH and mV
+        sensor->points[0].ph = 1000;
+        sensor->points[0].voltage = 1000;
+
+        sensor->points[1].ph = 7000;
+        sensor->points[1].voltage = 5000;
+
+        sensor->point_count = 2;
+    }
+
+    if (ph_sensor_build_table(sensor) != ESP_OK)
+        ESP_LOGW(TAG, "The sensor needs at least 2 calibration points");
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Converts a raw ADC value to millivolts
+ *
+ * @details the calibration scheme only converts whole counts,
+ *  the fractional bits of the filtered value are interpolated between the neighbouring counts
+ *
+ * @param raw the raw ADC value in Q16
+ * @param millivolts pointer to store the voltage
+ * @return esp_err_t ESP_OK if successful, error code of the calibration scheme otherwise
+ */
+static esp_err_t ph_sensor_raw_to_voltage(int32_t raw, sensor_unit_t *millivolts)
+{
+    int32_t count = raw >> PH_FILTER_Q;
+    int32_t fraction = raw & ((1 << PH_FILTER_Q) - 1);
+
+    if (ph_sensor_adc_cali == NULL)
+    {
+        *millivolts = ((int64_t)raw * ADC_VOLTAGE_MV / ADC_RESOLUTION) >> PH_FILTER_Q;
         return ESP_OK;
     }
 
-    if (ret != ESP_ERR_NVS_NOT_FOUND)
-        ESP_LOGW(TAG, "Unknown NVS error: (%d) %s", ret, esp_err_to_name(ret));
+    int low, high;
 
-    sensor->ph_high = 7;
-    sensor->voltage_high = 5000;
+    ESP_RETURN_ON_ERROR(adc_cali_raw_to_voltage(ph_sensor_adc_cali, count, &low), TAG, "Error while converting analog value");
 
-    sensor->ph_low = 1;
-    sensor->voltage_low = 1000;
+    if (fraction == 0 || count >= ADC_RESOLUTION)
+    {
+        *millivolts = low;
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_ERROR(adc_cali_raw_to_voltage(ph_sensor_adc_cali, count + 1, &high), TAG, "Error while converting analog value");
+
+    *millivolts = low + (((int64_t)(high - low) * fraction + (1 << (PH_FILTER_Q - 1))) >> PH_FILTER_Q);
 
     return ESP_OK;
 }
@@ -151,72 +551,73 @@ esp_err_t ph_sensor_init(ph_sensor_t *sensor)
 /**
  * @brief Measures the voltage from the pH sensor board
  *
+ * @details the voltage is the output of the filter chain fed in the background,
+ *  converted to millivolts with the ADC calibration scheme
+ *
  * @param sensor ph_sensor_t handle to the configured sensor
- * @param voltage pointer to a sensor_unit_t variable to store the voltage value
- * @return esp_err_t ESP_OK if successful, error code otherwise
+ * @param voltage pointer to a sensor_unit_t variable to store the voltage value in mV
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the sampling is not running or no frame was sampled yet,
+ *                      error code of the calibration scheme otherwise
  */
 esp_err_t ph_sensor_measure_voltage(ph_sensor_t *sensor, sensor_unit_t *voltage)
 {
-    // configure adc
-    adc_oneshot_unit_handle_t adc_handle;
-    adc_oneshot_unit_init_cfg_t adc_init_config = {
-        .unit_id = ADC_UNIT_1,
-        .ulp_mode = ADC_ULP_MODE_DISABLE,
-    };
+    if (ph_sensor_adc == NULL)
+        return ESP_ERR_INVALID_STATE;
 
-    ESP_RETURN_ON_ERROR(
-        adc_oneshot_new_unit(&adc_init_config, &adc_handle),
-        TAG,
-        "Error while initializing ADC");
+    taskENTER_CRITICAL(&ph_sensor_filter_lock);
 
-    adc_oneshot_chan_cfg_t config = {
-        .bitwidth = ADC_BIT_WIDTH,
-        .atten = ADC_ATTEN_DB_0,
-    };
+    bool valid = ph_sensor_filter.output_valid;
+    int32_t raw = ph_sensor_filter.output;
 
-    ESP_RETURN_ON_ERROR(
-        adc_oneshot_config_channel(adc_handle, CONFIG_PH_ADC_CHANNEL, &config),
-        TAG,
-        "Error while configuring ADC channel");
+    taskEXIT_CRITICAL(&ph_sensor_filter_lock);
 
-    // read the value
-    int value;
-    ESP_RETURN_ON_ERROR(
-        adc_oneshot_read(adc_handle, CONFIG_PH_ADC_CHANNEL, &value),
-        TAG,
-        "Error while reading analog value");
+    if (!valid)
+        return ESP_ERR_INVALID_STATE;
 
-    // dispose of the adc
-    adc_oneshot_del_unit(adc_handle);
-
-    *voltage = (float)(value) / ADC_RESOLUTION * ADC_VOLTAGE_MV;
-
-    return ESP_OK;
+    return ph_sensor_raw_to_voltage(raw, voltage);
 }
 
 /**
  * @brief Measures the pH value provided by the sensor
  *
+ * @details the voltage is interpolated between two entries of the lookup table,
+ *  voltages above PH_SENSOR_TABLE_MAX_MV read the last entry
+ *
  * @param sensor pointer to the sensor struct
  * @param measurement pointer to the unit to store measurement, set to NULL if not needed
- * @return esp_err_t
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the sensor has less than 2 calibration points,
+ *                      error code, see ph_sensor_measure_voltage()
  */
 esp_err_t ph_sensor_make_measurement(ph_sensor_t *sensor, sensor_unit_t *measurement)
 {
     int ret;
     sensor_unit_t voltage;
 
-    ret = ph_sensor_measure_voltage(sensor, &voltage);
+    if (sensor->point_count < 2)
+        return ESP_ERR_INVALID_STATE;
 
-    ESP_LOGI(TAG, "Measured voltage: %lu", voltage);
+    ret = ph_sensor_measure_voltage(sensor, &voltage);
 
     if (ret != ESP_OK)
         return ret;
 
-    // convert the measurement to pH value
-    float slope = (float)(sensor->ph_high - sensor->ph_low) / (int32_t)(sensor->voltage_high - sensor->voltage_low);
+    ESP_LOGD(TAG, "Measured voltage: %lu", voltage);
+
+    uint32_t index = voltage >> CONFIG_PH_CALIBRATION_TABLE_SHIFT;
+    int32_t fraction = voltage & ((1 << CONFIG_PH_CALIBRATION_TABLE_SHIFT) - 1);
 
-    sensor->ph_measurement = slope * (int32_t)(voltage - sensor->voltage_low) + sensor->ph_low;
+    if (index >= PH_SENSOR_TABLE_SIZE - 1)
+    {
+        index = PH_SENSOR_TABLE_SIZE - 2;
+        fraction = 1 << CONFIG_PH_CALIBRATION_TABLE_SHIFT;
+    }
+
+    int32_t low = sensor->table[index];
+    int32_t high = sensor->table[index + 1];
+
+    sensor->ph_measurement = low + (((high - low) * fraction) >> CONFIG_PH_CALIBRATION_TABLE_SHIFT);
 
     if (measurement != NULL)
         *measurement = sensor->ph_measurement;
@@ -224,43 +625,111 @@ esp_err_t ph_sensor_make_measurement(ph_sensor_t *sensor, sensor_unit_t *measure
     return ESP_OK;
 }
 
+/**
+ * @brief Finds the calibration point a calibration command replaces
+ *
+ * @param sensor the sensor
+ * @param calibration the calibration command
+ * @param control_ph the pH of the buffer solution
+ * @return int the index of the point, the point count if a point is added
+ */
+static int ph_sensor_find_point(const ph_sensor_t *sensor, ph_calibration_t calibration, sensor_unit_t control_ph)
+{
+    int found = sensor->point_count;
+
+    // with less than 2 points the low and the high point are added
+    if (calibration != PH_CALIBRATION_POINT && sensor->point_count < 2)
+        calibration = PH_CALIBRATION_POINT;
+
+    for (int i = 0; i < sensor->point_count; i++)
+    {
+        const ph_calibration_point_t *point = &sensor->points[i];
+
+        if (calibration == PH_CALIBRATION_POINT && point->ph == control_ph)
+            return i;
+
+        if (calibration == PH_CALIBRATION_LOW && (found == sensor->point_count || point->ph < sensor->points[found].ph))
+            found = i;
+
+        if (calibration == PH_CALIBRATION_HIGH && (found == sensor->point_count || point->ph > sensor->points[found].ph))
+            found = i;
+    }
+
+    return found;
+}
+
 /**
  * @brief Calibrates the pH sensor
  *
- * @details the pH value is calculated by linear interpolation.
- *  Use this method to set the high or the low voltage corresponding to a known pH value
+ * @details the voltage measured in a buffer solution of known pH becomes a calibration point.
+ *  PH_CALIBRATION_LOW and PH_CALIBRATION_HIGH replace the point with the lowest or the highest pH,
+ *  PH_CALIBRATION_POINT adds a point or replaces the point of the same pH,
+ *  PH_CALIBRATION_CLEAR removes every point.
+ *  The lookup table is rebuilt and the points are stored in the NVS after every change
  *
  * @param sensor ph_sensor_t handle to the sensor
- * @param high_point true if calibrating high point, false if calibrating low point
- * @param control_ph sensor_unit_t value of the known pH
- * @return esp_err_t    ESP_ERR_INVALID_ARG if the pH value is outside of the range
+ * @param calibration the calibration command
+ * @param control_ph sensor_unit_t value of the known pH, ignored by PH_CALIBRATION_CLEAR
+ * @return esp_err_t    ESP_ERR_INVALID_ARG if the pH value is above 14 pH, the voltage or the pH equals the one of another point,
+ *                      or the pH of the points does not change monotonically with the voltage
+ *                      ESP_ERR_NO_MEM if there are CONFIG_PH_CALIBRATION_MAX_POINTS points already
  *                      ESP_OK if successful
  *                      error code, see ph_sensor_measure_voltage()
  */
-esp_err_t ph_sensor_calibrate(ph_sensor_t *sensor, bool high_point, sensor_unit_t control_ph)
+esp_err_t ph_sensor_calibrate(ph_sensor_t *sensor, ph_calibration_t calibration, sensor_unit_t control_ph)
 {
-    if (control_ph < 1000 || control_ph > 7000)
+    int ret;
+
+    if (calibration == PH_CALIBRATION_CLEAR)
+    {
+        sensor->point_count = 0;
+
+        ESP_LOGI(TAG, "Calibration points cleared");
+
+        return ph_sensor_store_in_nvs(sensor);
+    }
+
+    if (control_ph > PH_SENSOR_PH_MAX)
         return ESP_ERR_INVALID_ARG;
 
+    int index = ph_sensor_find_point(sensor, calibration, control_ph);
+
+    if (index == CONFIG_PH_CALIBRATION_MAX_POINTS)
+        return ESP_ERR_NO_MEM;
+
     sensor_unit_t voltage;
 
-    int ret = ph_sensor_measure_voltage(sensor, &voltage);
+    ret = ph_sensor_measure_voltage(sensor, &voltage);
 
     if (ret != ESP_OK)
         return ret;
 
-    if (high_point)
-    {
-        sensor->ph_high = control_ph;
-        sensor->voltage_high = voltage;
-    }
-    else
+    // keep the points to restore them if the new one is rejected
+    ph_calibration_point_t points[CONFIG_PH_CALIBRATION_MAX_POINTS];
+    uint8_t point_count = sensor->point_count;
+
+    memcpy(points, sensor->points, sizeof(points));
+
+    sensor->points[index].voltage = voltage;
+    sensor->points[index].ph = control_ph;
+
+    if (index == sensor->point_count)
+        sensor->point_count++;
+
+    if (ph_sensor_sort_points(sensor) != ESP_OK)
     {
-        sensor->ph_low = control_ph;
-        sensor->voltage_low = voltage;
+        memcpy(sensor->points, points, sizeof(points));
+        sensor->point_count = point_count;
+
+        ESP_LOGW(TAG, "Calibration point %lu mV, pH %lu conflicts with the other points", voltage, control_ph);
+
+        return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_LOGI(TAG, "%s point voltage set to: %lu, control pH is %lu", high_point ? "High" : "Low", voltage, control_ph);
+    ESP_LOGI(TAG, "Calibration point set to: %lu mV, control pH is %lu, %u points", voltage, control_ph, sensor->point_count);
+
+    if (ph_sensor_build_table(sensor) != ESP_OK)
+        ESP_LOGI(TAG, "The sensor needs at least 2 calibration points");
 
     ret = ph_sensor_store_in_nvs(sensor);
 
@@ -268,4 +737,4 @@ esp_err_t ph_sensor_calibrate(ph_sensor_t *sensor, bool high_point, sensor_unit_
         ESP_LOGI(TAG, "Unable to store settings in NVS: %s", esp_err_to_name(ret));
 
     return ret;
-}
\ No newline at end of file
+}
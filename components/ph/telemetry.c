@@ -0,0 +1,91 @@
+/// @file
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "task_intercom.h"
+
+static const char *TAG = "pH Telemetry";
+
+/// @brief The last value handed to the FIWARE task
+static sensor_unit_t ph_telemetry_last_ph = 0;
+
+/// @brief Time the last value was handed to the FIWARE task
+static int64_t ph_telemetry_last_at_us = 0;
+
+static bool ph_telemetry_published = false;
+
+/**
+ * @brief Checks if a value is due according to CONFIG_PH_TELEMETRY_PERIOD_MS and CONFIG_PH_TELEMETRY_DELTA
+ *
+ * @param ph the new value
+ * @param now_us the current time
+ * @return true if the value has to be published
+ */
+static bool ph_telemetry_is_due(sensor_unit_t ph, int64_t now_us)
+{
+    if (!ph_telemetry_published)
+        return true;
+
+    if (CONFIG_PH_TELEMETRY_PERIOD_MS > 0 && now_us - ph_telemetry_last_at_us >= (int64_t)CONFIG_PH_TELEMETRY_PERIOD_MS * 1000)
+        return true;
+
+    sensor_unit_t change = ph > ph_telemetry_last_ph ? ph - ph_telemetry_last_ph : ph_telemetry_last_ph - ph;
+
+    return CONFIG_PH_TELEMETRY_DELTA > 0 && change >= CONFIG_PH_TELEMETRY_DELTA;
+}
+
+/**
+ * @brief Publishes a pH value as the CONFIG_PH_TELEMETRY_ATTRIBUTE attribute to FIWARE
+ *
+ * @details the value is put into the FIWARE measurement queue like a measurement of the controller,
+ *  so it passes the measurement filter and the rate limit too.
+ *  It is published if CONFIG_PH_TELEMETRY_PERIOD_MS passed since the last value
+ *  or the pH changed by at least CONFIG_PH_TELEMETRY_DELTA.
+ *  The value is dropped if the queue is full, the controller measurements are not held up
+ *
+ * @param ph the pH value in mpH
+ */
+void ph_telemetry_publish(sensor_unit_t ph)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (!ph_telemetry_is_due(ph, now_us))
+        return;
+
+    itc_message_t *message = task_intercom_message_create();
+
+    if (message == NULL)
+        return;
+
+    task_intercom_message_init(message);
+
+    if (asprintf(&message->payload, "%s|%lu", CONFIG_PH_TELEMETRY_ATTRIBUTE, ph) < 0)
+    {
+        message->payload = NULL;
+        task_intercom_message_delete(message);
+        return;
+    }
+
+    message->is_measurement = true;
+    message->no_reply = true;
+
+    // the FIWARE task may delete the message as soon as it is queued
+    task_intercom_publish_event(ITC_EVENT_MEASUREMENT, "%s", message->payload);
+
+    if (task_intercom_send(task_intercom_fiware_measurement_queue, message, 0) != pdTRUE)
+    {
+        ESP_LOGD(TAG, "Measurement queue full, dropping pH %lu", ph);
+        task_intercom_message_delete(message);
+        return;
+    }
+
+    ph_telemetry_last_ph = ph;
+    ph_telemetry_last_at_us = now_us;
+    ph_telemetry_published = true;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+esp_err_t telemetry_start(httpd_handle_t server);
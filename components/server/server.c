@@ -1,6 +1,8 @@
 /// @file
 #include "server.h"
 
+#include <string.h>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
@@ -8,105 +10,207 @@
 #include <esp_http_server.h>
 
 #include "iot_agent.h"
+#include "metrics.h"
 #include "task_intercom.h"
+#ifdef CONFIG_SERVER_TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
 
 #define RESPONSE_BUFFER_LENGTH 2 * (15 + APP_STATE_LENGTH) + 1
 
+/// @brief Size of the scratch buffer of a command response: the command header, '|' and the status
+#define SERVER_COMMAND_RESPONSE_LENGTH (TASK_INTERCOM_POOLED_PAYLOAD_SIZE + 16)
+
+/// @brief Number of socket timeouts tolerated while receiving a request body
+#define SERVER_RECEIVE_RETRIES 3
+
 static const char *TAG = "Server";
 
+/// @brief Buffer the status pages are rendered into
+/// @details the http server runs the handlers in a single task, so one buffer serves every request
+static char server_metrics_buffer[CONFIG_METRICS_BUFFER_SIZE];
+
+/**
+ * @brief Handles GET requests of the status page, reports the runtime metrics in JSON format
+ *
+ * @param request the incoming request
+ * @return esp_err_t
+ */
 esp_err_t get_handler(httpd_req_t *request)
 {
-    httpd_resp_send(request, "WIP", HTTPD_RESP_USE_STRLEN);
+    size_t length;
+
+    if (metrics_render_json(server_metrics_buffer, sizeof(server_metrics_buffer), &length) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Status page does not fit into CONFIG_METRICS_BUFFER_SIZE");
+        httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(request, "application/json");
+    httpd_resp_send(request, server_metrics_buffer, length);
 
     return ESP_OK;
 }
 
 /**
- * @brief Handles incoming POST requests from the FIWARE IoT Agent
+ * @brief Handles GET requests of the metrics page, reports the runtime metrics in Prometheus text format
  *
  * @param request the incoming request
  * @return esp_err_t
  */
-esp_err_t api_post_handler(httpd_req_t *request)
+esp_err_t metrics_get_handler(httpd_req_t *request)
 {
-    // allocate the payload buffer
-    size_t payload_buffer_size = request->content_len + 1;
-    char *payload = (char *)calloc(sizeof(char), payload_buffer_size);
+    size_t length;
 
-    // check if the allocation was successful
-    if (payload == NULL)
+    if (metrics_render_prometheus(server_metrics_buffer, sizeof(server_metrics_buffer), &length) != ESP_OK)
     {
-        ESP_LOGI(TAG, "Incoming POST payload too large: %d", request->content_len);
-        // send back an error message
-        httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "Payload too large");
-        return ESP_FAIL;
+        ESP_LOGW(TAG, "Metrics page does not fit into CONFIG_METRICS_BUFFER_SIZE");
+        httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Metrics too long");
+        return ESP_OK;
     }
 
-    // receive the data
-    int ret = httpd_req_recv(request, payload, request->content_len);
+    httpd_resp_set_type(request, "text/plain; version=0.0.4");
+    httpd_resp_send(request, server_metrics_buffer, length);
 
-    if (ret <= 0)
+    return ESP_OK;
+}
+
+/**
+ * @brief Sends the response to an IoT Agent command formatted by fiware_iota_command_format_response()
+ *
+ * @param request the incoming request
+ * @param format_result the return value of fiware_iota_command_format_response()
+ * @param response the formatted response
+ */
+static void api_send_command_response(httpd_req_t *request, esp_err_t format_result, const char *response)
+{
+    if (format_result != ESP_OK)
     {
-        // check if a timeout has occurred
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Response too long");
+        return;
+    }
+
+    httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
+}
+
+/**
+ * @brief Receives the body of a request, the body can arrive in multiple parts
+ *
+ * @details socket timeouts are retried SERVER_RECEIVE_RETRIES times, then answered with 408
+ *
+ * @param request the incoming request, its content_len was checked against the size of the buffer
+ * @param buffer the buffer to receive into, the body is NUL terminated
+ * @return esp_err_t ESP_OK if the whole body was received, ESP_FAIL otherwise
+ */
+static esp_err_t api_receive_body(httpd_req_t *request, char *buffer)
+{
+    size_t received = 0;
+    int retries = 0;
+
+    while (received < request->content_len)
+    {
+        int ret = httpd_req_recv(request, buffer + received, request->content_len - received);
+
+        // retry a few times if the socket timed out
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries < SERVER_RECEIVE_RETRIES)
+            continue;
+
+        if (ret <= 0)
         {
-            // send back a 408 reuqest timeout
-            httpd_resp_send_408(request);
+            // check if a timeout has occurred
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                // send back a 408 reuqest timeout
+                httpd_resp_send_408(request);
+            }
+
+            return ESP_FAIL;
         }
 
-        free(payload);
-
-        return ESP_FAIL;
+        received += ret;
     }
 
-    ESP_LOGI(TAG, "Got command: %s", payload);
+    buffer[received] = '\0';
 
-    // allocate a new message
-    itc_message_t *message = task_intercom_message_create();
-    // initialize the message
-    task_intercom_message_init(message);
+    return ESP_OK;
+}
 
-    // set the payload to the message
-    message->payload = strdup(payload);
+/**
+ * @brief Handles incoming POST requests from the FIWARE IoT Agent
+ *
+ * @details the body is received directly into the payload buffer of a pooled ITC message
+ *  and the response is formatted into a scratch buffer on the stack,
+ *  so a request does not need heap allocations.
+ *  Bodies larger than CONFIG_ITC_IOTA_COMMAND_MESSAGE_SIZE are rejected.
+ *  If the message pool is exhausted or the command queue is full the command is answered
+ *  with <device_id>@<command>|BUSY, the same way in both cases.
+ *
+ * @param request the incoming request
+ * @return esp_err_t
+ */
+esp_err_t api_post_handler(httpd_req_t *request)
+{
+    char response[SERVER_COMMAND_RESPONSE_LENGTH];
+
+    // the size comes from the client, check it before receiving anything
+    if (request->content_len >= TASK_INTERCOM_POOLED_PAYLOAD_SIZE)
+    {
+        ESP_LOGI(TAG, "Incoming POST payload too large: %d", request->content_len);
+        // send back an error message
+        httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "Payload too large");
+        return ESP_FAIL;
+    }
 
-    char *response = NULL;
+    // take a message with a preallocated payload buffer
+    itc_message_t *message = task_intercom_message_create_pooled();
 
-    if (message->payload == NULL)
+    if (message == NULL)
     {
-        fiware_iota_command_make_response(payload, "NO MEM", &response);
-        httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
+        ESP_LOGW(TAG, "Message pool exhausted");
 
-        // message could not be added to the queue, free the resource
-        task_intercom_message_delete(message);
+        // the command header is needed for the response, receive the body into the scratch buffer
+        if (api_receive_body(request, response) != ESP_OK)
+            return ESP_FAIL;
 
-        // free the allocated resources
-        free(payload);
+        // the scratch buffer has room for the status after the longest body, replace the parameters in place
+        strcpy(response + strcspn(response, "|"), "|BUSY");
+
+        api_send_command_response(request, ESP_OK, response);
         return ESP_OK;
     }
 
-    // send the command to the fiware task
-    ret = xQueueSend(task_intercom_fiware_command_queue, &message, 0);
+    if (api_receive_body(request, message->payload) != ESP_OK)
+    {
+        task_intercom_message_delete(message);
+        return ESP_FAIL;
+    }
 
-    if (ret == pdTRUE)
+    ESP_LOGI(TAG, "Got command: %s", message->payload);
+
+    task_intercom_publish_event(ITC_EVENT_COMMAND, "%s", message->payload);
+
+    // the message belongs to the FIWARE task once it is in the queue, format the response before sending it
+    esp_err_t ret = fiware_iota_command_format_response(
+        message->payload,
+        CONFIG_IOT_AGENT_COMMAND_INIT_RESPONSE,
+        response,
+        sizeof(response));
+
+    // send the command to the fiware task
+    if (task_intercom_send(task_intercom_fiware_command_queue, message, 0) == pdTRUE)
     {
         // command appended to queue, send back default success message
-        fiware_iota_command_make_response(payload, CONFIG_IOT_AGENT_COMMAND_INIT_RESPONSE, &response);
-        httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
+        api_send_command_response(request, ret, response);
+        return ESP_OK;
     }
-    else
-    {
-        // command queue full, send back BUSY
-        fiware_iota_command_make_response(payload, "BUSY", &response);
-        httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
 
-        // message could not be added to the queue, free the resource
-        task_intercom_message_delete(message);
-    }
+    // command queue full, send back BUSY
+    ret = fiware_iota_command_format_response(message->payload, "BUSY", response, sizeof(response));
+    api_send_command_response(request, ret, response);
 
-    // free the allocated resources
-    free(payload);
-    if (response != NULL)
-        free(response);
+    // message could not be added to the queue, return it to the pool
+    task_intercom_message_delete(message);
 
     return ESP_OK;
 }
@@ -118,6 +222,13 @@ httpd_uri_t uri_get = {
     .user_ctx = NULL,
 };
 
+httpd_uri_t uri_metrics_get = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_get_handler,
+    .user_ctx = NULL,
+};
+
 httpd_uri_t uri_api_post = {
     .uri = CONFIG_IOT_DEVICE_ENDPOINT,
     .method = HTTP_POST,
@@ -143,7 +254,15 @@ httpd_handle_t start_http_server()
     {
         // register handlers
         httpd_register_uri_handler(server, &uri_get);
+        httpd_register_uri_handler(server, &uri_metrics_get);
         httpd_register_uri_handler(server, &uri_api_post);
+
+#ifdef CONFIG_SERVER_TELEMETRY_ENABLE
+        esp_err_t ret = telemetry_start(server);
+
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "Unable to start telemetry stream: %s", esp_err_to_name(ret));
+#endif
         ESP_LOGI(TAG, "HTTP server started successfully");
     }
     else
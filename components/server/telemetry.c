@@ -0,0 +1,355 @@
+/// @file
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_check.h>
+
+#include "task_intercom.h"
+
+#define MIN(a, b) ((a) < (b)) ? (a) : (b)
+
+/// @brief Size of a frame sent to the clients: "<sequence> <type> <text>"
+#define TELEMETRY_FRAME_SIZE (TASK_INTERCOM_EVENT_TEXT_SIZE + 16)
+
+/// @brief Period of the client check when no events are published
+#define TELEMETRY_IDLE_PERIOD_MS 1000
+
+/// @brief Size of the buffer incoming client frames are read into, larger frames close the connection
+#define TELEMETRY_RECEIVE_BUFFER_SIZE 32
+
+static const char *TAG = "Telemetry";
+
+/// @brief Event waiting in the ring of a client
+typedef struct
+{
+    uint32_t sequence;
+    itc_event_type_t type;
+    uint8_t length;
+    char text[TASK_INTERCOM_EVENT_TEXT_SIZE];
+} telemetry_event_t;
+
+/// @brief Connected client with its own bounded ring of events
+typedef struct
+{
+    /// @brief socket of the client, -1 if the slot is free
+    int fd;
+    /// @brief index of the next event to write, free running
+    uint32_t head;
+    /// @brief index of the next event to send, free running
+    uint32_t tail;
+    telemetry_event_t ring[CONFIG_SERVER_TELEMETRY_RING_SIZE];
+} telemetry_client_t;
+
+static telemetry_client_t telemetry_clients[CONFIG_SERVER_TELEMETRY_MAX_CLIENTS];
+
+/// @brief Protects the client slots and rings, held only while copying a single event
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Sequence number of the last published event, a gap on the client side means dropped events
+static uint32_t telemetry_sequence = 0;
+
+static httpd_handle_t telemetry_server = NULL;
+
+static TaskHandle_t telemetry_task_handle = NULL;
+
+/// @brief Set while a send is queued to the http server task
+static bool telemetry_send_queued = false;
+
+static const char telemetry_event_types[] = {
+    [ITC_EVENT_MEASUREMENT] = 'M',
+    [ITC_EVENT_COMMAND] = 'C',
+    [ITC_EVENT_RESPONSE] = 'R',
+    [ITC_EVENT_ERROR] = 'E',
+};
+
+/**
+ * @brief Appends a published event to the ring of every client
+ *
+ * @details runs in the publishing task. If the ring of a client is full the oldest event is dropped,
+ *  so a slow client never blocks the publisher.
+ *
+ * @param type the type of the event
+ * @param text the text of the event
+ * @param length the length of the text
+ */
+static void telemetry_event_sink(itc_event_type_t type, const char *text, size_t length)
+{
+    bool has_client = false;
+
+    taskENTER_CRITICAL(&telemetry_lock);
+
+    uint32_t sequence = ++telemetry_sequence;
+
+    for (int i = 0; i < CONFIG_SERVER_TELEMETRY_MAX_CLIENTS; i++)
+    {
+        telemetry_client_t *client = &telemetry_clients[i];
+
+        if (client->fd < 0)
+            continue;
+
+        // drop the oldest event of a slow client
+        if (client->head - client->tail == CONFIG_SERVER_TELEMETRY_RING_SIZE)
+            client->tail++;
+
+        telemetry_event_t *event = &client->ring[client->head % CONFIG_SERVER_TELEMETRY_RING_SIZE];
+        event->sequence = sequence;
+        event->type = type;
+        event->length = length;
+        memcpy(event->text, text, length);
+
+        client->head++;
+        has_client = true;
+    }
+
+    taskEXIT_CRITICAL(&telemetry_lock);
+
+    if (has_client)
+        xTaskNotifyGive(telemetry_task_handle);
+}
+
+/**
+ * @brief Frees the slot of a client
+ *
+ * @param fd socket of the client
+ */
+static void telemetry_remove_client(int fd)
+{
+    taskENTER_CRITICAL(&telemetry_lock);
+
+    for (int i = 0; i < CONFIG_SERVER_TELEMETRY_MAX_CLIENTS; i++)
+    {
+        if (telemetry_clients[i].fd == fd)
+            telemetry_clients[i].fd = -1;
+    }
+
+    taskEXIT_CRITICAL(&telemetry_lock);
+}
+
+/**
+ * @brief Takes the next event of a client
+ *
+ * @param client pointer to the client
+ * @param fd socket the client had when the event was queued
+ * @param event pointer to store the event
+ * @return true if an event was taken
+ * @return false if the ring is empty or the client is gone
+ */
+static bool telemetry_take_event(telemetry_client_t *client, int fd, telemetry_event_t *event)
+{
+    bool taken = false;
+
+    taskENTER_CRITICAL(&telemetry_lock);
+
+    if (client->fd == fd && client->tail != client->head)
+    {
+        *event = client->ring[client->tail % CONFIG_SERVER_TELEMETRY_RING_SIZE];
+        client->tail++;
+        taken = true;
+    }
+
+    taskEXIT_CRITICAL(&telemetry_lock);
+
+    return taken;
+}
+
+/**
+ * @brief Sends the buffered events to the clients
+ *
+ * @details queued by the telemetry task and run by the http server task, which owns the sockets.
+ *  A socket can not be closed or reused between the client check and the send.
+ *  Clients whose socket was closed are removed.
+ *
+ * @param arg unused
+ */
+static void telemetry_send_events(void *arg)
+{
+    static char frame_buffer[TELEMETRY_FRAME_SIZE];
+    telemetry_event_t event;
+
+    // events published from now on need another run
+    __atomic_store_n(&telemetry_send_queued, false, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < CONFIG_SERVER_TELEMETRY_MAX_CLIENTS; i++)
+    {
+        telemetry_client_t *client = &telemetry_clients[i];
+        int fd = client->fd;
+
+        if (fd < 0)
+            continue;
+
+        if (httpd_ws_get_fd_info(telemetry_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+        {
+            ESP_LOGI(TAG, "Client disconnected (fd: %d)", fd);
+            telemetry_remove_client(fd);
+            continue;
+        }
+
+        while (telemetry_take_event(client, fd, &event))
+        {
+            int length = snprintf(
+                frame_buffer,
+                sizeof(frame_buffer),
+                "%" PRIu32 " %c %.*s",
+                event.sequence,
+                telemetry_event_types[event.type],
+                event.length,
+                event.text);
+
+            httpd_ws_frame_t frame = {
+                .final = true,
+                .fragmented = false,
+                .type = HTTPD_WS_TYPE_TEXT,
+                .payload = (uint8_t *)frame_buffer,
+                .len = MIN(length, (int)sizeof(frame_buffer) - 1),
+            };
+
+            if (httpd_ws_send_frame_async(telemetry_server, fd, &frame) != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Unable to send to client, removing it (fd: %d)", fd);
+                telemetry_remove_client(fd);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Hands the sending of the buffered events to the http server task
+ *
+ * @details the publishing tasks only notify this task, so neither the UART nor the FIWARE task
+ *  waits for the http server. At most one send is queued at a time.
+ *
+ * @param arg unused
+ */
+static void telemetry_task(void *arg)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TELEMETRY_IDLE_PERIOD_MS));
+
+        if (__atomic_exchange_n(&telemetry_send_queued, true, __ATOMIC_ACQ_REL))
+            continue;
+
+        if (httpd_queue_work(telemetry_server, telemetry_send_events, NULL) != ESP_OK)
+        {
+            ESP_LOGD(TAG, "Unable to queue the send, retrying with the next event");
+            __atomic_store_n(&telemetry_send_queued, false, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/**
+ * @brief Handles the /telemetry WebSocket endpoint
+ *
+ * @details the handshake registers the client. Frames sent by the client are read and discarded.
+ *
+ * @param request the incoming request
+ * @return esp_err_t ESP_OK if successful, ESP_FAIL to close the connection
+ */
+static esp_err_t telemetry_ws_handler(httpd_req_t *request)
+{
+    if (request->method == HTTP_GET)
+    {
+        int fd = httpd_req_to_sockfd(request);
+        telemetry_client_t *slot = NULL;
+
+        taskENTER_CRITICAL(&telemetry_lock);
+
+        for (int i = 0; i < CONFIG_SERVER_TELEMETRY_MAX_CLIENTS; i++)
+        {
+            // a reused socket number belongs to a new client, take over its stale slot
+            if (telemetry_clients[i].fd == fd)
+            {
+                slot = &telemetry_clients[i];
+                break;
+            }
+
+            if (slot == NULL && telemetry_clients[i].fd < 0)
+                slot = &telemetry_clients[i];
+        }
+
+        if (slot != NULL)
+        {
+            slot->fd = fd;
+            slot->head = 0;
+            slot->tail = 0;
+        }
+
+        taskEXIT_CRITICAL(&telemetry_lock);
+
+        if (slot == NULL)
+        {
+            ESP_LOGW(TAG, "Too many telemetry clients, closing fd %d", fd);
+            return ESP_FAIL;
+        }
+
+        ESP_LOGI(TAG, "Client connected (fd: %d)", fd);
+        return ESP_OK;
+    }
+
+    uint8_t buffer[TELEMETRY_RECEIVE_BUFFER_SIZE];
+    httpd_ws_frame_t frame = {.payload = buffer};
+
+    // read the frame length first
+    ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(request, &frame, 0), TAG, "Unable to receive frame length");
+
+    ESP_RETURN_ON_FALSE(frame.len <= sizeof(buffer), ESP_FAIL, TAG, "Client frame too long: %d", frame.len);
+
+    if (frame.len > 0)
+        ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(request, &frame, sizeof(buffer)), TAG, "Unable to receive frame");
+
+    return ESP_OK;
+}
+
+static const httpd_uri_t telemetry_uri = {
+    .uri = "/telemetry",
+    .method = HTTP_GET,
+    .handler = telemetry_ws_handler,
+    .user_ctx = NULL,
+    .is_websocket = true,
+};
+
+/**
+ * @brief Starts the telemetry stream on the http server
+ *
+ * @details registers the /telemetry WebSocket endpoint, starts the task queuing the sends
+ *  and subscribes to the ITC events
+ *
+ * @param server handle of the running http server
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the stream is already started,
+ *                      ESP_ERR_NO_MEM if the task could not be started,
+ *                      error code of httpd_register_uri_handler() otherwise
+ */
+esp_err_t telemetry_start(httpd_handle_t server)
+{
+    ESP_RETURN_ON_FALSE(telemetry_task_handle == NULL, ESP_ERR_INVALID_STATE, TAG, "Telemetry already started");
+
+    for (int i = 0; i < CONFIG_SERVER_TELEMETRY_MAX_CLIENTS; i++)
+        telemetry_clients[i].fd = -1;
+
+    telemetry_server = server;
+
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &telemetry_uri), TAG, "Unable to register telemetry endpoint");
+
+    int ret = xTaskCreate(
+        telemetry_task,
+        TAG,
+        CONFIG_SERVER_TELEMETRY_TASK_STACK_DEPTH,
+        NULL,
+        MIN(CONFIG_SERVER_TELEMETRY_TASK_PRIO, configMAX_PRIORITIES - 1),
+        &telemetry_task_handle);
+
+    ESP_RETURN_ON_FALSE(ret == pdPASS, ESP_ERR_NO_MEM, TAG, "Unable to start telemetry task");
+
+    task_intercom_set_event_sink(telemetry_event_sink);
+
+    return ESP_OK;
+}
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <esp_err.h>
-#include <esp_timer.h>
 
-/// @brief Stepper motor handle
+#include "stepper_motion.h"
+#include "stepper_planner.h"
+
+/// @brief Number of axes driven by the stepper task
+#define STEPPER_AXIS_COUNT CONFIG_STEPPER_AXIS_COUNT
+
+/// @brief Stepper motor handle, one axis
 typedef struct
 {
     /// @brief enable pin number
@@ -14,31 +20,69 @@ typedef struct
     uint8_t pin_step;
     /// @brief direction pin number
     uint8_t pin_dir;
-    /// @brief true if the motor is running, false otherwise
+} stepper_t;
+
+/// @brief Stepper motors driven by a single step clock, their moves start and finish together
+typedef struct
+{
+    /// @brief the axes
+    stepper_t axes[STEPPER_AXIS_COUNT];
+    /// @brief number of axes
+    uint8_t axis_count;
+    /// @brief true if the motors are running, false otherwise
+    /// @details cleared by the step generation backend when the motion finishes
     bool is_on;
-    /**
-     * @brief boolean flag to keep track of the output pin state
-     * @internal
-     */
-    bool step;
-    /// @brief current speed in steps per second
-    uint32_t speed;
-    /// @brief number of steps to take
+    /// @brief interval of the last step of the axis with the most steps in us, 0 at rest
+    /// @details written from the tick source, the speed is 1000000 / step_interval_us
+    uint32_t step_interval_us;
+    /// @brief number of steps the first axis takes when turned on, the sign sets the direction, 0 to run until turned off
     int32_t steps_to_make;
-    /// @brief steps remaining
-    int32_t steps_remaining;
-    /// @brief maximum allowed rotation speed in steps / second
+    /// @brief maximum allowed speed of the axis with the most steps in steps / second
     uint32_t max_speed;
-    /// @brief high precision hardware timer to control the motor
-    esp_timer_handle_t timer;
-} stepper_t;
+    /// @brief acceleration in steps / second^2, 0 to start at the maximum speed
+    uint32_t acceleration;
+    /// @brief jerk in steps / second^3, 0 for a trapezoidal speed profile
+    uint32_t jerk;
+    /// @brief the motion of the motors turned on without a step limit
+    stepper_motion_t motion;
+    /// @brief true if the first axis was turned on without a step limit
+    bool continuous;
+    /// @brief the queued moves
+    stepper_planner_t planner;
+    /// @brief position of each axis in steps, counted by the tick source as the steps are generated
+    int32_t positions[STEPPER_AXIS_COUNT];
+    /// @brief position of each axis at the end of the queued moves
+    int32_t targets[STEPPER_AXIS_COUNT];
+    /// @brief position of each axis at the home reference in steps, stored in NVS
+    int32_t home_offsets[STEPPER_AXIS_COUNT];
+    /// @brief level of the direction pins, bit mask of the axes moving forward
+    uint32_t directions;
+    /// @brief set to decelerate the running motion to rest, read by the tick source
+    bool stop_requested;
+} stepper_group_t;
+
+esp_err_t stepper_init_stepper(uint8_t step, uint8_t dir, uint8_t en, stepper_t *stepper);
+
+esp_err_t stepper_init_group(stepper_group_t *group, const stepper_t *axes, uint8_t axis_count);
+
+esp_err_t stepper_set_max_speed(stepper_group_t *group, uint32_t max_speed);
+
+esp_err_t stepper_set_acceleration(stepper_group_t *group, uint32_t acceleration, uint32_t jerk);
+
+esp_err_t stepper_set_steps(stepper_group_t *group, int32_t steps);
+
+esp_err_t stepper_turn_on(stepper_group_t *group, bool on);
+
+esp_err_t stepper_move(stepper_group_t *group, const int32_t *deltas);
+
+esp_err_t stepper_goto(stepper_group_t *group, const int32_t *positions);
 
-esp_err_t stepper_init_stepper(uint8_t step, uint8_t dir, uint8_t en, esp_timer_handle_t timer, stepper_t *stepper);
+esp_err_t stepper_run_queue(stepper_group_t *group);
 
-esp_err_t stepper_set_max_speed(stepper_t *stepper, uint32_t max_speed);
+esp_err_t stepper_get_positions(stepper_group_t *group, int32_t *positions);
 
-esp_err_t stepper_set_steps(stepper_t *stepper, int32_t steps);
+esp_err_t stepper_set_home_offsets(stepper_group_t *group, const int32_t *offsets);
 
-esp_err_t stepper_turn_on(stepper_t *stepper, bool on);
+esp_err_t stepper_home(stepper_group_t *group);
 
-esp_err_t stepper_start_task();
\ No newline at end of file
+esp_err_t stepper_start_task();
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+/// @brief Longest time between two steps in microseconds, longer intervals are clamped
+#define STEPPER_MAX_INTERVAL_US 1000000
+
+/// @brief Most axes a backend drives from one step clock
+#define STEPPER_MAX_AXES 4
+
+/// @brief One tick of the step clock
+typedef struct
+{
+    /// @brief time from the step pulses of this tick to the next tick in microseconds
+    uint32_t interval_us;
+    /// @brief bit mask of the axes that step on this tick
+    uint32_t axes;
+} stepper_tick_t;
+
+/// @brief Timing statistics of the step edges, measured by the backends that write the edges in software
+typedef struct
+{
+    /// @brief number of edge to edge intervals measured
+    uint32_t samples;
+    /// @brief largest difference between a measured and the programmed edge to edge interval in ns
+    uint32_t jitter_max_ns;
+    /// @brief mean difference between the measured and the programmed edge to edge intervals in ns
+    uint32_t jitter_mean_ns;
+    /// @brief longest time spent in the interrupt handling an edge in ns
+    uint32_t isr_max_ns;
+    /// @brief number of edges scheduled after their due time because the interrupt was late
+    uint32_t late_edges;
+} stepper_backend_stats_t;
+
+/**
+ * @brief Produces the ticks of a motion, called by the backend whenever it needs the next step
+ *
+ * @details the calling context depends on the backend, the source must not block
+ *
+ * @param context the context passed to stepper_backend_start()
+ * @param tick pointer to store the next tick
+ * @return true if a tick was produced, false if the motion is finished
+ */
+typedef bool (*stepper_tick_source_t)(void *context, stepper_tick_t *tick);
+
+/**
+ * @brief Called by the backend when the motion finished or was stopped
+ *
+ * @param context the context passed to stepper_backend_start()
+ */
+typedef void (*stepper_done_callback_t)(void *context);
+
+esp_err_t stepper_backend_init(const uint8_t *pins_step, size_t axis_count);
+
+esp_err_t stepper_backend_start(stepper_tick_source_t source, stepper_done_callback_t done, void *context);
+
+esp_err_t stepper_backend_stop();
+
+bool stepper_backend_is_running();
+
+uint32_t stepper_backend_queued_us();
+
+esp_err_t stepper_backend_get_stats(stepper_backend_stats_t *stats, bool reset);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stepper_backend.h"
+
+#ifdef ESP_PLATFORM
+#include <hal/rmt_types.h>
+
+/// @brief Two timed levels of the step pin, the RMT symbol layout
+typedef rmt_symbol_word_t stepper_symbol_t;
+#else
+/// @brief Two timed levels of the step pin, the RMT symbol layout
+typedef union
+{
+    struct
+    {
+        uint16_t duration0 : 15;
+        uint16_t level0 : 1;
+        uint16_t duration1 : 15;
+        uint16_t level1 : 1;
+    };
+    uint32_t val;
+} stepper_symbol_t;
+#endif
+
+/// @brief Longest duration of one level of a symbol in ticks of 1 us
+#define STEPPER_ENCODER_MAX_DURATION 32767
+
+/// @brief Most symbols a tick is encoded into, see stepper_encoder_encode_tick()
+#define STEPPER_ENCODER_MAX_SYMBOLS (2 + STEPPER_MAX_INTERVAL_US / (2 * STEPPER_ENCODER_MAX_DURATION))
+
+/// @brief State of the conversion of the ticks of a motion into symbols
+/// @details every axis has its own block of symbols, the blocks of the axes have the same timing
+typedef struct
+{
+    /// @brief width of the step pulse in us
+    uint32_t pulse_us;
+    /// @brief number of axes, the number of blocks filled at once
+    size_t axis_count;
+    /// @brief true once the source finished the motion
+    bool done;
+} stepper_encoder_t;
+
+void stepper_encoder_init(stepper_encoder_t *encoder, uint32_t pulse_us, size_t axis_count);
+
+uint32_t stepper_encoder_min_interval(const stepper_encoder_t *encoder);
+
+size_t stepper_encoder_encode_tick(const stepper_encoder_t *encoder, const stepper_tick_t *tick, stepper_symbol_t *const *blocks, size_t offset);
+
+size_t stepper_encoder_fill(stepper_encoder_t *encoder, stepper_tick_source_t source, void *context, stepper_symbol_t *const *blocks, size_t capacity);
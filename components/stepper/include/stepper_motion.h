@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stepper_backend.h"
+#include "stepper_ramp.h"
+
+/// @brief A linear move of the axes along a ramp, the tick source of the step generation backends
+/// @details the axis with the most steps (the major axis) steps on every tick and follows the ramp,
+///  the other axes are interpolated with Bresenham's algorithm so all axes start and finish together
+typedef struct
+{
+    /// @brief position on the ramp, the speed of the major axis
+    stepper_ramp_t ramp;
+    /// @brief ticks left, negative if the motion runs until stopped
+    int32_t steps_remaining;
+    /// @brief number of axes
+    uint32_t axis_count;
+    /// @brief steps of each axis
+    uint32_t deltas[STEPPER_MAX_AXES];
+    /// @brief steps of the major axis, the number of ticks of the move
+    uint32_t major;
+    /// @brief Bresenham error terms of the axes, in [0, major)
+    uint32_t errors[STEPPER_MAX_AXES];
+    /// @brief axes stepping on every tick of a motion that runs until stopped
+    uint32_t continuous_axes;
+    /// @brief ramp index the motion decelerates to by its last step, 0 to stop
+    uint32_t exit_index;
+} stepper_motion_t;
+
+void stepper_motion_chain(stepper_motion_t *motion, const uint32_t *deltas, uint32_t axis_count);
+
+void stepper_motion_start(stepper_motion_t *motion, const stepper_ramp_table_t *table, const uint32_t *deltas, uint32_t axis_count);
+
+void stepper_motion_start_continuous(stepper_motion_t *motion, const stepper_ramp_table_t *table, uint32_t axes);
+
+bool stepper_motion_next(void *context, stepper_tick_t *tick);
+
+void stepper_motion_stop(stepper_motion_t *motion);
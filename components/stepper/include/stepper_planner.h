@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+#include "stepper_backend.h"
+#include "stepper_motion.h"
+#include "stepper_ramp.h"
+
+/// @brief Number of segments the planner queue holds, including the one being executed
+#define STEPPER_PLANNER_LENGTH CONFIG_STEPPER_PLANNER_LENGTH
+
+/// @brief A linear move of the axes waiting in the planner queue
+typedef struct
+{
+    /// @brief steps of each axis
+    uint32_t deltas[STEPPER_MAX_AXES];
+    /// @brief steps of the axis with the most steps
+    uint32_t major;
+    /// @brief bit mask of the axes moving forward, the level of the direction pins
+    uint32_t directions;
+    /// @brief highest ramp index the segment may start with, limited by the change of the axis speeds at the junction
+    uint32_t junction_index;
+    /// @brief ramp index the segment decelerates to by its last step, the entry speed of the next segment
+    /// @details only raised by the planner while the segment is queued or executed, read by the tick source on every step
+    uint32_t exit_index;
+} stepper_segment_t;
+
+/// @brief Queue of segments executed back to back without stopping at the junctions
+/// @details single producer, single consumer: segments are pushed by the stepper task
+///  and taken by the tick source in the context of the step generation backend
+typedef struct
+{
+    /// @brief ring of the segments, the one at the tail is executed
+    stepper_segment_t segments[STEPPER_PLANNER_LENGTH];
+    /// @brief number of segments pushed, written by the producer
+    uint32_t head;
+    /// @brief number of segments finished, written by the consumer
+    uint32_t tail;
+    /// @brief number of axes
+    uint32_t axis_count;
+    /// @brief largest change of the speed of an axis at a junction in steps / second
+    uint32_t junction_speed;
+    /// @brief the ramp of the segments
+    const stepper_ramp_table_t *table;
+    /// @brief directions of the last pushed segment
+    uint32_t directions;
+    /// @brief directions the stream was started with, a segment with other directions ends the stream
+    uint32_t stream_directions;
+    /// @brief true if the segment at the tail is being executed
+    bool active;
+    /// @brief true if the stream decelerates to rest and ends, set by stepper_planner_stop()
+    bool stopping;
+    /// @brief the motion of the executed segment
+    stepper_motion_t motion;
+} stepper_planner_t;
+
+void stepper_planner_init(stepper_planner_t *planner, const stepper_ramp_table_t *table, uint32_t axis_count, uint32_t junction_speed);
+
+void stepper_planner_clear(stepper_planner_t *planner);
+
+uint32_t stepper_planner_queued(const stepper_planner_t *planner);
+
+uint32_t stepper_planner_free(const stepper_planner_t *planner);
+
+esp_err_t stepper_planner_push(stepper_planner_t *planner, const uint32_t *deltas, uint32_t directions);
+
+bool stepper_planner_begin(stepper_planner_t *planner, uint32_t *directions);
+
+bool stepper_planner_next(void *context, stepper_tick_t *tick);
+
+void stepper_planner_stop(stepper_planner_t *planner);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+/// @brief Number of intervals of the ramp table, limits the steps an acceleration from rest to cruise speed can take
+#define STEPPER_RAMP_TABLE_SIZE CONFIG_STEPPER_RAMP_TABLE_SIZE
+
+/// @brief Step intervals of an acceleration from rest to the cruise speed
+typedef struct
+{
+    /// @brief interval of the k-th step of the acceleration in us, the intervals are decreasing
+    uint32_t intervals[STEPPER_RAMP_TABLE_SIZE];
+    /// @brief number of intervals of the acceleration, 0 if there is no ramp
+    uint32_t length;
+    /// @brief interval at cruise speed in us
+    uint32_t cruise_interval;
+    /// @brief true if the table ran out before the requested speed was reached, the cruise speed is lowered
+    bool truncated;
+} stepper_ramp_table_t;
+
+/// @brief Position of a motion on the ramp
+typedef struct
+{
+    /// @brief the ramp of the motion
+    const stepper_ramp_table_t *table;
+    /// @brief number of acceleration steps taken and not taken back by deceleration, 0 at rest
+    uint32_t index;
+} stepper_ramp_t;
+
+esp_err_t stepper_ramp_build(stepper_ramp_table_t *table, uint32_t max_speed, uint32_t acceleration, uint32_t jerk);
+
+void stepper_ramp_start(stepper_ramp_t *ramp, const stepper_ramp_table_t *table);
+
+uint32_t stepper_ramp_next(stepper_ramp_t *ramp, int32_t steps_remaining);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Number of step pulses the simulation backend records
+#define STEPPER_SIM_MAX_PULSES (1 << 18)
+
+/// @brief The step pulses of a tick recorded by the simulation backend
+typedef struct
+{
+    /// @brief time of the rising edges in us since stepper_sim_reset()
+    uint64_t time_us;
+    /// @brief width of the pulses in us
+    uint32_t width_us;
+    /// @brief bit mask of the axes that stepped
+    uint32_t axes;
+} stepper_sim_pulse_t;
+
+void stepper_sim_reset();
+
+const stepper_sim_pulse_t *stepper_sim_pulses(size_t *count);
+
+uint64_t stepper_sim_time_us();
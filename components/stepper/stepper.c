@@ -1,10 +1,14 @@
 /// @file
 #include "stepper.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #include <esp_check.h>
+#include <esp_attr.h>
+#include <esp_rom_sys.h>
 #include <driver/gpio.h>
+#include <nvs.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
@@ -12,8 +16,13 @@
 
 #include "task_intercom.h"
 
+#include "stepper_backend.h"
+
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
 
+#define STEPPER_NVS_STORAGE_NAME "stepper"
+#define STEPPER_NVS_HOME_OFFSETS_NAME "home_offsets"
+
 static const char *TAG = "Stepper";
 
 static const char *KW_MOTOR = "MOTOR";
@@ -21,33 +30,184 @@ static const char *KW_ON = "ON";
 static const char *KW_OFF = "OFF";
 static const char *KW_SPEED = "SPEED";
 static const char *KW_STEP = "STEP";
+static const char *KW_ACCEL = "ACCEL";
+static const char *KW_JITTER = "JITTER";
+static const char *KW_RESET = "RESET";
+static const char *KW_MOVE = "MOVE";
+static const char *KW_QUEUE = "QUEUE";
+static const char *KW_GOTO = "GOTO";
+static const char *KW_POS = "POS";
+static const char *KW_HOME = "HOME";
+static const char *KW_OFFSET = "OFFSET";
 
 static TaskHandle_t stepper_task_handle = NULL;
 
+/// @brief Ramp of the motions, rebuilt whenever a motion starts from rest with an empty queue
+static stepper_ramp_table_t stepper_ramp_table;
+
+/// @brief Pins of the axes
+static const stepper_t stepper_axes[STEPPER_AXIS_COUNT] = {
+    {.pin_step = CONFIG_STEPPER_STEP_PIN, .pin_dir = CONFIG_STEPPER_DIR_PIN, .pin_en = CONFIG_STEPPER_EN_PIN},
+#if CONFIG_STEPPER_AXIS_COUNT >= 2
+    {.pin_step = CONFIG_STEPPER_AXIS_2_STEP_PIN, .pin_dir = CONFIG_STEPPER_AXIS_2_DIR_PIN, .pin_en = CONFIG_STEPPER_AXIS_2_EN_PIN},
+#endif
+#if CONFIG_STEPPER_AXIS_COUNT >= 3
+    {.pin_step = CONFIG_STEPPER_AXIS_3_STEP_PIN, .pin_dir = CONFIG_STEPPER_AXIS_3_DIR_PIN, .pin_en = CONFIG_STEPPER_AXIS_3_EN_PIN},
+#endif
+#if CONFIG_STEPPER_AXIS_COUNT >= 4
+    {.pin_step = CONFIG_STEPPER_AXIS_4_STEP_PIN, .pin_dir = CONFIG_STEPPER_AXIS_4_DIR_PIN, .pin_en = CONFIG_STEPPER_AXIS_4_EN_PIN},
+#endif
+};
+
 /**
- * @brief Callback function that gets called when a stepper motor step is due
+ * @brief Counts the steps of a tick into the positions of the axes
  *
- * @param param void* pointer to a stepper_t struct used to control the motor
+ * @param group the steppers
+ * @param tick the tick
  */
-void timer_callback(void *param)
+static void IRAM_ATTR stepper_count_tick(stepper_group_t *group, const stepper_tick_t *tick)
 {
-    stepper_t *stepper = (stepper_t *)param;
-
-    // check remaining steps
-    if (stepper->steps_remaining == 0)
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
     {
-        stepper_turn_on(stepper, false);
-        return;
+        if (((tick->axes >> axis) & 1) == 0)
+            continue;
+
+        int32_t step = (group->directions >> axis) & 1 ? 1 : -1;
+
+        __atomic_store_n(&group->positions[axis], group->positions[axis] + step, __ATOMIC_RELAXED);
     }
 
-    // flip the step flag
-    stepper->step = !stepper->step;
-    // set the gpio level according to the step flag
-    gpio_set_level(stepper->pin_step, stepper->step);
+    group->step_interval_us = tick->interval_us;
+}
+
+/**
+ * @brief Tick source of the motion of the steppers, called by the step generation backend
+ *
+ * @param context pointer to a stepper_group_t struct used to control the motors
+ * @param tick pointer to store the next tick
+ * @return true if a step is due, false if the steps ran out
+ */
+static bool IRAM_ATTR stepper_next_tick(void *context, stepper_tick_t *tick)
+{
+    stepper_group_t *group = (stepper_group_t *)context;
+
+    if (__atomic_load_n(&group->stop_requested, __ATOMIC_ACQUIRE))
+        stepper_motion_stop(&group->motion);
+
+    if (!stepper_motion_next(&group->motion, tick))
+        return false;
+
+    stepper_count_tick(group, tick);
+
+    return true;
+}
+
+/**
+ * @brief Tick source of the queued moves, called by the step generation backend
+ *
+ * @param context pointer to a stepper_group_t struct used to control the motors
+ * @param tick pointer to store the next tick
+ * @return true if a step is due, false if the queue ran out or the next move changes direction
+ */
+static bool IRAM_ATTR stepper_next_queued_tick(void *context, stepper_tick_t *tick)
+{
+    stepper_group_t *group = (stepper_group_t *)context;
+
+    if (__atomic_load_n(&group->stop_requested, __ATOMIC_ACQUIRE))
+        stepper_planner_stop(&group->planner);
+
+    if (!stepper_planner_next(&group->planner, tick))
+        return false;
+
+    stepper_count_tick(group, tick);
+
+    return true;
+}
+
+/**
+ * @brief Called by the step generation backend when the motion of the steppers finished
+ *
+ * @param context pointer to a stepper_group_t struct used to control the motors
+ */
+static void IRAM_ATTR stepper_motion_done(void *context)
+{
+    stepper_group_t *group = (stepper_group_t *)context;
+
+    __atomic_store_n(&group->is_on, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Estimates the highest step rate the measured edge timing allows
+ *
+ * @details the interrupt of the rising edge has to finish before the falling edge is due
+ *  and the interrupt of the falling edge before the next rising edge, both can be late by the jitter
+ *
+ * @param stats the timing statistics of the step generation backend
+ * @return uint32_t the step rate in steps / second
+ */
+static uint32_t stepper_max_clean_rate(const stepper_backend_stats_t *stats)
+{
+    uint32_t high_ns = CONFIG_STEPPER_PULSE_WIDTH_US * 1000;
+
+    if (stats->isr_max_ns > high_ns)
+        high_ns = stats->isr_max_ns;
 
-    // decrement the steps if step counter is not disabled (negative)
-    if (stepper->steps_remaining > 0)
-        stepper->steps_remaining--;
+    return 1000000000 / (high_ns + stats->isr_max_ns + stats->jitter_max_ns);
+}
+
+/**
+ * @brief Parses one value per axis from the tokens following the keyword of a message
+ *
+ * @param message the message
+ * @param values array of STEPPER_AXIS_COUNT values, the values of the missing axes are kept
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if there are no values or more values than axes
+ */
+static esp_err_t stepper_parse_axes(const itc_message_t *message, int32_t *values)
+{
+    if (message->token_num < 3 || message->token_num - 2 > STEPPER_AXIS_COUNT)
+        return ESP_ERR_INVALID_ARG;
+
+    for (uint8_t axis = 0; axis < message->token_num - 2; axis++)
+        values[axis] = atoi(message->tokens[axis + 2]);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Formats one value per axis as the response of a message
+ *
+ * @param message the message
+ * @param values the values
+ * @param count number of values
+ */
+static void stepper_respond_axes(itc_message_t *message, const int32_t *values, uint8_t count)
+{
+    // sign, 10 digits and a separator per axis
+    char response[STEPPER_AXIS_COUNT * 12];
+    size_t length = 0;
+
+    for (uint8_t axis = 0; axis < count; axis++)
+        length += snprintf(response + length, sizeof(response) - length, axis == 0 ? "%ld" : "|%ld", (long)values[axis]);
+
+    message->response = strdup(response);
+}
+
+/**
+ * @brief Sets the response of a queued move
+ *
+ * @param message the message
+ * @param ret the result of the move
+ * @param planner the planner the move was queued in
+ */
+static void stepper_respond_queued(itc_message_t *message, int ret, const stepper_planner_t *planner)
+{
+    if (ret == ESP_OK)
+        // free slots of the queue, the robot streams the next moves while there is room
+        asprintf(&message->response, "OK|%lu", stepper_planner_free(planner));
+    else if (ret == ESP_ERR_NO_MEM)
+        message->response_static = "QUEUE FULL";
+    else
+        message->response_static = esp_err_to_name(ret);
 }
 
 /**
@@ -56,33 +216,30 @@ void timer_callback(void *param)
  */
 void stepper_task()
 {
-    stepper_t stepper;
-    esp_timer_handle_t timer;
+    stepper_group_t stepper;
     int ret;
     itc_message_t *message = NULL;
 
-    // create the timer
-    esp_timer_create_args_t timer_args = {
-        .callback = timer_callback,
-        .name = "Stepper timer",
-        .arg = &stepper,
-    };
-
-    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
-
-    ESP_ERROR_CHECK(
-        stepper_init_stepper(
-            CONFIG_STEPPER_STEP_PIN,
-            CONFIG_STEPPER_DIR_PIN,
-            CONFIG_STEPPER_EN_PIN,
-            timer,
-            &stepper));
+    ESP_ERROR_CHECK(stepper_init_group(&stepper, stepper_axes, STEPPER_AXIS_COUNT));
 
     //* LOOP
     while (1)
     {
-        // wait for incoming messages
-        xQueuePeek(task_itc_from_uart_queue, &message, portMAX_DELAY);
+        // wait for incoming messages, restart the queued moves stopped by a change of direction in the meantime
+        ret = xQueuePeek(
+            task_itc_from_uart_queue,
+            &message,
+            stepper_planner_queued(&stepper.planner) > 0 ? pdMS_TO_TICKS(10) : portMAX_DELAY);
+
+        if (ret != pdTRUE)
+        {
+            ret = stepper_run_queue(&stepper);
+
+            if (ret != ESP_OK)
+                ESP_LOGE(TAG, "Unable to run the queued moves: %s", esp_err_to_name(ret));
+
+            continue;
+        }
 
         // motor control message syntax
         //   0       1      2
@@ -90,6 +247,14 @@ void stepper_task()
         // MOTOR |  ON
         // MOTOR |  OFF
         // MOTOR | STEP  | 100
+        // MOTOR | ACCEL | 2000 [| 20000]
+        // MOTOR | JITTER [| RESET]
+        // MOTOR | MOVE  | 100 | -50 [| ...]
+        // MOTOR | QUEUE
+        // MOTOR | GOTO  | 1000 | -200 [| ...]
+        // MOTOR | POS
+        // MOTOR | HOME
+        // MOTOR | OFFSET [| 100 | 0 ...]
 
         // check if the message is for the stepper controller task
         if (message->token_num < 2)
@@ -136,33 +301,133 @@ void stepper_task()
         //* MOTOR STEP
         else if (task_itc_message_token_match(message, 1, KW_STEP) == ESP_OK)
         {
-            // parse the number of steps
-            uint32_t steps = atoi(message->tokens[2]);
+            // parse the number of steps, the sign is the direction
+            int32_t steps = atoi(message->tokens[2]);
 
             stepper_set_steps(&stepper, steps);
         }
+        //* MOTOR ACCEL
+        else if (task_itc_message_token_match(message, 1, KW_ACCEL) == ESP_OK && message->token_num >= 3)
+        {
+            // parse the acceleration and the optional jerk
+            uint32_t acceleration = atoi(message->tokens[2]);
+            uint32_t jerk = message->token_num >= 4 ? atoi(message->tokens[3]) : 0;
+
+            stepper_set_acceleration(&stepper, acceleration, jerk);
+        }
+        //* MOTOR MOVE
+        else if (task_itc_message_token_match(message, 1, KW_MOVE) == ESP_OK)
+        {
+            // parse the steps of the axes, missing axes do not move
+            int32_t deltas[STEPPER_AXIS_COUNT] = {0};
+
+            if (stepper_parse_axes(message, deltas) != ESP_OK)
+                message->response_static = "INVALID AXES";
+            else
+                stepper_respond_queued(message, stepper_move(&stepper, deltas), &stepper.planner);
+        }
+        //* MOTOR GOTO
+        else if (task_itc_message_token_match(message, 1, KW_GOTO) == ESP_OK)
+        {
+            // parse the target positions, missing axes stay where the queued moves end
+            int32_t positions[STEPPER_AXIS_COUNT];
+
+            memcpy(positions, stepper.targets, sizeof(positions));
 
-        xQueueSend(task_itc_to_uart_queue, &message, portMAX_DELAY);
+            if (stepper_parse_axes(message, positions) != ESP_OK)
+                message->response_static = "INVALID AXES";
+            else
+                stepper_respond_queued(message, stepper_goto(&stepper, positions), &stepper.planner);
+        }
+        //* MOTOR POS
+        else if (task_itc_message_token_match(message, 1, KW_POS) == ESP_OK)
+        {
+            int32_t positions[STEPPER_AXIS_COUNT];
+
+            stepper_get_positions(&stepper, positions);
+            stepper_respond_axes(message, positions, stepper.axis_count);
+        }
+        //* MOTOR HOME
+        else if (task_itc_message_token_match(message, 1, KW_HOME) == ESP_OK)
+        {
+            ret = stepper_home(&stepper);
+
+            if (ret == ESP_ERR_INVALID_STATE)
+                message->response_static = "MOVING";
+        }
+        //* MOTOR OFFSET
+        else if (task_itc_message_token_match(message, 1, KW_OFFSET) == ESP_OK)
+        {
+            // parse the home offsets, missing axes keep their offset
+            int32_t offsets[STEPPER_AXIS_COUNT];
+
+            memcpy(offsets, stepper.home_offsets, sizeof(offsets));
+
+            if (message->token_num < 3)
+                stepper_respond_axes(message, offsets, stepper.axis_count);
+            else if (stepper_parse_axes(message, offsets) != ESP_OK)
+                message->response_static = "INVALID AXES";
+            else
+            {
+                ret = stepper_set_home_offsets(&stepper, offsets);
+
+                if (ret != ESP_OK)
+                    message->response_static = esp_err_to_name(ret);
+            }
+        }
+        //* MOTOR QUEUE
+        else if (task_itc_message_token_match(message, 1, KW_QUEUE) == ESP_OK)
+        {
+            // queued moves | free slots
+            asprintf(
+                &message->response,
+                "%lu|%lu",
+                stepper_planner_queued(&stepper.planner),
+                stepper_planner_free(&stepper.planner));
+        }
+        //* MOTOR JITTER
+        else if (task_itc_message_token_match(message, 1, KW_JITTER) == ESP_OK)
+        {
+            stepper_backend_stats_t stats;
+            bool reset = task_itc_message_token_match(message, 2, KW_RESET) == ESP_OK;
+
+            ret = stepper_backend_get_stats(&stats, reset);
+
+            if (ret == ESP_OK)
+                // samples | max jitter | mean jitter | max ISR time | late edges | max clean step rate
+                asprintf(
+                    &message->response,
+                    "%lu|%lu|%lu|%lu|%lu|%lu",
+                    stats.samples,
+                    stats.jitter_max_ns,
+                    stats.jitter_mean_ns,
+                    stats.isr_max_ns,
+                    stats.late_edges,
+                    stepper_max_clean_rate(&stats));
+            else
+                message->response_static = esp_err_to_name(ret);
+        }
+
+        task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
     }
 }
 
 /**
  * @brief This method is used to initialize the communication with a stepper motor controller
  *
- * @param step number of the step pin
+ * @param step number of the step pin, driven by the step generation backend
  * @param dir number of the direction pin
  * @param en number of the enable pin
- * @param timer timer object used to time the step intervals
  * @param stepper pointer to a stepper_t struct to store the object
  * @return esp_err_t ESP_OK if the operation succeeded, error code if there was a gpio configuration error
  */
-esp_err_t stepper_init_stepper(uint8_t step, uint8_t dir, uint8_t en, esp_timer_handle_t timer, stepper_t *stepper)
+esp_err_t stepper_init_stepper(uint8_t step, uint8_t dir, uint8_t en, stepper_t *stepper)
 {
-    // configure the GPIO ports
+    // configure the GPIO ports, the step pin is driven by the step generation backend
     gpio_config_t config = {
         .intr_type = GPIO_INTR_DISABLE,
         .mode = GPIO_MODE_OUTPUT,
-        .pin_bit_mask = (1 << step) | (1 << dir) | (1 << en),
+        .pin_bit_mask = (1ULL << dir) | (1ULL << en),
     };
 
     int ret = gpio_config(&config);
@@ -173,101 +438,542 @@ esp_err_t stepper_init_stepper(uint8_t step, uint8_t dir, uint8_t en, esp_timer_
     stepper->pin_dir = dir;
     stepper->pin_en = en;
     stepper->pin_step = step;
-    stepper->is_on = false;
-    stepper->step = false;
-    stepper->speed = 0;
-    stepper->steps_remaining = 0;
-    stepper->max_speed = 0;
-    stepper->timer = timer;
 
     return ESP_OK;
 }
 
 /**
- * @brief Sets the maximum speed of the stepper
+ * @brief Loads the home offsets from the non-volatile storage (NVS)
  *
- * @note there are currently no acceleration and deceleration implemented,
- *  meaning the max speed is equal to the speed of the motor
+ * @param group stepper_group_t handle to load the offsets into
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_NVS_NOT_FOUND if there are no stored offsets,
+ *                      ESP_ERR_INVALID_SIZE if the offsets were stored for another number of axes,
+ *                      error code if there was an NVS flash error
+ */
+static esp_err_t stepper_load_home_offsets(stepper_group_t *group)
+{
+    nvs_handle_t nvs_handle;
+    int32_t offsets[STEPPER_AXIS_COUNT];
+    size_t length = sizeof(offsets);
+    int ret;
+
+    ret = nvs_open(STEPPER_NVS_STORAGE_NAME, NVS_READONLY, &nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ret = nvs_get_blob(nvs_handle, STEPPER_NVS_HOME_OFFSETS_NAME, offsets, &length);
+
+    nvs_close(nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    if (length != group->axis_count * sizeof(int32_t))
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(group->home_offsets, offsets, length);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Initializes the axes and the step generation backend that drives them
  *
- * @param stepper stepper_t handle
+ * @param group pointer to a stepper_group_t struct to store the object
+ * @param axes the pins of the axes
+ * @param axis_count number of axes, at most STEPPER_AXIS_COUNT
+ * @return esp_err_t    ESP_OK if the operation succeeded,
+ *                      ESP_ERR_INVALID_ARG if the number of axes is not supported,
+ *                      error code if there was a gpio configuration error or the step generation backend could not be started
+ */
+esp_err_t stepper_init_group(stepper_group_t *group, const stepper_t *axes, uint8_t axis_count)
+{
+    uint8_t pins_step[STEPPER_AXIS_COUNT];
+
+    ESP_RETURN_ON_FALSE(axis_count >= 1 && axis_count <= STEPPER_AXIS_COUNT, ESP_ERR_INVALID_ARG, TAG, "Unsupported number of axes");
+
+    for (uint8_t axis = 0; axis < axis_count; axis++)
+    {
+        ESP_RETURN_ON_ERROR(
+            stepper_init_stepper(axes[axis].pin_step, axes[axis].pin_dir, axes[axis].pin_en, &group->axes[axis]),
+            TAG,
+            "Unable to initialize axis %u",
+            axis);
+
+        pins_step[axis] = axes[axis].pin_step;
+    }
+
+    ESP_RETURN_ON_ERROR(stepper_backend_init(pins_step, axis_count), TAG, "Unable to initialize step generation");
+
+    group->axis_count = axis_count;
+    group->is_on = false;
+    group->continuous = false;
+    group->stop_requested = false;
+    group->step_interval_us = 0;
+    group->steps_to_make = 0;
+    group->max_speed = 0;
+    group->acceleration = CONFIG_STEPPER_ACCELERATION;
+    group->jerk = CONFIG_STEPPER_JERK;
+
+    stepper_planner_init(&group->planner, &stepper_ramp_table, axis_count, CONFIG_STEPPER_JUNCTION_SPEED);
+
+    // the position is unknown until homed, the direction pins start backwards
+    memset(group->positions, 0, sizeof(group->positions));
+    memset(group->targets, 0, sizeof(group->targets));
+    memset(group->home_offsets, 0, sizeof(group->home_offsets));
+
+    group->directions = 0;
+
+    for (uint8_t axis = 0; axis < axis_count; axis++)
+        gpio_set_level(group->axes[axis].pin_dir, 0);
+
+    int ret = stepper_load_home_offsets(group);
+
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+        ESP_LOGW(TAG, "Unable to load the home offsets: %s", esp_err_to_name(ret));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sets the maximum speed of the steppers
+ *
+ * @details the motors accelerate to the max speed, see stepper_set_acceleration().
+ *  In a move the speed is the speed of the axis with the most steps
+ *
+ * @param group stepper_group_t handle
  * @param max_speed the maximum speed in steps/second
  * @return esp_err_t ESP_OK
  */
-esp_err_t stepper_set_max_speed(stepper_t *stepper, uint32_t max_speed)
+esp_err_t stepper_set_max_speed(stepper_group_t *group, uint32_t max_speed)
+{
+    group->max_speed = max_speed;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sets the acceleration of the steppers, takes effect the next time a motion starts from rest with an empty queue
+ *
+ * @param group stepper_group_t handle
+ * @param acceleration the acceleration in steps/second^2, 0 to start at the max speed without a ramp
+ * @param jerk the jerk in steps/second^3, 0 for a trapezoidal speed profile
+ * @return esp_err_t ESP_OK
+ */
+esp_err_t stepper_set_acceleration(stepper_group_t *group, uint32_t acceleration, uint32_t jerk)
 {
-    stepper->max_speed = max_speed;
+    group->acceleration = acceleration;
+    group->jerk = jerk;
 
     return ESP_OK;
 }
 
-esp_err_t stepper_set_steps(stepper_t *stepper, int32_t steps)
+/**
+ * @brief Sets the number of steps of the first axis the next time the stepper is turned on
+ *
+ * @param group stepper_group_t handle
+ * @param steps the number of steps, the sign sets the direction, 0 to run until turned off
+ * @return esp_err_t ESP_OK
+ */
+esp_err_t stepper_set_steps(stepper_group_t *group, int32_t steps)
 {
-    stepper->steps_to_make = steps;
+    group->steps_to_make = steps;
 
     return ESP_OK;
 }
 
 /**
- * @brief Turns on the stepper motor
+ * @brief Rebuilds the ramp from the speed settings, only while the motors are off and the queue is empty
  *
- * @param stepper stepper_t handle
- * @param on true to turn, false to turn off the motor
- * @return esp_err_t    ESP_OK if successful,
- *                      ESP_ERR_INVALID_STATE if the motor is already turned off,
- *                      ESP_ERR_INVALID_ARG if the motor speed is set to zero
+ * @param group stepper_group_t handle
  */
-esp_err_t stepper_turn_on(stepper_t *stepper, bool on)
+static void stepper_build_ramp(stepper_group_t *group)
 {
-    int ret;
+    stepper_ramp_build(&stepper_ramp_table, group->max_speed, group->acceleration, group->jerk);
 
-    // turn off
-    if (!on)
+    if (stepper_ramp_table.truncated)
+        ESP_LOGW(TAG, "Ramp table too short, max speed lowered to %lu", 1000000 / stepper_ramp_table.cruise_interval);
+}
+
+/**
+ * @brief Returns true if the motors are running or moves are queued
+ *
+ * @param group stepper_group_t handle
+ * @return true if busy, false if the motors are at rest and the queue is empty
+ */
+static bool stepper_is_busy(stepper_group_t *group)
+{
+    return __atomic_load_n(&group->is_on, __ATOMIC_ACQUIRE) || stepper_planner_queued(&group->planner) > 0;
+}
+
+/**
+ * @brief Sets the direction pins, waits for the setup time of the drivers if a pin changed
+ *
+ * @details only called while the motors are at rest, the last step pulse was at least one step interval ago
+ *
+ * @param group stepper_group_t handle
+ * @param directions bit mask of the axes moving forward
+ */
+static void stepper_set_directions(stepper_group_t *group, uint32_t directions)
+{
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
+        gpio_set_level(group->axes[axis].pin_dir, (directions >> axis) & 1);
+
+    if (directions != group->directions)
+        esp_rom_delay_us(CONFIG_STEPPER_DIR_SETUP_US);
+
+    group->directions = directions;
+}
+
+/**
+ * @brief Reads the positions of the axes
+ *
+ * @details while the motors run, the positions count the steps generated so far,
+ *  the step generation backend may not have pulsed all of them yet
+ *
+ * @param group stepper_group_t handle
+ * @param positions array of STEPPER_AXIS_COUNT values to store the positions in steps
+ * @return esp_err_t ESP_OK
+ */
+esp_err_t stepper_get_positions(stepper_group_t *group, int32_t *positions)
+{
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
+        positions[axis] = __atomic_load_n(&group->positions[axis], __ATOMIC_RELAXED);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Hands the prepared motion to the step generation backend
+ *
+ * @param group stepper_group_t handle
+ * @param source the tick source of the motion
+ * @return esp_err_t ESP_OK if successful, error code of the step generation backend otherwise
+ */
+static esp_err_t stepper_start_motion(stepper_group_t *group, stepper_tick_source_t source)
+{
+    ESP_LOGI(TAG, "Stepper started with period: %lu (us), ramp of %lu steps", stepper_ramp_table.cruise_interval, stepper_ramp_table.length);
+
+    group->step_interval_us = 0;
+    group->is_on = true;
+
+    int ret = stepper_backend_start(source, stepper_motion_done, group);
+
+    if (ret != ESP_OK)
+        group->is_on = false;
+
+    return ret;
+}
+
+/**
+ * @brief Decelerates the motors to rest and drops the queued moves
+ *
+ * @details the tick source cuts the motion short, so the positions stay exact.
+ *  The steps the backend encoded ahead are transmitted before the deceleration,
+ *  their time is added to the timeout. If the deceleration does not finish in time
+ *  the step generation backend is stopped at once
+ *
+ * @param group stepper_group_t handle
+ * @return esp_err_t ESP_OK if successful, error code of the step generation backend if it could not be stopped
+ */
+static esp_err_t stepper_stop(stepper_group_t *group)
+{
+    int ret = ESP_OK;
+    TickType_t start = xTaskGetTickCount();
+
+    __atomic_store_n(&group->stop_requested, true, __ATOMIC_RELEASE);
+
+    // the longest deceleration walks the whole ramp after the steps already queued in the backend
+    uint64_t timeout_us = STEPPER_MAX_INTERVAL_US + stepper_backend_queued_us();
+
+    for (uint32_t index = 0; index < stepper_ramp_table.length; index++)
+        timeout_us += stepper_ramp_table.intervals[index];
+
+    while (__atomic_load_n(&group->is_on, __ATOMIC_ACQUIRE))
     {
-        // motor is on
-        if (stepper->is_on)
+        if ((uint64_t)pdTICKS_TO_MS(xTaskGetTickCount() - start) * 1000 > timeout_us)
         {
-            ret = esp_timer_stop(stepper->timer);
+            ESP_LOGW(TAG, "Deceleration timed out, the positions may be lost");
+
+            ret = stepper_backend_stop();
+
+            // the motion might have finished in the meantime
+            if (ret == ESP_ERR_INVALID_STATE)
+                ret = ESP_OK;
 
             if (ret == ESP_OK)
-                stepper->is_on = false;
+                group->is_on = false;
 
-            return ret;
+            break;
         }
 
-        // if motor is off, invalid state
-        return ESP_ERR_INVALID_STATE;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    __atomic_store_n(&group->stop_requested, false, __ATOMIC_RELEASE);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    group->continuous = false;
+    stepper_planner_clear(&group->planner);
+    stepper_get_positions(group, group->targets);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Turns the first stepper motor on or off
+ *
+ * @details turned on, the motor makes the steps set by stepper_set_steps() or runs until turned off.
+ *  The motor accelerates to the max speed and decelerates to stop at the last step.
+ *  Turned off, the motors decelerate to rest and the queued moves are dropped
+ *
+ * @param group stepper_group_t handle
+ * @param on true to turn on, false to turn off the motors
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the motors are already turned on or off,
+ *                      ESP_ERR_INVALID_ARG if the motor speed is set to zero
+ */
+esp_err_t stepper_turn_on(stepper_group_t *group, bool on)
+{
+    // turn off
+    if (!on)
+    {
+        if (!stepper_is_busy(group))
+            return ESP_ERR_INVALID_STATE;
+
+        return stepper_stop(group);
     }
 
     // turn on
+    if (stepper_is_busy(group))
+        return ESP_ERR_INVALID_STATE;
+
+    if (group->steps_to_make != 0)
+    {
+        int32_t deltas[STEPPER_AXIS_COUNT] = {group->steps_to_make};
+
+        return stepper_move(group, deltas);
+    }
 
     // check if motor speed is zero
-    if (stepper->max_speed == 0)
+    if (group->max_speed == 0)
     {
         ESP_LOGW(TAG, "Stepper motor speed is set to 0, cannot start");
         return ESP_ERR_INVALID_ARG;
     }
 
-    // calculate period in microseconds
-    uint64_t period_us = 1000000 / 2 / stepper->max_speed;
+    // run until turned off in the last direction
+    stepper_build_ramp(group);
+    stepper_motion_start_continuous(&group->motion, &stepper_ramp_table, 1);
 
-    // set the remaining steps to the steps
-    stepper->steps_remaining = stepper->steps_to_make;
+    group->continuous = true;
 
-    ESP_LOGI(TAG, "Stepper timer started with value: %llu (us)", period_us);
+    int ret = stepper_start_motion(group, stepper_next_tick);
 
-    // stepper was already on, restart timer
-    if (stepper->is_on)
-        return esp_timer_restart(stepper->timer, period_us);
+    if (ret != ESP_OK)
+        group->continuous = false;
 
-    // stepper was off, start timer
-    ret = esp_timer_start_periodic(stepper->timer, period_us);
+    return ret;
+}
 
-    if (ret == ESP_OK)
-        stepper->is_on = true;
+/**
+ * @brief Prepares the queue for the next move
+ *
+ * @details if the motors are at rest and the queue is empty, the ramp is rebuilt from the speed settings
+ *  and the targets are taken from the positions. The junction speeds are planned on the current ramp
+ *
+ * @param group stepper_group_t handle
+ */
+static void stepper_prepare_queue(stepper_group_t *group)
+{
+    if (stepper_is_busy(group))
+        return;
+
+    stepper_build_ramp(group);
+    stepper_get_positions(group, group->targets);
+}
+
+/**
+ * @brief Queues a move of the axes along a line, the axes start and finish together
+ *
+ * @details the axis with the most steps follows the ramp, the other axes are interpolated
+ *  with Bresenham's algorithm on the same step clock. Queued moves run back to back,
+ *  the motors only slow down at a junction as much as the change of the axis speeds requires
+ *  and stop when the queue runs empty or an axis changes direction
+ *
+ * @param group stepper_group_t handle
+ * @param deltas the steps of each axis, the sign sets the direction pin
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_ARG if the motor speed is set to zero or a delta is out of range,
+ *                      ESP_ERR_INVALID_STATE if the motor runs until turned off,
+ *                      ESP_ERR_NO_MEM if the queue is full,
+ *                      error code of the step generation backend otherwise
+ */
+esp_err_t stepper_move(stepper_group_t *group, const int32_t *deltas)
+{
+    uint32_t steps[STEPPER_AXIS_COUNT];
+    int32_t targets[STEPPER_AXIS_COUNT];
+    uint32_t directions = 0;
+
+    // check if motor speed is zero
+    if (group->max_speed == 0)
+    {
+        ESP_LOGW(TAG, "Stepper motor speed is set to 0, cannot start");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (group->continuous && __atomic_load_n(&group->is_on, __ATOMIC_ACQUIRE))
+        return ESP_ERR_INVALID_STATE;
+
+    stepper_prepare_queue(group);
+
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
+    {
+        int64_t target = (int64_t)group->targets[axis] + deltas[axis];
+
+        ESP_RETURN_ON_FALSE(
+            deltas[axis] != INT32_MIN && target >= INT32_MIN && target <= INT32_MAX,
+            ESP_ERR_INVALID_ARG,
+            TAG,
+            "Move of axis %u out of range",
+            axis);
+
+        if (deltas[axis] >= 0)
+            directions |= 1UL << axis;
+
+        steps[axis] = deltas[axis] >= 0 ? deltas[axis] : -deltas[axis];
+        targets[axis] = target;
+    }
+
+    int ret = stepper_planner_push(&group->planner, steps, directions);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    memcpy(group->targets, targets, group->axis_count * sizeof(int32_t));
+
+    return stepper_run_queue(group);
+}
+
+/**
+ * @brief Queues a move of the axes to absolute positions, see stepper_move()
+ *
+ * @details the move starts where the queued moves end
+ *
+ * @param group stepper_group_t handle
+ * @param positions the target position of each axis in steps
+ * @return esp_err_t see stepper_move(), ESP_ERR_INVALID_ARG if a target is too far
+ */
+esp_err_t stepper_goto(stepper_group_t *group, const int32_t *positions)
+{
+    int32_t deltas[STEPPER_AXIS_COUNT];
+
+    stepper_prepare_queue(group);
+
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
+    {
+        int64_t delta = (int64_t)positions[axis] - group->targets[axis];
+
+        ESP_RETURN_ON_FALSE(delta > INT32_MIN && delta <= INT32_MAX, ESP_ERR_INVALID_ARG, TAG, "Target of axis %u too far", axis);
+
+        deltas[axis] = delta;
+    }
+
+    return stepper_move(group, deltas);
+}
+
+/**
+ * @brief Starts the queued moves if the motors are off
+ *
+ * @details sets the direction pins of the first move, the moves until the next change of direction run in one stream.
+ *  Called by the stepper task while moves are queued
+ *
+ * @param group stepper_group_t handle
+ * @return esp_err_t ESP_OK if successful or there is nothing to start, error code of the step generation backend otherwise
+ */
+esp_err_t stepper_run_queue(stepper_group_t *group)
+{
+    uint32_t directions;
+
+    if (__atomic_load_n(&group->is_on, __ATOMIC_ACQUIRE))
+        return ESP_OK;
+
+    if (!stepper_planner_begin(&group->planner, &directions))
+        return ESP_OK;
+
+    stepper_set_directions(group, directions);
+
+    int ret = stepper_start_motion(group, stepper_next_queued_tick);
+
+    // do not retry a failing backend
+    if (ret != ESP_OK)
+    {
+        stepper_planner_clear(&group->planner);
+        stepper_get_positions(group, group->targets);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Sets the home offsets and stores them in the non-volatile storage (NVS)
+ *
+ * @details the offsets are the positions of the axes at the home reference, applied by stepper_home()
+ *
+ * @param group stepper_group_t handle
+ * @param offsets the offset of each axis in steps
+ * @return esp_err_t ESP_OK if successful, error code if there was an NVS flash error
+ */
+esp_err_t stepper_set_home_offsets(stepper_group_t *group, const int32_t *offsets)
+{
+    nvs_handle_t nvs_handle;
+    int ret;
+
+    memcpy(group->home_offsets, offsets, group->axis_count * sizeof(int32_t));
+
+    ret = nvs_open(STEPPER_NVS_STORAGE_NAME, NVS_READWRITE, &nvs_handle);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ESP_GOTO_ON_ERROR(
+        nvs_set_blob(nvs_handle, STEPPER_NVS_HOME_OFFSETS_NAME, group->home_offsets, group->axis_count * sizeof(int32_t)),
+        cleanup,
+        TAG,
+        "Unable to set value: " STEPPER_NVS_HOME_OFFSETS_NAME);
+
+    ret = nvs_commit(nvs_handle);
+
+cleanup:
+    nvs_close(nvs_handle);
 
     return ret;
 }
 
+/**
+ * @brief Sets the positions of the axes to the home offsets, call with the axes at the home reference
+ *
+ * @param group stepper_group_t handle
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if the motors are running or moves are queued
+ */
+esp_err_t stepper_home(stepper_group_t *group)
+{
+    if (stepper_is_busy(group))
+        return ESP_ERR_INVALID_STATE;
+
+    for (uint8_t axis = 0; axis < group->axis_count; axis++)
+    {
+        __atomic_store_n(&group->positions[axis], group->home_offsets[axis], __ATOMIC_RELAXED);
+        group->targets[axis] = group->home_offsets[axis];
+    }
+
+    return ESP_OK;
+}
+
 /**
  * @brief Starts the stepper task task
  *
@@ -0,0 +1,137 @@
+/// @file
+#include "stepper_encoder.h"
+
+/**
+ * @brief Resets the encoder for a new motion
+ *
+ * @param encoder the encoder
+ * @param pulse_us width of the step pulse in us
+ * @param axis_count number of axes, at most STEPPER_MAX_AXES
+ */
+void stepper_encoder_init(stepper_encoder_t *encoder, uint32_t pulse_us, size_t axis_count)
+{
+    if (pulse_us < 1)
+        pulse_us = 1;
+
+    if (pulse_us > STEPPER_ENCODER_MAX_DURATION)
+        pulse_us = STEPPER_ENCODER_MAX_DURATION;
+
+    encoder->pulse_us = pulse_us;
+    encoder->axis_count = axis_count;
+    encoder->done = false;
+}
+
+/**
+ * @brief Returns the shortest interval the encoder can produce, the pulse and one tick of low level
+ *
+ * @param encoder the encoder
+ * @return uint32_t the interval in us, shorter intervals are stretched to it
+ */
+uint32_t stepper_encoder_min_interval(const stepper_encoder_t *encoder)
+{
+    return encoder->pulse_us + 1;
+}
+
+/**
+ * @brief Encodes a tick into the symbols of every axis
+ *
+ * @details the first symbol holds the step pulse and the start of the low level,
+ *  the rest of a long interval is split into low only symbols.
+ *  Axes that do not step on the tick get a low level instead of the pulse, so the blocks of the axes stay aligned.
+ *  A level of a symbol lasts at least 1 us, a zero duration would end the transmission.
+ *  The interval is clamped between stepper_encoder_min_interval() and STEPPER_MAX_INTERVAL_US
+ *
+ * @param encoder the encoder
+ * @param tick the tick to encode
+ * @param blocks the blocks of the axes, each has room for STEPPER_ENCODER_MAX_SYMBOLS after the offset
+ * @param offset the index of the first symbol to write in the blocks
+ * @return size_t the number of symbols written to each block
+ */
+size_t stepper_encoder_encode_tick(const stepper_encoder_t *encoder, const stepper_tick_t *tick, stepper_symbol_t *const *blocks, size_t offset)
+{
+    uint32_t interval = tick->interval_us;
+
+    if (interval < stepper_encoder_min_interval(encoder))
+        interval = stepper_encoder_min_interval(encoder);
+
+    if (interval > STEPPER_MAX_INTERVAL_US)
+        interval = STEPPER_MAX_INTERVAL_US;
+
+    uint32_t low = interval - encoder->pulse_us;
+    uint32_t first_low = low > STEPPER_ENCODER_MAX_DURATION ? STEPPER_ENCODER_MAX_DURATION : low;
+    uint32_t rest = low - first_low;
+
+    // a low only symbol needs at least 2 us, one for each level
+    if (rest == 1)
+    {
+        first_low--;
+        rest++;
+    }
+
+    for (size_t axis = 0; axis < encoder->axis_count; axis++)
+    {
+        stepper_symbol_t *symbol = blocks[axis] + offset;
+
+        symbol->level0 = (tick->axes >> axis) & 1;
+        symbol->duration0 = encoder->pulse_us;
+        symbol->level1 = 0;
+        symbol->duration1 = first_low;
+    }
+
+    size_t count = 1;
+
+    while (rest > 0)
+    {
+        uint32_t chunk = rest > 2 * STEPPER_ENCODER_MAX_DURATION ? 2 * STEPPER_ENCODER_MAX_DURATION : rest;
+
+        if (rest - chunk == 1)
+            chunk--;
+
+        for (size_t axis = 0; axis < encoder->axis_count; axis++)
+        {
+            stepper_symbol_t *symbol = blocks[axis] + offset + count;
+
+            symbol->level0 = 0;
+            symbol->duration0 = (chunk + 1) / 2;
+            symbol->level1 = 0;
+            symbol->duration1 = chunk / 2;
+        }
+
+        rest -= chunk;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Fills the blocks of the axes with the next ticks of the source
+ *
+ * @details ticks are pulled as long as the blocks have room for the longest encoded tick,
+ *  so a tick is never split between two blocks
+ *
+ * @param encoder the encoder, its done flag is set when the source finishes the motion
+ * @param source the source of the ticks
+ * @param context the context of the source
+ * @param blocks the blocks of the axes to fill
+ * @param capacity the number of symbols a block can hold
+ * @return size_t the number of symbols written to each block, 0 if the motion is finished
+ */
+size_t stepper_encoder_fill(stepper_encoder_t *encoder, stepper_tick_source_t source, void *context, stepper_symbol_t *const *blocks, size_t capacity)
+{
+    stepper_tick_t tick;
+    size_t count = 0;
+
+    while (!encoder->done && capacity - count >= STEPPER_ENCODER_MAX_SYMBOLS)
+    {
+        if (!source(context, &tick))
+        {
+            encoder->done = true;
+            break;
+        }
+
+        count += stepper_encoder_encode_tick(encoder, &tick, blocks, count);
+    }
+
+    return count;
+}
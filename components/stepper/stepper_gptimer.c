@@ -0,0 +1,482 @@
+/// @file
+#include "stepper_backend.h"
+
+#include <esp_log.h>
+#include <esp_check.h>
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+#include <driver/gpio.h>
+#include <driver/gptimer.h>
+#include <soc/gpio_reg.h>
+#include <soc/soc_caps.h>
+
+#include <freertos/FreeRTOS.h>
+
+/// @brief The step clock, 1 tick is 1 us
+#define STEPPER_GPTIMER_RESOLUTION_HZ 1000000
+
+/// @brief Delay of the first step of a motion in us
+#define STEPPER_GPTIMER_START_DELAY_US 10
+
+/// @brief Shortest time in us an alarm is scheduled ahead of the current count, a later edge is counted as late
+#define STEPPER_GPTIMER_MIN_LEAD_US 2
+
+static const char *TAG = "Stepper GPTimer";
+
+static gptimer_handle_t stepper_gptimer = NULL;
+
+/// @brief Bit of the step pin of each axis in the GPIO output registers
+static uint32_t stepper_gptimer_axis_masks[STEPPER_MAX_AXES] = {0};
+/// @brief true if the step pin of the axis is in the second GPIO output register (pin 32 and above)
+static bool stepper_gptimer_axis_high[STEPPER_MAX_AXES] = {false};
+static size_t stepper_gptimer_axis_count = 0;
+
+/// @brief Step pins of all axes in the first and the second GPIO output register, cleared by a falling edge
+static uint32_t stepper_gptimer_all_mask = 0;
+static uint32_t stepper_gptimer_all_mask_high = 0;
+
+/// @brief Step pins of the axes of the next tick, set by its rising edge
+static uint32_t stepper_gptimer_next_mask = 0;
+static uint32_t stepper_gptimer_next_mask_high = 0;
+
+static stepper_tick_source_t stepper_gptimer_source = NULL;
+static stepper_done_callback_t stepper_gptimer_done = NULL;
+static void *stepper_gptimer_context = NULL;
+
+static bool stepper_gptimer_running = false;
+
+/// @brief true while the step pin is high
+static bool stepper_gptimer_pulse = false;
+
+/// @brief Timer count of the rising edge of the current step
+static uint64_t stepper_gptimer_edge = 0;
+/// @brief Interval of the current step in us
+static uint32_t stepper_gptimer_interval = 0;
+/// @brief Interval of the next step in us, pulled from the source ahead of its rising edge
+static uint32_t stepper_gptimer_next_interval = 0;
+
+/// @brief CPU cycle count at the previous rising edge, 0 before the first edge of a motion
+static uint32_t stepper_gptimer_last_edge_cycles = 0;
+
+/// @brief Statistics in CPU cycles, protected by stepper_gptimer_lock
+static uint32_t stepper_gptimer_samples = 0;
+static uint32_t stepper_gptimer_jitter_max = 0;
+static uint64_t stepper_gptimer_jitter_sum = 0;
+static uint32_t stepper_gptimer_isr_max = 0;
+static uint32_t stepper_gptimer_late_edges = 0;
+
+/// @brief Protects the motion state and the statistics between the alarm interrupt and the task calling the backend
+static portMUX_TYPE stepper_gptimer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Clamps the interval of a tick to the range the pulse can be generated in
+ *
+ * @param tick the tick
+ * @return uint32_t the interval in us
+ */
+static uint32_t IRAM_ATTR stepper_gptimer_interval_of(const stepper_tick_t *tick)
+{
+    if (tick->interval_us < CONFIG_STEPPER_PULSE_WIDTH_US + 1)
+        return CONFIG_STEPPER_PULSE_WIDTH_US + 1;
+
+    if (tick->interval_us > STEPPER_MAX_INTERVAL_US)
+        return STEPPER_MAX_INTERVAL_US;
+
+    return tick->interval_us;
+}
+
+/**
+ * @brief Prepares the step pins the rising edge of a tick sets
+ *
+ * @param tick the tick
+ */
+static void IRAM_ATTR stepper_gptimer_prepare(const stepper_tick_t *tick)
+{
+    stepper_gptimer_next_interval = stepper_gptimer_interval_of(tick);
+    stepper_gptimer_next_mask = 0;
+    stepper_gptimer_next_mask_high = 0;
+
+    for (size_t axis = 0; axis < stepper_gptimer_axis_count; axis++)
+    {
+        if (!((tick->axes >> axis) & 1))
+            continue;
+
+        if (stepper_gptimer_axis_high[axis])
+            stepper_gptimer_next_mask_high |= stepper_gptimer_axis_masks[axis];
+        else
+            stepper_gptimer_next_mask |= stepper_gptimer_axis_masks[axis];
+    }
+}
+
+/**
+ * @brief Sets the step pins of the next tick, the axes of a register switch at the same time
+ */
+static void IRAM_ATTR stepper_gptimer_write_rising()
+{
+    if (stepper_gptimer_next_mask != 0)
+        REG_WRITE(GPIO_OUT_W1TS_REG, stepper_gptimer_next_mask);
+
+#if SOC_GPIO_PIN_COUNT > 32
+    if (stepper_gptimer_next_mask_high != 0)
+        REG_WRITE(GPIO_OUT1_W1TS_REG, stepper_gptimer_next_mask_high);
+#endif
+}
+
+/**
+ * @brief Clears the step pins of every axis
+ */
+static void IRAM_ATTR stepper_gptimer_write_falling()
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, stepper_gptimer_all_mask);
+
+#if SOC_GPIO_PIN_COUNT > 32
+    if (stepper_gptimer_all_mask_high != 0)
+        REG_WRITE(GPIO_OUT1_W1TC_REG, stepper_gptimer_all_mask_high);
+#endif
+}
+
+/**
+ * @brief Schedules the next alarm, at least STEPPER_GPTIMER_MIN_LEAD_US from now
+ *
+ * @param timer the timer
+ * @param count the count of the alarm
+ * @param now the current count
+ * @return uint64_t the count the alarm was scheduled at
+ */
+static uint64_t IRAM_ATTR stepper_gptimer_schedule(gptimer_handle_t timer, uint64_t count, uint64_t now)
+{
+    if (count < now + STEPPER_GPTIMER_MIN_LEAD_US)
+    {
+        count = now + STEPPER_GPTIMER_MIN_LEAD_US;
+        stepper_gptimer_late_edges++;
+    }
+
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = count,
+    };
+
+    gptimer_set_alarm_action(timer, &alarm);
+
+    return count;
+}
+
+/**
+ * @brief Records the edge to edge jitter of a rising edge
+ *
+ * @details the jitter is the difference of the measured and the programmed time since the previous rising edge,
+ *  called before the interval of the new step is taken over
+ *
+ * @param cycles the CPU cycle count at the edge
+ */
+static void IRAM_ATTR stepper_gptimer_record_edge(uint32_t cycles)
+{
+    if (stepper_gptimer_last_edge_cycles != 0)
+    {
+        uint32_t measured = cycles - stepper_gptimer_last_edge_cycles;
+        uint32_t expected = stepper_gptimer_interval * esp_rom_get_cpu_ticks_per_us();
+        uint32_t jitter = measured > expected ? measured - expected : expected - measured;
+
+        if (jitter > stepper_gptimer_jitter_max)
+            stepper_gptimer_jitter_max = jitter;
+
+        stepper_gptimer_jitter_sum += jitter;
+        stepper_gptimer_samples++;
+    }
+
+    // a cycle count of exactly 0 only skips one sample
+    stepper_gptimer_last_edge_cycles = cycles;
+}
+
+/**
+ * @brief Ends the motion, called with the lock held
+ *
+ * @param timer the timer
+ */
+static void IRAM_ATTR stepper_gptimer_finish(gptimer_handle_t timer)
+{
+    gptimer_stop(timer);
+
+    stepper_gptimer_write_falling();
+
+    stepper_gptimer_pulse = false;
+    stepper_gptimer_running = false;
+}
+
+/**
+ * @brief Alarm callback of the step timer, drives the step pin
+ *
+ * @details the pin is written first, the rest of the work does not delay the edge.
+ *  A rising edge schedules the falling edge, a falling edge pulls the next tick from the source
+ *  and schedules its rising edge. The source and the done callback are called from here
+ *
+ * @param timer the timer
+ * @param event the alarm event
+ * @param context unused
+ * @return false, no task is woken up
+ */
+static bool IRAM_ATTR stepper_gptimer_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *event, void *context)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    bool finished = false;
+    stepper_tick_t tick;
+
+    portENTER_CRITICAL_ISR(&stepper_gptimer_lock);
+
+    // the motion was stopped while the alarm was pending
+    if (!stepper_gptimer_running)
+    {
+        portEXIT_CRITICAL_ISR(&stepper_gptimer_lock);
+        return false;
+    }
+
+    if (!stepper_gptimer_pulse)
+    {
+        stepper_gptimer_write_rising();
+        stepper_gptimer_pulse = true;
+
+        stepper_gptimer_record_edge(esp_cpu_get_cycle_count());
+        stepper_gptimer_interval = stepper_gptimer_next_interval;
+
+        stepper_gptimer_schedule(timer, stepper_gptimer_edge + CONFIG_STEPPER_PULSE_WIDTH_US, event->count_value);
+    }
+    else
+    {
+        stepper_gptimer_write_falling();
+        stepper_gptimer_pulse = false;
+
+        if (stepper_gptimer_source(stepper_gptimer_context, &tick))
+        {
+            stepper_gptimer_prepare(&tick);
+            stepper_gptimer_edge = stepper_gptimer_schedule(timer, stepper_gptimer_edge + stepper_gptimer_interval, event->count_value);
+        }
+        else
+        {
+            stepper_gptimer_finish(timer);
+            finished = true;
+        }
+    }
+
+    uint32_t duration = esp_cpu_get_cycle_count() - start;
+
+    if (duration > stepper_gptimer_isr_max)
+        stepper_gptimer_isr_max = duration;
+
+    portEXIT_CRITICAL_ISR(&stepper_gptimer_lock);
+
+    if (finished && stepper_gptimer_done != NULL)
+        stepper_gptimer_done(stepper_gptimer_context);
+
+    return false;
+}
+
+/**
+ * @brief Initializes the general purpose timer step generation backend
+ *
+ * @details every edge of the step pins is written from the alarm interrupt of a 1 MHz timer
+ *  through the GPIO set and clear registers, the pins of all axes with one write per register
+ *
+ * @param pins_step numbers of the step pins of the axes
+ * @param axis_count number of axes
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_ARG if the number of axes is not supported,
+ *                      error code of the GPIO or the timer driver otherwise
+ */
+esp_err_t stepper_backend_init(const uint8_t *pins_step, size_t axis_count)
+{
+    if (stepper_gptimer != NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    ESP_RETURN_ON_FALSE(axis_count >= 1 && axis_count <= STEPPER_MAX_AXES, ESP_ERR_INVALID_ARG, TAG, "Unsupported number of axes");
+
+    int ret;
+
+    stepper_gptimer_all_mask = 0;
+    stepper_gptimer_all_mask_high = 0;
+
+    for (size_t axis = 0; axis < axis_count; axis++)
+    {
+        uint8_t pin = pins_step[axis];
+
+        gpio_config_t config = {
+            .intr_type = GPIO_INTR_DISABLE,
+            .mode = GPIO_MODE_OUTPUT,
+            .pin_bit_mask = 1ULL << pin,
+        };
+
+        ESP_RETURN_ON_ERROR(gpio_config(&config), TAG, "Unable to configure step pin");
+        ESP_RETURN_ON_ERROR(gpio_set_level(pin, 0), TAG, "Unable to clear step pin");
+
+        stepper_gptimer_axis_high[axis] = pin >= 32;
+        stepper_gptimer_axis_masks[axis] = 1UL << (pin % 32);
+
+        if (stepper_gptimer_axis_high[axis])
+            stepper_gptimer_all_mask_high |= stepper_gptimer_axis_masks[axis];
+        else
+            stepper_gptimer_all_mask |= stepper_gptimer_axis_masks[axis];
+    }
+
+    stepper_gptimer_axis_count = axis_count;
+
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = STEPPER_GPTIMER_RESOLUTION_HZ,
+        .intr_priority = CONFIG_STEPPER_GPTIMER_INTR_PRIO,
+    };
+
+    ESP_RETURN_ON_ERROR(gptimer_new_timer(&timer_config, &stepper_gptimer), TAG, "Unable to create timer");
+
+    gptimer_event_callbacks_t callbacks = {
+        .on_alarm = stepper_gptimer_alarm,
+    };
+
+    ESP_GOTO_ON_ERROR(gptimer_register_event_callbacks(stepper_gptimer, &callbacks, NULL), cleanup, TAG, "Unable to register callbacks");
+
+    ESP_GOTO_ON_ERROR(gptimer_enable(stepper_gptimer), cleanup, TAG, "Unable to enable timer");
+
+    return ESP_OK;
+
+cleanup:
+    gptimer_del_timer(stepper_gptimer);
+
+    stepper_gptimer = NULL;
+    stepper_gptimer_axis_count = 0;
+
+    return ret;
+}
+
+/**
+ * @brief Starts a motion
+ *
+ * @details the first tick is pulled here, the rest of the ticks and the done callback are called from the alarm interrupt,
+ *  they must be fast. A motion without ticks finishes immediately
+ *
+ * @param source the source of the ticks of the motion
+ * @param done called when the motion finished or was stopped, can be NULL
+ * @param context passed to the source and the done callback
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the backend is not initialized or a motion is running,
+ *                      error code of the timer driver otherwise
+ */
+esp_err_t stepper_backend_start(stepper_tick_source_t source, stepper_done_callback_t done, void *context)
+{
+    stepper_tick_t tick;
+
+    if (stepper_gptimer == NULL || stepper_backend_is_running())
+        return ESP_ERR_INVALID_STATE;
+
+    if (!source(context, &tick))
+    {
+        if (done != NULL)
+            done(context);
+
+        return ESP_OK;
+    }
+
+    stepper_gptimer_source = source;
+    stepper_gptimer_done = done;
+    stepper_gptimer_context = context;
+
+    stepper_gptimer_pulse = false;
+    stepper_gptimer_edge = STEPPER_GPTIMER_START_DELAY_US;
+    stepper_gptimer_interval = 0;
+    stepper_gptimer_prepare(&tick);
+    stepper_gptimer_last_edge_cycles = 0;
+
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = STEPPER_GPTIMER_START_DELAY_US,
+    };
+
+    ESP_RETURN_ON_ERROR(gptimer_set_raw_count(stepper_gptimer, 0), TAG, "Unable to reset timer");
+    ESP_RETURN_ON_ERROR(gptimer_set_alarm_action(stepper_gptimer, &alarm), TAG, "Unable to set alarm");
+
+    __atomic_store_n(&stepper_gptimer_running, true, __ATOMIC_RELEASE);
+
+    int ret = gptimer_start(stepper_gptimer);
+
+    if (ret != ESP_OK)
+        __atomic_store_n(&stepper_gptimer_running, false, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+/**
+ * @brief Stops the running motion immediately, the step pin is cleared
+ *
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if no motion is running
+ */
+esp_err_t stepper_backend_stop()
+{
+    portENTER_CRITICAL(&stepper_gptimer_lock);
+
+    if (!stepper_gptimer_running)
+    {
+        portEXIT_CRITICAL(&stepper_gptimer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    stepper_gptimer_finish(stepper_gptimer);
+
+    portEXIT_CRITICAL(&stepper_gptimer_lock);
+
+    if (stepper_gptimer_done != NULL)
+        stepper_gptimer_done(stepper_gptimer_context);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Checks if a motion is running
+ *
+ * @return true if a motion is running
+ */
+bool stepper_backend_is_running()
+{
+    return __atomic_load_n(&stepper_gptimer_running, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief The interrupt takes the ticks from the source one at a time, no steps are queued ahead
+ *
+ * @details the tick of the running step is at most STEPPER_MAX_INTERVAL_US long
+ *
+ * @return uint32_t 0
+ */
+uint32_t stepper_backend_queued_us()
+{
+    return 0;
+}
+
+/**
+ * @brief Returns the timing statistics of the rising edges
+ *
+ * @param stats pointer to store the statistics
+ * @param reset true to start a new measurement
+ * @return esp_err_t ESP_OK
+ */
+esp_err_t stepper_backend_get_stats(stepper_backend_stats_t *stats, bool reset)
+{
+    uint32_t cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+
+    portENTER_CRITICAL(&stepper_gptimer_lock);
+
+    stats->samples = stepper_gptimer_samples;
+    stats->jitter_max_ns = (uint64_t)stepper_gptimer_jitter_max * 1000 / cycles_per_us;
+    stats->jitter_mean_ns = stepper_gptimer_samples > 0 ? stepper_gptimer_jitter_sum * 1000 / cycles_per_us / stepper_gptimer_samples : 0;
+    stats->isr_max_ns = (uint64_t)stepper_gptimer_isr_max * 1000 / cycles_per_us;
+    stats->late_edges = stepper_gptimer_late_edges;
+
+    if (reset)
+    {
+        stepper_gptimer_samples = 0;
+        stepper_gptimer_jitter_max = 0;
+        stepper_gptimer_jitter_sum = 0;
+        stepper_gptimer_isr_max = 0;
+        stepper_gptimer_late_edges = 0;
+    }
+
+    portEXIT_CRITICAL(&stepper_gptimer_lock);
+
+    return ESP_OK;
+}
@@ -0,0 +1,126 @@
+/// @file
+#include "stepper_motion.h"
+
+#include <esp_attr.h>
+
+/**
+ * @brief Continues the motion with a linear move of the axes, the speed is kept
+ *
+ * @details the error terms start at half of the major steps, the steps of an axis are centered between the ticks.
+ *  The move decelerates to the exit index of the motion by its last step
+ *
+ * @param motion the motion
+ * @param deltas the steps of each axis, at most INT32_MAX
+ * @param axis_count number of axes, at most STEPPER_MAX_AXES
+ */
+void IRAM_ATTR stepper_motion_chain(stepper_motion_t *motion, const uint32_t *deltas, uint32_t axis_count)
+{
+    motion->axis_count = axis_count;
+    motion->major = 0;
+    motion->continuous_axes = 0;
+
+    for (uint32_t axis = 0; axis < axis_count; axis++)
+    {
+        motion->deltas[axis] = deltas[axis];
+
+        if (deltas[axis] > motion->major)
+            motion->major = deltas[axis];
+    }
+
+    for (uint32_t axis = 0; axis < axis_count; axis++)
+        motion->errors[axis] = motion->major / 2;
+
+    motion->steps_remaining = motion->major;
+}
+
+/**
+ * @brief Starts a linear move of the axes from rest
+ *
+ * @param motion the motion
+ * @param table the ramp of the major axis
+ * @param deltas the steps of each axis, at most INT32_MAX
+ * @param axis_count number of axes, at most STEPPER_MAX_AXES
+ */
+void stepper_motion_start(stepper_motion_t *motion, const stepper_ramp_table_t *table, const uint32_t *deltas, uint32_t axis_count)
+{
+    stepper_motion_chain(motion, deltas, axis_count);
+
+    motion->exit_index = 0;
+
+    stepper_ramp_start(&motion->ramp, table);
+}
+
+/**
+ * @brief Starts a motion that runs until it is stopped
+ *
+ * @param motion the motion
+ * @param table the ramp of the axes
+ * @param axes bit mask of the axes that step on every tick
+ */
+void stepper_motion_start_continuous(stepper_motion_t *motion, const stepper_ramp_table_t *table, uint32_t axes)
+{
+    motion->axis_count = 0;
+    motion->major = 0;
+    motion->continuous_axes = axes;
+    motion->steps_remaining = -1;
+    motion->exit_index = 0;
+
+    stepper_ramp_start(&motion->ramp, table);
+}
+
+/**
+ * @brief Tick source of a motion, see stepper_tick_source_t
+ *
+ * @param context pointer to a stepper_motion_t
+ * @param tick pointer to store the next tick
+ * @return true if a tick was produced, false if the motion is finished
+ */
+bool IRAM_ATTR stepper_motion_next(void *context, stepper_tick_t *tick)
+{
+    stepper_motion_t *motion = (stepper_motion_t *)context;
+
+    if (motion->steps_remaining == 0)
+        return false;
+
+    // the ramp stops at the exit index as if the motion went on for that many steps
+    int32_t steps_remaining = motion->steps_remaining;
+
+    if (steps_remaining > 0)
+        steps_remaining = (uint32_t)steps_remaining > INT32_MAX - motion->exit_index ? INT32_MAX : steps_remaining + (int32_t)motion->exit_index;
+
+    tick->interval_us = stepper_ramp_next(&motion->ramp, steps_remaining);
+
+    tick->axes = motion->continuous_axes;
+
+    for (uint32_t axis = 0; axis < motion->axis_count; axis++)
+    {
+        // error + delta < 2 * major, fits as long as the steps fit an int32_t
+        motion->errors[axis] += motion->deltas[axis];
+
+        if (motion->errors[axis] >= motion->major)
+        {
+            motion->errors[axis] -= motion->major;
+            tick->axes |= 1UL << axis;
+        }
+    }
+
+    if (motion->steps_remaining > 0)
+        motion->steps_remaining--;
+
+    return true;
+}
+
+/**
+ * @brief Decelerates the motion to rest as fast as the ramp allows, the steps left are dropped
+ *
+ * @details a move is cut short, its axes stop wherever the interpolation is
+ *
+ * @param motion the motion
+ */
+void IRAM_ATTR stepper_motion_stop(stepper_motion_t *motion)
+{
+    motion->exit_index = 0;
+
+    if (motion->steps_remaining < 0 || (uint32_t)motion->steps_remaining > motion->ramp.index)
+        motion->steps_remaining = motion->ramp.index;
+}
@@ -0,0 +1,302 @@
+/// @file
+#include "stepper_planner.h"
+
+#include <math.h>
+
+#include <esp_attr.h>
+
+/**
+ * @brief Initializes an empty planner
+ *
+ * @param planner the planner
+ * @param table the ramp of the segments, the speeds at the junctions are indices of this table
+ * @param axis_count number of axes, at most STEPPER_MAX_AXES
+ * @param junction_speed largest change of the speed of an axis at a junction in steps / second
+ */
+void stepper_planner_init(stepper_planner_t *planner, const stepper_ramp_table_t *table, uint32_t axis_count, uint32_t junction_speed)
+{
+    planner->table = table;
+    planner->axis_count = axis_count;
+    planner->junction_speed = junction_speed;
+    planner->stream_directions = 0;
+
+    stepper_planner_clear(planner);
+}
+
+/**
+ * @brief Drops the queued segments, only while the step generation backend is stopped
+ *
+ * @details the directions of the next segments are compared to the ones of the last stream, the level of the direction pins
+ *
+ * @param planner the planner
+ */
+void stepper_planner_clear(stepper_planner_t *planner)
+{
+    planner->head = 0;
+    planner->tail = 0;
+    planner->active = false;
+    planner->stopping = false;
+    planner->directions = planner->stream_directions;
+}
+
+/**
+ * @brief Returns the number of queued segments including the one being executed
+ *
+ * @param planner the planner
+ * @return uint32_t number of segments
+ */
+uint32_t stepper_planner_queued(const stepper_planner_t *planner)
+{
+    return planner->head - __atomic_load_n(&planner->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the number of segments that can be pushed
+ *
+ * @param planner the planner
+ * @return uint32_t number of free slots of the queue
+ */
+uint32_t stepper_planner_free(const stepper_planner_t *planner)
+{
+    return STEPPER_PLANNER_LENGTH - stepper_planner_queued(planner);
+}
+
+/**
+ * @brief Returns the highest ramp index the step clock may run at to stay below a speed
+ *
+ * @details the first step of a segment entered at index k takes the k-th interval of the table
+ *
+ * @param table the ramp
+ * @param speed the speed in steps / second
+ * @return uint32_t the ramp index, 0 to start from rest
+ */
+static uint32_t stepper_planner_speed_index(const stepper_ramp_table_t *table, float speed)
+{
+    float interval = 1000000 / speed;
+    uint32_t low = 0;
+    uint32_t high = table->length;
+
+    // the intervals decrease along the table, the cruise interval is the shortest
+    while (low < high)
+    {
+        uint32_t index = (low + high + 1) / 2;
+        uint32_t index_interval = index < table->length ? table->intervals[index] : table->cruise_interval;
+
+        if (index_interval >= interval)
+            low = index;
+        else
+            high = index - 1;
+    }
+
+    return low;
+}
+
+/**
+ * @brief Computes the highest ramp index two segments can be joined with
+ *
+ * @details the step clock runs through the junction, the speed of an axis jumps from v * d1 / major1 to v * d2 / major2.
+ *  The jump of every axis has to stay below the junction speed.
+ *  A change of direction stops the motion, the direction pins are only changed at rest
+ *
+ * @param planner the planner
+ * @param previous the segment before the junction
+ * @param next the segment after the junction
+ * @return uint32_t the ramp index
+ */
+static uint32_t stepper_planner_junction_index(const stepper_planner_t *planner, const stepper_segment_t *previous, const stepper_segment_t *next)
+{
+    if (previous->directions != next->directions)
+        return 0;
+
+    float change = 0;
+
+    for (uint32_t axis = 0; axis < planner->axis_count; axis++)
+    {
+        float axis_change = fabsf((float)previous->deltas[axis] / previous->major - (float)next->deltas[axis] / next->major);
+
+        if (axis_change > change)
+            change = axis_change;
+    }
+
+    // the segments are collinear
+    if (change < 1e-6f)
+        return planner->table->length;
+
+    return stepper_planner_speed_index(planner->table, planner->junction_speed / change);
+}
+
+/**
+ * @brief Raises the exit speeds of the queued segments after a segment was pushed
+ *
+ * @details backward pass from the last segment, which stops: a segment may exit at the entry speed of the next one
+ *  as long as the next one can still decelerate to its own exit. The exits only ever rise, so the tick source
+ *  can read them at any time. The pass ends at the first segment whose exit does not change
+ *
+ * @param planner the planner
+ */
+static void stepper_planner_replan(stepper_planner_t *planner)
+{
+    uint32_t tail = __atomic_load_n(&planner->tail, __ATOMIC_ACQUIRE);
+
+    for (uint32_t index = planner->head - 1; index != tail; index--)
+    {
+        const stepper_segment_t *next = &planner->segments[index % STEPPER_PLANNER_LENGTH];
+        stepper_segment_t *previous = &planner->segments[(index - 1) % STEPPER_PLANNER_LENGTH];
+
+        // a deceleration from index e to index x takes e - x steps
+        uint32_t exit_index = next->exit_index + next->major;
+
+        if (exit_index > next->junction_index)
+            exit_index = next->junction_index;
+
+        if (exit_index <= previous->exit_index)
+            break;
+
+        __atomic_store_n(&previous->exit_index, exit_index, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Appends a segment to the queue and plans the junction speeds
+ *
+ * @details axes that do not move keep the direction of the previous segment.
+ *  A segment without steps is dropped
+ *
+ * @param planner the planner
+ * @param deltas the steps of each axis, at most INT32_MAX
+ * @param directions bit mask of the axes moving forward
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_NO_MEM if the queue is full
+ */
+esp_err_t stepper_planner_push(stepper_planner_t *planner, const uint32_t *deltas, uint32_t directions)
+{
+    if (stepper_planner_free(planner) == 0)
+        return ESP_ERR_NO_MEM;
+
+    stepper_segment_t *segment = &planner->segments[planner->head % STEPPER_PLANNER_LENGTH];
+    uint32_t moving = 0;
+
+    segment->major = 0;
+
+    for (uint32_t axis = 0; axis < planner->axis_count; axis++)
+    {
+        segment->deltas[axis] = deltas[axis];
+
+        if (deltas[axis] > segment->major)
+            segment->major = deltas[axis];
+
+        if (deltas[axis] != 0)
+            moving |= 1UL << axis;
+    }
+
+    if (segment->major == 0)
+        return ESP_OK;
+
+    segment->directions = (directions & moving) | (planner->directions & ~moving);
+    segment->exit_index = 0;
+
+    if (stepper_planner_queued(planner) == 0)
+        segment->junction_index = 0;
+    else
+        segment->junction_index = stepper_planner_junction_index(
+            planner,
+            &planner->segments[(planner->head - 1) % STEPPER_PLANNER_LENGTH],
+            segment);
+
+    planner->directions = segment->directions;
+
+    // publish the segment before the exits are raised, the tick source must find it once it sees a raised exit
+    __atomic_store_n(&planner->head, planner->head + 1, __ATOMIC_RELEASE);
+
+    stepper_planner_replan(planner);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Prepares a stream of segments starting from rest, call before starting the backend with stepper_planner_next()
+ *
+ * @param planner the planner
+ * @param directions pointer to store the directions of the stream, the direction pins have to be set before it starts
+ * @return true if there are segments to execute, false if the queue is empty
+ */
+bool stepper_planner_begin(stepper_planner_t *planner, uint32_t *directions)
+{
+    if (stepper_planner_queued(planner) == 0)
+        return false;
+
+    planner->stream_directions = planner->segments[planner->tail % STEPPER_PLANNER_LENGTH].directions;
+    planner->active = false;
+    planner->stopping = false;
+
+    stepper_ramp_start(&planner->motion.ramp, planner->table);
+
+    *directions = planner->stream_directions;
+
+    return true;
+}
+
+/**
+ * @brief Tick source of the queued segments, see stepper_tick_source_t
+ *
+ * @details the segments are chained without stopping. The stream ends when the queue runs empty
+ *  or the next segment moves an axis in the other direction
+ *
+ * @param context pointer to a stepper_planner_t
+ * @param tick pointer to store the next tick
+ * @return true if a tick was produced, false if the stream is finished
+ */
+bool IRAM_ATTR stepper_planner_next(void *context, stepper_tick_t *tick)
+{
+    stepper_planner_t *planner = (stepper_planner_t *)context;
+
+    while (1)
+    {
+        stepper_segment_t *segment = &planner->segments[planner->tail % STEPPER_PLANNER_LENGTH];
+
+        if (!planner->active)
+        {
+            // a stop at a junction decelerates on the next segment, its entry was planned to allow it
+            if (planner->stopping && planner->motion.ramp.index == 0)
+                return false;
+
+            if (planner->tail == __atomic_load_n(&planner->head, __ATOMIC_ACQUIRE))
+                return false;
+
+            if (segment->directions != planner->stream_directions)
+                return false;
+
+            stepper_motion_chain(&planner->motion, segment->deltas, planner->axis_count);
+            planner->active = true;
+
+            if (planner->stopping)
+                stepper_motion_stop(&planner->motion);
+        }
+
+        // the exit may be raised while the segment runs
+        if (!planner->stopping)
+            planner->motion.exit_index = __atomic_load_n(&segment->exit_index, __ATOMIC_ACQUIRE);
+
+        if (stepper_motion_next(&planner->motion, tick))
+            return true;
+
+        planner->active = false;
+        __atomic_store_n(&planner->tail, planner->tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Decelerates the stream to rest, called from the tick source, see stepper_motion_stop()
+ *
+ * @details the executed segment is cut short and the stream ends with it, or with the next one
+ *  if the executed segment ends before the motion is at rest.
+ *  The queue has to be cleared with stepper_planner_clear() once the backend stopped
+ *
+ * @param planner the planner
+ */
+void IRAM_ATTR stepper_planner_stop(stepper_planner_t *planner)
+{
+    planner->stopping = true;
+
+    if (planner->active)
+        stepper_motion_stop(&planner->motion);
+}
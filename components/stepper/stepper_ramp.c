@@ -0,0 +1,230 @@
+/// @file
+#include "stepper_ramp.h"
+
+#include <math.h>
+
+#include <esp_attr.h>
+
+/// @brief Fractional bits of the intervals of the integer recurrence
+#define STEPPER_RAMP_Q 8
+
+/// @brief The step clock, 1 tick is 1 us
+#define STEPPER_RAMP_CLOCK_HZ 1000000ULL
+
+/// @brief Most Newton iterations spent on the interval of one step of an S-curve
+#define STEPPER_RAMP_NEWTON_ITERATIONS 8
+
+/**
+ * @brief Integer square root
+ *
+ * @param value the value
+ * @return uint64_t the square root rounded down
+ */
+static uint64_t stepper_ramp_isqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/**
+ * @brief Builds a trapezoidal ramp with the Austin recurrence
+ *
+ * @details c0 = 0.676 * f * sqrt(2 / a), c(n) = c(n - 1) - 2 * c(n - 1) / (4n + 1).
+ *  The factor 0.676 corrects the error of the recurrence at the first step.
+ *  The intervals are computed in Q8 us using integer math only
+ *
+ * @param table the table
+ * @param acceleration the acceleration in steps / s^2
+ */
+static void stepper_ramp_build_trapezoid(stepper_ramp_table_t *table, uint32_t acceleration)
+{
+    // f * sqrt(2 / a) in Q8: sqrt(2 * f^2 * 2^16 / a)
+    uint64_t interval = stepper_ramp_isqrt((2 * STEPPER_RAMP_CLOCK_HZ * STEPPER_RAMP_CLOCK_HZ << (2 * STEPPER_RAMP_Q)) / acceleration);
+    interval = interval * 676 / 1000;
+
+    uint64_t cruise = (uint64_t)table->cruise_interval << STEPPER_RAMP_Q;
+
+    for (uint32_t n = 0; n < STEPPER_RAMP_TABLE_SIZE && interval > cruise; n++)
+    {
+        table->intervals[n] = (interval + (1 << (STEPPER_RAMP_Q - 1))) >> STEPPER_RAMP_Q;
+        table->length = n + 1;
+
+        interval -= 2 * interval / (4 * n + 5);
+    }
+}
+
+/**
+ * @brief Builds an S-curve ramp, the acceleration rises and falls with the jerk
+ *
+ * @details the kinematics of each step are integrated with constant jerk,
+ *  the interval is the time the motor takes to travel one step: v*t + a*t^2/2 + j*t^3/6 = 1.
+ *  The acceleration starts to fall when the speed would overshoot the cruise speed otherwise.
+ *  The table is built once per change of the parameters, the math is done in floating point
+ *
+ * @param table the table
+ * @param max_speed the cruise speed in steps / s
+ * @param acceleration the maximum acceleration in steps / s^2
+ * @param jerk the jerk in steps / s^3
+ */
+static void stepper_ramp_build_s_curve(stepper_ramp_table_t *table, uint32_t max_speed, uint32_t acceleration, uint32_t jerk)
+{
+    float v = 0;
+    float a = 0;
+    const float v_max = max_speed;
+    const float a_max = acceleration;
+    const float j_max = jerk;
+
+    for (uint32_t n = 0; n < STEPPER_RAMP_TABLE_SIZE; n++)
+    {
+        float j;
+
+        // speed gained while the acceleration falls to zero
+        if (v + a * a / (2 * j_max) >= v_max)
+            j = -j_max;
+        else if (a < a_max)
+            j = j_max;
+        else
+            j = 0;
+
+        float t = v > 0 ? 1 / v : cbrtf(6 / j_max);
+
+        for (int i = 0; i < STEPPER_RAMP_NEWTON_ITERATIONS; i++)
+        {
+            float f = ((j * t / 6 + a / 2) * t + v) * t - 1;
+            float df = (j * t / 2 + a) * t + v;
+
+            if (df <= 0)
+                break;
+
+            t -= f / df;
+        }
+
+        uint32_t interval = t * STEPPER_RAMP_CLOCK_HZ + 0.5f;
+
+        if (interval <= table->cruise_interval)
+            return;
+
+        table->intervals[n] = interval;
+        table->length = n + 1;
+
+        v += (a + j * t / 2) * t;
+        a += j * t;
+
+        if (a > a_max)
+            a = a_max;
+
+        if (a < 0 || v >= v_max)
+            return;
+    }
+}
+
+/**
+ * @brief Builds the ramp of the motions
+ *
+ * @details an acceleration of 0 disables the ramp, the motor starts at the cruise speed.
+ *  A jerk of 0 builds a trapezoidal profile, otherwise an S-curve.
+ *  If the acceleration to the cruise speed does not fit the table, the cruise speed is lowered to the last interval of the table
+ *
+ * @param table the table
+ * @param max_speed the cruise speed in steps / s
+ * @param acceleration the acceleration in steps / s^2
+ * @param jerk the jerk in steps / s^3
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the speed is 0
+ */
+esp_err_t stepper_ramp_build(stepper_ramp_table_t *table, uint32_t max_speed, uint32_t acceleration, uint32_t jerk)
+{
+    if (max_speed == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    table->length = 0;
+    table->cruise_interval = STEPPER_RAMP_CLOCK_HZ / max_speed;
+
+    if (table->cruise_interval == 0)
+        table->cruise_interval = 1;
+
+    table->truncated = false;
+
+    if (acceleration == 0)
+        return ESP_OK;
+
+    if (jerk == 0)
+        stepper_ramp_build_trapezoid(table, acceleration);
+    else
+        stepper_ramp_build_s_curve(table, max_speed, acceleration, jerk);
+
+    if (table->length == STEPPER_RAMP_TABLE_SIZE && table->intervals[STEPPER_RAMP_TABLE_SIZE - 1] > table->cruise_interval)
+    {
+        table->cruise_interval = table->intervals[STEPPER_RAMP_TABLE_SIZE - 1];
+        table->truncated = true;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Starts a motion from rest
+ *
+ * @param ramp the ramp position
+ * @param table the ramp of the motion
+ */
+void stepper_ramp_start(stepper_ramp_t *ramp, const stepper_ramp_table_t *table)
+{
+    ramp->table = table;
+    ramp->index = 0;
+}
+
+/**
+ * @brief Returns the interval of the next step
+ *
+ * @details the motion accelerates along the table, cruises at its end
+ *  and walks the table backwards once the remaining steps are just enough to stop.
+ *  The deceleration mirrors the acceleration, so the intervals of a motion read the same backwards.
+ *  A short motion that cannot reach the cruise speed holds its speed for a step if needed to stay symmetric
+ *
+ * @param ramp the ramp position
+ * @param steps_remaining the steps left including this one, negative if the motion runs until stopped
+ * @return uint32_t the interval from this step to the next one in us
+ */
+uint32_t IRAM_ATTR stepper_ramp_next(stepper_ramp_t *ramp, int32_t steps_remaining)
+{
+    const stepper_ramp_table_t *table = ramp->table;
+    bool infinite = steps_remaining < 0;
+    uint32_t remaining = steps_remaining;
+
+    // decelerate, the steps after this one are just enough to walk the table back to rest
+    if (!infinite && remaining <= ramp->index)
+    {
+        ramp->index--;
+
+        return table->intervals[ramp->index];
+    }
+
+    // cruise
+    if (ramp->index >= table->length)
+        return table->cruise_interval;
+
+    // accelerate if the motion can still stop after the step
+    if (infinite || remaining >= ramp->index + 2)
+        return table->intervals[ramp->index++];
+
+    // hold the speed
+    return table->intervals[ramp->index > 0 ? ramp->index - 1 : 0];
+}
@@ -0,0 +1,437 @@
+/// @file
+#include "stepper_backend.h"
+
+#include <esp_log.h>
+#include <esp_check.h>
+#include <esp_attr.h>
+#include <driver/rmt_tx.h>
+#include <soc/soc_caps.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "stepper_encoder.h"
+
+#define MIN(a, b) ((a) < (b)) ? (a) : (b)
+
+/// @brief Number of symbol blocks, the next block is queued while the current one is transmitted
+#define STEPPER_RMT_BLOCKS 2
+
+/// @brief The step clock, 1 tick is 1 us
+#define STEPPER_RMT_RESOLUTION_HZ 1000000
+
+/// @brief Time to wait for the refill task to abort a motion
+#define STEPPER_RMT_STOP_TIMEOUT_MS 100
+
+static const char *TAG = "Stepper RMT";
+
+/// @brief One channel per axis
+static rmt_channel_handle_t stepper_rmt_channels[STEPPER_MAX_AXES] = {NULL};
+static size_t stepper_rmt_axis_count = 0;
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+/// @brief Starts the blocks of the axes together
+static rmt_sync_manager_handle_t stepper_rmt_sync = NULL;
+#endif
+
+/// @brief Copies the blocks into the RMT memory, the blocks are already encoded
+static rmt_encoder_handle_t stepper_rmt_copy_encoder = NULL;
+
+static stepper_symbol_t stepper_rmt_symbols[STEPPER_RMT_BLOCKS][CONFIG_STEPPER_AXIS_COUNT][CONFIG_STEPPER_RMT_BLOCK_SYMBOLS];
+
+/// @brief Index of the blocks to fill next, the blocks are transmitted in order
+static size_t stepper_rmt_next_block = 0;
+
+/// @brief Number of blocks of all axes queued in the RMT driver, decremented from the transmit done interrupt
+static uint32_t stepper_rmt_in_flight = 0;
+
+/// @brief Duration of the steps last encoded into each block in us, the blocks of the axes have the same timing
+static uint32_t stepper_rmt_block_us[STEPPER_RMT_BLOCKS] = {0};
+
+static stepper_encoder_t stepper_rmt_encoder;
+
+static stepper_tick_source_t stepper_rmt_source = NULL;
+static stepper_done_callback_t stepper_rmt_done = NULL;
+static void *stepper_rmt_context = NULL;
+
+static bool stepper_rmt_running = false;
+static bool stepper_rmt_stop_requested = false;
+
+/// @brief Refills the blocks and finishes the motions
+static TaskHandle_t stepper_rmt_task_handle = NULL;
+
+/// @brief Given by the refill task when a motion finished or was stopped
+static SemaphoreHandle_t stepper_rmt_stopped = NULL;
+
+/**
+ * @brief Transmit done callback of the RMT driver, called from the RMT interrupt
+ *
+ * @details the block is free again, the refill task is woken up to fill it
+ *
+ * @param channel the RMT channel
+ * @param event the transmit done event
+ * @param context unused
+ * @return true if a higher priority task was woken up
+ */
+static bool IRAM_ATTR stepper_rmt_transmit_done(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t *event, void *context)
+{
+    BaseType_t woken = pdFALSE;
+
+    __atomic_sub_fetch(&stepper_rmt_in_flight, 1, __ATOMIC_RELEASE);
+
+    vTaskNotifyGiveFromISR(stepper_rmt_task_handle, &woken);
+
+    return woken == pdTRUE;
+}
+
+/// @brief Ends the current motion and notifies the owner of the motion
+static void stepper_rmt_finish()
+{
+    __atomic_store_n(&stepper_rmt_running, false, __ATOMIC_RELEASE);
+
+    if (stepper_rmt_done != NULL)
+        stepper_rmt_done(stepper_rmt_context);
+
+    xSemaphoreGive(stepper_rmt_stopped);
+}
+
+/**
+ * @brief Disables and enables the channels, drops the queued blocks
+ */
+static void stepper_rmt_abort()
+{
+    for (size_t axis = 0; axis < stepper_rmt_axis_count; axis++)
+        rmt_disable(stepper_rmt_channels[axis]);
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    if (stepper_rmt_sync != NULL)
+        rmt_sync_reset(stepper_rmt_sync);
+#endif
+
+    for (size_t axis = 0; axis < stepper_rmt_axis_count; axis++)
+        rmt_enable(stepper_rmt_channels[axis]);
+
+    __atomic_store_n(&stepper_rmt_in_flight, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Adds up the durations of the symbols of a block
+ *
+ * @param block the block
+ * @param count number of symbols
+ * @return uint32_t the duration in us
+ */
+static uint32_t stepper_rmt_block_duration(const stepper_symbol_t *block, size_t count)
+{
+    uint32_t duration_us = 0;
+
+    for (size_t i = 0; i < count; i++)
+        duration_us += block[i].duration0 + block[i].duration1;
+
+    return duration_us;
+}
+
+/// @brief Fills the free blocks and queues them for transmission, the blocks of the axes are queued together
+static void stepper_rmt_refill()
+{
+    rmt_transmit_config_t config = {
+        .loop_count = 0,
+    };
+
+    while (__atomic_load_n(&stepper_rmt_in_flight, __ATOMIC_ACQUIRE) + stepper_rmt_axis_count <= STEPPER_RMT_BLOCKS * stepper_rmt_axis_count)
+    {
+        stepper_symbol_t *blocks[STEPPER_MAX_AXES];
+
+        for (size_t axis = 0; axis < stepper_rmt_axis_count; axis++)
+            blocks[axis] = stepper_rmt_symbols[stepper_rmt_next_block][axis];
+
+        size_t count = stepper_encoder_fill(&stepper_rmt_encoder, stepper_rmt_source, stepper_rmt_context, blocks, CONFIG_STEPPER_RMT_BLOCK_SYMBOLS);
+
+        if (count == 0)
+            return;
+
+        __atomic_store_n(&stepper_rmt_block_us[stepper_rmt_next_block], stepper_rmt_block_duration(blocks[0], count), __ATOMIC_RELEASE);
+
+        __atomic_add_fetch(&stepper_rmt_in_flight, stepper_rmt_axis_count, __ATOMIC_RELEASE);
+
+        for (size_t axis = 0; axis < stepper_rmt_axis_count; axis++)
+        {
+            int ret = rmt_transmit(stepper_rmt_channels[axis], stepper_rmt_copy_encoder, blocks[axis], count * sizeof(stepper_symbol_t), &config);
+
+            if (ret != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Unable to transmit steps of axis %u: %s", axis, esp_err_to_name(ret));
+
+                // the axes are out of step, drop everything
+                stepper_rmt_abort();
+                stepper_rmt_encoder.done = true;
+
+                return;
+            }
+        }
+
+        stepper_rmt_next_block = (stepper_rmt_next_block + 1) % STEPPER_RMT_BLOCKS;
+    }
+}
+
+/**
+ * @brief Task code of the refill task
+ *
+ * @details the task is woken up when a motion starts, a block was transmitted or a stop is requested.
+ *  The motion is finished once the source is exhausted and every block was transmitted
+ */
+static void stepper_rmt_task()
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (!__atomic_load_n(&stepper_rmt_running, __ATOMIC_ACQUIRE))
+            continue;
+
+        if (__atomic_load_n(&stepper_rmt_stop_requested, __ATOMIC_ACQUIRE))
+        {
+            stepper_rmt_abort();
+            stepper_rmt_finish();
+            continue;
+        }
+
+        stepper_rmt_refill();
+
+        if (stepper_rmt_encoder.done && __atomic_load_n(&stepper_rmt_in_flight, __ATOMIC_ACQUIRE) == 0)
+            stepper_rmt_finish();
+    }
+}
+
+/**
+ * @brief Deletes the channels, the encoder and the refill task
+ */
+static void stepper_rmt_cleanup()
+{
+    if (stepper_rmt_task_handle != NULL)
+        vTaskDelete(stepper_rmt_task_handle);
+
+    if (stepper_rmt_stopped != NULL)
+        vSemaphoreDelete(stepper_rmt_stopped);
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    if (stepper_rmt_sync != NULL)
+        rmt_del_sync_manager(stepper_rmt_sync);
+
+    stepper_rmt_sync = NULL;
+#endif
+
+    if (stepper_rmt_copy_encoder != NULL)
+        rmt_del_encoder(stepper_rmt_copy_encoder);
+
+    for (size_t axis = 0; axis < STEPPER_MAX_AXES; axis++)
+    {
+        if (stepper_rmt_channels[axis] != NULL)
+            rmt_del_channel(stepper_rmt_channels[axis]);
+
+        stepper_rmt_channels[axis] = NULL;
+    }
+
+    stepper_rmt_task_handle = NULL;
+    stepper_rmt_stopped = NULL;
+    stepper_rmt_copy_encoder = NULL;
+    stepper_rmt_axis_count = 0;
+}
+
+/**
+ * @brief Initializes the RMT step generation backend
+ *
+ * @details every step pin is driven by an RMT channel at 1 MHz.
+ *  The ticks of a motion are encoded into blocks of CONFIG_STEPPER_RMT_BLOCK_SYMBOLS symbols per axis,
+ *  one block is transmitted while the refill task fills the other one.
+ *  The channels of multiple axes are started together by a sync manager
+ *
+ * @param pins_step numbers of the step pins of the axes
+ * @param axis_count number of axes, at most CONFIG_STEPPER_AXIS_COUNT
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_ARG if the number of axes is not supported,
+ *                      error code of the RMT driver otherwise
+ */
+esp_err_t stepper_backend_init(const uint8_t *pins_step, size_t axis_count)
+{
+    if (stepper_rmt_axis_count != 0)
+        return ESP_ERR_INVALID_STATE;
+
+    ESP_RETURN_ON_FALSE(axis_count >= 1 && axis_count <= CONFIG_STEPPER_AXIS_COUNT, ESP_ERR_INVALID_ARG, TAG, "Unsupported number of axes");
+
+#if !SOC_RMT_SUPPORT_TX_SYNCHRO
+    ESP_RETURN_ON_FALSE(axis_count == 1, ESP_ERR_INVALID_ARG, TAG, "The RMT channels of this chip cannot be synchronized");
+#endif
+
+    int ret;
+
+    stepper_rmt_axis_count = axis_count;
+
+    for (size_t axis = 0; axis < axis_count; axis++)
+    {
+        rmt_tx_channel_config_t channel_config = {
+            .gpio_num = pins_step[axis],
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = STEPPER_RMT_RESOLUTION_HZ,
+            .mem_block_symbols = CONFIG_STEPPER_RMT_MEM_SYMBOLS,
+            .trans_queue_depth = STEPPER_RMT_BLOCKS,
+#ifdef CONFIG_STEPPER_RMT_WITH_DMA
+            .flags.with_dma = true,
+#endif
+        };
+
+        ESP_GOTO_ON_ERROR(rmt_new_tx_channel(&channel_config, &stepper_rmt_channels[axis]), cleanup, TAG, "Unable to create RMT channel");
+
+        rmt_tx_event_callbacks_t callbacks = {
+            .on_trans_done = stepper_rmt_transmit_done,
+        };
+
+        ESP_GOTO_ON_ERROR(rmt_tx_register_event_callbacks(stepper_rmt_channels[axis], &callbacks, NULL), cleanup, TAG, "Unable to register callbacks");
+
+        ESP_GOTO_ON_ERROR(rmt_enable(stepper_rmt_channels[axis]), cleanup, TAG, "Unable to enable RMT channel");
+    }
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    if (axis_count > 1)
+    {
+        rmt_sync_manager_config_t sync_config = {
+            .tx_channel_array = stepper_rmt_channels,
+            .array_size = axis_count,
+        };
+
+        ESP_GOTO_ON_ERROR(rmt_new_sync_manager(&sync_config, &stepper_rmt_sync), cleanup, TAG, "Unable to synchronize RMT channels");
+    }
+#endif
+
+    rmt_copy_encoder_config_t encoder_config = {};
+
+    ESP_GOTO_ON_ERROR(rmt_new_copy_encoder(&encoder_config, &stepper_rmt_copy_encoder), cleanup, TAG, "Unable to create encoder");
+
+    stepper_rmt_stopped = xSemaphoreCreateBinary();
+
+    ESP_GOTO_ON_FALSE(stepper_rmt_stopped != NULL, ESP_ERR_NO_MEM, cleanup, TAG, "Unable to create semaphore");
+
+    ESP_GOTO_ON_FALSE(
+        xTaskCreate(
+            stepper_rmt_task,
+            TAG,
+            CONFIG_STEPPER_BACKEND_TASK_STACK_DEPTH,
+            NULL,
+            MIN(CONFIG_STEPPER_BACKEND_TASK_PRIO, configMAX_PRIORITIES - 1),
+            &stepper_rmt_task_handle) == pdPASS,
+        ESP_ERR_NO_MEM,
+        cleanup,
+        TAG,
+        "Unable to start refill task");
+
+    return ESP_OK;
+
+cleanup:
+    stepper_rmt_cleanup();
+
+    return ret;
+}
+
+/**
+ * @brief Starts a motion
+ *
+ * @details the source is called from the refill task, the done callback too
+ *
+ * @param source the source of the ticks of the motion
+ * @param done called when the motion finished or was stopped, can be NULL
+ * @param context passed to the source and the done callback
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if the backend is not initialized or a motion is running
+ */
+esp_err_t stepper_backend_start(stepper_tick_source_t source, stepper_done_callback_t done, void *context)
+{
+    if (stepper_rmt_axis_count == 0 || stepper_backend_is_running())
+        return ESP_ERR_INVALID_STATE;
+
+    stepper_rmt_source = source;
+    stepper_rmt_done = done;
+    stepper_rmt_context = context;
+
+    stepper_encoder_init(&stepper_rmt_encoder, CONFIG_STEPPER_PULSE_WIDTH_US, stepper_rmt_axis_count);
+
+    for (size_t block = 0; block < STEPPER_RMT_BLOCKS; block++)
+        stepper_rmt_block_us[block] = 0;
+
+    // drop the notice of the previous motion
+    xSemaphoreTake(stepper_rmt_stopped, 0);
+
+    __atomic_store_n(&stepper_rmt_stop_requested, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&stepper_rmt_running, true, __ATOMIC_RELEASE);
+
+    xTaskNotifyGive(stepper_rmt_task_handle);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stops the running motion immediately, the queued steps are dropped
+ *
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_STATE if no motion is running,
+ *                      ESP_ERR_TIMEOUT if the refill task did not stop the motion in time
+ */
+esp_err_t stepper_backend_stop()
+{
+    if (!stepper_backend_is_running())
+        return ESP_ERR_INVALID_STATE;
+
+    __atomic_store_n(&stepper_rmt_stop_requested, true, __ATOMIC_RELEASE);
+
+    xTaskNotifyGive(stepper_rmt_task_handle);
+
+    // the motion might have finished on its own in the meantime, that gives the semaphore too
+    if (xSemaphoreTake(stepper_rmt_stopped, pdMS_TO_TICKS(STEPPER_RMT_STOP_TIMEOUT_MS)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Checks if a motion is running
+ *
+ * @return true if a motion is running
+ */
+bool stepper_backend_is_running()
+{
+    return __atomic_load_n(&stepper_rmt_running, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the time of the steps taken from the tick source that are not transmitted yet
+ *
+ * @details the steps are encoded up to STEPPER_RMT_BLOCKS blocks ahead of the pulses.
+ *  The whole duration of every block counts, so the time is an upper bound.
+ *  A block encoded while this is called counts with the duration of the block it replaces
+ *
+ * @return uint32_t the time in us, 0 if no motion is running
+ */
+uint32_t stepper_backend_queued_us()
+{
+    if (!stepper_backend_is_running())
+        return 0;
+
+    uint32_t queued_us = 0;
+
+    for (size_t block = 0; block < STEPPER_RMT_BLOCKS; block++)
+        queued_us += __atomic_load_n(&stepper_rmt_block_us[block], __ATOMIC_ACQUIRE);
+
+    return queued_us;
+}
+
+/**
+ * @brief The edges are timed by the RMT peripheral, there is no software jitter to measure
+ *
+ * @param stats unused
+ * @param reset unused
+ * @return esp_err_t ESP_ERR_NOT_SUPPORTED
+ */
+esp_err_t stepper_backend_get_stats(stepper_backend_stats_t *stats, bool reset)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
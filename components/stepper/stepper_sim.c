@@ -0,0 +1,190 @@
+/// @file
+#include "stepper_backend.h"
+#include "stepper_sim.h"
+
+#include "stepper_encoder.h"
+
+// the simulation runs the encoder of the RMT backend on the host and decodes the symbols into a pulse timeline
+
+#ifndef CONFIG_STEPPER_RMT_BLOCK_SYMBOLS
+#define CONFIG_STEPPER_RMT_BLOCK_SYMBOLS 128
+#endif
+
+#ifndef CONFIG_STEPPER_PULSE_WIDTH_US
+#define CONFIG_STEPPER_PULSE_WIDTH_US 5
+#endif
+
+static stepper_sim_pulse_t stepper_sim_timeline[STEPPER_SIM_MAX_PULSES];
+
+static size_t stepper_sim_pulse_count = 0;
+
+static size_t stepper_sim_axis_count = 0;
+
+/// @brief Simulated time, the end of the last decoded symbol
+static uint64_t stepper_sim_now_us = 0;
+
+static bool stepper_sim_initialized = false;
+static bool stepper_sim_stop_requested = false;
+
+/// @brief Clears the recorded pulses and the simulated time
+void stepper_sim_reset()
+{
+    stepper_sim_pulse_count = 0;
+    stepper_sim_now_us = 0;
+}
+
+/**
+ * @brief Returns the recorded pulses
+ *
+ * @param count pointer to store the number of pulses
+ * @return const stepper_sim_pulse_t* the pulses in the order of their rising edges
+ */
+const stepper_sim_pulse_t *stepper_sim_pulses(size_t *count)
+{
+    *count = stepper_sim_pulse_count;
+
+    return stepper_sim_timeline;
+}
+
+/**
+ * @brief Returns the simulated time
+ *
+ * @return uint64_t the time in us since stepper_sim_reset()
+ */
+uint64_t stepper_sim_time_us()
+{
+    return stepper_sim_now_us;
+}
+
+/**
+ * @brief Decodes the blocks of the axes into the timeline, like the synchronized RMT channels would transmit them
+ *
+ * @details the axes share the timing of the first axis, the encoder writes the same durations into every block
+ *
+ * @param blocks the blocks of the axes
+ * @param count the number of symbols of each block
+ */
+static void stepper_sim_transmit(stepper_symbol_t *const *blocks, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t axes = 0;
+
+        for (size_t axis = 0; axis < stepper_sim_axis_count; axis++)
+            axes |= blocks[axis][i].level0 << axis;
+
+        if (axes != 0 && stepper_sim_pulse_count < STEPPER_SIM_MAX_PULSES)
+        {
+            stepper_sim_timeline[stepper_sim_pulse_count].time_us = stepper_sim_now_us;
+            stepper_sim_timeline[stepper_sim_pulse_count].width_us = blocks[0][i].duration0;
+            stepper_sim_timeline[stepper_sim_pulse_count].axes = axes;
+            stepper_sim_pulse_count++;
+        }
+
+        stepper_sim_now_us += blocks[0][i].duration0 + blocks[0][i].duration1;
+    }
+}
+
+/**
+ * @brief Initializes the simulation backend
+ *
+ * @param pins_step unused
+ * @param axis_count number of axes
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the number of axes is not supported
+ */
+esp_err_t stepper_backend_init(const uint8_t *pins_step, size_t axis_count)
+{
+    (void)pins_step;
+
+    if (axis_count < 1 || axis_count > STEPPER_MAX_AXES)
+        return ESP_ERR_INVALID_ARG;
+
+    stepper_sim_axis_count = axis_count;
+    stepper_sim_initialized = true;
+    stepper_sim_reset();
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Runs a motion to its end in simulated time
+ *
+ * @details the ticks are encoded in blocks of CONFIG_STEPPER_RMT_BLOCK_SYMBOLS symbols like on the RMT backend.
+ *  The motion runs synchronously, the done callback is called before the function returns
+ *
+ * @param source the source of the ticks of the motion
+ * @param done called when the motion finished, can be NULL
+ * @param context passed to the source and the done callback
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if the backend is not initialized
+ */
+esp_err_t stepper_backend_start(stepper_tick_source_t source, stepper_done_callback_t done, void *context)
+{
+    static stepper_symbol_t symbols[STEPPER_MAX_AXES][CONFIG_STEPPER_RMT_BLOCK_SYMBOLS];
+    stepper_symbol_t *const blocks[STEPPER_MAX_AXES] = {symbols[0], symbols[1], symbols[2], symbols[3]};
+    stepper_encoder_t encoder;
+
+    if (!stepper_sim_initialized)
+        return ESP_ERR_INVALID_STATE;
+
+    stepper_encoder_init(&encoder, CONFIG_STEPPER_PULSE_WIDTH_US, stepper_sim_axis_count);
+    stepper_sim_stop_requested = false;
+
+    while (!stepper_sim_stop_requested)
+    {
+        size_t count = stepper_encoder_fill(&encoder, source, context, blocks, CONFIG_STEPPER_RMT_BLOCK_SYMBOLS);
+
+        if (count == 0)
+            break;
+
+        stepper_sim_transmit(blocks, count);
+    }
+
+    if (done != NULL)
+        done(context);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stops the simulated motion after the current block, can be called from the source
+ *
+ * @return esp_err_t ESP_OK
+ */
+esp_err_t stepper_backend_stop()
+{
+    stepper_sim_stop_requested = true;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The simulated motions run synchronously, no motion is running outside stepper_backend_start()
+ *
+ * @return false
+ */
+bool stepper_backend_is_running()
+{
+    return false;
+}
+
+/**
+ * @brief The simulated motions run synchronously, no steps are left to transmit outside stepper_backend_start()
+ *
+ * @return uint32_t 0
+ */
+uint32_t stepper_backend_queued_us()
+{
+    return 0;
+}
+
+/**
+ * @brief The simulated edges are exact, there is no jitter to measure
+ *
+ * @param stats unused
+ * @param reset unused
+ * @return esp_err_t ESP_ERR_NOT_SUPPORTED
+ */
+esp_err_t stepper_backend_get_stats(stepper_backend_stats_t *stats, bool reset)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
@@ -5,7 +5,7 @@
 
 /// @brief Inter Task Communication message
 /// @details Use this struct to pass messages to and from tasks via the provided queues
-typedef struct
+typedef struct itc_message_t
 {
     /// @brief The ID of the message
     uint32_t message_id;
@@ -20,6 +20,13 @@ typedef struct
     char *response;
     const char *response_static;
     bool is_measurement;
+    /// @brief The message was generated on the MAU, nobody waits for its response
+    /// @details the message is deleted after it was processed instead of being sent back to the UART task
+    bool no_reply;
+    /// @brief The IoT Agent command message the message executes, NULL if the message is not an IoT command
+    /// @details the result of the command is reported back to the IoT Agent via the result queue.
+    ///  The command message is owned by the message and deleted with it
+    struct itc_message_t *iot_command;
 } itc_message_t;
 
 typedef struct
@@ -35,13 +42,72 @@ extern QueueHandle_t task_itc_from_uart_queue;
 extern QueueHandle_t task_intercom_fiware_measurement_queue;
 /** @brief Queue to store the commands from the FIWARE IoT Agent */
 extern QueueHandle_t task_intercom_fiware_command_queue;
+/** @brief Queue to store the executed IoT Agent commands whose result needs to be reported */
+extern QueueHandle_t task_intercom_fiware_result_queue;
+/** @brief Queue set the FIWARE task waits on, contains the measurement, the command and the result queue */
+extern QueueSetHandle_t task_intercom_fiware_queue_set;
+
+/// @brief Size of the payload buffer of a pooled message, including the terminating NUL
+#define TASK_INTERCOM_POOLED_PAYLOAD_SIZE (CONFIG_ITC_IOTA_COMMAND_MESSAGE_SIZE + 1)
+
+/// @brief Number of slots in the FIWARE queue set reserved for the members added by the FIWARE task
+/// @details the token refresh, the measurement heartbeat, the minimum interval release and the rate limit release semaphores
+#define TASK_INTERCOM_FIWARE_QUEUE_SET_RESERVED 4
+
+/// @brief Number of ITC queues reported by task_intercom_get_queue_stats()
+#define TASK_INTERCOM_QUEUE_COUNT 5
+
+/// @brief Snapshot of the usage of an ITC queue
+typedef struct
+{
+    /// @brief Name of the queue
+    const char *name;
+    /// @brief Number of messages currently in the queue
+    UBaseType_t depth;
+    /// @brief Number of messages the queue can hold
+    UBaseType_t capacity;
+    /// @brief Highest depth observed after a send via task_intercom_send()
+    UBaseType_t high_water;
+} itc_queue_stats_t;
+
+/// @brief Type of an event published to the event sink
+typedef enum
+{
+    /// @brief Measurement received from the controller
+    ITC_EVENT_MEASUREMENT,
+    /// @brief Command received from the controller or the IoT Agent
+    ITC_EVENT_COMMAND,
+    /// @brief Response sent to the controller or command result reported to the IoT Agent
+    ITC_EVENT_RESPONSE,
+    /// @brief Communication error
+    ITC_EVENT_ERROR,
+} itc_event_type_t;
+
+/**
+ * @brief Callback receiving the published events
+ * @details called from the publishing task, the callback must not block
+ */
+typedef void (*itc_event_sink_t)(itc_event_type_t type, const char *text, size_t length);
+
+/// @brief Maximum length of the text of a published event, longer texts are truncated
+#define TASK_INTERCOM_EVENT_TEXT_SIZE 120
 
 esp_err_t task_intercom_init();
 
+void task_intercom_set_event_sink(itc_event_sink_t sink);
+
+void task_intercom_publish_event(itc_event_type_t type, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+BaseType_t task_intercom_send(QueueHandle_t queue, itc_message_t *message, TickType_t ticks_to_wait);
+
+esp_err_t task_intercom_get_queue_stats(int index, itc_queue_stats_t *stats);
+
 itc_message_t *task_intercom_message_create();
 
 void task_intercom_message_init(itc_message_t *message);
 
+itc_message_t *task_intercom_message_create_pooled();
+
 esp_err_t task_itc_message_add_token(itc_message_t *message, char *token);
 
 esp_err_t task_itc_message_token_match(itc_message_t *message, int token_num, const char *match);
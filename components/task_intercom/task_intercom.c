@@ -1,6 +1,9 @@
 /// @file
 #include "task_intercom.h"
 
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
 
@@ -21,6 +24,51 @@ QueueHandle_t task_intercom_fiware_measurement_queue = NULL;
 
 QueueHandle_t task_intercom_fiware_command_queue = NULL;
 
+QueueHandle_t task_intercom_fiware_result_queue = NULL;
+
+QueueSetHandle_t task_intercom_fiware_queue_set = NULL;
+
+/// @brief Preallocated message with its own payload buffer
+typedef struct
+{
+    itc_message_t message;
+    char payload[TASK_INTERCOM_POOLED_PAYLOAD_SIZE];
+} itc_pooled_message_t;
+
+/// @brief Storage of the pooled messages
+static itc_pooled_message_t task_intercom_message_pool[CONFIG_ITC_MESSAGE_POOL_SIZE];
+
+/// @brief Queue holding the pointers to the free pooled messages
+static QueueHandle_t task_intercom_message_pool_free = NULL;
+
+/// @brief Names of the queues reported in the statistics, same order as task_intercom_queues
+static const char *task_intercom_queue_names[TASK_INTERCOM_QUEUE_COUNT] = {
+    "to_uart",
+    "from_uart",
+    "iota_measurement",
+    "iota_command",
+    "iota_result",
+};
+
+/// @brief The queues reported in the statistics
+static QueueHandle_t *task_intercom_queues[TASK_INTERCOM_QUEUE_COUNT] = {
+    &task_itc_to_uart_queue,
+    &task_itc_from_uart_queue,
+    &task_intercom_fiware_measurement_queue,
+    &task_intercom_fiware_command_queue,
+    &task_intercom_fiware_result_queue,
+};
+
+/// @brief High-water mark of every queue in task_intercom_queues
+static UBaseType_t task_intercom_queue_high_water[TASK_INTERCOM_QUEUE_COUNT] = {0};
+
+/// @brief Receiver of the published events, NULL if nobody listens
+static itc_event_sink_t task_intercom_event_sink = NULL;
+
+#define IS_POOLED_MESSAGE(message)                                         \
+    ((void *)(message) >= (void *)&task_intercom_message_pool[0] &&       \
+     (void *)(message) < (void *)&task_intercom_message_pool[CONFIG_ITC_MESSAGE_POOL_SIZE])
+
 /**
  * @brief Initializes the task intercom objects
  *
@@ -28,25 +76,168 @@ QueueHandle_t task_intercom_fiware_command_queue = NULL;
  */
 esp_err_t task_intercom_init()
 {
-    task_itc_to_uart_queue = xQueueCreate(CONFIG_ITC_UART_QUEUE_SIZE, sizeof(itc_message_t));
+    task_itc_to_uart_queue = xQueueCreate(CONFIG_ITC_UART_QUEUE_SIZE, sizeof(itc_message_t *));
 
     ESP_RETURN_ON_FALSE(task_itc_to_uart_queue != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate UART queue");
 
-    task_itc_from_uart_queue = xQueueCreate(CONFIG_ITC_MAU_QUEUE_SIZE, sizeof(itc_message_t));
+    task_itc_from_uart_queue = xQueueCreate(CONFIG_ITC_MAU_QUEUE_SIZE, sizeof(itc_message_t *));
 
     ESP_RETURN_ON_FALSE(task_itc_from_uart_queue != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate MAU queue");
 
-    task_intercom_fiware_measurement_queue = xQueueCreate(CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE, sizeof(itc_message_t));
+    task_intercom_fiware_measurement_queue = xQueueCreate(CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE, sizeof(itc_message_t *));
 
     ESP_RETURN_ON_FALSE(task_intercom_fiware_measurement_queue != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate IoT Measurement queue");
 
-    task_intercom_fiware_command_queue = xQueueCreate(CONFIG_ITC_IOTA_COMMAND_QUEUE_SIZE, sizeof(itc_message_t));
+    task_intercom_fiware_command_queue = xQueueCreate(CONFIG_ITC_IOTA_COMMAND_QUEUE_SIZE, sizeof(itc_message_t *));
 
     ESP_RETURN_ON_FALSE(task_intercom_fiware_command_queue != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate IoT Command queue");
 
+    task_intercom_message_pool_free = xQueueCreate(CONFIG_ITC_MESSAGE_POOL_SIZE, sizeof(itc_pooled_message_t *));
+
+    ESP_RETURN_ON_FALSE(task_intercom_message_pool_free != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate message pool");
+
+    for (int i = 0; i < CONFIG_ITC_MESSAGE_POOL_SIZE; i++)
+    {
+        itc_pooled_message_t *pooled = &task_intercom_message_pool[i];
+        xQueueSend(task_intercom_message_pool_free, &pooled, 0);
+    }
+
+    // every executed command can have a result waiting to be reported
+    task_intercom_fiware_result_queue = xQueueCreate(CONFIG_ITC_IOTA_COMMAND_QUEUE_SIZE, sizeof(itc_message_t *));
+
+    ESP_RETURN_ON_FALSE(task_intercom_fiware_result_queue != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate IoT Command result queue");
+
+    // the set needs one slot for every item its members can hold
+    task_intercom_fiware_queue_set = xQueueCreateSet(
+        CONFIG_ITC_IOTA_MEASUREMENT_QUEUE_SIZE +
+        2 * CONFIG_ITC_IOTA_COMMAND_QUEUE_SIZE +
+        TASK_INTERCOM_FIWARE_QUEUE_SET_RESERVED);
+
+    ESP_RETURN_ON_FALSE(task_intercom_fiware_queue_set != NULL, ESP_FAIL, TAG, "Insufficient memory to allocate FIWARE queue set");
+
+    // the queues have to be added while they are still empty
+    ESP_RETURN_ON_FALSE(
+        xQueueAddToSet(task_intercom_fiware_measurement_queue, task_intercom_fiware_queue_set) == pdPASS,
+        ESP_FAIL,
+        TAG,
+        "Unable to add IoT Measurement queue to the FIWARE queue set");
+
+    ESP_RETURN_ON_FALSE(
+        xQueueAddToSet(task_intercom_fiware_command_queue, task_intercom_fiware_queue_set) == pdPASS,
+        ESP_FAIL,
+        TAG,
+        "Unable to add IoT Command queue to the FIWARE queue set");
+
+    ESP_RETURN_ON_FALSE(
+        xQueueAddToSet(task_intercom_fiware_result_queue, task_intercom_fiware_queue_set) == pdPASS,
+        ESP_FAIL,
+        TAG,
+        "Unable to add IoT Command result queue to the FIWARE queue set");
+
     return ESP_OK;
 }
 
+/**
+ * @brief Sends a message to the back of an ITC queue and updates the high-water mark of the queue
+ *
+ * @param queue the queue to send the message to
+ * @param message the message, the receiving task takes ownership if the send succeeds
+ * @param ticks_to_wait number of ticks to wait for free space in the queue
+ * @return BaseType_t pdTRUE if the message was sent, errQUEUE_FULL otherwise
+ */
+BaseType_t task_intercom_send(QueueHandle_t queue, itc_message_t *message, TickType_t ticks_to_wait)
+{
+    BaseType_t ret = xQueueSend(queue, &message, ticks_to_wait);
+
+    if (ret != pdTRUE)
+        return ret;
+
+    // the depth is read after the send, the consumer might have already taken the message
+    UBaseType_t depth = uxQueueMessagesWaiting(queue);
+
+    for (int i = 0; i < TASK_INTERCOM_QUEUE_COUNT; i++)
+    {
+        if (*task_intercom_queues[i] != queue)
+            continue;
+
+        // the mark only grows, a racing update can only lose a value that is not the maximum
+        UBaseType_t high_water = __atomic_load_n(&task_intercom_queue_high_water[i], __ATOMIC_RELAXED);
+
+        while (depth > high_water &&
+               !__atomic_compare_exchange_n(&task_intercom_queue_high_water[i], &high_water, depth, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+
+        break;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Reads the usage statistics of an ITC queue
+ *
+ * @param index index of the queue, 0 to TASK_INTERCOM_QUEUE_COUNT - 1
+ * @param stats pointer to store the statistics
+ * @return esp_err_t    ESP_OK if successful,
+ *                      ESP_ERR_INVALID_ARG if the index is out of range,
+ *                      ESP_ERR_INVALID_STATE if the queue is not created
+ */
+esp_err_t task_intercom_get_queue_stats(int index, itc_queue_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(index >= 0 && index < TASK_INTERCOM_QUEUE_COUNT, ESP_ERR_INVALID_ARG, TAG, "Invalid queue index");
+
+    QueueHandle_t queue = *task_intercom_queues[index];
+
+    if (queue == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    stats->name = task_intercom_queue_names[index];
+    stats->depth = uxQueueMessagesWaiting(queue);
+    stats->capacity = stats->depth + uxQueueSpacesAvailable(queue);
+    stats->high_water = __atomic_load_n(&task_intercom_queue_high_water[index], __ATOMIC_RELAXED);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sets the receiver of the events published with task_intercom_publish_event()
+ *
+ * @param sink the callback, NULL to stop receiving events
+ */
+void task_intercom_set_event_sink(itc_event_sink_t sink)
+{
+    __atomic_store_n(&task_intercom_event_sink, sink, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Publishes an event to the event sink
+ *
+ * @details the text is only formatted if a sink is set, so publishing is cheap without a listener.
+ *  The text is formatted on the stack and truncated to TASK_INTERCOM_EVENT_TEXT_SIZE - 1 characters.
+ *
+ * @param type the type of the event
+ * @param format printf style format string of the event text
+ */
+void task_intercom_publish_event(itc_event_type_t type, const char *format, ...)
+{
+    itc_event_sink_t sink = __atomic_load_n(&task_intercom_event_sink, __ATOMIC_ACQUIRE);
+
+    if (sink == NULL)
+        return;
+
+    char text[TASK_INTERCOM_EVENT_TEXT_SIZE];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    sink(type, text, MIN(length, (int)sizeof(text) - 1));
+}
+
 /**
  * @brief Allocates a message on the stack
  * @note The fields of the struct need to be allocated separately
@@ -75,6 +266,31 @@ void task_intercom_message_init(itc_message_t *message)
     message->response = NULL;
     message->response_static = NULL;
     message->is_measurement = false;
+    message->no_reply = false;
+    message->iot_command = NULL;
+}
+
+/**
+ * @brief Takes an initialized message from the message pool
+ *
+ * @details the payload of the message points to a buffer of TASK_INTERCOM_POOLED_PAYLOAD_SIZE bytes
+ *  owned by the pool. Return the message with task_intercom_message_delete().
+ *
+ * @return itc_message_t* the pointer to the message or NULL if the pool is exhausted
+ */
+itc_message_t *task_intercom_message_create_pooled()
+{
+    itc_pooled_message_t *pooled;
+
+    if (xQueueReceive(task_intercom_message_pool_free, &pooled, 0) != pdTRUE)
+        return NULL;
+
+    task_intercom_message_init(&pooled->message);
+
+    pooled->payload[0] = '\0';
+    pooled->message.payload = pooled->payload;
+
+    return &pooled->message;
 }
 
 /**
@@ -129,7 +345,7 @@ esp_err_t task_itc_message_token_match(itc_message_t *message, int token_num, co
 }
 
 /**
- * @brief Deletes a heap-allocated ITC message
+ * @brief Deletes a heap-allocated ITC message or returns a pooled message to the pool
  *
  * @param message the message pointer to be deleted
  */
@@ -138,8 +354,10 @@ void task_intercom_message_delete(itc_message_t *message)
     if (message == NULL)
         return;
 
-    // free the payload
-    if (message->payload != NULL)
+    bool is_pooled = IS_POOLED_MESSAGE(message);
+
+    // free the payload unless it is the buffer of a pooled message
+    if (message->payload != NULL && !(is_pooled && message->payload == ((itc_pooled_message_t *)message)->payload))
         free(message->payload);
 
     // free the payload copy holding the tokens
@@ -153,6 +371,18 @@ void task_intercom_message_delete(itc_message_t *message)
     if (message->response != NULL)
         free(message->response);
 
+    // the IoT Agent command the message executed, a pooled message
+    if (message->iot_command != NULL)
+        task_intercom_message_delete(message->iot_command);
+
+    if (is_pooled)
+    {
+        // hand the message back to the pool
+        itc_pooled_message_t *pooled = (itc_pooled_message_t *)message;
+        xQueueSend(task_intercom_message_pool_free, &pooled, 0);
+        return;
+    }
+
     free(message);
 
     message = NULL;
@@ -1,6 +1,7 @@
 /// @file
 #include "kawasaki.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #define KAWASAKI_INTERNAL_PAYLOAD_BUFFER_SIZE 32
@@ -372,6 +373,7 @@ esp_err_t kawasaki_write_transmission(uart_port_t port, const char *payload)
 
 #define KAWASAKI_TRANSMISSION_TYPE_MEASUREMENT "MEASUREMENT"
 #define KAWASAKI_TRANSMISSION_TYPE_COMMAND "COMMAND"
+#define KAWASAKI_TRANSMISSION_TYPE_RESULT "RESULT"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
@@ -458,6 +460,39 @@ esp_err_t kawasaki_parse_transmission(const char *raw, itc_message_t **message)
     return ESP_FAIL;
 }
 
+/**
+ * @brief Parses the reply of the controller to a command forwarded from the IoT Agent
+ *
+ * @details result transmission syntax: #RESULT:<id>@<result>
+ *  where id is the message id of the forwarded command
+ *
+ * @param raw pointer to the raw transmission payload char array
+ * @param id pointer to store the message id of the command
+ * @param result pointer to store the start of the result, it points into the raw payload
+ * @return esp_err_t    ESP_OK if the transmission is a result,
+ *                      ESP_ERR_NOT_FOUND if the transmission is of another type,
+ *                      ESP_FAIL if the result has no valid id
+ */
+esp_err_t kawasaki_parse_result(const char *raw, uint32_t *id, const char **result)
+{
+    const char *type = KAWASAKI_TRANSMISSION_TYPE_RESULT KAWASAKI_TRANSMISSION_TYPE_POSTFIX;
+
+    if (raw == NULL || raw[0] != KAWASAKI_TRANSMISSION_ID_CHAR || strncmp(raw + 1, type, strlen(type)) != 0)
+        return ESP_ERR_NOT_FOUND;
+
+    const char *id_string = raw + 1 + strlen(type);
+    char *end;
+    unsigned long value = strtoul(id_string, &end, 10);
+
+    if (value == 0 || end == id_string || *end != KAWASAKI_TRANSMISSION_HEADER_POSTFIX[0])
+        return ESP_FAIL;
+
+    *id = value;
+    *result = end + 1;
+
+    return ESP_OK;
+}
+
 /**
  * @brief Makes and sends the response from the message object
  *
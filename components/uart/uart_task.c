@@ -13,6 +13,7 @@
 #include <freertos/semphr.h>
 
 #include "kawasaki.h"
+#include "metrics.h"
 #include "task_intercom.h"
 #ifdef CONFIG_IOT_AGENT_REMOTE_COMMANDS
 #include "iot_agent.h"
@@ -62,13 +63,137 @@ static uart_config_t uart_config_robot = {
 const uart_port_t uart_robot = UART_NUM_1;
 QueueHandle_t uart_queue_robot;
 
+/// @brief A command forwarded from the IoT Agent that waits for the result transmission of the controller
+typedef struct
+{
+    /// @brief The forwarded message, NULL if the slot is free
+    itc_message_t *message;
+    /// @brief Tick count at the time the command was sent to the controller
+    TickType_t sent_at;
+} uart_pending_command_t;
+
+/// @brief Commands waiting for their result, every IoT Agent command occupies a pooled message
+static uart_pending_command_t uart_pending_commands[CONFIG_ITC_MESSAGE_POOL_SIZE];
+
+/// @brief Message id of the last command forwarded from the IoT Agent, the controller replies with it
+static uint32_t uart_command_sequence = 0;
+
+/**
+ * @brief Hands a message that executed an IoT Agent command back to the FIWARE task
+ *
+ * @details the FIWARE task reports the result to the IoT Agent and deletes the message.
+ *  The result of the controller is copied into the response field,
+ *  the error of a command that failed on this side is set as the response_static field.
+ *
+ * @param message the message with a non NULL iot_command field
+ * @param result the result replied by the controller, NULL if the command failed
+ * @param error the error reported if result is NULL
+ */
+static void uart_report_command_result(itc_message_t *message, const char *result, const char *error)
+{
+    // the response was the transmission to the controller, it is replaced by the result
+    if (message->response != NULL)
+    {
+        free(message->response);
+        message->response = NULL;
+    }
+
+    if (result != NULL)
+    {
+        message->response = strdup(result);
+        message->response_static = message->response != NULL ? NULL : esp_err_to_name(ESP_ERR_NO_MEM);
+    }
+    else
+        message->response_static = error;
+
+    if (task_intercom_send(task_intercom_fiware_result_queue, message, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Result queue full, dropping result of: %s", message->iot_command->payload);
+        task_intercom_message_delete(message);
+    }
+}
+
+/**
+ * @brief Takes a free slot for a forwarded command and assigns the message id the controller replies with
+ *
+ * @param message the message with a non NULL iot_command field
+ * @return uart_pending_command_t* the slot, NULL if every slot is taken
+ */
+static uart_pending_command_t *uart_take_pending_slot(itc_message_t *message)
+{
+    for (int i = 0; i < CONFIG_ITC_MESSAGE_POOL_SIZE; i++)
+    {
+        if (uart_pending_commands[i].message != NULL)
+            continue;
+
+        // ids run from 1 to 0xFFFFFFFE, 0 is invalid and 0xFFFFFFFF is the remote command id
+        uart_command_sequence = uart_command_sequence % 0xFFFFFFFE + 1;
+        message->message_id = uart_command_sequence;
+
+        return &uart_pending_commands[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Reports the result transmission of the controller for the forwarded command it belongs to
+ *
+ * @param id the message id the command was sent with
+ * @param result the result text of the controller
+ */
+static void uart_complete_command(uint32_t id, const char *result)
+{
+    for (int i = 0; i < CONFIG_ITC_MESSAGE_POOL_SIZE; i++)
+    {
+        itc_message_t *message = uart_pending_commands[i].message;
+
+        if (message == NULL || message->message_id != id)
+            continue;
+
+        uart_pending_commands[i].message = NULL;
+        uart_report_command_result(message, result, NULL);
+
+        return;
+    }
+
+    ESP_LOGW(TAG, "Result for unknown or expired command %lu: %s", (unsigned long)id, result);
+}
+
+/**
+ * @brief Reports a timeout for every forwarded command the controller did not reply to in time
+ *
+ * @details the timeout is set by CONFIG_UART_COMMAND_RESULT_TIMEOUT_MS
+ */
+static void uart_expire_pending_commands()
+{
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < CONFIG_ITC_MESSAGE_POOL_SIZE; i++)
+    {
+        itc_message_t *message = uart_pending_commands[i].message;
+
+        if (message == NULL || now - uart_pending_commands[i].sent_at < pdMS_TO_TICKS(CONFIG_UART_COMMAND_RESULT_TIMEOUT_MS))
+            continue;
+
+        ESP_LOGW(TAG, "No result from the controller for: %s", message->iot_command->payload);
+        metrics_uart_count(METRICS_UART_ERROR_TIMEOUT);
+
+        uart_pending_commands[i].message = NULL;
+        uart_report_command_result(message, NULL, esp_err_to_name(ESP_ERR_TIMEOUT));
+    }
+}
+
 /**
  * @brief Processes incoming messages from the UART queue
  *
  * @details the function receives an ITC message from the incoming queue (timeout is zero).
  *  The incoming command is then sent to the controller via the kawasaki_make_response() method.
  *  If CONFIG_IOT_AGENT_REMOTE_COMMANDS is defined and the message id is IOT_AGENT_REMOTE_COMMAND_ID
- *  then the payload of the message is treated as an incoming command from the controller
+ *  then the payload of the message is treated as an incoming command from the controller.
+ *  Messages that execute an IoT Agent command are sent with a new message id and wait until the controller
+ *  replies with a result transmission carrying that id, see uart_complete_command().
+ *  If the command cannot be sent, the error is handed back to the FIWARE task as the result right away.
  *
  * @param payload char array of the raw incoming payload
  *
@@ -98,7 +223,12 @@ esp_err_t process_incoming_messages(char **payload)
     {
         *payload = strdup(incoming_message->payload);
 
-        task_intercom_message_delete(incoming_message);
+        // the remote command is executed as if it came from the controller
+        if (incoming_message->iot_command != NULL)
+            uart_report_command_result(incoming_message, *payload != NULL ? "OK" : NULL, esp_err_to_name(ESP_ERR_NO_MEM));
+        else
+            task_intercom_message_delete(incoming_message);
+
         return ESP_OK;
     }
 #endif
@@ -106,6 +236,20 @@ esp_err_t process_incoming_messages(char **payload)
     if (incoming_message->response == NULL && incoming_message->response_static == NULL)
         return ESP_ERR_INVALID_ARG;
 
+    uart_pending_command_t *pending = NULL;
+
+    if (incoming_message->iot_command != NULL)
+    {
+        pending = uart_take_pending_slot(incoming_message);
+
+        if (pending == NULL)
+        {
+            ESP_LOGW(TAG, "Too many commands waiting for their result: %s", incoming_message->iot_command->payload);
+            uart_report_command_result(incoming_message, NULL, "BUSY");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     const char *response = incoming_message->response != NULL ? incoming_message->response : incoming_message->response_static;
 
     ESP_LOGI(TAG, "Sending message to robot: (ID: %ld) %s", incoming_message->message_id, response);
@@ -117,25 +261,44 @@ esp_err_t process_incoming_messages(char **payload)
     {
     case ESP_FAIL:
         ESP_LOGW(TAG, "Transmission failed: %s", response);
+        metrics_uart_count(METRICS_UART_ERROR_TRANSMISSION);
         break;
 
     case ESP_ERR_INVALID_RESPONSE:
         ESP_LOGW(TAG, "Invalid response to: %s", response);
+        metrics_uart_count(METRICS_UART_ERROR_INVALID_RESPONSE);
         break;
 
     case ESP_ERR_NOT_FINISHED:
         ESP_LOGW(TAG, "Possible ENQ collision during sending %s", response);
+        metrics_uart_count(METRICS_UART_ERROR_COLLISION);
         break;
 
     case ESP_ERR_TIMEOUT:
         ESP_LOGW(TAG, "Message timed out: %s", response);
+        metrics_uart_count(METRICS_UART_ERROR_TIMEOUT);
         break;
 
     default:
+        metrics_uart_count(METRICS_UART_FRAME_SENT);
         break;
     }
 
-    task_intercom_message_delete(incoming_message);
+    if (ret == ESP_OK)
+        task_intercom_publish_event(ITC_EVENT_RESPONSE, "%s", response);
+    else
+        task_intercom_publish_event(ITC_EVENT_ERROR, "%s: %s", esp_err_to_name(ret), response);
+
+    if (pending != NULL && ret == ESP_OK)
+    {
+        // the result is reported once the controller replies
+        pending->message = incoming_message;
+        pending->sent_at = xTaskGetTickCount();
+    }
+    else if (pending != NULL)
+        uart_report_command_result(incoming_message, NULL, esp_err_to_name(ret));
+    else
+        task_intercom_message_delete(incoming_message);
 
     return ret;
 }
@@ -183,6 +346,8 @@ void uart_task(void *arg)
             free(payload);
         payload = NULL;
 
+        uart_expire_pending_commands();
+
         ret = kawasaki_read_transmission(uart_robot, &payload, pdMS_TO_TICKS(UART_TIMEOUT_MS));
 
         if (ret == ESP_ERR_TIMEOUT)
@@ -198,6 +363,7 @@ void uart_task(void *arg)
 
         if (ret == ESP_OK)
         {
+            metrics_uart_count(METRICS_UART_FRAME_RECEIVED);
 
             // check if it was not an empty message
             if (strlen(payload) == 0)
@@ -210,6 +376,25 @@ void uart_task(void *arg)
             // process the incoming message
             ESP_LOGI(TAG, "Incoming message: %s", payload);
 
+            uint32_t command_id;
+            const char *result;
+
+            // the reply of the controller to a command forwarded from the IoT Agent
+            ret = kawasaki_parse_result(payload, &command_id, &result);
+
+            if (ret == ESP_OK)
+            {
+                uart_complete_command(command_id, result);
+                continue;
+            }
+
+            if (ret == ESP_FAIL)
+            {
+                metrics_uart_count(METRICS_UART_ERROR_INVALID_HEADER);
+                task_intercom_publish_event(ITC_EVENT_ERROR, "INVALID RESULT: %s", payload);
+                continue;
+            }
+
             itc_message_t *message = task_intercom_message_create();
             task_intercom_message_init(message);
 
@@ -219,6 +404,9 @@ void uart_task(void *arg)
             // check if the message parsing was successful or not
             if (ret == ESP_FAIL)
             {
+                metrics_uart_count(METRICS_UART_ERROR_INVALID_HEADER);
+                task_intercom_publish_event(ITC_EVENT_ERROR, "INVALID HEADER: %s", payload);
+
                 ret = kawasaki_write_transmission(uart_robot, "INVALID HEADER");
 
                 if (ret != ESP_OK)
@@ -232,14 +420,19 @@ void uart_task(void *arg)
 
             ESP_LOGI(TAG, "ITC(%ld) payload: %s", message->message_id, message->payload);
 
+            task_intercom_publish_event(message->is_measurement ? ITC_EVENT_MEASUREMENT : ITC_EVENT_COMMAND, "%s", message->payload);
+
             if (message->is_measurement)
-                ret = xQueueSend(task_intercom_fiware_measurement_queue, (void *)&message, 0);
+                ret = task_intercom_send(task_intercom_fiware_measurement_queue, message, 0);
             else
-                ret = xQueueSend(task_itc_from_uart_queue, (void *)&message, 0);
+                ret = task_intercom_send(task_itc_from_uart_queue, message, 0);
 
             // check if the message was added to the queue
             if (ret == errQUEUE_FULL)
             {
+                metrics_uart_count(METRICS_UART_ERROR_QUEUE_FULL);
+                task_intercom_publish_event(ITC_EVENT_ERROR, "BUSY: %s", message->payload);
+
                 // respond with busy message
                 message->response = "BUSY";
                 ret = kawasaki_make_response(uart_robot, message);
@@ -255,6 +448,8 @@ void uart_task(void *arg)
         }
 
         // other errors
+        metrics_uart_count(ret == ESP_ERR_INVALID_RESPONSE ? METRICS_UART_ERROR_INVALID_RESPONSE : METRICS_UART_ERROR_TRANSMISSION);
+
         const char *error = esp_err_to_name(ret);
         ESP_LOGE(TAG, "An error occurred: %d -> %s", ret, error);
     }
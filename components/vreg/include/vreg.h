@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stdint.h>
+
 #include <esp_err.h>
 
-esp_err_t vreg_start_task();
\ No newline at end of file
+esp_err_t vreg_set_voltage(uint32_t mvolts);
+
+esp_err_t vreg_read_voltage(uint32_t *setpoint, uint32_t *output);
+
+esp_err_t vreg_start_task();
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+#include <driver/uart.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/// @brief Longest command or reply line in characters, without the terminator
+#define VREG_LINK_LINE_LENGTH 32
+
+/// @brief A command sent to the regulator, queried commands wait for a reply line
+/// @details the request is owned by the submitting task until vreg_link_wait() returned
+typedef struct
+{
+    /// @brief the command line, without the terminator
+    char command[VREG_LINK_LINE_LENGTH + 1];
+    /// @brief true if the regulator answers the command with a line
+    bool query;
+    /// @brief the reply line, without the terminator
+    char reply[VREG_LINK_LINE_LENGTH + 1];
+    /// @brief result of the request, valid once done
+    esp_err_t result;
+    /// @brief the task notified when the request is done
+    TaskHandle_t owner;
+    /// @brief tick count the reply is due by
+    TickType_t deadline;
+    /// @brief set by the link when the request is done
+    bool done;
+} vreg_link_request_t;
+
+esp_err_t vreg_link_init(uart_port_t uart_num);
+
+esp_err_t vreg_link_submit(vreg_link_request_t *request, const char *command, bool query);
+
+esp_err_t vreg_link_wait(vreg_link_request_t *request);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// @brief Largest number of points of a profile
+#define VREG_PROFILE_MAX_POINTS CONFIG_VREG_PROFILE_MAX_POINTS
+
+/// @brief A point of a voltage profile, the setpoint is ramped linearly to it from the previous point
+typedef struct
+{
+    /// @brief the setpoint reached at the point in millivolts
+    uint32_t mvolts;
+    /// @brief time of the ramp from the previous point in ms, 0 for a step
+    uint32_t duration_ms;
+} vreg_profile_point_t;
+
+/// @brief A ramp between two points, split into evenly spaced setpoint writes
+typedef struct
+{
+    /// @brief time the segment starts at, relative to the start of the profile in ms
+    uint32_t start_ms;
+    uint32_t duration_ms;
+    uint32_t from_mv;
+    uint32_t to_mv;
+    /// @brief number of setpoints written along the segment, the last one is the end of the segment
+    uint32_t steps;
+} vreg_profile_segment_t;
+
+/// @brief Precomputed schedule of the setpoint writes of a profile
+typedef struct
+{
+    vreg_profile_segment_t segments[VREG_PROFILE_MAX_POINTS];
+    uint32_t segment_count;
+    /// @brief duration of the whole profile in ms
+    uint32_t duration_ms;
+    /// @brief the segment of the next write
+    uint32_t segment;
+    /// @brief the step of the next write in the segment, starting from 1
+    uint32_t step;
+} vreg_schedule_t;
+
+void vreg_schedule_init(vreg_schedule_t *schedule, const vreg_profile_point_t *points, uint32_t point_count, uint32_t from_mv, uint32_t interval_ms, uint32_t resolution_mv);
+
+bool vreg_schedule_done(const vreg_schedule_t *schedule);
+
+uint32_t vreg_schedule_due_ms(const vreg_schedule_t *schedule);
+
+bool vreg_schedule_next(vreg_schedule_t *schedule, uint32_t elapsed_ms, uint32_t *mvolts, bool *segment_end);
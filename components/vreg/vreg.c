@@ -2,101 +2,520 @@
 #include "vreg.h"
 
 #include <string.h>
+#include <ctype.h>
 
 #include <esp_check.h>
-#include <driver/uart.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
 
+#include "metrics.h"
 #include "task_intercom.h"
+#include "vreg_link.h"
+#include "vreg_profile.h"
 
-#define VREG_UART_TIMEOUT_MS 2000 // TODO move to Kconfig
+#define VREG_UART_NUM UART_NUM_2
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
 
+/// @brief Longest segment of a profile in ms, the duration of a full profile still fits into 32 bits
+#define VREG_PROFILE_MAX_DURATION_MS (UINT32_MAX / VREG_PROFILE_MAX_POINTS)
+
 static const char *TAG = "Voltage Regulator";
 
 static const char *KW_VOLTAGE = "VOLTAGE";
+static const char *KW_READ = "READ";
+static const char *KW_RAMP = "RAMP";
+static const char *KW_PROFILE = "PROFILE";
+static const char *KW_ADD = "ADD";
+static const char *KW_CLEAR = "CLEAR";
+static const char *KW_RUN = "RUN";
+static const char *KW_STOP = "STOP";
+static const char *KW_STATUS = "STATUS";
 
 static TaskHandle_t vreg_task_handle = NULL;
 
-static QueueHandle_t vreg_uart_queue;
+/// @brief the last setpoint written to the regulator in millivolts, valid if vreg_setpoint_known
+static uint32_t vreg_setpoint_mv = 0;
+static bool vreg_setpoint_known = false;
+
+/// @brief the profile uploaded with VOLTAGE|PROFILE|ADD
+static vreg_profile_point_t vreg_profile_points[VREG_PROFILE_MAX_POINTS];
+static uint32_t vreg_profile_point_count = 0;
+
+/// @brief the ramp or profile being executed by the task
+static vreg_schedule_t vreg_schedule;
+static bool vreg_schedule_running = false;
+static TickType_t vreg_schedule_start;
+/// @brief result of the last schedule, reported by VOLTAGE|STATUS
+static esp_err_t vreg_schedule_result = ESP_OK;
+
+/**
+ * @brief Parses a voltage reply of the regulator into millivolts
+ *
+ * @details accepts the replies of V1? ("V1 12.345") and V1O? ("12.345V"), without floating point
+ *
+ * @param reply the reply line
+ * @param mvolts pointer to store the voltage in millivolts
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_RESPONSE if the reply is not a voltage
+ */
+static esp_err_t vreg_parse_millivolts(const char *reply, uint32_t *mvolts)
+{
+    uint32_t volts = 0;
+    uint32_t fraction = 0;
+    uint32_t digits = 0;
+
+    if (strncmp(reply, "V1 ", 3) == 0)
+        reply += 3;
+
+    if (!isdigit((unsigned char)*reply))
+        return ESP_ERR_INVALID_RESPONSE;
+
+    while (isdigit((unsigned char)*reply))
+    {
+        volts = volts * 10 + (*reply++ - '0');
+
+        if (volts > UINT32_MAX / 1000 - 1)
+            return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    if (*reply == '.')
+        reply++;
+
+    // the regulator reports at most millivolts, further digits are dropped
+    for (; isdigit((unsigned char)*reply); reply++)
+    {
+        if (digits < 3)
+        {
+            fraction = fraction * 10 + (*reply - '0');
+            digits++;
+        }
+    }
+
+    for (; digits < 3; digits++)
+        fraction *= 10;
+
+    if (*reply == 'V')
+        reply++;
+
+    if (*reply != '\0')
+        return ESP_ERR_INVALID_RESPONSE;
+
+    *mvolts = volts * 1000 + fraction;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sends a query to the regulator and parses the voltage it answers with
+ *
+ * @param request the request of the query, submitted by the caller
+ * @param mvolts pointer to store the voltage in millivolts
+ * @return esp_err_t ESP_OK if successful, the error of the link or of the parser otherwise
+ */
+static esp_err_t vreg_wait_millivolts(vreg_link_request_t *request, uint32_t *mvolts)
+{
+    esp_err_t ret = vreg_link_wait(request);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    ret = vreg_parse_millivolts(request->reply, mvolts);
+
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Invalid reply to %s: %s", request->command, request->reply);
+
+    return ret;
+}
 
 /**
  * @brief Sets the voltage to the given value on the regulator in millivolts
  *
- * @param uart_num the uart interface number to use
+ * @details the setpoint is read back with V1? in the same pipeline and written again
+ *  up to CONFIG_VREG_RETRIES times if the regulator did not take it
+ *
  * @param mvolts the voltage in mvolts to be set
  * @return esp_err_t
- *  ESP_ERR_NO_MEM if there was not enough memory for the operation
- *  ESP_ERR_TIMEOUT if there was a communication timeout
+ *  ESP_ERR_TIMEOUT if the regulator did not answer
+ *  ESP_ERR_INVALID_RESPONSE if the readback did not match the setpoint
  *  ESP_OK if the operation was successful
  */
-esp_err_t vreg_set_voltage(uart_port_t uart_num, uint32_t mvolts)
+esp_err_t vreg_set_voltage(uint32_t mvolts)
 {
-    char *vreg_message;
-    int ret;
+    char command[VREG_LINK_LINE_LENGTH + 1];
+    esp_err_t ret = ESP_FAIL;
 
-    ret = asprintf(&vreg_message, "V1 %f\r\n", (float)mvolts / 1000);
+    snprintf(command, sizeof(command), "V1 %lu.%03lu", mvolts / 1000, mvolts % 1000);
 
-    if (ret == -1)
-        return ESP_ERR_NO_MEM;
+    for (uint32_t attempt = 0; attempt <= CONFIG_VREG_RETRIES; attempt++)
+    {
+        vreg_link_request_t set;
+        vreg_link_request_t readback;
+        uint32_t confirmed;
 
-    uart_write_bytes(uart_num, vreg_message, strlen(vreg_message));
+        ESP_RETURN_ON_ERROR(vreg_link_submit(&set, command, false), TAG, "Unable to queue setpoint");
 
-    free(vreg_message);
+        ret = vreg_link_submit(&readback, "V1?", true);
+
+        if (ret != ESP_OK)
+        {
+            vreg_link_wait(&set);
+            return ret;
+        }
 
-    ret = uart_wait_tx_done(uart_num, pdMS_TO_TICKS(VREG_UART_TIMEOUT_MS));
+        vreg_link_wait(&set);
+
+        ret = vreg_wait_millivolts(&readback, &confirmed);
+
+        if (ret == ESP_OK)
+        {
+            uint32_t error = confirmed > mvolts ? confirmed - mvolts : mvolts - confirmed;
+
+            if (error <= CONFIG_VREG_READBACK_TOLERANCE_MV)
+            {
+                vreg_setpoint_mv = mvolts;
+                vreg_setpoint_known = true;
+
+                return ESP_OK;
+            }
+
+            ESP_LOGW(TAG, "Setpoint %lumV read back as %lumV", mvolts, confirmed);
+
+            ret = ESP_ERR_INVALID_RESPONSE;
+        }
+
+        ESP_LOGW(TAG, "Setpoint not confirmed (%s), attempt %lu", esp_err_to_name(ret), attempt + 1);
+    }
+
+    vreg_setpoint_known = false;
+
+    return ret;
+}
 
-    if (ret == ESP_ERR_TIMEOUT)
+/**
+ * @brief Writes a setpoint without reading it back, the intermediate setpoints of a ramp
+ *
+ * @param mvolts the voltage in mvolts to be set
+ * @return esp_err_t ESP_OK once the setpoint was transmitted, the error of the link otherwise
+ */
+static esp_err_t vreg_write_setpoint(uint32_t mvolts)
+{
+    char command[VREG_LINK_LINE_LENGTH + 1];
+    vreg_link_request_t set;
+
+    snprintf(command, sizeof(command), "V1 %lu.%03lu", mvolts / 1000, mvolts % 1000);
+
+    esp_err_t ret = vreg_link_submit(&set, command, false);
+
+    if (ret == ESP_OK)
+        ret = vreg_link_wait(&set);
+
+    vreg_setpoint_mv = mvolts;
+    vreg_setpoint_known = ret == ESP_OK;
+
+    return ret;
+}
+
+/**
+ * @brief Reads the setpoint and the output voltage of the regulator
+ *
+ * @param setpoint pointer to store the setpoint in millivolts
+ * @param output pointer to store the measured output voltage in millivolts
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_TIMEOUT if the regulator did not answer,
+ *  ESP_ERR_INVALID_RESPONSE if a reply could not be parsed
+ */
+esp_err_t vreg_read_voltage(uint32_t *setpoint, uint32_t *output)
+{
+    vreg_link_request_t setpoint_query;
+    vreg_link_request_t output_query;
+
+    ESP_RETURN_ON_ERROR(vreg_link_submit(&setpoint_query, "V1?", true), TAG, "Unable to queue query");
+
+    esp_err_t ret = vreg_link_submit(&output_query, "V1O?", true);
+
+    if (ret != ESP_OK)
+    {
+        vreg_link_wait(&setpoint_query);
         return ret;
+    }
+
+    // both queries are waited for, the requests live on this stack
+    esp_err_t setpoint_ret = vreg_wait_millivolts(&setpoint_query, setpoint);
+
+    ret = vreg_wait_millivolts(&output_query, output);
+
+    return setpoint_ret != ESP_OK ? setpoint_ret : ret;
+}
+
+/**
+ * @brief Returns the shortest time between two setpoint writes of a schedule
+ *
+ * @details the writes are paced to the slower of the regulator and the line, "V1 xx.xxx" and the terminator take 11 characters
+ *
+ * @return uint32_t the interval in ms
+ */
+static uint32_t vreg_write_interval_ms()
+{
+    uint32_t transmit_ms = 11 * 10 * 1000 / CONFIG_VREG_BAUD + 1;
+
+    return CONFIG_VREG_WRITE_INTERVAL_MS > transmit_ms ? CONFIG_VREG_WRITE_INTERVAL_MS : transmit_ms;
+}
+
+/**
+ * @brief Returns the time since the schedule was started
+ *
+ * @return uint32_t time in ms
+ */
+static uint32_t vreg_schedule_elapsed_ms()
+{
+    return (xTaskGetTickCount() - vreg_schedule_start) * portTICK_PERIOD_MS;
+}
+
+/**
+ * @brief Starts executing a profile from the current setpoint
+ *
+ * @details the setpoint is read from the regulator if it is not known yet
+ *
+ * @param points the points of the profile
+ * @param point_count number of points
+ * @return esp_err_t ESP_OK if the profile was started, the error of the readback otherwise
+ */
+static esp_err_t vreg_schedule_begin(const vreg_profile_point_t *points, uint32_t point_count)
+{
+    vreg_schedule_running = false;
+
+    if (!vreg_setpoint_known)
+    {
+        uint32_t output;
+
+        ESP_RETURN_ON_ERROR(vreg_read_voltage(&vreg_setpoint_mv, &output), TAG, "Unable to read the setpoint");
+
+        vreg_setpoint_known = true;
+    }
+
+    vreg_schedule_init(&vreg_schedule, points, point_count, vreg_setpoint_mv, vreg_write_interval_ms(), CONFIG_VREG_RAMP_RESOLUTION_MV);
+
+    vreg_schedule_start = xTaskGetTickCount();
+    vreg_schedule_running = true;
+    vreg_schedule_result = ESP_OK;
+
+    ESP_LOGI(TAG, "Profile of %lu points started, %lu ms", point_count, vreg_schedule.duration_ms);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Writes the setpoint of the running schedule that is due, if any
+ *
+ * @details the ends of the segments are confirmed by readback, the setpoints in between are only written
+ */
+static void vreg_schedule_run()
+{
+    uint32_t mvolts;
+    bool segment_end;
+
+    if (!vreg_schedule_running || !vreg_schedule_next(&vreg_schedule, vreg_schedule_elapsed_ms(), &mvolts, &segment_end))
+        return;
+
+    esp_err_t ret = segment_end ? vreg_set_voltage(mvolts) : vreg_write_setpoint(mvolts);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Profile aborted at %lumV: %s", mvolts, esp_err_to_name(ret));
+
+        vreg_schedule_result = ret;
+        vreg_schedule_running = false;
+    }
+    else if (vreg_schedule_done(&vreg_schedule))
+    {
+        ESP_LOGI(TAG, "Profile finished at %lumV", mvolts);
+
+        vreg_schedule_running = false;
+    }
+}
+
+/**
+ * @brief Returns the time to wait for a message before the next setpoint of the schedule is due
+ *
+ * @return TickType_t ticks to wait, portMAX_DELAY if no schedule is running
+ */
+static TickType_t vreg_schedule_timeout()
+{
+    if (!vreg_schedule_running)
+        return portMAX_DELAY;
+
+    uint32_t due_ms = vreg_schedule_due_ms(&vreg_schedule);
+    uint32_t elapsed_ms = vreg_schedule_elapsed_ms();
 
-    // TODO imlpement waiting for a response
+    if (elapsed_ms >= due_ms)
+        return 0;
+
+    return (due_ms - elapsed_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+/**
+ * @brief Parses an unsigned decimal token of a command
+ *
+ * @details unlike atoi() signs, other characters and values beyond the limit are rejected
+ *
+ * @param token the token
+ * @param max the highest value accepted
+ * @param value pointer to store the value
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_ARG if the token is not a number up to max
+ */
+static esp_err_t vreg_parse_number(const char *token, uint32_t max, uint32_t *value)
+{
+    uint64_t number = 0;
+
+    if (!isdigit((unsigned char)*token))
+        return ESP_ERR_INVALID_ARG;
+
+    for (; *token != '\0'; token++)
+    {
+        if (!isdigit((unsigned char)*token))
+            return ESP_ERR_INVALID_ARG;
+
+        number = number * 10 + (*token - '0');
+
+        if (number > max)
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    *value = number;
 
     return ESP_OK;
 }
 
+/**
+ * @brief Handles the profile commands
+ *
+ * @details
+ *    0         1        2       3      4
+ * VOLTAGE | PROFILE                                       -> <points>|<duration ms>
+ * VOLTAGE | PROFILE | CLEAR
+ * VOLTAGE | PROFILE | ADD | <mV> | <ms> [| <mV> | <ms> ...] -> OK|<points>
+ * VOLTAGE | PROFILE | RUN
+ *
+ * @param message the message, the response is set
+ */
+static void vreg_handle_profile(itc_message_t *message)
+{
+    if (message->token_num == 2)
+    {
+        uint32_t duration_ms = 0;
+
+        for (uint32_t i = 0; i < vreg_profile_point_count; i++)
+            duration_ms += vreg_profile_points[i].duration_ms;
+
+        asprintf(&message->response, "%lu|%lu", vreg_profile_point_count, duration_ms);
+    }
+    else if (task_itc_message_token_match(message, 2, KW_CLEAR) == ESP_OK)
+    {
+        vreg_profile_point_count = 0;
+        message->response_static = "OK";
+    }
+    else if (task_itc_message_token_match(message, 2, KW_ADD) == ESP_OK && message->token_num >= 5 && message->token_num % 2 == 1)
+    {
+        uint32_t point_count = (message->token_num - 3) / 2;
+
+        if (vreg_profile_point_count + point_count > VREG_PROFILE_MAX_POINTS)
+        {
+            message->response_static = "PROFILE FULL";
+            return;
+        }
+
+        // the points are added only if all of them are valid
+        for (uint32_t i = 0; i < point_count; i++)
+        {
+            vreg_profile_point_t *point = &vreg_profile_points[vreg_profile_point_count + i];
+
+            if (vreg_parse_number(message->tokens[3 + 2 * i], CONFIG_VREG_MAX_MV, &point->mvolts) != ESP_OK ||
+                vreg_parse_number(message->tokens[4 + 2 * i], VREG_PROFILE_MAX_DURATION_MS, &point->duration_ms) != ESP_OK)
+            {
+                message->response_static = esp_err_to_name(ESP_ERR_INVALID_ARG);
+                return;
+            }
+        }
+
+        vreg_profile_point_count += point_count;
+
+        asprintf(&message->response, "OK|%lu", vreg_profile_point_count);
+    }
+    else if (task_itc_message_token_match(message, 2, KW_RUN) == ESP_OK)
+    {
+        if (vreg_profile_point_count == 0)
+        {
+            message->response_static = "PROFILE EMPTY";
+            return;
+        }
+
+        esp_err_t ret = vreg_schedule_begin(vreg_profile_points, vreg_profile_point_count);
+
+        message->response_static = ret == ESP_OK ? "OK" : esp_err_to_name(ret);
+    }
+    else
+    {
+        message->response_static = esp_err_to_name(ESP_ERR_INVALID_ARG);
+    }
+}
+
+/**
+ * @brief Returns true if the message sets the voltage, VOLTAGE|<mV>
+ *
+ * @param message the message
+ * @return true if the message is a setpoint
+ */
+static bool vreg_is_setpoint(itc_message_t *message)
+{
+    return message->token_num == 2 &&
+           task_itc_message_token_match(message, 0, KW_VOLTAGE) == ESP_OK &&
+           isdigit((unsigned char)message->tokens[1][0]);
+}
+
+/**
+ * @brief Replaces a setpoint by the newest one queued right behind it
+ *
+ * @details setpoints that arrived while the regulator link was busy are not written one by one,
+ *  only the last of them is. The superseded ones are answered right away.
+ *  Only the head of the queue is looked at, a message of another task ends the run of setpoints
+ *
+ * @param message the setpoint taken from the queue
+ * @return itc_message_t* the setpoint to write
+ */
+static itc_message_t *vreg_take_latest_setpoint(itc_message_t *message)
+{
+    itc_message_t *next;
+
+    // no other task takes a VOLTAGE message at the head of the queue
+    while (xQueuePeek(task_itc_from_uart_queue, &next, 0) == pdTRUE &&
+           vreg_is_setpoint(next) &&
+           xQueueReceive(task_itc_from_uart_queue, &next, 0) == pdTRUE)
+    {
+        ESP_LOGD(TAG, "Setpoint %s superseded by %s", message->tokens[1], next->tokens[1]);
+
+        message->response_static = "SUPERSEDED";
+        task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
+
+        metrics_vreg_count(METRICS_VREG_SETPOINT_COALESCED);
+
+        message = next;
+    }
+
+    return message;
+}
+
 /**
  * @brief Voltage regulator task code
  *
- * @details The UART interface is initialized and the main loop is entered.
+ * @details The regulator link is initialized and the main loop is entered.
  *  The task checks the queue for an ITC message and if it is matching then removes it from the queue.
- *  Then the voltage is set accordingly.
+ *  Then the voltage is set or read back accordingly.
+ *  While a ramp or profile runs the task wakes up when its next setpoint is due
  */
 void vreg_task()
 {
-    // setup the uart interface
-    uart_port_t uart_num = UART_NUM_2;
-    uart_config_t uart_config = {
-        .baud_rate = CONFIG_VREG_BAUD,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-    };
-
-    ESP_ERROR_CHECK(uart_param_config(uart_num, &uart_config));
-
-    // set up the pins
-    ESP_ERROR_CHECK(
-        uart_set_pin(
-            uart_num,
-            CONFIG_VREG_TX_PIN,
-            CONFIG_VREG_RX_PIN,
-            UART_PIN_NO_CHANGE,
-            UART_PIN_NO_CHANGE));
-
-    // install drivers
-    ESP_ERROR_CHECK(
-        uart_driver_install(
-            uart_num,
-            CONFIG_VREG_RX_BUFFER_SIZE,
-            CONFIG_VREG_TX_BUFFER_SIZE,
-            CONFIG_VREG_QUEUE_SIZE,
-            &vreg_uart_queue,
-            0));
+    ESP_ERROR_CHECK(vreg_link_init(VREG_UART_NUM));
 
     int ret;
     itc_message_t *message;
@@ -104,13 +523,21 @@ void vreg_task()
     //* LOOP
     while (1)
     {
-        xQueuePeek(task_itc_from_uart_queue, &message, portMAX_DELAY);
+        vreg_schedule_run();
 
-        // Voltage regulator controls
-        //    0         1
-        // VOLTAGE | <value>
+        if (xQueuePeek(task_itc_from_uart_queue, &message, vreg_schedule_timeout()) != pdTRUE)
+            continue;
 
-        if (message->token_num != 2)
+        // Voltage regulator controls
+        //    0         1         2        3
+        // VOLTAGE | <value>                      -> OK, or SUPERSEDED if a newer value was queued behind it
+        // VOLTAGE | READ                         -> <setpoint mV>|<output mV>
+        // VOLTAGE | RAMP   | <target mV> | <ms>
+        // VOLTAGE | PROFILE ...                  see vreg_handle_profile()
+        // VOLTAGE | STOP
+        // VOLTAGE | STATUS                       -> IDLE|<mV>, RUNNING|<mV>|<remaining ms> or FAILED|<error>
+
+        if (message->token_num < 2)
             continue;
 
         if (task_itc_message_token_match(message, 0, KW_VOLTAGE) != ESP_OK)
@@ -125,19 +552,89 @@ void vreg_task()
             continue;
         }
 
-        uint32_t mvolts = atoi(message->tokens[1]);
+        if (task_itc_message_token_match(message, 1, KW_READ) == ESP_OK)
+        {
+            uint32_t setpoint, output;
 
-        ESP_LOGI(TAG, "Setting voltage to %fV", (float)mvolts / 1000);
+            ret = vreg_read_voltage(&setpoint, &output);
 
-        ret = vreg_set_voltage(uart_num, mvolts);
+            if (ret == ESP_OK)
+                asprintf(&message->response, "%lu|%lu", setpoint, output);
 
-        if (ret == ESP_OK)
+            else
+                message->response_static = esp_err_to_name(ret);
+        }
+        else if (task_itc_message_token_match(message, 1, KW_RAMP) == ESP_OK && message->token_num == 4)
+        {
+            vreg_profile_point_t ramp;
+
+            ret = vreg_parse_number(message->tokens[2], CONFIG_VREG_MAX_MV, &ramp.mvolts);
+
+            if (ret == ESP_OK)
+                ret = vreg_parse_number(message->tokens[3], VREG_PROFILE_MAX_DURATION_MS, &ramp.duration_ms);
+
+            if (ret == ESP_OK)
+                ret = vreg_schedule_begin(&ramp, 1);
+
+            message->response_static = ret == ESP_OK ? "OK" : esp_err_to_name(ret);
+        }
+        else if (task_itc_message_token_match(message, 1, KW_PROFILE) == ESP_OK)
+        {
+            vreg_handle_profile(message);
+        }
+        else if (task_itc_message_token_match(message, 1, KW_STOP) == ESP_OK)
+        {
+            // the setpoint stays where the schedule is
+            vreg_schedule_running = false;
             message->response_static = "OK";
+        }
+        else if (task_itc_message_token_match(message, 1, KW_STATUS) == ESP_OK)
+        {
+            uint32_t elapsed_ms = vreg_schedule_elapsed_ms();
+
+            if (vreg_schedule_running)
+                asprintf(&message->response, "RUNNING|%lu|%lu", vreg_setpoint_mv, elapsed_ms < vreg_schedule.duration_ms ? vreg_schedule.duration_ms - elapsed_ms : 0);
 
+            else if (vreg_schedule_result != ESP_OK)
+                asprintf(&message->response, "FAILED|%s", esp_err_to_name(vreg_schedule_result));
+
+            else
+                asprintf(&message->response, "IDLE|%lu", vreg_setpoint_mv);
+        }
+        else if (vreg_is_setpoint(message))
+        {
+            message = vreg_take_latest_setpoint(message);
+
+            uint32_t mvolts;
+
+            if (vreg_parse_number(message->tokens[1], CONFIG_VREG_MAX_MV, &mvolts) != ESP_OK)
+            {
+                message->response_static = esp_err_to_name(ESP_ERR_INVALID_ARG);
+                task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
+                continue;
+            }
+
+            // a setpoint of the robot ends the running schedule
+            vreg_schedule_running = false;
+
+            metrics_vreg_count(METRICS_VREG_SETPOINT_SENT);
+
+            ESP_LOGI(TAG, "Setting voltage to %lu.%03luV", mvolts / 1000, mvolts % 1000);
+
+            ret = vreg_set_voltage(mvolts);
+
+            if (ret == ESP_OK)
+                message->response_static = "OK";
+
+            else
+                message->response_static = esp_err_to_name(ret);
+        }
         else
-            message->response_static = esp_err_to_name(ret);
+        {
+            message->response_static = esp_err_to_name(ESP_ERR_INVALID_ARG);
+        }
 
-        xQueueSend(task_itc_to_uart_queue, &message, portMAX_DELAY);
+        task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
     }
 }
 
@@ -0,0 +1,474 @@
+/// @file
+#include "vreg_link.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_check.h>
+#include <esp_log.h>
+
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#define MIN(a, b) ((a) < (b)) ? (a) : (b)
+
+/// @brief Number of queries waiting for a reply at once
+#define VREG_LINK_PIPELINE_DEPTH CONFIG_VREG_PIPELINE_DEPTH
+
+/// @brief Size of the chunks the received bytes are read in
+#define VREG_LINK_READ_CHUNK 64
+
+static const char *TAG = "Voltage Regulator Link";
+
+static uart_port_t vreg_link_uart_num;
+
+/// @brief events of the UART driver, read by the receive task
+static QueueHandle_t vreg_link_uart_queue = NULL;
+
+/// @brief requests waiting to be written, pointers to vreg_link_request_t
+static QueueHandle_t vreg_link_tx_queue = NULL;
+
+/// @brief counts the free places of the pipeline, taken by the transmit task for every query
+/// @details the receive task gives them back once the reply arrived or the line was resynchronized
+static SemaphoreHandle_t vreg_link_slots = NULL;
+
+static TaskHandle_t vreg_link_tx_task_handle = NULL;
+static TaskHandle_t vreg_link_rx_task_handle = NULL;
+
+/// @brief queries written and waiting for a reply, answered in order by the regulator
+static vreg_link_request_t *vreg_link_in_flight[VREG_LINK_PIPELINE_DEPTH];
+static uint32_t vreg_link_in_flight_head = 0;
+static uint32_t vreg_link_in_flight_count = 0;
+static portMUX_TYPE vreg_link_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief the reply line being received, only used by the receive task
+static char vreg_link_line[VREG_LINK_LINE_LENGTH + 1];
+static uint32_t vreg_link_line_length = 0;
+static bool vreg_link_line_overflow = false;
+
+/**
+ * @brief Finishes a request and wakes up its owner
+ *
+ * @param request the request
+ * @param result the result of the request
+ */
+static void vreg_link_complete(vreg_link_request_t *request, esp_err_t result)
+{
+    TaskHandle_t owner = request->owner;
+
+    request->result = result;
+
+    // the owner may return as soon as it sees the flag, the request must not be touched after it
+    __atomic_store_n(&request->done, true, __ATOMIC_RELEASE);
+
+    xTaskNotifyGive(owner);
+}
+
+/**
+ * @brief Removes the oldest query waiting for a reply
+ *
+ * @return vreg_link_request_t* the query, NULL if no query is in flight
+ */
+static vreg_link_request_t *vreg_link_pop()
+{
+    vreg_link_request_t *request = NULL;
+
+    taskENTER_CRITICAL(&vreg_link_lock);
+
+    if (vreg_link_in_flight_count > 0)
+    {
+        request = vreg_link_in_flight[vreg_link_in_flight_head];
+        vreg_link_in_flight_head = (vreg_link_in_flight_head + 1) % VREG_LINK_PIPELINE_DEPTH;
+        vreg_link_in_flight_count--;
+    }
+
+    taskEXIT_CRITICAL(&vreg_link_lock);
+
+    return request;
+}
+
+/**
+ * @brief Returns the ticks until the oldest query times out
+ *
+ * @return TickType_t ticks to wait for the next UART event, portMAX_DELAY if no query is in flight
+ */
+static TickType_t vreg_link_next_timeout()
+{
+    TickType_t timeout = portMAX_DELAY;
+
+    taskENTER_CRITICAL(&vreg_link_lock);
+
+    if (vreg_link_in_flight_count > 0)
+    {
+        int32_t left = (int32_t)(vreg_link_in_flight[vreg_link_in_flight_head]->deadline - xTaskGetTickCount());
+
+        timeout = left > 0 ? left : 0;
+    }
+
+    taskEXIT_CRITICAL(&vreg_link_lock);
+
+    return timeout;
+}
+
+/**
+ * @brief Fails every query in flight and drops the received bytes until the line is quiet
+ *
+ * @details the regulator answers in order, a lost or garbled reply would shift the replies of the queries behind it.
+ *  The pipeline is held while the late replies of the failed queries are drained
+ *
+ * @param result the result of the failed queries
+ */
+static void vreg_link_resync(esp_err_t result)
+{
+    uint32_t slots = 0;
+    vreg_link_request_t *request;
+    uart_event_t event;
+
+    // no new query may be written while the line is drained
+    while (xSemaphoreTake(vreg_link_slots, 0) == pdTRUE)
+        slots++;
+
+    while ((request = vreg_link_pop()) != NULL)
+    {
+        vreg_link_complete(request, result);
+        slots++;
+    }
+
+    while (xQueueReceive(vreg_link_uart_queue, &event, pdMS_TO_TICKS(CONFIG_VREG_REPLY_TIMEOUT_MS)) == pdTRUE)
+        uart_flush_input(vreg_link_uart_num);
+
+    uart_flush_input(vreg_link_uart_num);
+    xQueueReset(vreg_link_uart_queue);
+
+    vreg_link_line_length = 0;
+    vreg_link_line_overflow = false;
+
+    while (slots-- > 0)
+        xSemaphoreGive(vreg_link_slots);
+}
+
+/**
+ * @brief Hands a complete reply line to the oldest query in flight
+ */
+static void vreg_link_reply()
+{
+    vreg_link_line[vreg_link_line_length] = '\0';
+
+    vreg_link_request_t *request = vreg_link_pop();
+
+    if (request == NULL)
+    {
+        ESP_LOGW(TAG, "Unexpected reply: %s", vreg_link_line);
+    }
+    else
+    {
+        strcpy(request->reply, vreg_link_line);
+
+        vreg_link_complete(request, vreg_link_line_overflow ? ESP_ERR_INVALID_SIZE : ESP_OK);
+
+        xSemaphoreGive(vreg_link_slots);
+    }
+
+    vreg_link_line_length = 0;
+    vreg_link_line_overflow = false;
+}
+
+/**
+ * @brief Reads the received bytes and splits them into reply lines
+ *
+ * @param size number of bytes reported by the UART driver
+ */
+static void vreg_link_read(size_t size)
+{
+    uint8_t data[VREG_LINK_READ_CHUNK];
+
+    while (size > 0)
+    {
+        int length = uart_read_bytes(vreg_link_uart_num, data, MIN(size, sizeof(data)), 0);
+
+        if (length <= 0)
+            return;
+
+        size -= length;
+
+        for (int i = 0; i < length; i++)
+        {
+            if (data[i] == '\r')
+                continue;
+
+            if (data[i] == '\n')
+            {
+                // empty lines carry no reply
+                if (vreg_link_line_length > 0 || vreg_link_line_overflow)
+                    vreg_link_reply();
+
+                continue;
+            }
+
+            if (vreg_link_line_length < VREG_LINK_LINE_LENGTH)
+                vreg_link_line[vreg_link_line_length++] = data[i];
+            else
+                vreg_link_line_overflow = true;
+        }
+    }
+}
+
+/**
+ * @brief Task code of the receive task
+ *
+ * @details the UART events are handled as they arrive, the task wakes up when the oldest query timed out
+ */
+static void vreg_link_rx_task()
+{
+    uart_event_t event;
+
+    while (1)
+    {
+        if (xQueueReceive(vreg_link_uart_queue, &event, vreg_link_next_timeout()) == pdTRUE)
+        {
+            switch (event.type)
+            {
+            case UART_DATA:
+                vreg_link_read(event.size);
+                break;
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                ESP_LOGW(TAG, "Receive buffer overflow");
+                vreg_link_resync(ESP_ERR_INVALID_RESPONSE);
+                break;
+
+            case UART_FRAME_ERR:
+            case UART_PARITY_ERR:
+                // the garbled line fails to parse or the query times out
+                ESP_LOGW(TAG, "Receive error %d", event.type);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        if (vreg_link_next_timeout() == 0)
+        {
+            ESP_LOGW(TAG, "Reply timeout");
+            vreg_link_resync(ESP_ERR_TIMEOUT);
+        }
+    }
+}
+
+/**
+ * @brief Task code of the transmit task
+ *
+ * @details the commands are written back to back, up to VREG_LINK_PIPELINE_DEPTH queries wait for their reply at once.
+ *  A query is put in flight before it is written, its reply cannot arrive earlier.
+ *  The receive task may complete a query as soon as it is in flight and its owner may return,
+ *  the query is not touched after it was published
+ */
+static void vreg_link_tx_task()
+{
+    vreg_link_request_t *request;
+    char line[VREG_LINK_LINE_LENGTH + 3];
+
+    while (1)
+    {
+        xQueueReceive(vreg_link_tx_queue, &request, portMAX_DELAY);
+
+        int length = snprintf(line, sizeof(line), "%s\r\n", request->command);
+        bool query = request->query;
+
+        // the previous command was transmitted, the reply is due after this one is on the line
+        TickType_t transmit_ticks = pdMS_TO_TICKS(length * 10 * 1000 / CONFIG_VREG_BAUD + 1);
+
+        if (query)
+        {
+            xSemaphoreTake(vreg_link_slots, portMAX_DELAY);
+
+            request->deadline = xTaskGetTickCount() + transmit_ticks + pdMS_TO_TICKS(CONFIG_VREG_REPLY_TIMEOUT_MS);
+
+            taskENTER_CRITICAL(&vreg_link_lock);
+
+            vreg_link_in_flight[(vreg_link_in_flight_head + vreg_link_in_flight_count) % VREG_LINK_PIPELINE_DEPTH] = request;
+            bool first = ++vreg_link_in_flight_count == 1;
+
+            taskEXIT_CRITICAL(&vreg_link_lock);
+
+            // published, owned by the receive task from here on
+            request = NULL;
+
+            // the receive task waits without a timeout while no query is in flight
+            if (first)
+                xQueueSend(vreg_link_uart_queue, &(uart_event_t){.type = UART_EVENT_MAX}, 0);
+        }
+
+        uart_write_bytes(vreg_link_uart_num, line, length);
+
+        esp_err_t ret = uart_wait_tx_done(vreg_link_uart_num, transmit_ticks + pdMS_TO_TICKS(CONFIG_VREG_REPLY_TIMEOUT_MS));
+
+        // a command without a reply is done once it was transmitted, it was never published
+        if (!query)
+            vreg_link_complete(request, ret);
+    }
+}
+
+/**
+ * @brief Frees the resources of the link
+ */
+static void vreg_link_cleanup()
+{
+    if (vreg_link_tx_task_handle != NULL)
+        vTaskDelete(vreg_link_tx_task_handle);
+
+    if (vreg_link_rx_task_handle != NULL)
+        vTaskDelete(vreg_link_rx_task_handle);
+
+    if (vreg_link_slots != NULL)
+        vSemaphoreDelete(vreg_link_slots);
+
+    if (vreg_link_tx_queue != NULL)
+        vQueueDelete(vreg_link_tx_queue);
+
+    if (vreg_link_uart_queue != NULL)
+        uart_driver_delete(vreg_link_uart_num);
+
+    vreg_link_tx_task_handle = NULL;
+    vreg_link_rx_task_handle = NULL;
+    vreg_link_slots = NULL;
+    vreg_link_tx_queue = NULL;
+    vreg_link_uart_queue = NULL;
+}
+
+/**
+ * @brief Sets up the UART interface of the regulator and starts the transmit and receive tasks
+ *
+ * @param uart_num the uart interface number to use
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if already initialized,
+ *  ESP_ERR_NO_MEM if the tasks could not be started, the error of the UART driver otherwise
+ */
+esp_err_t vreg_link_init(uart_port_t uart_num)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(vreg_link_uart_queue == NULL, ESP_ERR_INVALID_STATE, TAG, "Already initialized");
+
+    vreg_link_uart_num = uart_num;
+
+    uart_config_t uart_config = {
+        .baud_rate = CONFIG_VREG_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+
+    ESP_RETURN_ON_ERROR(uart_param_config(uart_num, &uart_config), TAG, "Unable to configure UART");
+
+    ESP_RETURN_ON_ERROR(
+        uart_set_pin(
+            uart_num,
+            CONFIG_VREG_TX_PIN,
+            CONFIG_VREG_RX_PIN,
+            UART_PIN_NO_CHANGE,
+            UART_PIN_NO_CHANGE),
+        TAG,
+        "Unable to set UART pins");
+
+    ESP_RETURN_ON_ERROR(
+        uart_driver_install(
+            uart_num,
+            CONFIG_VREG_RX_BUFFER_SIZE,
+            CONFIG_VREG_TX_BUFFER_SIZE,
+            CONFIG_VREG_QUEUE_SIZE,
+            &vreg_link_uart_queue,
+            0),
+        TAG,
+        "Unable to install UART driver");
+
+    vreg_link_tx_queue = xQueueCreate(CONFIG_VREG_TX_QUEUE_SIZE, sizeof(vreg_link_request_t *));
+
+    ESP_GOTO_ON_FALSE(vreg_link_tx_queue != NULL, ESP_ERR_NO_MEM, cleanup, TAG, "Unable to create transmit queue");
+
+    vreg_link_slots = xSemaphoreCreateCounting(VREG_LINK_PIPELINE_DEPTH, VREG_LINK_PIPELINE_DEPTH);
+
+    ESP_GOTO_ON_FALSE(vreg_link_slots != NULL, ESP_ERR_NO_MEM, cleanup, TAG, "Unable to create semaphore");
+
+    ESP_GOTO_ON_FALSE(
+        xTaskCreate(
+            vreg_link_rx_task,
+            "Vreg RX",
+            CONFIG_VREG_LINK_TASK_STACK_DEPTH,
+            NULL,
+            MIN(CONFIG_VREG_LINK_TASK_PRIO, configMAX_PRIORITIES - 1),
+            &vreg_link_rx_task_handle) == pdPASS,
+        ESP_ERR_NO_MEM,
+        cleanup,
+        TAG,
+        "Unable to start receive task");
+
+    ESP_GOTO_ON_FALSE(
+        xTaskCreate(
+            vreg_link_tx_task,
+            "Vreg TX",
+            CONFIG_VREG_LINK_TASK_STACK_DEPTH,
+            NULL,
+            MIN(CONFIG_VREG_LINK_TASK_PRIO, configMAX_PRIORITIES - 1),
+            &vreg_link_tx_task_handle) == pdPASS,
+        ESP_ERR_NO_MEM,
+        cleanup,
+        TAG,
+        "Unable to start transmit task");
+
+    return ESP_OK;
+
+cleanup:
+    vreg_link_cleanup();
+
+    return ret;
+}
+
+/**
+ * @brief Queues a command to the regulator without waiting for it
+ *
+ * @details the commands are written in the order they were submitted.
+ *  The request has to stay valid until vreg_link_wait() returned
+ *
+ * @param request the request to fill in
+ * @param command the command line, without the terminator
+ * @param query true if the regulator answers the command
+ * @return esp_err_t ESP_OK if the command was queued, ESP_ERR_INVALID_SIZE if the command is too long,
+ *  ESP_ERR_TIMEOUT if the transmit queue stayed full
+ */
+esp_err_t vreg_link_submit(vreg_link_request_t *request, const char *command, bool query)
+{
+    ESP_RETURN_ON_FALSE(strlen(command) <= VREG_LINK_LINE_LENGTH, ESP_ERR_INVALID_SIZE, TAG, "Command too long");
+
+    strcpy(request->command, command);
+    request->query = query;
+    request->reply[0] = '\0';
+    request->result = ESP_FAIL;
+    request->owner = xTaskGetCurrentTaskHandle();
+    request->done = false;
+
+    if (xQueueSend(vreg_link_tx_queue, &request, pdMS_TO_TICKS(CONFIG_VREG_REPLY_TIMEOUT_MS)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Waits until a submitted request is done
+ *
+ * @details a query is done once its reply arrived or it timed out, other commands once they were written
+ *
+ * @param request the request
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_TIMEOUT if the regulator did not answer in time,
+ *  ESP_ERR_INVALID_RESPONSE if the reply was lost, ESP_ERR_INVALID_SIZE if the reply was too long
+ */
+esp_err_t vreg_link_wait(vreg_link_request_t *request)
+{
+    // the notification may be of another request of the owner
+    while (!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE))
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    return request->result;
+}
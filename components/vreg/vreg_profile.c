@@ -0,0 +1,109 @@
+/// @file
+#include "vreg_profile.h"
+
+/**
+ * @brief Precomputes the setpoint writes of a profile
+ *
+ * @details every segment is split into evenly spaced writes at most one write interval apart.
+ *  Slow ramps are written once per resolution step instead, a step without a ramp is a single write
+ *
+ * @param schedule the schedule
+ * @param points the points of the profile, at most VREG_PROFILE_MAX_POINTS
+ * @param point_count number of points
+ * @param from_mv the setpoint the profile starts from in millivolts
+ * @param interval_ms shortest time between two writes, the throughput of the regulator
+ * @param resolution_mv smallest change of the setpoint worth a write in millivolts
+ */
+void vreg_schedule_init(vreg_schedule_t *schedule, const vreg_profile_point_t *points, uint32_t point_count, uint32_t from_mv, uint32_t interval_ms, uint32_t resolution_mv)
+{
+    uint32_t start_ms = 0;
+
+    for (uint32_t i = 0; i < point_count; i++)
+    {
+        vreg_profile_segment_t *segment = &schedule->segments[i];
+        uint32_t change = points[i].mvolts > from_mv ? points[i].mvolts - from_mv : from_mv - points[i].mvolts;
+
+        segment->start_ms = start_ms;
+        segment->duration_ms = points[i].duration_ms;
+        segment->from_mv = from_mv;
+        segment->to_mv = points[i].mvolts;
+        segment->steps = interval_ms > 0 ? segment->duration_ms / interval_ms : segment->duration_ms;
+
+        if (resolution_mv > 0 && segment->steps > (change + resolution_mv - 1) / resolution_mv)
+            segment->steps = (change + resolution_mv - 1) / resolution_mv;
+
+        if (segment->steps == 0)
+            segment->steps = 1;
+
+        start_ms += segment->duration_ms;
+        from_mv = segment->to_mv;
+    }
+
+    schedule->segment_count = point_count;
+    schedule->duration_ms = start_ms;
+    schedule->segment = 0;
+    schedule->step = 1;
+}
+
+/**
+ * @brief Returns true once every setpoint of the schedule was written
+ *
+ * @param schedule the schedule
+ * @return true if the schedule is finished
+ */
+bool vreg_schedule_done(const vreg_schedule_t *schedule)
+{
+    return schedule->segment >= schedule->segment_count;
+}
+
+/**
+ * @brief Returns the time the next setpoint is due at
+ *
+ * @param schedule the schedule, not done
+ * @return uint32_t time relative to the start of the profile in ms
+ */
+uint32_t vreg_schedule_due_ms(const vreg_schedule_t *schedule)
+{
+    const vreg_profile_segment_t *segment = &schedule->segments[schedule->segment];
+
+    return segment->start_ms + (uint64_t)schedule->step * segment->duration_ms / segment->steps;
+}
+
+/**
+ * @brief Takes the next setpoint to write
+ *
+ * @details a late write skips the setpoints of the segment it missed, the end of a segment is never skipped
+ *
+ * @param schedule the schedule
+ * @param elapsed_ms time since the start of the profile in ms
+ * @param mvolts pointer to store the setpoint in millivolts
+ * @param segment_end pointer to store true if the setpoint is the end of a segment
+ * @return true if a setpoint is due, false if the schedule is done or the next setpoint is not due yet
+ */
+bool vreg_schedule_next(vreg_schedule_t *schedule, uint32_t elapsed_ms, uint32_t *mvolts, bool *segment_end)
+{
+    if (vreg_schedule_done(schedule) || elapsed_ms < vreg_schedule_due_ms(schedule))
+        return false;
+
+    const vreg_profile_segment_t *segment = &schedule->segments[schedule->segment];
+    uint32_t step = segment->steps;
+
+    if (segment->duration_ms > 0 && elapsed_ms - segment->start_ms < segment->duration_ms)
+        step = (uint64_t)(elapsed_ms - segment->start_ms) * segment->steps / segment->duration_ms;
+
+    if (step < schedule->step)
+        step = schedule->step;
+
+    *mvolts = segment->from_mv + ((int64_t)segment->to_mv - segment->from_mv) * step / segment->steps;
+    *segment_end = step == segment->steps;
+
+    if (*segment_end)
+    {
+        schedule->segment++;
+        schedule->step = 1;
+    }
+    else
+        schedule->step = step + 1;
+
+    return true;
+}
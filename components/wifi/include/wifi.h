@@ -28,3 +28,5 @@ bool is_wifi_connected();
 
 esp_err_t wifi_wait_initialized(TickType_t ticks_to_wait);
 esp_err_t wifi_wait_connected(TickType_t ticks_to_wait);
+
+esp_err_t wifi_get_rssi(int *rssi);
@@ -186,4 +186,24 @@ esp_err_t wifi_wait_connected(TickType_t ticks_to_wait)
     EventBits_t bits = xEventGroupWaitBits(wifi_events, WIFI_CONNECTED, pdFALSE, pdTRUE, ticks_to_wait);
 
     return bits & WIFI_CONNECTED ? ESP_OK : ESP_ERR_TIMEOUT;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Reads the signal strength of the access point the station is connected to
+ *
+ * @param rssi pointer to store the RSSI in dBm
+ * @return esp_err_t ESP_OK if successful, ESP_ERR_INVALID_STATE if the WiFi is not connected
+ */
+esp_err_t wifi_get_rssi(int *rssi)
+{
+    if (!is_wifi_connected())
+        return ESP_ERR_INVALID_STATE;
+
+    wifi_ap_record_t ap_info;
+
+    ESP_RETURN_ON_ERROR(esp_wifi_sta_get_ap_info(&ap_info), TAG, "Unable to read the AP info");
+
+    *rssi = ap_info.rssi;
+
+    return ESP_OK;
+}
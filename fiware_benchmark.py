@@ -0,0 +1,118 @@
+import argparse
+import time
+import requests
+
+# defaults match docker/.env and the firmware Kconfig defaults
+HOST = 'localhost'
+ORION_PORT = 1026
+IOTA_NORTH_PORT = 4041
+IOTA_SOUTH_PORT = 7896
+
+APIKEY = 'openiot'
+DEVICE_ID = 'edi001'
+ENTITY_ID = 'urn:ngsi-ld:Device:edi001'
+ENTITY_TYPE = 'Device'
+
+FIWARE_HEADERS = {'Fiware-Service': 'openiot', 'Fiware-ServicePath': '/'}
+
+
+def provision(host: str):
+    """Registers the service group and the device in the IoT Agent, existing registrations are kept"""
+    north = f'http://{host}:{IOTA_NORTH_PORT}/iot'
+
+    requests.post(f'{north}/services', headers=FIWARE_HEADERS, json={'services': [{
+        'apikey': APIKEY,
+        'cbroker': f'http://orion:{ORION_PORT}',
+        'entity_type': ENTITY_TYPE,
+        'resource': '/iot/d',
+    }]})
+
+    requests.post(f'{north}/devices', headers=FIWARE_HEADERS, json={'devices': [{
+        'device_id': DEVICE_ID,
+        'entity_name': ENTITY_ID,
+        'entity_type': ENTITY_TYPE,
+        'transport': 'HTTP',
+        'attributes': [{'object_id': 'counter', 'name': 'counter', 'type': 'Number'}],
+    }]})
+
+
+def wait_for_value(host: str, value: int, timeout: float = 30) -> bool:
+    """Polls Orion until the counter attribute of the entity reaches the value"""
+    url = f'http://{host}:{ORION_PORT}/v2/entities/{ENTITY_ID}/attrs/counter/value'
+    deadline = time.monotonic() + timeout
+
+    while time.monotonic() < deadline:
+        response = requests.get(url, headers=FIWARE_HEADERS)
+
+        if response.ok and int(float(response.text)) >= value:
+            return True
+
+        time.sleep(0.05)
+
+    return False
+
+
+def run_iot_agent(session: requests.Session, host: str, count: int, offset: int):
+    """Sends one UltraLight measurement per request, like the IoT Agent upload mode"""
+    url = f'http://{host}:{IOTA_SOUTH_PORT}/iot/d?i={DEVICE_ID}&k={APIKEY}'
+
+    for i in range(count):
+        session.post(url, data=f'counter|{offset + i}', headers={'Content-Type': 'text/plain'})
+
+
+def run_orion(session: requests.Session, host: str, count: int, offset: int, batch: int):
+    """Sends the measurements in NGSI v2 batch updates, like the Orion upload mode"""
+    url = f'http://{host}:{ORION_PORT}/v2/op/update'
+    headers = dict(FIWARE_HEADERS, **{'Content-Type': 'application/json'})
+
+    for start in range(0, count, batch):
+        entities = [{
+            'id': ENTITY_ID,
+            'type': ENTITY_TYPE,
+            'counter': {'type': 'Number', 'value': offset + i},
+        } for i in range(start, min(start + batch, count))]
+
+        session.post(url, json={'actionType': 'append', 'entities': entities}, headers=headers)
+
+
+def measure(name: str, host: str, count: int, offset: int, run):
+    """Runs an upload path and reports the entity update rate until the last value is visible in Orion"""
+    start = time.monotonic()
+    run()
+    sent = time.monotonic()
+
+    if not wait_for_value(host, offset + count - 1):
+        print(f'{name}: last update did not arrive in Orion')
+        return
+
+    done = time.monotonic()
+
+    print(f'{name}: {count} updates, sent in {sent - start:.2f} s, '
+          f'visible after {done - start:.2f} s ({count / (done - start):.1f} updates/s)')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compares the IoT Agent and the direct Orion upload paths')
+    parser.add_argument('--host', default=HOST)
+    parser.add_argument('--count', type=int, default=500, help='number of measurements per path')
+    parser.add_argument('--batch', type=int, default=16, help='measurements per Orion batch (CONFIG_ORION_BATCH_SIZE)')
+    args = parser.parse_args()
+
+    provision(args.host)
+
+    session = requests.Session()
+
+    # every run continues the counter so the end of the run can be detected in Orion
+    offset = int(time.time())
+
+    measure('IoT Agent (UltraLight)', args.host, args.count, offset,
+            lambda: run_iot_agent(session, args.host, args.count, offset))
+
+    offset += args.count
+
+    measure(f'Orion NGSI v2 (batch {args.batch})', args.host, args.count, offset,
+            lambda: run_orion(session, args.host, args.count, offset, args.batch))
+
+
+if __name__ == '__main__':
+    main()
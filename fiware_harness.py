@@ -0,0 +1,663 @@
+import argparse
+import json
+import os
+import random
+import secrets
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse, parse_qs
+
+import requests
+from serial import SerialException, serial_for_url
+
+import host_build
+
+# defaults match the firmware Kconfig defaults, point CONFIG_FIWARE_HOST at the machine running the harness
+PORT = 'COM5'
+DEVICE_HOST = '192.168.0.100'
+IOTA_SOUTH_PORT = 7896
+IDM_PORT = 8088
+ORION_PORT = 1026
+
+DEVICE_ID = 'edi001'
+APIKEY = 'openiot'
+DEVICE_ENDPOINT = '/api'
+
+ENQ = b'\x05'
+STX = b'\x02'
+ETX = b'\x03'
+ACK = b'\x06'
+EOT = b'\x04'
+
+# the FIWARE and UART components of the firmware built for the host, the robot line and the device endpoint are local ports
+HOST_UART_PORT = 7900
+HOST_HTTP_PORT = 7980
+
+HOST_SOURCES = [
+    host_build.source('fiware', 'fiware_task.c'),
+    host_build.source('fiware', 'iot_agent.c'),
+    host_build.source('fiware', 'fiware_idm.c'),
+    host_build.source('fiware', 'fiware_idm_parser.c'),
+    host_build.source('uart', 'uart_task.c'),
+    host_build.source('uart', 'kawasaki.c'),
+    host_build.source('task_intercom', 'task_intercom.c'),
+    host_build.source('server', 'server.c'),
+]
+
+# the sources the fiware component adds with an option, see its CMakeLists.txt
+HOST_OPTIONAL_SOURCES = {
+    'FIWARE_UPLOAD_ORION': [host_build.source('fiware', 'orion.c')],
+    'MEASUREMENT_FILTER_ENABLE': [host_build.source('fiware', 'measurement_payload.c'), host_build.source('fiware', 'measurement_filter.c')],
+    'MEASUREMENT_SHAPER_ENABLE': [host_build.source('fiware', 'measurement_payload.c'), host_build.source('fiware', 'measurement_shaper.c')],
+}
+
+# the upload modes of the fiware component, the Kconfig choice and the options it selects
+HOST_UPLOADS = {
+    'iot-agent': {},
+    'ngsi-v2': {'FIWARE_UPLOAD_IOT_AGENT': None, 'FIWARE_UPLOAD_NGSI_V2': 1, 'FIWARE_UPLOAD_ORION': 1},
+    'ngsi-ld': {'FIWARE_UPLOAD_IOT_AGENT': None, 'FIWARE_UPLOAD_NGSI_LD': 1, 'FIWARE_UPLOAD_ORION': 1},
+}
+
+# starts the tasks like app_main does. The MAU tasks are not built, a stand-in answers the robot commands with OK
+HOST_DRIVER = r'''
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+
+#include "fiware_task.h"
+#include "server.h"
+#include "task_intercom.h"
+#include "uart_task.h"
+#include "wifi.h"
+
+static void mau_stand_in(void *arg)
+{
+    itc_message_t *message;
+
+    while (true)
+    {
+        if (xQueueReceive(task_itc_from_uart_queue, &message, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        message->response_static = "OK";
+        task_intercom_send(task_itc_to_uart_queue, message, portMAX_DELAY);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    host_uart_tcp_port[UART_NUM_1] = atoi(argv[1]);
+    host_httpd_port = atoi(argv[2]);
+    host_log_level = atoi(argv[3]);
+
+    ESP_ERROR_CHECK(task_intercom_init());
+    ESP_ERROR_CHECK(uart_start_task());
+
+    if (xTaskCreate(mau_stand_in, "MAU", 4096, NULL, 1, NULL) != pdPASS)
+        return 1;
+
+    ESP_ERROR_CHECK(fiware_start_task());
+
+    wifi_wait_connected(portMAX_DELAY);
+
+    if (start_http_server() == NULL)
+        return 1;
+
+    while (true)
+        pause();
+}
+'''
+
+# the robot replies to the forwarded program update h<seq> with this prefix and the sequence number
+ROBOT_RESULT_PREFIX = 'DONE h'
+
+# protocol timeouts of the controller side, the firmware waits PROTOCOL_T1 (100 ms) for the ACK
+TIMEOUT_ACK = 0.5
+TIMEOUT_TEXT = 1.0
+
+
+class Recorder:
+    """Collects the send and arrival timestamps of every tracked event"""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.sent = {}
+        self.latencies = {}
+        self.counters = {}
+
+    def count(self, name: str, value: int = 1):
+        with self.lock:
+            self.counters[name] = self.counters.get(name, 0) + value
+
+    def start(self, kind: str, key):
+        with self.lock:
+            self.sent[(kind, key)] = time.monotonic()
+
+    def finish(self, kind: str, key) -> bool:
+        now = time.monotonic()
+
+        with self.lock:
+            start = self.sent.pop((kind, key), None)
+
+            if start is None:
+                return False
+
+            self.latencies.setdefault(kind, []).append(now - start)
+
+        return True
+
+    def cancel(self, kind: str, key):
+        with self.lock:
+            self.sent.pop((kind, key), None)
+
+    def outstanding(self, kind: str) -> int:
+        with self.lock:
+            return sum(1 for sent_kind, _ in self.sent if sent_kind == kind)
+
+
+def percentile(values: list, p: float) -> float:
+    """Nearest rank percentile of the values"""
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, max(0, round(p / 100 * len(ordered)) - 1))]
+
+
+def parse_command_result(result: str) -> int or None:
+    """Returns the sequence number of an IoT Agent command from the result the robot replied with"""
+    if result.startswith(ROBOT_RESULT_PREFIX) and result[len(ROBOT_RESULT_PREFIX):].isdigit():
+        return int(result[len(ROBOT_RESULT_PREFIX):])
+
+    return None
+
+
+def parse_ultralight(payload: str) -> dict:
+    """Splits an UltraLight 2.0 measurement "attr|value|attr|value" into a dict"""
+    fields = payload.split('|')
+    return dict(zip(fields[0::2], fields[1::2]))
+
+
+def make_handler(recorder: Recorder, token_lifetime: int):
+    """Creates the request handler shared by the IoT Agent, Keyrock and Orion stand-ins"""
+
+    class StandInHandler(BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def log_message(self, format, *args):
+            pass
+
+        def reply(self, status: int, body: bytes = b'', content_type: str = 'text/plain'):
+            self.send_response(status)
+            self.send_header('Content-Type', content_type)
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_POST(self):
+            url = urlparse(self.path)
+            body = self.rfile.read(int(self.headers.get('Content-Length', 0))).decode()
+
+            if url.path == '/oauth2/token':
+                self.oauth2_token()
+            elif url.path == '/iot/d':
+                self.iot_agent(parse_qs(url.query), body)
+            elif url.path in ('/v2/op/update', '/ngsi-ld/v1/entityOperations/upsert'):
+                self.orion(body)
+            else:
+                self.reply(404)
+
+        def oauth2_token(self):
+            recorder.count('token requests')
+
+            token = {
+                'access_token': secrets.token_hex(20),
+                'token_type': 'Bearer',
+                'expires_in': token_lifetime,
+                'refresh_token': secrets.token_hex(20),
+                'scope': ['bearer'],
+            }
+
+            self.reply(200, json.dumps(token).encode(), 'application/json')
+
+        def iot_agent(self, query: dict, body: str):
+            if query.get('k') != [APIKEY] or query.get('i') != [DEVICE_ID]:
+                self.reply(404)
+                return
+
+            recorder.count('iot agent requests')
+
+            # command results look like "<device>@<command>|<result>"
+            if '@' in body.split('|', 1)[0]:
+                recorder.count('command results')
+                self.finish_command(body.partition('|')[2])
+                self.reply(200)
+                return
+
+            measurement = parse_ultralight(body)
+
+            if 'seq' in measurement and recorder.finish('upload', int(measurement['seq'])):
+                recorder.count('measurements uploaded')
+
+            self.reply(200)
+
+        def orion(self, body: str):
+            recorder.count('orion requests')
+
+            try:
+                entities = json.loads(body)
+                entities = entities['entities'] if isinstance(entities, dict) else entities
+            except (ValueError, KeyError):
+                self.reply(400)
+                return
+
+            for entity in entities:
+                seq = entity.get('seq', {}).get('value')
+
+                if seq is not None and recorder.finish('upload', int(seq)):
+                    recorder.count('measurements uploaded')
+
+                # command results are batched as <command>_status and <command>_info
+                info = entity.get('update_program_info', {}).get('value')
+
+                if info is not None:
+                    recorder.count('command results')
+                    self.finish_command(str(info))
+
+            self.reply(204)
+
+        def finish_command(self, result: str):
+            seq = parse_command_result(result)
+
+            if seq is not None and recorder.finish('iot command result', seq):
+                recorder.count('command results from robot')
+
+    return StandInHandler
+
+
+def start_stand_ins(ports: list, recorder: Recorder, token_lifetime: int):
+    """Serves every stand-in on all of its ports, the handler dispatches by path"""
+    handler = make_handler(recorder, token_lifetime)
+
+    for port in ports:
+        server = ThreadingHTTPServer(('0.0.0.0', port), handler)
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+
+
+class Robot:
+    """Plays the Kawasaki Controller on the serial line"""
+
+    def __init__(self, url: str, baudrate: int, recorder: Recorder, connect_timeout: float = 0):
+        deadline = time.monotonic() + connect_timeout
+
+        # the line of the host firmware is only there once its UART task started
+        while True:
+            try:
+                self.ser = serial_for_url(url, baudrate=baudrate, timeout=0.01)
+                break
+            except SerialException:
+                if time.monotonic() > deadline:
+                    raise
+
+                time.sleep(0.1)
+
+        self.recorder = recorder
+        self.message_id = 0
+        self.results = []
+
+    def read_byte(self, timeout: float) -> bytes:
+        deadline = time.monotonic() + timeout
+
+        while time.monotonic() < deadline:
+            data = self.ser.read(1)
+
+            if data:
+                return data
+
+        return b''
+
+    def send(self, payload: str) -> bool:
+        """Sends a transmission, returns False on collision or protocol error"""
+        self.ser.write(ENQ)
+
+        answer = self.read_byte(TIMEOUT_ACK)
+
+        if answer == ENQ:
+            # the device started a transmission at the same time, it gives up on its side
+            self.recorder.count('collisions')
+            return False
+
+        if answer != ACK:
+            self.recorder.count('protocol errors')
+            return False
+
+        self.ser.write(STX + payload.encode() + ETX)
+
+        if self.read_byte(TIMEOUT_ACK) != ACK:
+            self.recorder.count('protocol errors')
+            return False
+
+        self.ser.write(EOT)
+
+        return True
+
+    def receive(self) -> str or None:
+        """Receives a transmission after the ENQ has been read"""
+        self.ser.write(ACK)
+
+        if self.read_byte(TIMEOUT_TEXT) != STX:
+            self.recorder.count('protocol errors')
+            return None
+
+        text = b''
+
+        while True:
+            data = self.read_byte(TIMEOUT_TEXT)
+
+            if data == ETX:
+                break
+
+            if not data:
+                self.recorder.count('protocol errors')
+                return None
+
+            text += data
+
+        self.ser.write(ACK)
+
+        if self.read_byte(TIMEOUT_TEXT) != EOT:
+            self.recorder.count('protocol errors')
+
+        return text.decode(errors='replace')
+
+    def poll(self):
+        """Receives the pending transmission of the device if there is one"""
+        if self.ser.read(1) != ENQ:
+            return
+
+        text = self.receive()
+
+        if text is None:
+            return
+
+        self.recorder.count('frames received')
+
+        header, _, response = text.partition('@')
+        response_type = response.split('|', 1)[0]
+
+        # commands forwarded from the IoT Agent, the program name carries the sequence number.
+        # The robot replies with a result transmission carrying the id of the command
+        if response.startswith('PROGRAM|h'):
+            seq = int(response[len('PROGRAM|h'):])
+            self.recorder.finish('iot command', seq)
+            self.results.append(f'#RESULT:{header[1:]}@{ROBOT_RESULT_PREFIX}{seq}')
+            return
+
+        if not header.startswith('#') or not header[1:].isdigit():
+            self.recorder.count('unexpected frames')
+            return
+
+        message_id = int(header[1:])
+
+        if self.recorder.finish('reply', message_id):
+            self.recorder.count(f'replies {response_type}')
+        elif self.recorder.finish('robot command', message_id):
+            self.recorder.count(f'command replies {response_type}')
+
+    def send_result(self):
+        """Sends the oldest result of the forwarded commands, it is retried after a collision"""
+        if self.send(self.results[0]):
+            self.recorder.count('results sent')
+            self.results.pop(0)
+
+    def inject(self, kind: str, payload: str, seq: int) -> bool:
+        """Sends a measurement or command frame and tracks its reply"""
+        self.message_id += 1
+
+        transmission_type = 'MEASUREMENT' if kind == 'reply' else 'COMMAND'
+
+        # start the clock before the first byte, the device may answer before send() returns
+        self.recorder.start(kind, self.message_id)
+
+        if kind == 'reply':
+            self.recorder.start('upload', seq)
+
+        if self.send(f'#{transmission_type}:{self.message_id}@{payload}'):
+            self.recorder.count('frames sent')
+            return True
+
+        self.recorder.cancel(kind, self.message_id)
+        self.recorder.cancel('upload', seq)
+
+        return False
+
+
+def run_iot_commands(args, recorder: Recorder, stop: threading.Event):
+    """Sends commands to the device like the north port of the IoT Agent"""
+    session = requests.Session()
+    url = f'http://{args.device}{DEVICE_ENDPOINT}'
+    seq = 0
+
+    while not stop.wait(1 / args.command_rate):
+        seq += 1
+        recorder.start('iot command', seq)
+        recorder.start('iot command result', seq)
+
+        try:
+            response = session.post(url, data=f'{DEVICE_ID}@update_program|h{seq}', timeout=5)
+            recorder.count(f'iot command responses {response.text.rsplit("|", 1)[-1]}')
+        except requests.RequestException:
+            recorder.count('iot command errors')
+            recorder.cancel('iot command', seq)
+            recorder.cancel('iot command result', seq)
+
+
+def build_host_firmware(args, directory: str) -> str:
+    """Builds the FIWARE and UART components for the host, configured for the stand-ins"""
+    iota_port, idm_port, orion_port = args.stand_in_ports
+    config = dict(HOST_UPLOADS[args.upload], IOT_AGENT_SOUTH_PORT=iota_port, FIWARE_IDM_PORT=idm_port, ORION_PORT=orion_port)
+
+    for option in args.config:
+        name, _, value = option.partition('=')
+        config[name] = value if value else None
+
+    enabled = dict(host_build.CONFIG, **config)
+    sources = list(HOST_SOURCES)
+
+    for name, optional in HOST_OPTIONAL_SOURCES.items():
+        if enabled.get(name) is not None:
+            sources += [source for source in optional if source not in sources]
+
+    return host_build.build(args.cc, directory, HOST_DRIVER, sources, config=config, name='firmware')
+
+
+def start_host_firmware(args, executable: str) -> subprocess.Popen:
+    """Starts the host firmware, the robot and the IoT Agent commands are pointed at its ports"""
+    args.port = f'socket://127.0.0.1:{args.host_uart_port}'
+    args.device = f'127.0.0.1:{args.host_http_port}'
+
+    return subprocess.Popen([executable, str(args.host_uart_port), str(args.host_http_port), str(args.host_log_level)])
+
+
+def run(args, recorder: Recorder) -> float:
+    """Drives the robot for the duration of the run and waits for the outstanding events"""
+    robot = Robot(args.port, args.baudrate, recorder, connect_timeout=10 if args.host else 0)
+
+    stop = threading.Event()
+
+    if args.command_rate > 0:
+        threading.Thread(target=run_iot_commands, args=(args, recorder, stop), daemon=True).start()
+
+    start = time.monotonic()
+    next_event = start
+    seq = 0
+
+    while time.monotonic() - start < args.duration:
+        robot.poll()
+
+        if robot.results and not robot.ser.in_waiting:
+            robot.send_result()
+
+        if time.monotonic() < next_event:
+            continue
+
+        next_event += 1 / args.rate
+
+        # never start a transmission while the device has one pending
+        if robot.ser.in_waiting:
+            continue
+
+        if random.random() < args.command_mix:
+            robot.inject('robot command', args.robot_command, 0)
+        else:
+            seq += 1
+            robot.inject('reply', f'seq|{seq}|ph|{random.uniform(6, 8):.2f}|temperature|{random.uniform(20, 30):.1f}', seq)
+
+    elapsed = time.monotonic() - start
+    stop.set()
+
+    # collect the replies and uploads still in flight
+    deadline = time.monotonic() + args.drain
+
+    while time.monotonic() < deadline and any(recorder.outstanding(kind) for kind in ('reply', 'upload', 'iot command result')):
+        robot.poll()
+
+        if robot.results and not robot.ser.in_waiting:
+            robot.send_result()
+
+    recorder.count('measurements sent', seq)
+
+    return elapsed
+
+
+def summarize(recorder: Recorder, elapsed: float) -> dict:
+    """Computes the result figures compared against the baseline"""
+    result = {
+        'uploads_per_s': recorder.counters.get('measurements uploaded', 0) / elapsed,
+        'lost_uploads': recorder.outstanding('upload'),
+        'lost_replies': recorder.outstanding('reply'),
+        'lost_command_results': recorder.outstanding('iot command result'),
+    }
+
+    for kind, values in recorder.latencies.items():
+        name = kind.replace(' ', '_')
+
+        for p in (50, 95, 99):
+            result[f'{name}_p{p}_ms'] = 1000 * percentile(values, p)
+
+    return result
+
+
+def check_regressions(result: dict, baseline: dict, threshold: float) -> list:
+    """Lists the figures that are worse than the baseline by more than the threshold"""
+    regressions = []
+
+    for name, reference in baseline.items():
+        value = result.get(name)
+
+        if value is None:
+            continue
+
+        if name.endswith('_ms') and value > reference * (1 + threshold):
+            regressions.append(f'{name}: {value:.1f} vs {reference:.1f}')
+        elif name.endswith('_per_s') and value < reference * (1 - threshold):
+            regressions.append(f'{name}: {value:.1f} vs {reference:.1f}')
+        elif name.startswith('lost_') and value > reference:
+            regressions.append(f'{name}: {value} vs {reference}')
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='End-to-end load harness with local FIWARE stand-ins and a simulated robot, '
+                                                 'against a device or with --host the firmware components built for Linux')
+    parser.add_argument('--port', default=PORT, help='serial port of the robot UART, any pyserial URL works')
+    parser.add_argument('--baudrate', type=int, default=9600)
+    parser.add_argument('--device', default=DEVICE_HOST, help='address of the device for the IoT Agent commands')
+    parser.add_argument('--stand-in-ports', type=int, nargs='+', default=[IOTA_SOUTH_PORT, IDM_PORT, ORION_PORT])
+    parser.add_argument('--token-lifetime', type=int, default=3600, help='expires_in of the issued access tokens in seconds')
+    parser.add_argument('--duration', type=float, default=30, help='injection time in seconds')
+    parser.add_argument('--drain', type=float, default=10, help='time to wait for outstanding events in seconds')
+    parser.add_argument('--rate', type=float, default=5, help='frames injected by the robot per second')
+    parser.add_argument('--command-mix', type=float, default=0.1, help='share of commands among the robot frames')
+    parser.add_argument('--robot-command', default='PH|MEASURE', help='payload of the robot commands')
+    parser.add_argument('--command-rate', type=float, default=0.5, help='IoT Agent commands per second, 0 disables them')
+    parser.add_argument('--baseline', help='JSON file with the reference results')
+    parser.add_argument('--save-baseline', help='stores the results of this run as the reference')
+    parser.add_argument('--threshold', type=float, default=0.2, help='allowed relative regression against the baseline')
+    parser.add_argument('--host', action='store_true', help='run the FIWARE and UART components built for the host instead of a device')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'), help='compiler of the host firmware')
+    parser.add_argument('--upload', choices=HOST_UPLOADS, default='iot-agent', help='upload mode of the host firmware')
+    parser.add_argument('--config', action='append', default=[], metavar='NAME=VALUE',
+                        help='overrides a Kconfig option of the host firmware, an empty value disables it')
+    parser.add_argument('--host-uart-port', type=int, default=HOST_UART_PORT, help='TCP port of the robot line of the host firmware')
+    parser.add_argument('--host-http-port', type=int, default=HOST_HTTP_PORT, help='TCP port of the device endpoint of the host firmware')
+    parser.add_argument('--host-log-level', type=int, default=2, help='log level of the host firmware, 0 none to 5 verbose')
+    args = parser.parse_args()
+
+    if args.host and shutil.which(args.cc) is None:
+        sys.exit(f'Compiler {args.cc} not found')
+
+    recorder = Recorder()
+    start_stand_ins(args.stand_in_ports, recorder, args.token_lifetime)
+
+    with tempfile.TemporaryDirectory() as directory:
+        firmware = start_host_firmware(args, build_host_firmware(args, directory)) if args.host else None
+
+        try:
+            print("Opening serial port: ", args.port)
+            elapsed = run(args, recorder)
+        finally:
+            crashed = firmware is not None and firmware.poll() is not None
+
+            if firmware is not None:
+                firmware.terminate()
+                firmware.wait()
+
+    if crashed:
+        sys.exit(f'The host firmware exited with {firmware.returncode}')
+
+    result = summarize(recorder, elapsed)
+
+    for name, value in sorted(recorder.counters.items()):
+        print(f'{name:32s} {value}')
+
+    print()
+
+    for name, value in result.items():
+        print(f'{name:32s} {value:.1f}')
+
+    if args.save_baseline:
+        with open(args.save_baseline, 'w') as file:
+            json.dump(result, file, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as file:
+            regressions = check_regressions(result, json.load(file), args.threshold)
+
+        if regressions:
+            print()
+            print("Regressions beyond the threshold:")
+
+            for regression in regressions:
+                print("  ", regression)
+
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    try:
+        main()
+
+    except KeyboardInterrupt:
+        print()
+        print("Exiting")
+        sys.exit(1)
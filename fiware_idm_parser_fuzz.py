@@ -0,0 +1,539 @@
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+PARSER_SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'components', 'fiware', 'fiware_idm_parser.c')
+PARSER_INCLUDE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'components', 'fiware', 'include')
+
+# length of the token buffers, FIWARE_IDM_ACCESS_TOKEN_LEN
+TOKEN_LEN = 40
+
+# deepest nesting of objects and arrays, FIWARE_IDM_PARSER_MAX_DEPTH
+MAX_DEPTH = 16
+
+# the host has no ESP-IDF, the parser only needs the error codes
+ESP_ERR_SHIM = r'''
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_INVALID_RESPONSE 0x108
+'''
+
+# parses a body read from stdin in chunks, fuzzes the parser with mutations of a corpus,
+# or times the parser on a body. Every chunk is copied into a buffer of its exact size,
+# so the address sanitizer catches reads past the end of a chunk
+DRIVER = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fiware_idm_parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#endif
+
+#define MAX_INPUT 4096
+#define MAX_SPLITS 64
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef struct
+{
+    esp_err_t ret;
+    bool complete;
+    FiwareAccessToken_t token;
+} result_t;
+
+static size_t read_all(FILE *file, char *buffer)
+{
+    return fread(buffer, 1, MAX_INPUT, file);
+}
+
+/* feeds the body in the chunks between the split points, stops at the first error like the event handler */
+static void parse(const char *data, size_t length, const size_t *splits, size_t split_count, result_t *result)
+{
+    fiware_idm_parser_t parser;
+    size_t start = 0;
+
+    memset(&result->token, 0xa5, sizeof(result->token));
+    fiware_idm_parser_init(&parser, &result->token);
+    result->ret = ESP_OK;
+
+    for (size_t i = 0; i <= split_count; i++)
+    {
+        size_t end = i < split_count ? splits[i] : length;
+        char *chunk = malloc(MAX(1, end - start));
+
+        memcpy(chunk, data + start, end - start);
+        result->ret = fiware_idm_parser_feed(&parser, chunk, end - start);
+        free(chunk);
+
+        start = end;
+
+        if (result->ret != ESP_OK)
+            break;
+    }
+
+    result->complete = result->ret == ESP_OK && fiware_idm_parser_is_complete(&parser);
+
+    if (!result->complete)
+        return;
+
+    // a complete token has terminated strings
+    if (memchr(result->token.token, '\0', sizeof(result->token.token)) == NULL ||
+        memchr(result->token.refresh_token, '\0', sizeof(result->token.refresh_token)) == NULL)
+    {
+        fprintf(stderr, "unterminated token\n");
+        abort();
+    }
+}
+
+static size_t even_splits(size_t length, size_t chunk, size_t *splits)
+{
+    size_t count = 0;
+
+    for (size_t offset = chunk; chunk > 0 && offset < length; offset += chunk)
+        splits[count++] = offset;
+
+    return count;
+}
+
+static bool same(const result_t *a, const result_t *b)
+{
+    if (a->ret != b->ret || a->complete != b->complete)
+        return false;
+
+    if (!a->complete)
+        return true;
+
+    return strcmp(a->token.token, b->token.token) == 0 &&
+           strcmp(a->token.refresh_token, b->token.refresh_token) == 0 &&
+           a->token.expires_in == b->token.expires_in;
+}
+
+static void print_result(const result_t *result)
+{
+    printf("%d %d", result->ret, result->complete);
+
+    if (result->complete)
+        printf(" %s %s %lld", result->token.token, result->token.refresh_token, (long long)result->token.expires_in);
+
+    printf("\n");
+}
+
+/* mutations favour the characters the tokenizer switches on */
+static size_t mutate(char *data, size_t length, const char *donor, size_t donor_length)
+{
+    static const char special[] = "{}[]\":,\\ \t\r\n0123456789.eE-tfn";
+    int mutations = 1 + rand() % 4;
+
+    for (int m = 0; m < mutations; m++)
+    {
+        size_t position = length > 0 ? (size_t)rand() % (length + 1) : 0;
+
+        switch (rand() % 7)
+        {
+        case 0: // replace a character
+            if (position < length)
+                data[position] = special[rand() % (sizeof(special) - 1)];
+            break;
+        case 1: // random byte
+            if (position < length)
+                data[position] = (char)(rand() % 256);
+            break;
+        case 2: // insert a character
+            if (length < MAX_INPUT)
+            {
+                memmove(data + position + 1, data + position, length - position);
+                data[position] = special[rand() % (sizeof(special) - 1)];
+                length++;
+            }
+            break;
+        case 3: // delete a range
+            if (position < length)
+            {
+                size_t count = 1 + rand() % (length - position);
+                memmove(data + position, data + position + count, length - position - count);
+                length -= count;
+            }
+            break;
+        case 4: // truncate
+            length = position;
+            break;
+        case 5: // repeat a range, grows strings past their buffers and nests deeper
+            if (position < length)
+            {
+                size_t count = 1 + rand() % (length - position);
+
+                if (count > 64)
+                    count = 64;
+
+                if (length + count <= MAX_INPUT)
+                {
+                    memmove(data + position + count, data + position, length - position);
+                    length += count;
+                }
+            }
+            break;
+        case 6: // splice a piece of another input
+            if (donor_length > 0)
+            {
+                size_t from = rand() % donor_length;
+                size_t count = 1 + rand() % (donor_length - from);
+
+                if (length + count <= MAX_INPUT)
+                {
+                    memmove(data + position + count, data + position, length - position);
+                    memcpy(data + position, donor + from, count);
+                    length += count;
+                }
+            }
+            break;
+        }
+    }
+
+    return length;
+}
+
+static int fuzz(unsigned seed, long iterations, int corpus_count, char **corpus_paths)
+{
+    static char corpus[64][MAX_INPUT];
+    size_t corpus_lengths[64];
+    static char input[MAX_INPUT];
+    size_t splits[MAX_SPLITS];
+    long complete = 0, failed = 0;
+
+    for (int i = 0; i < corpus_count && i < 64; i++)
+    {
+        FILE *file = fopen(corpus_paths[i], "rb");
+        corpus_lengths[i] = read_all(file, corpus[i]);
+        fclose(file);
+    }
+
+    srand(seed);
+
+    for (long iteration = 0; iteration < iterations; iteration++)
+    {
+        int base = rand() % corpus_count;
+        int donor = rand() % corpus_count;
+        size_t length = corpus_lengths[base];
+
+        memcpy(input, corpus[base], length);
+        length = mutate(input, length, corpus[donor], corpus_lengths[donor]);
+
+        result_t whole, split;
+        parse(input, length, NULL, 0, &whole);
+
+        // byte by byte, a fixed chunk size and random split points must all agree with the whole body
+        for (int pass = 0; pass < 3; pass++)
+        {
+            size_t count;
+
+            if (pass < 2)
+            {
+                size_t chunk = pass == 0 ? 1 : 1 + rand() % 16;
+
+                // long inputs are split into fewer, longer chunks
+                if (length / chunk >= MAX_SPLITS)
+                    chunk = length / MAX_SPLITS + 1;
+
+                count = even_splits(length, chunk, splits);
+            }
+            else
+            {
+                count = length > 1 ? rand() % MAX_SPLITS : 0;
+
+                for (size_t i = 0; i < count; i++)
+                    splits[i] = rand() % (length + 1);
+
+                // sort, empty chunks are allowed
+                for (size_t i = 1; i < count; i++)
+                    for (size_t j = i; j > 0 && splits[j - 1] > splits[j]; j--)
+                    {
+                        size_t swap = splits[j];
+                        splits[j] = splits[j - 1];
+                        splits[j - 1] = swap;
+                    }
+            }
+
+            parse(input, length, splits, count, &split);
+
+            if (!same(&whole, &split))
+            {
+                FILE *file = fopen("fuzz_failure.bin", "wb");
+                fwrite(input, 1, length, file);
+                fclose(file);
+
+                printf("mismatch at iteration %ld, pass %d, input written to fuzz_failure.bin\n", iteration, pass);
+                print_result(&whole);
+                print_result(&split);
+
+                return 1;
+            }
+        }
+
+        if (whole.complete)
+            complete++;
+        else if (whole.ret != ESP_OK)
+            failed++;
+    }
+
+    printf("%ld %ld %ld\n", iterations, complete, failed);
+
+    return 0;
+}
+
+static int bench(const char *data, size_t length, long repeats, size_t chunk)
+{
+    size_t splits[MAX_INPUT];
+    size_t count = even_splits(length, chunk, splits);
+    size_t start;
+    fiware_idm_parser_t parser;
+    FiwareAccessToken_t token;
+    volatile int sink = 0;
+    struct timespec begin, end;
+    unsigned long long cycles = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+#ifdef HAS_TSC
+    unsigned long long tsc = __rdtsc();
+#endif
+
+    for (long r = 0; r < repeats; r++)
+    {
+        fiware_idm_parser_init(&parser, &token);
+        start = 0;
+
+        for (size_t i = 0; i <= count; i++)
+        {
+            size_t stop = i < count ? splits[i] : length;
+            fiware_idm_parser_feed(&parser, data + start, stop - start);
+            start = stop;
+        }
+
+        sink += fiware_idm_parser_is_complete(&parser);
+    }
+
+#ifdef HAS_TSC
+    cycles = __rdtsc() - tsc;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double total = (double)length * repeats;
+    double ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+
+    printf("%f %f %d\n", ns / total, cycles / total, sink == repeats);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static char body[MAX_INPUT];
+
+    if (strcmp(argv[1], "fuzz") == 0)
+        return fuzz(atoi(argv[2]), atol(argv[3]), argc - 4, argv + 4);
+
+    size_t length = read_all(stdin, body);
+
+    if (strcmp(argv[1], "bench") == 0)
+        return bench(body, length, atol(argv[2]), atoi(argv[3]));
+
+    size_t splits[MAX_INPUT];
+    result_t result;
+
+    parse(body, length, splits, even_splits(length, atoi(argv[2]), splits), &result);
+    print_result(&result);
+
+    return 0;
+}
+'''
+
+ACCESS = 'a' * 8 + '-' + 'b' * 4 + '-' + 'c' * 4 + '-' + 'd' * 4 + '-' + 'e' * 12
+REFRESH = '0123456789abcdef0123456789abcdef01234567'
+
+# a KeyRock password grant response
+KEYROCK = ('{"access_token":"%s","token_type":"Bearer","expires_in":3599,'
+           '"refresh_token":"%s","scope":["bearer"]}' % (ACCESS, REFRESH))
+
+OK = (0, True, ACCESS, REFRESH, 3599)
+INCOMPLETE = (0, False)
+INVALID_SIZE = (0x104, False)
+INVALID_RESPONSE = (0x108, False)
+
+# name, body, expected (error code, complete, access token, refresh token, expires in)
+CASES = [
+    ('keyrock', KEYROCK, OK),
+    ('whitespace', KEYROCK.replace(':', ' :\r\n\t ').replace(',', ' ,\n ').replace('{', ' {\n'), OK),
+    ('field order', '{"expires_in":3599,"refresh_token":"%s","access_token":"%s"}' % (REFRESH, ACCESS), OK),
+    ('nested skipped', '{"user":{"id":"x","name":"a \\" } ] { [","roles":[{"id":"r"},[1,2]]},'
+                       '"access_token":"%s","refresh_token":"%s","expires_in":3599}' % (ACCESS, REFRESH), OK),
+    ('deepest nesting', '{"x":%s%s,"access_token":"%s","refresh_token":"%s","expires_in":3599}'
+                        % ('[' * (MAX_DEPTH - 1), ']' * (MAX_DEPTH - 1), ACCESS, REFRESH), OK),
+    ('nesting too deep', '{"x":%s{"access_token":"x"}%s,"access_token":"%s","refresh_token":"%s","expires_in":3599}'
+                         % ('[' * 300, ']' * 300, ACCESS, REFRESH), INVALID_SIZE),
+    ('literals skipped', '{"a":true,"b":null,"c":-1.5e3,"access_token":"%s","d":false,'
+                         '"refresh_token":"%s","expires_in":3599}' % (ACCESS, REFRESH), OK),
+    ('long key', '{"a_key_longer_than_the_key_buffer":"access_token","access_token":"%s",'
+                 '"refresh_token":"%s","expires_in":3599}' % (ACCESS, REFRESH), OK),
+    ('field prefix key', '{"access_token_type":"x","access_token":"%s","refresh_token":"%s","expires_in":3599}'
+                         % (ACCESS, REFRESH), OK),
+    ('escaped key', '{"access\\_token":"x","access_token":"%s","refresh_token":"%s","expires_in":3599}'
+                    % (ACCESS, REFRESH), OK),
+    ('escaped token', '{"access_token":"ab\\"c\\\\d","refresh_token":"%s","expires_in":1}' % REFRESH,
+     (0, True, 'ab"c\\d', REFRESH, 1)),
+    ('full length token', '{"access_token":"%s","refresh_token":"%s","expires_in":3599}' % ('x' * TOKEN_LEN, REFRESH),
+     (0, True, 'x' * TOKEN_LEN, REFRESH, 3599)),
+    ('token too long', '{"access_token":"%s","refresh_token":"%s","expires_in":3599}' % ('x' * (TOKEN_LEN + 1), REFRESH),
+     INVALID_SIZE),
+    ('expires fraction', '{"access_token":"%s","refresh_token":"%s","expires_in":3599.75}' % (ACCESS, REFRESH), OK),
+    ('expires exponent', '{"access_token":"%s","refresh_token":"%s","expires_in":3599e0 }' % (ACCESS, REFRESH), OK),
+    ('expires too long', '{"access_token":"%s","refresh_token":"%s","expires_in":12345678901}' % (ACCESS, REFRESH),
+     INVALID_SIZE),
+    ('expires string', '{"access_token":"%s","refresh_token":"%s","expires_in":"3599"}' % (ACCESS, REFRESH),
+     INCOMPLETE),
+    ('missing field', '{"access_token":"%s","expires_in":3599}' % ACCESS, INCOMPLETE),
+    ('truncated', KEYROCK[:len(KEYROCK) // 2], INCOMPLETE),
+    ('truncated at end', KEYROCK[:-1], INCOMPLETE),
+    ('empty object', '{}', INCOMPLETE),
+    ('empty body', '', INCOMPLETE),
+    ('trailing data', KEYROCK + '\n{"access_token":"other"}', OK),
+    ('html error page', '<html><body>502 Bad Gateway</body></html>', INVALID_RESPONSE),
+    ('array body', '[%s]' % KEYROCK, INVALID_RESPONSE),
+    ('missing colon', '{"access_token" "%s"}' % ACCESS, INVALID_RESPONSE),
+    ('missing comma', '{"access_token":"%s" "refresh_token":"%s"}' % (ACCESS, REFRESH), INVALID_RESPONSE),
+]
+
+
+def build(cc: str, directory: str, sanitize: bool) -> str:
+    """Compiles the parser and the driver into a host executable, with the address and undefined behaviour sanitizers"""
+    driver = os.path.join(directory, 'driver.c')
+    executable = os.path.join(directory, 'driver_asan' if sanitize else 'driver')
+
+    with open(driver, 'w') as file:
+        file.write(DRIVER)
+
+    with open(os.path.join(directory, 'esp_err.h'), 'w') as file:
+        file.write(ESP_ERR_SHIM)
+
+    if sanitize:
+        flags = ['-O1', '-g', '-fsanitize=address,undefined', '-fno-sanitize-recover=all', '-fno-omit-frame-pointer']
+    else:
+        flags = ['-O2']
+
+    subprocess.run([cc, *flags, '-std=gnu11', '-Wall', f'-I{directory}', f'-I{PARSER_INCLUDE}',
+                    '-o', executable, driver, PARSER_SOURCE], check=True)
+
+    return executable
+
+
+def parse(executable: str, body: str, chunk: int) -> tuple:
+    """Parses the body in chunks of the given size, 0 for a single chunk"""
+    output = subprocess.run([executable, 'parse', str(chunk)], input=body.encode(), check=True,
+                            capture_output=True).stdout.decode().split()
+
+    ret, complete = int(output[0]), output[1] == '1'
+
+    if not complete:
+        return ret, complete
+
+    return ret, complete, output[2], output[3], int(output[4])
+
+
+def check_cases(executable: str, chunks: list) -> int:
+    """Parses every case in every chunk size, returns the number of failures"""
+    failures = 0
+
+    for name, body, expected in CASES:
+        failed = False
+
+        for chunk in chunks:
+            result = parse(executable, body, chunk)
+
+            if result != expected:
+                print(f'{name} (chunks of {chunk or "all"}): expected {expected}, got {result}')
+                failed = True
+
+        failures += failed
+
+    print(f'cases: {len(CASES) - failures}/{len(CASES)} ok in chunks of {", ".join(str(chunk or "all") for chunk in chunks)}')
+
+    return failures
+
+
+def fuzz(executable: str, directory: str, args) -> bool:
+    """Mutates the case bodies, every input is parsed whole and split, the results have to agree"""
+    corpus = []
+
+    for index, (_, body, _) in enumerate(CASES):
+        if not body:
+            continue
+
+        path = os.path.join(directory, f'corpus_{index}.json')
+
+        with open(path, 'w') as file:
+            file.write(body)
+
+        corpus.append(path)
+
+    result = subprocess.run([executable, 'fuzz', str(args.seed), str(args.iterations), *corpus],
+                            cwd=os.getcwd(), capture_output=True, text=True)
+
+    if result.returncode != 0:
+        print(result.stdout + result.stderr)
+        return False
+
+    iterations, complete, failed = (int(value) for value in result.stdout.split())
+    print(f'fuzz: {iterations} inputs, {complete} complete tokens, {failed} rejected, no sanitizer findings')
+
+    return True
+
+
+def bench(executable: str, args):
+    """Times the parser on the KeyRock response, whole and in small chunks"""
+    for chunk in (0, 16, 1):
+        output = subprocess.run([executable, 'bench', str(args.repeats), str(chunk)], input=KEYROCK.encode(),
+                                check=True, capture_output=True).stdout.split()
+        ns, cycles, complete = float(output[0]), float(output[1]), output[2] == b'1'
+
+        label = f'chunks of {chunk}' if chunk else 'single chunk'
+        cycles_text = f', {cycles:.2f} cycles/byte' if cycles > 0 else ''
+        print(f'bench ({label}): {ns:.2f} ns/byte{cycles_text}, {ns * len(KEYROCK) / 1000:.2f} us per response'
+              f'{"" if complete else ", NOT COMPLETE"}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Checks, fuzzes and benchmarks the IdM token response parser on the host')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--iterations', type=int, default=200000, help='mutated inputs of the fuzzer')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--repeats', type=int, default=200000, help='parsed responses per benchmark')
+    parser.add_argument('--no-sanitize', action='store_true', help='check and fuzz without the sanitizers')
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        sys.exit(f'Compiler {args.cc} not found')
+
+    with tempfile.TemporaryDirectory() as directory:
+        checked = build(args.cc, directory, not args.no_sanitize)
+        timed = build(args.cc, directory, False)
+
+        failures = check_cases(checked, [0, 1, 2, 3, 7, 64])
+        fuzzed = fuzz(checked, directory, args)
+        bench(timed, args)
+
+    if failures or not fuzzed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
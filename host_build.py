@@ -0,0 +1,2327 @@
+import os
+import subprocess
+
+# host build of the firmware components: the ESP-IDF and FreeRTOS APIs they use are replaced by shims
+# running on pthreads and sockets, the component sources are compiled unchanged
+ROOT = os.path.dirname(os.path.abspath(__file__))
+COMPONENTS = os.path.join(ROOT, 'components')
+
+INCLUDES = [os.path.join(COMPONENTS, name, 'include') for name in ('fiware', 'task_intercom', 'metrics', 'wifi', 'uart', 'server')]
+
+# the Kconfig defaults of the options the host build compiles with, booleans are defined as 1
+CONFIG = {
+    'FIWARE_TASK_ENABLE': 1,
+    'FIWARE_TASK_PRIO': 3,
+    'FIWARE_TASK_STACK_DEPTH': 4000,
+    'FIWARE_TASK_MEASUREMENT_RATIO': 4,
+    'FIWARE_HOST': '"127.0.0.1"',
+    'FIWARE_UPLOAD_IOT_AGENT': 1,
+    'FIWARE_IDM_PORT': 8088,
+    'FIWARE_IDM_APP_ID': '"47239baf-a484-4067-b22b-1cf0e7494e48"',
+    'FIWARE_IDM_APP_SECRET': '"8c7d6e2d-5984-4595-99ee-a7872c730d17"',
+    'FIWARE_IDM_USERNAME': '"iot_sensor_8ece83c7-3846-470a-90ed-52bc41c9661b"',
+    'FIWARE_IDM_PASSWORD': '"iot_sensor_d859d9aa-733b-43b5-a67e-895b7c01affe"',
+    'FIWARE_IDM_REFRESH_MARGIN': 60,
+    'FIWARE_IDM_PERSIST_TOKEN': 1,
+    'ORION_PORT': 1026,
+    'ORION_ENTITY_ID': '"urn:ngsi-ld:Device:edi001"',
+    'ORION_ENTITY_TYPE': '"Device"',
+    'ORION_FIWARE_SERVICE': '""',
+    'ORION_FIWARE_SERVICE_PATH': '"/"',
+    'ORION_LD_CONTEXT': '"https://uri.etsi.org/ngsi-ld/v1/ngsi-ld-core-context.jsonld"',
+    'ORION_BATCH_SIZE': 16,
+    'ORION_BUFFER_SIZE': 2048,
+    'IOT_AGENT_SOUTH_PORT': 7896,
+    'IOT_AGENT_RESOURCE': '"/iot/d"',
+    'IOT_AGENT_APIKEY': '"openiot"',
+    'IOT_AGENT_DEVICE_ID': '"edi001"',
+    'IOT_DEVICE_ENDPOINT': '"/api"',
+    'IOT_AGENT_COMMAND_INIT_RESPONSE': '"PENDING"',
+    'IOT_AGENT_COMMAND_NAME_LEN': 32,
+    'IOT_AGENT_COMMAND_PAYLOAD_LEN': 32,
+    'ITC_UART_QUEUE_SIZE': 10,
+    'ITC_MAU_QUEUE_SIZE': 10,
+    'ITC_IOTA_MEASUREMENT_QUEUE_SIZE': 10,
+    'ITC_IOTA_MEASUREMENT_MESSAGE_SIZE': 255,
+    'ITC_IOTA_COMMAND_QUEUE_SIZE': 8,
+    'ITC_IOTA_COMMAND_MESSAGE_SIZE': 255,
+    'ITC_MESSAGE_POOL_SIZE': 16,
+    'METRICS_BUFFER_SIZE': 8192,
+    'MEASUREMENT_FILTER_MAX_ATTRIBUTES': 16,
+    'MEASUREMENT_FILTER_NAME_LEN': 16,
+    'MEASUREMENT_FILTER_VALUE_LEN': 16,
+    'MEASUREMENT_FILTER_DEADBAND_ABSOLUTE': 0,
+    'MEASUREMENT_FILTER_DEADBAND_PERCENT': 0,
+    'MEASUREMENT_FILTER_MIN_INTERVAL_MS': 0,
+    'MEASUREMENT_FILTER_MAX_INTERVAL_MS': 60000,
+    'MEASUREMENT_FILTER_HEARTBEAT_MS': 0,
+    'MEASUREMENT_SHAPER_MAX_ATTRIBUTES': 16,
+    'MEASUREMENT_SHAPER_NAME_LEN': 16,
+    'MEASUREMENT_SHAPER_VALUE_LEN': 16,
+    'MEASUREMENT_SHAPER_RATE': 1000,
+    'MEASUREMENT_SHAPER_BURST': 3,
+    'MEASUREMENT_SHAPER_ATTRIBUTE_LIMITS': '""',
+    'UART_TASK_ENABLE': 1,
+    'UART_TASK_STACK_DEPTH': 4000,
+    'UART_TASK_PRIO': 20,
+    'UART_RX': 17,
+    'UART_TX': 5,
+    'UART_BAUD': 9600,
+    'UART_COMMAND_RESULT_TIMEOUT_MS': 10000,
+}
+
+ESP_ERR_SHIM = r'''
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_NOT_FINISHED 0x10C
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_HTTP_CONNECT 0x7003
+
+const char *esp_err_to_name(esp_err_t code);
+
+#define ESP_ERROR_CHECK(x)                                                                   \
+    do                                                                                       \
+    {                                                                                        \
+        esp_err_t err_rc_ = (x);                                                             \
+        if (err_rc_ != ESP_OK)                                                               \
+        {                                                                                    \
+            fprintf(stderr, "%s:%d: %s failed: %s\n", __FILE__, __LINE__, #x, esp_err_to_name(err_rc_)); \
+            abort();                                                                         \
+        }                                                                                    \
+    } while (0)
+
+#define ESP_ERROR_CHECK_WITHOUT_ABORT(x) ({ esp_err_t err_rc_ = (x); err_rc_; })
+'''
+
+ESP_LOG_SHIM = r'''
+#pragma once
+
+#include <esp_err.h>
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+/* messages above this level are dropped before they are formatted */
+extern esp_log_level_t host_log_level;
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) host_log(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+'''
+
+ESP_CHECK_SHIM = r'''
+#pragma once
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#define ESP_RETURN_ON_ERROR(x, log_tag, format, ...)                                      \
+    do                                                                                    \
+    {                                                                                     \
+        esp_err_t err_rc_ = (x);                                                          \
+        if (err_rc_ != ESP_OK)                                                            \
+        {                                                                                 \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);  \
+            return err_rc_;                                                               \
+        }                                                                                 \
+    } while (0)
+
+#define ESP_RETURN_ON_FALSE(a, err_code, log_tag, format, ...)                            \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(a))                                                                         \
+        {                                                                                 \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);  \
+            return err_code;                                                              \
+        }                                                                                 \
+    } while (0)
+
+#define ESP_GOTO_ON_ERROR(x, goto_tag, log_tag, format, ...)                              \
+    do                                                                                    \
+    {                                                                                     \
+        esp_err_t err_rc_ = (x);                                                          \
+        if (err_rc_ != ESP_OK)                                                            \
+        {                                                                                 \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);  \
+            ret = err_rc_;                                                                \
+            goto goto_tag;                                                                \
+        }                                                                                 \
+    } while (0)
+
+#define ESP_GOTO_ON_FALSE(a, err_code, goto_tag, log_tag, format, ...)                    \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(a))                                                                         \
+        {                                                                                 \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);  \
+            ret = err_code;                                                               \
+            goto goto_tag;                                                                \
+        }                                                                                 \
+    } while (0)
+'''
+
+ESP_BIT_DEFS_SHIM = r'''
+#pragma once
+
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
+'''
+
+NVS_SHIM = r'''
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
+'''
+
+ESP_TIMER_SHIM = r'''
+#pragma once
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+'''
+
+FREERTOS_SHIM = r'''
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <esp_err.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define errQUEUE_EMPTY pdFALSE
+#define errQUEUE_FULL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+
+#define configASSERT(x)                                                              \
+    do                                                                               \
+    {                                                                                \
+        if (!(x))                                                                    \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: assert failed: %s\n", __FILE__, __LINE__, #x);   \
+            abort();                                                                 \
+        }                                                                            \
+    } while (0)
+'''
+
+FREERTOS_QUEUE_SHIM = r'''
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+typedef struct host_queue *QueueHandle_t;
+typedef struct host_queue *QueueSetHandle_t;
+typedef struct host_queue *QueueSetMemberHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length);
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set);
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks_to_wait);
+
+#define xQueueSendToBack xQueueSend
+'''
+
+FREERTOS_SEMPHR_SHIM = r'''
+#pragma once
+
+#include <freertos/queue.h>
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive((semaphore), NULL, (ticks_to_wait))
+#define xSemaphoreGive(semaphore) xQueueSend((semaphore), NULL, 0)
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+'''
+
+FREERTOS_TASK_SHIM = r'''
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+'''
+
+FREERTOS_TIMERS_SHIM = r'''
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *id, TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#define xTimerReset xTimerStart
+'''
+
+ESP_NETIF_SNTP_SHIM = r'''
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+esp_err_t esp_netif_sntp_sync_wait(TickType_t ticks_to_wait);
+'''
+
+UART_SHIM = r'''
+#pragma once
+
+#include <stddef.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+typedef int uart_port_t;
+
+#define UART_NUM_0 0
+#define UART_NUM_1 1
+#define UART_NUM_2 2
+#define UART_NUM_MAX 3
+
+#define UART_PIN_NO_CHANGE -1
+
+typedef enum
+{
+    UART_DATA_5_BITS,
+    UART_DATA_6_BITS,
+    UART_DATA_7_BITS,
+    UART_DATA_8_BITS,
+} uart_word_length_t;
+
+typedef enum
+{
+    UART_PARITY_DISABLE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD,
+} uart_parity_t;
+
+typedef enum
+{
+    UART_STOP_BITS_1 = 1,
+    UART_STOP_BITS_1_5,
+    UART_STOP_BITS_2,
+} uart_stop_bits_t;
+
+typedef enum
+{
+    UART_HW_FLOWCTRL_DISABLE,
+    UART_HW_FLOWCTRL_RTS,
+    UART_HW_FLOWCTRL_CTS,
+    UART_HW_FLOWCTRL_CTS_RTS,
+} uart_hw_flowcontrol_t;
+
+typedef enum
+{
+    UART_SCLK_DEFAULT,
+} uart_sclk_t;
+
+typedef struct
+{
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+    uart_sclk_t source_clk;
+} uart_config_t;
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *queue, int flags);
+int uart_read_bytes(uart_port_t port, void *buffer, uint32_t length, TickType_t ticks_to_wait);
+int uart_write_bytes(uart_port_t port, const void *data, size_t length);
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks_to_wait);
+
+/* host only: the TCP port the line of a UART is served on, the robot connects to it, 0 leaves the UART unconnected */
+extern int host_uart_tcp_port[UART_NUM_MAX];
+'''
+
+ESP_HTTP_SERVER_SHIM = r'''
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <esp_err.h>
+
+typedef void *httpd_handle_t;
+
+typedef enum
+{
+    HTTP_DELETE,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+} httpd_method_t;
+
+typedef struct httpd_req
+{
+    httpd_handle_t handle;
+    int method;
+    const char *uri;
+    size_t content_len;
+    void *user_ctx;
+    /* the host_httpd_conn_t the request is served on */
+    void *aux;
+} httpd_req_t;
+
+typedef struct httpd_uri
+{
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *request);
+    void *user_ctx;
+} httpd_uri_t;
+
+typedef enum
+{
+    HTTPD_400_BAD_REQUEST,
+    HTTPD_404_NOT_FOUND,
+    HTTPD_408_REQ_TIMEOUT,
+    HTTPD_500_INTERNAL_SERVER_ERROR,
+} httpd_err_code_t;
+
+typedef struct
+{
+    uint16_t server_port;
+    uint16_t max_uri_handlers;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() {.server_port = 80, .max_uri_handlers = 8}
+
+#define HTTPD_RESP_USE_STRLEN -1
+
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_INVALID -2
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler);
+
+int httpd_req_recv(httpd_req_t *request, char *buffer, size_t buffer_len);
+esp_err_t httpd_resp_set_status(httpd_req_t *request, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *request, const char *type);
+esp_err_t httpd_resp_send(httpd_req_t *request, const char *buffer, ssize_t buffer_len);
+esp_err_t httpd_resp_send_err(httpd_req_t *request, httpd_err_code_t error, const char *message);
+esp_err_t httpd_resp_send_408(httpd_req_t *request);
+
+/* host only: the transport of a request, recv and send work like the socket functions of the server */
+typedef struct host_httpd_conn
+{
+    int (*recv)(struct host_httpd_conn *conn, char *buffer, size_t length);
+    void (*send)(struct host_httpd_conn *conn, const char *status, const char *type, const char *body, size_t length);
+    const char *status;
+    const char *type;
+} host_httpd_conn_t;
+
+/* host only: the registered handler of an uri, NULL if there is none */
+const httpd_uri_t *host_httpd_find(httpd_handle_t handle, const char *uri, httpd_method_t method);
+
+/* host only: the TCP port httpd_start() serves the handlers on, 0 leaves them to host_httpd_find() */
+extern int host_httpd_port;
+'''
+
+ESP_HTTP_CLIENT_SHIM = r'''
+#pragma once
+
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum
+{
+    HTTP_EVENT_ERROR,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event
+{
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void *data;
+    int data_len;
+    void *user_data;
+    char *header_key;
+    char *header_value;
+} esp_http_client_event_t;
+
+typedef esp_http_client_event_t *esp_http_client_event_handle_t;
+
+typedef enum
+{
+    HTTP_METHOD_GET,
+    HTTP_METHOD_POST,
+} esp_http_client_method_t;
+
+typedef enum
+{
+    HTTP_AUTH_TYPE_NONE,
+    HTTP_AUTH_TYPE_BASIC,
+} esp_http_client_auth_type_t;
+
+typedef struct
+{
+    const char *host;
+    int port;
+    const char *path;
+    esp_http_client_method_t method;
+    esp_err_t (*event_handler)(esp_http_client_event_t *event);
+    void *user_data;
+    const char *username;
+    const char *password;
+    esp_http_client_auth_type_t auth_type;
+    bool keep_alive_enable;
+    const char *cert_pem;
+    int timeout_ms;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len);
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+'''
+
+SHIMS = {
+    'esp_err.h': ESP_ERR_SHIM,
+    'esp_log.h': ESP_LOG_SHIM,
+    'esp_check.h': ESP_CHECK_SHIM,
+    'esp_bit_defs.h': ESP_BIT_DEFS_SHIM,
+    'esp_timer.h': ESP_TIMER_SHIM,
+    'nvs.h': NVS_SHIM,
+    'freertos/FreeRTOS.h': FREERTOS_SHIM,
+    'freertos/queue.h': FREERTOS_QUEUE_SHIM,
+    'freertos/semphr.h': FREERTOS_SEMPHR_SHIM,
+    'freertos/task.h': FREERTOS_TASK_SHIM,
+    'freertos/timers.h': FREERTOS_TIMERS_SHIM,
+    'esp_netif_sntp.h': ESP_NETIF_SNTP_SHIM,
+    'driver/uart.h': UART_SHIM,
+    'esp_http_server.h': ESP_HTTP_SERVER_SHIM,
+    'esp_http_client.h': ESP_HTTP_CLIENT_SHIM,
+}
+
+# error names, logging and the time base
+ESP_RUNTIME = r'''
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_HTTP_CONNECT: return "ESP_ERR_HTTP_CONNECT";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+
+    if (level > host_log_level)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    flockfile(stderr);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+    va_end(args);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    static struct timespec boot;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // the first call is the boot, it happens before any task is started
+    if (boot.tv_sec == 0 && boot.tv_nsec == 0)
+        boot = now;
+
+    return (int64_t)(now.tv_sec - boot.tv_sec) * 1000000 + (now.tv_nsec - boot.tv_nsec) / 1000;
+}
+
+__attribute__((constructor)) static void host_boot(void)
+{
+    esp_timer_get_time();
+}
+'''
+
+# queues, queue sets, semaphores and tasks on pthreads. One lock guards every object, a change wakes every waiter
+FREERTOS_RUNTIME = r'''
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+#include <esp_timer.h>
+
+struct host_queue
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    unsigned char *items;
+    struct host_queue *set;
+};
+
+struct host_task
+{
+    pthread_t thread;
+    TaskFunction_t code;
+    void *arg;
+    char name[16];
+};
+
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t host_changed;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+
+static void host_init(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&host_changed, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec host_deadline(TickType_t ticks)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    uint64_t ns = (uint64_t)pdTICKS_TO_MS(ticks) * 1000000 + deadline.tv_nsec;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+
+    return deadline;
+}
+
+/* waits for a change with the lock held, returns false once the deadline passed */
+static bool host_wait(TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0)
+        return false;
+
+    if (ticks == portMAX_DELAY)
+        return pthread_cond_wait(&host_changed, &host_lock) == 0;
+
+    return pthread_cond_timedwait(&host_changed, &host_lock, deadline) != ETIMEDOUT;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    pthread_once(&host_once, host_init);
+
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+
+    if (queue == NULL)
+        return NULL;
+
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->items = calloc(length, item_size > 0 ? item_size : 1);
+
+    if (queue->items == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+/* appends an item with the lock held, the space was checked by the caller */
+static void host_queue_push(struct host_queue *queue, const void *item)
+{
+    memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->item_size, item, queue->item_size);
+    queue->count++;
+
+    if (queue->set != NULL)
+    {
+        // like FreeRTOS, a set that cannot take the notification is a configuration error
+        configASSERT(queue->set->count < queue->set->length);
+        host_queue_push(queue->set, &queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = host_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&host_lock);
+
+    while (queue->count == queue->length)
+    {
+        if (!host_wait(ticks_to_wait, &deadline))
+        {
+            pthread_mutex_unlock(&host_lock);
+            return errQUEUE_FULL;
+        }
+    }
+
+    host_queue_push(queue, item);
+
+    pthread_cond_broadcast(&host_changed);
+    pthread_mutex_unlock(&host_lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = host_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&host_lock);
+
+    while (queue->count == 0)
+    {
+        if (!host_wait(ticks_to_wait, &deadline))
+        {
+            pthread_mutex_unlock(&host_lock);
+            return errQUEUE_EMPTY;
+        }
+    }
+
+    if (queue->item_size > 0)
+        memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    pthread_cond_broadcast(&host_changed);
+    pthread_mutex_unlock(&host_lock);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&host_lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&host_lock);
+
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&host_lock);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&host_lock);
+
+    return spaces;
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length)
+{
+    return xQueueCreate(length, sizeof(QueueSetMemberHandle_t));
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set)
+{
+    BaseType_t ret = pdPASS;
+
+    pthread_mutex_lock(&host_lock);
+
+    // like FreeRTOS, only empty queues that are not in a set yet can be added
+    if (member->set != NULL || member->count > 0)
+        ret = pdFAIL;
+    else
+        member->set = set;
+
+    pthread_mutex_unlock(&host_lock);
+
+    return ret;
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks_to_wait)
+{
+    QueueSetMemberHandle_t member = NULL;
+
+    xQueueReceive(set, &member, ticks_to_wait);
+
+    return member;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+static void *host_task_main(void *arg)
+{
+    struct host_task *task = arg;
+
+    task->code(task->arg);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+
+    if (task == NULL)
+        return pdFAIL;
+
+    task->code = code;
+    task->arg = arg;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+
+    if (pthread_create(&task->thread, NULL, host_task_main, task) != 0)
+    {
+        free(task);
+        return pdFAIL;
+    }
+
+    pthread_detach(task->thread);
+
+    if (handle != NULL)
+        *handle = task;
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // only a task deleting itself is supported, the thread ends
+    if (task == NULL)
+        pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t ns = (uint64_t)pdTICKS_TO_MS(ticks) * 1000000;
+    struct timespec delay = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+        ;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return pdMS_TO_TICKS(esp_timer_get_time() / 1000);
+}
+
+/* software timers, the callbacks run one after the other on the timer thread like on the timer service task */
+struct host_timer
+{
+    TickType_t period;
+    bool auto_reload;
+    bool active;
+    int64_t expiry_us;
+    void *id;
+    TimerCallbackFunction_t callback;
+    struct host_timer *next;
+};
+
+static struct host_timer *host_timers;
+static pthread_once_t host_timer_once = PTHREAD_ONCE_INIT;
+
+static void *host_timer_main(void *arg)
+{
+    pthread_mutex_lock(&host_lock);
+
+    while (true)
+    {
+        struct host_timer *due = NULL;
+
+        for (struct host_timer *timer = host_timers; timer != NULL; timer = timer->next)
+        {
+            if (timer->active && (due == NULL || timer->expiry_us < due->expiry_us))
+                due = timer;
+        }
+
+        if (due == NULL)
+        {
+            pthread_cond_wait(&host_changed, &host_lock);
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+
+        if (now < due->expiry_us)
+        {
+            TickType_t ticks = pdMS_TO_TICKS((due->expiry_us - now + 999) / 1000);
+            struct timespec deadline = host_deadline(ticks);
+
+            host_wait(ticks, &deadline);
+            continue;
+        }
+
+        if (due->auto_reload)
+            due->expiry_us += (int64_t)pdTICKS_TO_MS(due->period) * 1000;
+        else
+            due->active = false;
+
+        // the callback gives semaphores, it runs without the lock
+        pthread_mutex_unlock(&host_lock);
+        due->callback(due);
+        pthread_mutex_lock(&host_lock);
+    }
+
+    return NULL;
+}
+
+static void host_timer_init(void)
+{
+    pthread_t thread;
+
+    pthread_once(&host_once, host_init);
+    pthread_create(&thread, NULL, host_timer_main, NULL);
+    pthread_detach(thread);
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *id, TimerCallbackFunction_t callback)
+{
+    pthread_once(&host_timer_once, host_timer_init);
+
+    struct host_timer *timer = calloc(1, sizeof(struct host_timer));
+
+    if (timer == NULL)
+        return NULL;
+
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->id = id;
+    timer->callback = callback;
+
+    pthread_mutex_lock(&host_lock);
+    timer->next = host_timers;
+    host_timers = timer;
+    pthread_mutex_unlock(&host_lock);
+
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&host_lock);
+
+    timer->active = true;
+    timer->expiry_us = esp_timer_get_time() + (int64_t)pdTICKS_TO_MS(timer->period) * 1000;
+
+    pthread_cond_broadcast(&host_changed);
+    pthread_mutex_unlock(&host_lock);
+
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&host_lock);
+    timer->active = false;
+    pthread_mutex_unlock(&host_lock);
+
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait)
+{
+    // like FreeRTOS, changing the period starts a dormant timer
+    pthread_mutex_lock(&host_lock);
+    timer->period = period;
+    pthread_mutex_unlock(&host_lock);
+
+    return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    pthread_mutex_lock(&host_lock);
+    BaseType_t active = timer->active;
+    pthread_mutex_unlock(&host_lock);
+
+    return active;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+'''
+
+# the server keeps the registered handlers, the requests are served on a host_httpd_conn_t.
+# With host_httpd_port set, one thread serves the connections of a socket like the server task of the IDF
+HTTP_SERVER_RUNTIME = r'''
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <esp_http_server.h>
+
+#define HOST_HTTPD_MAX_HANDLERS 8
+#define HOST_HTTPD_MAX_CONNECTIONS 7
+#define HOST_HTTPD_HEAD_SIZE 2048
+#define HOST_HTTPD_RECV_TIMEOUT_S 5
+
+int host_httpd_port;
+
+typedef struct
+{
+    httpd_uri_t handlers[HOST_HTTPD_MAX_HANDLERS];
+    int handler_count;
+    int listener;
+} host_httpd_t;
+
+/* a request received on a socket, the body bytes read with the head are handed out first */
+typedef struct
+{
+    host_httpd_conn_t conn;
+    int fd;
+    char head[HOST_HTTPD_HEAD_SIZE];
+    size_t buffered;
+    size_t buffered_offset;
+    size_t remaining;
+    bool sent;
+} host_httpd_socket_t;
+
+static bool host_httpd_write(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t ret = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (ret <= 0)
+            return false;
+
+        data += ret;
+        length -= ret;
+    }
+
+    return true;
+}
+
+static int host_httpd_socket_recv(host_httpd_conn_t *conn, char *buffer, size_t length)
+{
+    host_httpd_socket_t *request = (host_httpd_socket_t *)conn;
+
+    if (length > request->remaining)
+        length = request->remaining;
+
+    if (length == 0)
+        return 0;
+
+    if (request->buffered > 0)
+    {
+        if (length > request->buffered)
+            length = request->buffered;
+
+        memcpy(buffer, request->head + request->buffered_offset, length);
+        request->buffered_offset += length;
+        request->buffered -= length;
+        request->remaining -= length;
+
+        return length;
+    }
+
+    ssize_t ret = recv(request->fd, buffer, length, 0);
+
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return HTTPD_SOCK_ERR_TIMEOUT;
+
+    if (ret <= 0)
+        return HTTPD_SOCK_ERR_FAIL;
+
+    request->remaining -= ret;
+
+    return ret;
+}
+
+static void host_httpd_socket_send(host_httpd_conn_t *conn, const char *status, const char *type, const char *body, size_t length)
+{
+    host_httpd_socket_t *request = (host_httpd_socket_t *)conn;
+    char head[256];
+
+    int head_len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n", status, type, length);
+
+    request->sent = host_httpd_write(request->fd, head, head_len) && host_httpd_write(request->fd, body, length);
+}
+
+static httpd_method_t host_httpd_method(const char *method)
+{
+    if (strcmp(method, "POST") == 0)
+        return HTTP_POST;
+    if (strcmp(method, "PUT") == 0)
+        return HTTP_PUT;
+    if (strcmp(method, "DELETE") == 0)
+        return HTTP_DELETE;
+    if (strcmp(method, "HEAD") == 0)
+        return HTTP_HEAD;
+
+    return HTTP_GET;
+}
+
+/* serves one request of the connection, returns false if the connection is to be closed */
+static bool host_httpd_serve(host_httpd_t *server, int fd)
+{
+    host_httpd_socket_t request = {
+        .conn = {.recv = host_httpd_socket_recv, .send = host_httpd_socket_send},
+        .fd = fd,
+    };
+    size_t received = 0;
+    char *head_end = NULL;
+
+    while (head_end == NULL)
+    {
+        if (received == sizeof(request.head) - 1)
+            return false;
+
+        ssize_t ret = recv(fd, request.head + received, sizeof(request.head) - 1 - received, 0);
+
+        if (ret <= 0)
+            return false;
+
+        received += ret;
+        request.head[received] = '\0';
+        head_end = strstr(request.head, "\r\n\r\n");
+    }
+
+    char method[8];
+    char uri[256];
+
+    if (sscanf(request.head, "%7s %255s", method, uri) != 2)
+        return false;
+
+    bool keep_alive = true;
+
+    for (char *line = strstr(request.head, "\r\n") + 2; line < head_end; line = strstr(line, "\r\n") + 2)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            request.remaining = strtoul(line + 15, NULL, 10);
+        else if (strncasecmp(line, "Connection:", 11) == 0 && strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0)
+            keep_alive = false;
+    }
+
+    request.buffered_offset = head_end + 4 - request.head;
+    request.buffered = received - request.buffered_offset;
+
+    // the uri of a handler has no query
+    uri[strcspn(uri, "?")] = '\0';
+
+    httpd_req_t req = {
+        .handle = server,
+        .method = host_httpd_method(method),
+        .uri = uri,
+        .content_len = request.remaining,
+        .aux = &request,
+    };
+
+    const httpd_uri_t *handler = host_httpd_find(server, uri, req.method);
+    esp_err_t ret;
+
+    if (handler == NULL)
+        ret = httpd_resp_send_err(&req, HTTPD_404_NOT_FOUND, "Nothing matches the given URI");
+    else
+    {
+        req.user_ctx = handler->user_ctx;
+        ret = handler->handler(&req);
+    }
+
+    // like the IDF server, a failed handler ends the connection, so does a body the handler did not read
+    return ret == ESP_OK && request.sent && request.remaining == 0 && keep_alive;
+}
+
+static void *host_httpd_main(void *arg)
+{
+    host_httpd_t *server = arg;
+    struct pollfd fds[1 + HOST_HTTPD_MAX_CONNECTIONS];
+    int count = 1;
+
+    fds[0] = (struct pollfd){.fd = server->listener, .events = POLLIN};
+
+    while (true)
+    {
+        if (poll(fds, count, -1) < 0)
+            continue;
+
+        for (int i = count - 1; i > 0; i--)
+        {
+            if (fds[i].revents == 0)
+                continue;
+
+            if (!(fds[i].revents & POLLIN) || !host_httpd_serve(server, fds[i].fd))
+            {
+                close(fds[i].fd);
+                fds[i] = fds[--count];
+            }
+        }
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        int fd = accept(server->listener, NULL, NULL);
+
+        if (fd < 0)
+            continue;
+
+        if (count == 1 + HOST_HTTPD_MAX_CONNECTIONS)
+        {
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        struct timeval timeout = {.tv_sec = HOST_HTTPD_RECV_TIMEOUT_S};
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        fds[count++] = (struct pollfd){.fd = fd, .events = POLLIN};
+    }
+
+    return NULL;
+}
+
+static esp_err_t host_httpd_listen(host_httpd_t *server)
+{
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(host_httpd_port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int one = 1;
+    pthread_t thread;
+
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (server->listener < 0)
+        return ESP_FAIL;
+
+    setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(server->listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server->listener, HOST_HTTPD_MAX_CONNECTIONS) != 0 ||
+        pthread_create(&thread, NULL, host_httpd_main, server) != 0)
+    {
+        close(server->listener);
+        return ESP_FAIL;
+    }
+
+    pthread_detach(thread);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    host_httpd_t *server = calloc(1, sizeof(host_httpd_t));
+
+    if (server == NULL)
+        return ESP_ERR_NO_MEM;
+
+    server->listener = -1;
+
+    if (host_httpd_port > 0 && host_httpd_listen(server) != ESP_OK)
+    {
+        free(server);
+        return ESP_FAIL;
+    }
+
+    *handle = server;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    // the thread serving a socket keeps using the server, it is never freed
+    if (((host_httpd_t *)handle)->listener < 0)
+        free(handle);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    host_httpd_t *server = handle;
+
+    if (server->handler_count == HOST_HTTPD_MAX_HANDLERS)
+        return ESP_ERR_NO_MEM;
+
+    server->handlers[server->handler_count++] = *uri_handler;
+
+    return ESP_OK;
+}
+
+const httpd_uri_t *host_httpd_find(httpd_handle_t handle, const char *uri, httpd_method_t method)
+{
+    host_httpd_t *server = handle;
+
+    for (int i = 0; i < server->handler_count; i++)
+    {
+        if (server->handlers[i].method == method && strcmp(server->handlers[i].uri, uri) == 0)
+            return &server->handlers[i];
+    }
+
+    return NULL;
+}
+
+int httpd_req_recv(httpd_req_t *request, char *buffer, size_t buffer_len)
+{
+    host_httpd_conn_t *conn = request->aux;
+
+    return conn->recv(conn, buffer, buffer_len);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *request, const char *status)
+{
+    ((host_httpd_conn_t *)request->aux)->status = status;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *request, const char *type)
+{
+    ((host_httpd_conn_t *)request->aux)->type = type;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *request, const char *buffer, ssize_t buffer_len)
+{
+    host_httpd_conn_t *conn = request->aux;
+
+    if (buffer_len == HTTPD_RESP_USE_STRLEN)
+        buffer_len = buffer != NULL ? strlen(buffer) : 0;
+
+    conn->send(conn, conn->status != NULL ? conn->status : "200 OK", conn->type != NULL ? conn->type : "text/html", buffer, buffer_len);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *request, httpd_err_code_t error, const char *message)
+{
+    static const char *statuses[] = {
+        [HTTPD_400_BAD_REQUEST] = "400 Bad Request",
+        [HTTPD_404_NOT_FOUND] = "404 Not Found",
+        [HTTPD_408_REQ_TIMEOUT] = "408 Request Timeout",
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = "500 Internal Server Error",
+    };
+
+    httpd_resp_set_status(request, statuses[error]);
+    httpd_resp_set_type(request, "text/html");
+
+    return httpd_resp_send(request, message, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_resp_send_408(httpd_req_t *request)
+{
+    return httpd_resp_send_err(request, HTTPD_408_REQ_TIMEOUT, "Server closed this connection");
+}
+'''
+
+# a blocking HTTP/1.1 client with keep-alive, the response body is handed to the event handler in one piece
+HTTP_CLIENT_RUNTIME = r'''
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <esp_http_client.h>
+
+#define HOST_HTTP_MAX_HEADERS 8
+#define HOST_HTTP_BUFFER_SIZE 8192
+
+struct esp_http_client
+{
+    esp_http_client_config_t config;
+    char *header_keys[HOST_HTTP_MAX_HEADERS];
+    char *header_values[HOST_HTTP_MAX_HEADERS];
+    int header_count;
+    const char *post_data;
+    int post_len;
+    void *user_data;
+    int fd;
+    int status_code;
+    int64_t content_length;
+    char buffer[HOST_HTTP_BUFFER_SIZE];
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+
+    if (client == NULL)
+        return NULL;
+
+    client->config = *config;
+    client->user_data = config->user_data;
+    client->fd = -1;
+
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    int i;
+
+    for (i = 0; i < client->header_count; i++)
+    {
+        if (strcasecmp(client->header_keys[i], key) == 0)
+            break;
+    }
+
+    if (i == HOST_HTTP_MAX_HEADERS)
+        return ESP_ERR_NO_MEM;
+
+    if (i == client->header_count)
+    {
+        client->header_keys[i] = strdup(key);
+        client->header_count++;
+    }
+    else
+        free(client->header_values[i]);
+
+    client->header_values[i] = strdup(value);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    client->post_data = data;
+    client->post_len = len;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data)
+{
+    client->user_data = data;
+
+    return ESP_OK;
+}
+
+static void host_http_close(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0)
+        close(client->fd);
+
+    client->fd = -1;
+}
+
+static esp_err_t host_http_connect(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *address;
+    char port[8];
+
+    snprintf(port, sizeof(port), "%d", client->config.port);
+
+    if (getaddrinfo(client->config.host, port, &hints, &address) != 0)
+        return ESP_ERR_HTTP_CONNECT;
+
+    client->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+    if (client->fd < 0 || connect(client->fd, address->ai_addr, address->ai_addrlen) != 0)
+    {
+        freeaddrinfo(address);
+        host_http_close(client);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+
+    freeaddrinfo(address);
+
+    int one = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct timeval timeout = {.tv_sec = client->config.timeout_ms > 0 ? client->config.timeout_ms / 1000 : 5};
+    setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    return ESP_OK;
+}
+
+static bool host_http_write(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t ret = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (ret <= 0)
+            return false;
+
+        data += ret;
+        length -= ret;
+    }
+
+    return true;
+}
+
+static const char host_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void host_http_base64(const char *input, char *output)
+{
+    size_t length = strlen(input);
+
+    for (size_t i = 0; i < length; i += 3)
+    {
+        uint32_t triple = (unsigned char)input[i] << 16;
+
+        if (i + 1 < length)
+            triple |= (unsigned char)input[i + 1] << 8;
+        if (i + 2 < length)
+            triple |= (unsigned char)input[i + 2];
+
+        *output++ = host_base64[(triple >> 18) & 0x3f];
+        *output++ = host_base64[(triple >> 12) & 0x3f];
+        *output++ = i + 1 < length ? host_base64[(triple >> 6) & 0x3f] : '=';
+        *output++ = i + 2 < length ? host_base64[triple & 0x3f] : '=';
+    }
+
+    *output = '\0';
+}
+
+/* sends the request and reads the response head and body into the client buffer */
+static esp_err_t host_http_exchange(esp_http_client_handle_t client, bool *keep_alive, int *body_offset)
+{
+    char *buffer = client->buffer;
+    int length = snprintf(buffer, sizeof(client->buffer),
+                          "%s %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Length: %d\r\nConnection: %s\r\n",
+                          client->config.method == HTTP_METHOD_POST ? "POST" : "GET",
+                          client->config.path,
+                          client->config.host,
+                          client->config.port,
+                          client->post_len,
+                          client->config.keep_alive_enable ? "keep-alive" : "close");
+
+    for (int i = 0; i < client->header_count; i++)
+        length += snprintf(buffer + length, sizeof(client->buffer) - length, "%s: %s\r\n", client->header_keys[i], client->header_values[i]);
+
+    if (client->config.auth_type == HTTP_AUTH_TYPE_BASIC && client->config.username != NULL)
+    {
+        char credentials[256];
+        char encoded[344];
+
+        snprintf(credentials, sizeof(credentials), "%s:%s", client->config.username, client->config.password != NULL ? client->config.password : "");
+        host_http_base64(credentials, encoded);
+        length += snprintf(buffer + length, sizeof(client->buffer) - length, "Authorization: Basic %s\r\n", encoded);
+    }
+
+    length += snprintf(buffer + length, sizeof(client->buffer) - length, "\r\n");
+
+    if (!host_http_write(client->fd, buffer, length) || !host_http_write(client->fd, client->post_data, client->post_len))
+        return ESP_FAIL;
+
+    // read until the end of the head, then until the end of the body
+    int received = 0;
+    char *head_end = NULL;
+
+    while (head_end == NULL)
+    {
+        ssize_t ret = recv(client->fd, buffer + received, sizeof(client->buffer) - 1 - received, 0);
+
+        if (ret <= 0)
+            return ESP_FAIL;
+
+        received += ret;
+        buffer[received] = '\0';
+        head_end = strstr(buffer, "\r\n\r\n");
+
+        if (head_end == NULL && received == sizeof(client->buffer) - 1)
+            return ESP_FAIL;
+    }
+
+    *body_offset = head_end + 4 - buffer;
+    client->status_code = atoi(strchr(buffer, ' ') != NULL ? strchr(buffer, ' ') + 1 : "0");
+    client->content_length = 0;
+    *keep_alive = client->config.keep_alive_enable;
+
+    for (char *line = strstr(buffer, "\r\n") + 2; line < head_end; line = strstr(line, "\r\n") + 2)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            client->content_length = atoll(line + 15);
+        else if (strncasecmp(line, "Connection:", 11) == 0 && strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0)
+            *keep_alive = false;
+    }
+
+    if (*body_offset + client->content_length >= (int64_t)sizeof(client->buffer))
+        return ESP_FAIL;
+
+    while (received < *body_offset + client->content_length)
+    {
+        ssize_t ret = recv(client->fd, buffer + received, *body_offset + client->content_length - received, 0);
+
+        if (ret <= 0)
+            return ESP_FAIL;
+
+        received += ret;
+    }
+
+    buffer[received] = '\0';
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    bool keep_alive = false;
+    int body_offset = 0;
+    esp_err_t ret = ESP_FAIL;
+
+    // a kept connection might have been closed by the server meanwhile, retry once on a new one
+    for (int attempt = 0; attempt < 2 && ret != ESP_OK; attempt++)
+    {
+        bool reused = client->fd >= 0;
+
+        if (!reused && host_http_connect(client) != ESP_OK)
+            return ESP_ERR_HTTP_CONNECT;
+
+        ret = host_http_exchange(client, &keep_alive, &body_offset);
+
+        if (ret != ESP_OK)
+            host_http_close(client);
+
+        if (!reused)
+            break;
+    }
+
+    if (ret != ESP_OK)
+        return ret;
+
+    if (client->config.event_handler != NULL && client->content_length > 0)
+    {
+        esp_http_client_event_t event = {
+            .event_id = HTTP_EVENT_ON_DATA,
+            .client = client,
+            .data = client->buffer + body_offset,
+            .data_len = client->content_length,
+            .user_data = client->user_data,
+        };
+
+        client->config.event_handler(&event);
+    }
+
+    if (!keep_alive)
+        host_http_close(client);
+
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status_code;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->content_length;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    host_http_close(client);
+
+    for (int i = 0; i < client->header_count; i++)
+    {
+        free(client->header_keys[i]);
+        free(client->header_values[i]);
+    }
+
+    free(client);
+
+    return ESP_OK;
+}
+'''
+
+# the line of a UART is a TCP connection the robot makes, the bytes are paced at the configured baud rate
+UART_RUNTIME = r'''
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <driver/uart.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+int host_uart_tcp_port[UART_NUM_MAX];
+
+typedef struct
+{
+    int baud_rate;
+    int bits_per_byte;
+    int listener;
+    int fd;
+    /* time the bytes written or read so far are through the line */
+    int64_t tx_done_us;
+    int64_t rx_done_us;
+} host_uart_t;
+
+static host_uart_t host_uarts[UART_NUM_MAX] = {
+    [0 ... UART_NUM_MAX - 1] = {.listener = -1, .fd = -1},
+};
+
+static void host_uart_sleep_until(int64_t time_us)
+{
+    int64_t delay_us = time_us - esp_timer_get_time();
+
+    if (delay_us <= 0)
+        return;
+
+    struct timespec delay = {.tv_sec = delay_us / 1000000, .tv_nsec = (delay_us % 1000000) * 1000};
+
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+        ;
+}
+
+/* advances the time the line is busy until by the given bytes, returns the new time */
+static int64_t host_uart_line_time(host_uart_t *uart, int64_t *done_us, size_t length)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (*done_us < now)
+        *done_us = now;
+
+    if (uart->baud_rate > 0)
+        *done_us += (int64_t)length * uart->bits_per_byte * 1000000 / uart->baud_rate;
+
+    return *done_us;
+}
+
+/* waits for the robot to connect, returns false if nobody did before the timeout */
+static bool host_uart_accept(host_uart_t *uart, int timeout_ms)
+{
+    if (uart->listener < 0)
+        return false;
+
+    struct pollfd listener = {.fd = uart->listener, .events = POLLIN};
+
+    if (poll(&listener, 1, timeout_ms) <= 0)
+        return false;
+
+    uart->fd = accept(uart->listener, NULL, NULL);
+
+    if (uart->fd < 0)
+        return false;
+
+    int one = 1;
+    setsockopt(uart->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    ESP_LOGI("Host UART", "Robot connected");
+
+    return true;
+}
+
+static void host_uart_disconnect(host_uart_t *uart)
+{
+    close(uart->fd);
+    uart->fd = -1;
+
+    ESP_LOGW("Host UART", "Robot disconnected");
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config)
+{
+    host_uart_t *uart = &host_uarts[port];
+
+    // start bit, data bits, parity and stop bits
+    uart->baud_rate = config->baud_rate;
+    uart->bits_per_byte = 1 + 5 + config->data_bits + (config->parity != UART_PARITY_DISABLE) + (config->stop_bits == UART_STOP_BITS_1 ? 1 : 2);
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *queue, int flags)
+{
+    host_uart_t *uart = &host_uarts[port];
+
+    if (queue != NULL)
+        *queue = xQueueCreate(queue_size > 0 ? queue_size : 1, sizeof(int));
+
+    if (host_uart_tcp_port[port] == 0)
+        return ESP_OK;
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(host_uart_tcp_port[port]),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int one = 1;
+
+    uart->listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (uart->listener < 0)
+        return ESP_FAIL;
+
+    setsockopt(uart->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(uart->listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(uart->listener, 1) != 0)
+    {
+        close(uart->listener);
+        uart->listener = -1;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void *buffer, uint32_t length, TickType_t ticks_to_wait)
+{
+    host_uart_t *uart = &host_uarts[port];
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)pdTICKS_TO_MS(ticks_to_wait) * 1000;
+    uint32_t received = 0;
+
+    while (received < length)
+    {
+        int timeout_ms = (deadline_us - esp_timer_get_time() + 999) / 1000;
+
+        if (timeout_ms < 0)
+            timeout_ms = 0;
+
+        if (uart->fd < 0)
+        {
+            // an unconnected line stays silent
+            if (!host_uart_accept(uart, timeout_ms))
+            {
+                if (esp_timer_get_time() >= deadline_us)
+                    break;
+
+                continue;
+            }
+        }
+
+        struct pollfd line = {.fd = uart->fd, .events = POLLIN};
+
+        if (poll(&line, 1, timeout_ms) <= 0)
+            break;
+
+        ssize_t ret = recv(uart->fd, (char *)buffer + received, length - received, 0);
+
+        if (ret <= 0)
+        {
+            host_uart_disconnect(uart);
+            continue;
+        }
+
+        received += ret;
+    }
+
+    // the bytes are handed over once they could have arrived at the baud rate
+    if (received > 0)
+        host_uart_sleep_until(host_uart_line_time(uart, &uart->rx_done_us, received));
+
+    return received;
+}
+
+int uart_write_bytes(uart_port_t port, const void *data, size_t length)
+{
+    host_uart_t *uart = &host_uarts[port];
+    size_t sent = 0;
+
+    while (uart->fd >= 0 && sent < length)
+    {
+        ssize_t ret = send(uart->fd, (const char *)data + sent, length - sent, MSG_NOSIGNAL);
+
+        if (ret <= 0)
+        {
+            host_uart_disconnect(uart);
+            break;
+        }
+
+        sent += ret;
+    }
+
+    // the TX buffer is never full, the writer waits as long as the line needs for the bytes
+    host_uart_sleep_until(host_uart_line_time(uart, &uart->tx_done_us, length));
+
+    return length;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks_to_wait)
+{
+    host_uart_sleep_until(host_uarts[port].tx_done_us);
+
+    return ESP_OK;
+}
+'''
+
+# the firmware services the components call, the host is always connected, in time and keeps no metrics
+SERVICES_RUNTIME = r'''
+#include <stdbool.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_netif_sntp.h>
+
+#include "metrics.h"
+#include "wifi.h"
+
+bool is_wifi_initialized()
+{
+    return true;
+}
+
+bool is_wifi_connected()
+{
+    return true;
+}
+
+esp_err_t wifi_wait_initialized(TickType_t ticks_to_wait)
+{
+    return ESP_OK;
+}
+
+esp_err_t wifi_wait_connected(TickType_t ticks_to_wait)
+{
+    return ESP_OK;
+}
+
+esp_err_t wifi_get_rssi(int *rssi)
+{
+    *rssi = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_sntp_sync_wait(TickType_t ticks_to_wait)
+{
+    // the clock of the host is synchronized already
+    return ESP_OK;
+}
+
+void metrics_uart_count(metrics_uart_counter_t counter)
+{
+}
+
+void metrics_attribute_count(metrics_attribute_counter_t counter, uint32_t count)
+{
+}
+
+void metrics_vreg_count(metrics_vreg_counter_t counter)
+{
+}
+
+void metrics_upload_record(metrics_upload_t upload, int64_t latency_us, bool success)
+{
+}
+
+esp_err_t metrics_render_prometheus(char *buffer, size_t buffer_len, size_t *length)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t metrics_render_json(char *buffer, size_t buffer_len, size_t *length)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+'''
+
+# counts the heap allocations of the threads that enabled counting, linked with -Wl,--wrap for every function
+ALLOCATION_FUNCTIONS = ['malloc', 'calloc', 'realloc', 'strdup', 'strndup', 'asprintf', 'vasprintf']
+
+ALLOCATION_RUNTIME = r'''
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+__thread int host_allocation_counting;
+unsigned long host_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+char *__real_strdup(const char *string);
+char *__real_strndup(const char *string, size_t size);
+int __real_vasprintf(char **string, const char *format, va_list args);
+
+static void host_allocation_count(void)
+{
+    if (host_allocation_counting)
+        __atomic_fetch_add(&host_allocations, 1, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    host_allocation_count();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    host_allocation_count();
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    host_allocation_count();
+    return __real_realloc(pointer, size);
+}
+
+char *__wrap_strdup(const char *string)
+{
+    host_allocation_count();
+    return __real_strdup(string);
+}
+
+char *__wrap_strndup(const char *string, size_t size)
+{
+    host_allocation_count();
+    return __real_strndup(string, size);
+}
+
+int __wrap_vasprintf(char **string, const char *format, va_list args)
+{
+    host_allocation_count();
+    return __real_vasprintf(string, format, args);
+}
+
+int __wrap_asprintf(char **string, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int ret = __wrap_vasprintf(string, format, args);
+    va_end(args);
+
+    return ret;
+}
+'''
+
+# the non-volatile storage lives in memory, it is empty on every start
+NVS_RUNTIME = r'''
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nvs.h>
+
+#define HOST_NVS_MAX_NAMESPACES 4
+#define HOST_NVS_MAX_ENTRIES 8
+
+typedef struct
+{
+    nvs_handle_t handle;
+    char key[16];
+    void *value;
+    size_t length;
+} host_nvs_entry_t;
+
+static char host_nvs_namespaces[HOST_NVS_MAX_NAMESPACES][16];
+static host_nvs_entry_t host_nvs_entries[HOST_NVS_MAX_ENTRIES];
+static pthread_mutex_t host_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+
+    for (int i = 0; i < HOST_NVS_MAX_NAMESPACES; i++)
+    {
+        if (host_nvs_namespaces[i][0] == '\0')
+            snprintf(host_nvs_namespaces[i], sizeof(host_nvs_namespaces[i]), "%s", name);
+
+        if (strcmp(host_nvs_namespaces[i], name) == 0)
+        {
+            *out_handle = i + 1;
+            pthread_mutex_unlock(&host_nvs_lock);
+            return ESP_OK;
+        }
+    }
+
+    pthread_mutex_unlock(&host_nvs_lock);
+
+    return ESP_ERR_NO_MEM;
+}
+
+static host_nvs_entry_t *host_nvs_find(nvs_handle_t handle, const char *key, bool create)
+{
+    for (int i = 0; i < HOST_NVS_MAX_ENTRIES; i++)
+    {
+        if (host_nvs_entries[i].handle == handle && strcmp(host_nvs_entries[i].key, key) == 0)
+            return &host_nvs_entries[i];
+    }
+
+    for (int i = 0; create && i < HOST_NVS_MAX_ENTRIES; i++)
+    {
+        if (host_nvs_entries[i].handle == 0)
+        {
+            host_nvs_entries[i].handle = handle;
+            snprintf(host_nvs_entries[i].key, sizeof(host_nvs_entries[i].key), "%s", key);
+            return &host_nvs_entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&host_nvs_lock);
+
+    host_nvs_entry_t *entry = host_nvs_find(handle, key, true);
+    void *copy = malloc(length);
+
+    if (entry == NULL || copy == NULL)
+    {
+        free(copy);
+        ret = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        memcpy(copy, value, length);
+        free(entry->value);
+        entry->value = copy;
+        entry->length = length;
+    }
+
+    pthread_mutex_unlock(&host_nvs_lock);
+
+    return ret;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&host_nvs_lock);
+
+    host_nvs_entry_t *entry = host_nvs_find(handle, key, false);
+
+    if (entry == NULL || entry->value == NULL)
+        ret = ESP_ERR_NVS_NOT_FOUND;
+    else if (out_value == NULL)
+        *length = entry->length;
+    else if (*length < entry->length)
+        ret = ESP_ERR_INVALID_SIZE;
+    else
+    {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+
+    pthread_mutex_unlock(&host_nvs_lock);
+
+    return ret;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+'''
+
+RUNTIME = {
+    'host_esp.c': ESP_RUNTIME,
+    'host_freertos.c': FREERTOS_RUNTIME,
+    'host_http_server.c': HTTP_SERVER_RUNTIME,
+    'host_http_client.c': HTTP_CLIENT_RUNTIME,
+    'host_nvs.c': NVS_RUNTIME,
+    'host_services.c': SERVICES_RUNTIME,
+    'host_uart.c': UART_RUNTIME,
+}
+
+
+def source(component: str, name: str) -> str:
+    """Path of a source file of a firmware component"""
+    return os.path.join(COMPONENTS, component, name)
+
+
+def config_defines(overrides: dict = None) -> list:
+    """Compiler flags defining the configuration, an override of None leaves the option undefined"""
+    config = dict(CONFIG, **(overrides or {}))
+
+    return [f'-DCONFIG_{name}={value}' for name, value in config.items() if value is not None]
+
+
+def build(cc: str, directory: str, driver: str, sources: list, config: dict = None, flags: list = None,
+          count_allocations: bool = False, name: str = 'driver') -> str:
+    """Writes the shims and the driver into the directory and compiles them with the component sources"""
+    # the shims get a directory of their own, driver/uart.h would take the name of the executable
+    shims = os.path.join(directory, 'include')
+
+    for header, text in SHIMS.items():
+        path = os.path.join(shims, header)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+
+        with open(path, 'w') as file:
+            file.write(text)
+
+    runtime = dict(RUNTIME)
+
+    if count_allocations:
+        runtime['host_allocations.c'] = ALLOCATION_RUNTIME
+
+    for file_name, text in runtime.items():
+        with open(os.path.join(directory, file_name), 'w') as file:
+            file.write(text)
+
+    with open(os.path.join(directory, f'{name}.c'), 'w') as file:
+        file.write(driver)
+
+    executable = os.path.join(directory, name)
+    wrap = [f'-Wl,--wrap={function}' for function in ALLOCATION_FUNCTIONS] if count_allocations else []
+
+    # fortified builds call the checking variants of the allocating functions, which are not wrapped
+    if count_allocations:
+        wrap.insert(0, '-U_FORTIFY_SOURCE')
+
+    # the formats are checked against the 32 bit types of the target, not the host ones
+    subprocess.run([cc, *(flags or ['-O2']), '-std=gnu11', '-D_GNU_SOURCE', '-Wall', '-Wno-unused-function', '-Wno-format', '-pthread',
+                    f'-I{shims}', *(f'-I{include}' for include in INCLUDES), *config_defines(config),
+                    '-o', executable, os.path.join(directory, f'{name}.c'),
+                    *(os.path.join(directory, file_name) for file_name in runtime), *sources, *wrap, '-lm'], check=True)
+
+    return executable
@@ -0,0 +1,263 @@
+import argparse
+import math
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+# defaults match the firmware Kconfig defaults of the "pH Filter" menu
+FILTER_SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'components', 'ph', 'filter.c')
+FILTER_INCLUDE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'components', 'ph', 'include')
+
+Q = 16
+ADC_MAX = 4095
+
+# feeds raw samples from a file through the filter chain,
+# either writing every output of the chain or timing the chain over repeated runs
+DRIVER = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#endif
+
+int main(int argc, char **argv)
+{
+    FILE *input = fopen(argv[2], "rb");
+    static uint16_t samples[1 << 22];
+    size_t count = fread(samples, sizeof(uint16_t), sizeof(samples) / sizeof(uint16_t), input);
+    fclose(input);
+
+    ph_filter_t filter;
+    ph_filter_init(&filter);
+
+    if (strcmp(argv[1], "filter") == 0)
+    {
+        for (size_t i = 0; i < count; i++)
+            if (ph_filter_push(&filter, samples[i]))
+                fwrite(&filter.output, sizeof(int32_t), 1, stdout);
+
+        return 0;
+    }
+
+    int repeats = atoi(argv[3]);
+    volatile int32_t sink = 0;
+    struct timespec start, end;
+    unsigned long long cycles = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef HAS_TSC
+    unsigned long long tsc = __rdtsc();
+#endif
+
+    for (int r = 0; r < repeats; r++)
+    {
+        for (size_t i = 0; i < count; i++)
+            ph_filter_push(&filter, samples[i]);
+
+        sink = filter.output;
+    }
+
+#ifdef HAS_TSC
+    cycles = __rdtsc() - tsc;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double total = (double)count * repeats;
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+    printf("%f %f\n", ns / total, cycles / total);
+
+    return sink == 0x7fffffff;
+}
+'''
+
+
+def build(args, directory: str) -> str:
+    """Compiles the filter chain with the configuration of the arguments into a host executable"""
+    driver = os.path.join(directory, 'driver.c')
+    executable = os.path.join(directory, 'driver')
+
+    with open(driver, 'w') as file:
+        file.write(DRIVER)
+
+    defines = [
+        f'-DCONFIG_PH_FILTER_DECIMATION_SHIFT={args.decimation_shift}',
+        f'-DCONFIG_PH_FILTER_MEDIAN_SIZE={args.median_size}',
+    ]
+
+    if args.smoothing == 'ema':
+        defines += ['-DCONFIG_PH_FILTER_EMA=1', f'-DCONFIG_PH_FILTER_EMA_SHIFT={args.ema_shift}']
+    elif args.smoothing == 'average':
+        defines += ['-DCONFIG_PH_FILTER_MOVING_AVERAGE=1', f'-DCONFIG_PH_FILTER_AVERAGE_SHIFT={args.average_shift}']
+    else:
+        defines += ['-DCONFIG_PH_FILTER_NO_SMOOTHING=1']
+
+    subprocess.run([args.cc, '-O2', '-std=gnu11', f'-I{FILTER_INCLUDE}', *defines,
+                    '-o', executable, driver, FILTER_SOURCE], check=True)
+
+    return executable
+
+
+def run(executable: str, directory: str, samples: list) -> list:
+    """Feeds the samples through the chain, the outputs are converted from Q16 to raw ADC counts"""
+    path = os.path.join(directory, 'samples.bin')
+
+    with open(path, 'wb') as file:
+        file.write(struct.pack(f'<{len(samples)}H', *samples))
+
+    output = subprocess.run([executable, 'filter', path], check=True, capture_output=True).stdout
+
+    return [value / (1 << Q) for value in struct.unpack(f'<{len(output) // 4}i', output)]
+
+
+def clamp(value: float) -> int:
+    return max(0, min(ADC_MAX, int(round(value))))
+
+
+def stdev(values: list) -> float:
+    mean = sum(values) / len(values)
+    return math.sqrt(sum((value - mean) ** 2 for value in values) / len(values))
+
+
+def noise_reduction(executable: str, directory: str, args, decimation: int) -> dict:
+    """Constant level with gaussian noise, compares the deviation of the input and the settled output"""
+    samples = [clamp(random.gauss(args.level, args.noise)) for _ in range(args.samples)]
+    output = run(executable, directory, samples)
+
+    # skip the outputs while the windows fill up
+    settled = output[len(output) // 4:]
+    input_deviation = stdev(samples)
+    output_deviation = max(stdev(settled), 1 / (1 << Q))
+
+    return {
+        'input_stdev_counts': input_deviation,
+        'output_stdev_counts': output_deviation,
+        'noise_reduction_db': 20 * math.log10(input_deviation / output_deviation),
+        'output_mean_error_counts': sum(settled) / len(settled) - args.level,
+    }
+
+
+def step_response(executable: str, directory: str, args, decimation: int) -> dict:
+    """Noiseless step from the level to the step level, times are in raw samples"""
+    low, high = args.level, args.step_level
+    before = args.samples // 4
+    samples = [low] * before + [high] * (args.samples - before)
+    output = run(executable, directory, samples)
+
+    step_index = before // decimation
+
+    def crossing(fraction: float) -> int:
+        threshold = low + (high - low) * fraction
+
+        for index in range(step_index, len(output)):
+            if (output[index] - threshold) * (high - low) >= 0:
+                return (index + 1) * decimation - before
+
+        return -1
+
+    settled_at = -1
+
+    for index in range(len(output) - 1, step_index - 1, -1):
+        if abs(output[index] - high) > abs(high - low) * 0.01:
+            settled_at = (index + 2) * decimation - before
+            break
+
+    return {
+        'rise_10_90_samples': crossing(0.9) - crossing(0.1),
+        'delay_50_samples': crossing(0.5),
+        'settling_1pct_samples': settled_at,
+    }
+
+
+def spike_rejection(executable: str, directory: str, args, decimation: int) -> dict:
+    """Constant level with short full scale spikes, reports the largest deviation of the output"""
+    samples = [args.level] * args.samples
+    spikes = 0
+
+    index = args.samples // 4
+    while index + args.spike_length < args.samples:
+        for offset in range(args.spike_length):
+            samples[index + offset] = ADC_MAX
+        spikes += 1
+        index += random.randint(args.spike_period // 2, args.spike_period * 3 // 2)
+
+    output = run(executable, directory, samples)
+    deviation = max(abs(value - args.level) for value in output[len(output) // 4:])
+
+    # the deviation a plain average of the decimation block would show
+    unfiltered = (ADC_MAX - args.level) * min(args.spike_length, decimation) / decimation
+
+    return {
+        'spikes': spikes,
+        'max_deviation_counts': deviation,
+        'block_average_deviation_counts': unfiltered,
+    }
+
+
+def throughput(executable: str, directory: str, args) -> dict:
+    """Times the chain on noisy samples, the cycles are only counted on x86"""
+    path = os.path.join(directory, 'samples.bin')
+    samples = [clamp(random.gauss(args.level, args.noise)) for _ in range(args.samples)]
+
+    with open(path, 'wb') as file:
+        file.write(struct.pack(f'<{len(samples)}H', *samples))
+
+    result = subprocess.run([executable, 'time', path, str(args.repeats)], check=True, capture_output=True)
+    ns, cycles = (float(value) for value in result.stdout.split())
+
+    return {'ns_per_sample': ns, 'cycles_per_sample': cycles if cycles > 0 else None}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Feeds synthetic waveforms through the pH filter chain on the host')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--decimation-shift', type=int, default=6, help='CONFIG_PH_FILTER_DECIMATION_SHIFT')
+    parser.add_argument('--median-size', type=int, default=5, help='CONFIG_PH_FILTER_MEDIAN_SIZE')
+    parser.add_argument('--smoothing', choices=['ema', 'average', 'none'], default='ema')
+    parser.add_argument('--ema-shift', type=int, default=4, help='CONFIG_PH_FILTER_EMA_SHIFT')
+    parser.add_argument('--average-shift', type=int, default=4, help='CONFIG_PH_FILTER_AVERAGE_SHIFT')
+    parser.add_argument('--samples', type=int, default=1 << 18, help='raw samples per waveform')
+    parser.add_argument('--level', type=int, default=2000, help='constant level in raw ADC counts')
+    parser.add_argument('--noise', type=float, default=20, help='standard deviation of the noise in raw ADC counts')
+    parser.add_argument('--step-level', type=int, default=3000, help='level after the step in raw ADC counts')
+    parser.add_argument('--spike-length', type=int, default=8, help='raw samples per spike')
+    parser.add_argument('--spike-period', type=int, default=4096, help='average raw samples between spikes')
+    parser.add_argument('--repeats', type=int, default=20, help='runs of the timed waveform')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        sys.exit(f'Compiler {args.cc} not found')
+
+    random.seed(args.seed)
+    decimation = 1 << args.decimation_shift
+
+    with tempfile.TemporaryDirectory() as directory:
+        executable = build(args, directory)
+
+        results = {
+            'noise': noise_reduction(executable, directory, args, decimation),
+            'step': step_response(executable, directory, args, decimation),
+            'spikes': spike_rejection(executable, directory, args, decimation),
+            'throughput': throughput(executable, directory, args),
+        }
+
+    for section, values in results.items():
+        print(section)
+
+        for key, value in values.items():
+            print(f'  {key}: {value:.3f}' if isinstance(value, float) else f'  {key}: {value}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,323 @@
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import host_build
+
+SOURCES = [
+    host_build.source('server', 'server.c'),
+    host_build.source('task_intercom', 'task_intercom.c'),
+    host_build.source('fiware', 'iot_agent.c'),
+    host_build.source('fiware', 'fiware_idm.c'),
+    host_build.source('fiware', 'fiware_idm_parser.c'),
+]
+
+# calls the IoT Agent command handler of the server in-process, the body arrives in random parts
+# with an occasional socket timeout. A consumer task stands in for the FIWARE task: it takes the
+# commands from the queue set and holds the last few of them like commands executed by the controller.
+# The requests are offered at a fixed rate or back to back, the time spent in the handler and
+# the heap allocations of the handler thread are counted after the warmup
+DRIVER = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+
+#include "server.h"
+#include "task_intercom.h"
+
+extern __thread int host_allocation_counting;
+extern unsigned long host_allocations;
+
+typedef struct
+{
+    host_httpd_conn_t conn;
+    const char *body;
+    size_t length;
+    size_t offset;
+    int max_chunk;
+    int timeout_every;
+    bool timed_out;
+    char status[32];
+    char response[512];
+} load_conn_t;
+
+static unsigned load_seed;
+static int load_service_us;
+static int load_in_flight;
+
+static int load_recv(host_httpd_conn_t *conn, char *buffer, size_t length)
+{
+    load_conn_t *load = (load_conn_t *)conn;
+
+    if (load->timeout_every > 0 && !load->timed_out && rand_r(&load_seed) % load->timeout_every == 0)
+    {
+        load->timed_out = true;
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+
+    size_t chunk = 1 + rand_r(&load_seed) % load->max_chunk;
+
+    if (chunk > length)
+        chunk = length;
+
+    if (chunk > load->length - load->offset)
+        chunk = load->length - load->offset;
+
+    if (chunk == 0)
+        return HTTPD_SOCK_ERR_FAIL;
+
+    memcpy(buffer, load->body + load->offset, chunk);
+    load->offset += chunk;
+
+    return chunk;
+}
+
+static void load_send(host_httpd_conn_t *conn, const char *status, const char *type, const char *body, size_t length)
+{
+    load_conn_t *load = (load_conn_t *)conn;
+
+    snprintf(load->status, sizeof(load->status), "%s", status);
+    snprintf(load->response, sizeof(load->response), "%.*s", (int)length, body);
+}
+
+static void load_consumer(void *arg)
+{
+    itc_message_t *held[CONFIG_ITC_MESSAGE_POOL_SIZE + 1] = {0};
+    int next = 0;
+
+    while (true)
+    {
+        QueueSetMemberHandle_t member = xQueueSelectFromSet(task_intercom_fiware_queue_set, portMAX_DELAY);
+        itc_message_t *message;
+
+        if (member == NULL || xQueueReceive(member, &message, 0) != pdTRUE)
+            continue;
+
+        if (load_service_us > 0)
+            usleep(load_service_us);
+
+        // the oldest command got its result, the new one is executed
+        if (load_in_flight > 0)
+        {
+            task_intercom_message_delete(held[next]);
+            held[next] = message;
+            next = (next + 1) % load_in_flight;
+        }
+        else
+            task_intercom_message_delete(message);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int requests = atoi(argv[1]);
+    int warmup = atoi(argv[2]);
+    int max_chunk = atoi(argv[3]);
+    int timeout_every = atoi(argv[4]);
+    int oversize_every = atoi(argv[5]);
+    load_service_us = atoi(argv[6]);
+    load_in_flight = atoi(argv[7]);
+    load_seed = atoi(argv[8]);
+    int rate = atoi(argv[9]);
+
+    host_log_level = ESP_LOG_NONE;
+
+    if (load_in_flight > CONFIG_ITC_MESSAGE_POOL_SIZE + 1)
+        load_in_flight = CONFIG_ITC_MESSAGE_POOL_SIZE + 1;
+
+    if (task_intercom_init() != ESP_OK)
+        return 1;
+
+    httpd_handle_t server = start_http_server();
+    const httpd_uri_t *handler = host_httpd_find(server, CONFIG_IOT_DEVICE_ENDPOINT, HTTP_POST);
+
+    if (handler == NULL)
+        return 1;
+
+    xTaskCreate(load_consumer, "consumer", 4096, NULL, 1, NULL);
+
+    static char oversize[CONFIG_ITC_IOTA_COMMAND_MESSAGE_SIZE + 16];
+    memset(oversize, 'a', sizeof(oversize) - 1);
+
+    unsigned long pending = 0, busy = 0, too_large = 0, timeouts = 0, malformed = 0;
+    struct timespec start, end, offered;
+    double handler_time = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &offered);
+
+    for (int i = 0; i < warmup + requests; i++)
+    {
+        if (i == warmup)
+        {
+            host_allocation_counting = 1;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+
+        char body[96];
+        char header[64];
+        load_conn_t load = {
+            .conn = {.recv = load_recv, .send = load_send},
+            .max_chunk = max_chunk,
+            .timeout_every = timeout_every,
+        };
+
+        snprintf(header, sizeof(header), CONFIG_IOT_AGENT_DEVICE_ID "@update_program");
+
+        if (oversize_every > 0 && i % oversize_every == oversize_every - 1)
+            load.body = oversize;
+        else
+        {
+            snprintf(body, sizeof(body), "%s|h%d", header, i);
+            load.body = body;
+        }
+
+        load.length = strlen(load.body);
+
+        // wait for the slot of the request
+        if (rate > 0)
+        {
+            offered.tv_nsec += 1000000000L / rate;
+            offered.tv_sec += offered.tv_nsec / 1000000000L;
+            offered.tv_nsec %= 1000000000L;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &offered, NULL);
+        }
+
+        httpd_req_t request = {
+            .handle = server,
+            .method = HTTP_POST,
+            .uri = CONFIG_IOT_DEVICE_ENDPOINT,
+            .content_len = load.length,
+            .aux = &load,
+        };
+
+        struct timespec handler_start, handler_end;
+
+        clock_gettime(CLOCK_MONOTONIC, &handler_start);
+        handler->handler(&request);
+        clock_gettime(CLOCK_MONOTONIC, &handler_end);
+
+        if (i < warmup)
+            continue;
+
+        handler_time += (handler_end.tv_sec - handler_start.tv_sec) + (handler_end.tv_nsec - handler_start.tv_nsec) / 1e9;
+
+        size_t header_len = strlen(header);
+
+        if (strcmp(load.status, "400 Bad Request") == 0 && load.body == oversize)
+            too_large++;
+        else if (strcmp(load.status, "408 Request Timeout") == 0)
+            timeouts++;
+        else if (strcmp(load.status, "200 OK") != 0 || strncmp(load.response, header, header_len) != 0 || load.response[header_len] != '|')
+            malformed++;
+        else if (strcmp(load.response + header_len + 1, CONFIG_IOT_AGENT_COMMAND_INIT_RESPONSE) == 0)
+            pending++;
+        else if (strcmp(load.response + header_len + 1, "BUSY") == 0)
+            busy++;
+        else
+            malformed++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    host_allocation_counting = 0;
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("requests_per_s %.0f\n", requests / elapsed);
+    printf("handler_us %.3f\n", handler_time * 1e6 / requests);
+    printf("pending %lu\n", pending);
+    printf("busy %lu\n", busy);
+    printf("too_large %lu\n", too_large);
+    printf("timeouts %lu\n", timeouts);
+    printf("malformed %lu\n", malformed);
+    printf("allocations %lu\n", host_allocations);
+
+    return 0;
+}
+'''
+
+# name, offered requests/s (0 back to back), maximum body part, one timeout every n recv calls,
+# one oversized body every n requests, time the consumer takes per command in us, commands held by the consumer.
+# The consumer of the last scenario waits for more commands than the pool has, so every BUSY comes from the pool
+SCENARIOS = [
+    ('paced', 20000, 64, 0, 0, 0, 0),
+    ('back to back', 0, 64, 0, 0, 0, 0),
+    ('partial reads', 0, 3, 8, 0, 0, 0),
+    ('oversized bodies', 0, 64, 0, 10, 0, 0),
+    ('slow consumer', 0, 64, 0, 0, 200, 4),
+    ('pool exhausted', 0, 64, 0, 0, 50, 17),
+]
+
+
+def run(executable: str, args, scenario: tuple) -> dict:
+    """Runs a scenario, returns the figures reported by the driver"""
+    name, rate, max_chunk, timeout_every, oversize_every, service_us, in_flight = scenario
+
+    # a paced scenario is cut to the given duration
+    requests = args.requests if rate == 0 else min(args.requests, rate * args.paced_seconds)
+
+    output = subprocess.run([executable, str(requests), str(args.warmup), str(max_chunk), str(timeout_every),
+                             str(oversize_every), str(service_us), str(in_flight), str(args.seed), str(rate)],
+                            check=True, capture_output=True, text=True).stdout
+
+    return {key: float(value) for key, value in (line.split() for line in output.splitlines())}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Load test of the IoT Agent command handler of the server on the host build')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--requests', type=int, default=200000, help='measured requests per scenario')
+    parser.add_argument('--warmup', type=int, default=1000, help='requests before the measurement starts')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--paced-seconds', type=int, default=2, help='longest duration of a paced scenario')
+    parser.add_argument('--min-rate', type=float, default=0, help='fail if the handler sustains fewer requests/s in a scenario')
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        sys.exit(f'Compiler {args.cc} not found')
+
+    failed = False
+
+    with tempfile.TemporaryDirectory() as directory:
+        executable = host_build.build(args.cc, directory, DRIVER, SOURCES, count_allocations=True)
+
+        # offered is the rate the requests arrived at, sustained the rate the handler alone could serve
+        print(f'{"scenario":18s} {"offered/s":>10s} {"handler us":>10s} {"sustained/s":>11s} '
+              f'{"PENDING":>8s} {"BUSY":>8s} {"400":>6s} {"408":>6s} {"allocs":>6s}')
+
+        for scenario in SCENARIOS:
+            result = run(executable, args, scenario)
+            sustained = 1e6 / result['handler_us']
+
+            print(f'{scenario[0]:18s} {result["requests_per_s"]:10.0f} {result["handler_us"]:10.3f} {sustained:11.0f} '
+                  f'{result["pending"]:8.0f} {result["busy"]:8.0f} {result["too_large"]:6.0f} {result["timeouts"]:6.0f} '
+                  f'{result["allocations"]:6.0f}')
+
+            if result['allocations'] > 0:
+                print(f'  {scenario[0]}: the handler allocated from the heap')
+                failed = True
+
+            if result['malformed'] > 0:
+                print(f'  {scenario[0]}: {result["malformed"]:.0f} malformed responses')
+                failed = True
+
+            if sustained < args.min_rate:
+                print(f'  {scenario[0]}: below {args.min_rate:.0f} requests/s')
+                failed = True
+
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,686 @@
+import argparse
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+# defaults match the firmware Kconfig defaults of the "Step generation" menu
+STEPPER_DIRECTORY = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'components', 'stepper')
+STEPPER_INCLUDE = os.path.join(STEPPER_DIRECTORY, 'include')
+STEPPER_SOURCES = [os.path.join(STEPPER_DIRECTORY, name) for name in ('stepper_encoder.c', 'stepper_ramp.c', 'stepper_motion.c', 'stepper_planner.c', 'stepper_sim.c')]
+
+MAX_INTERVAL_US = 1000000
+
+# the host has no ESP-IDF, the backend interface only needs the error type
+ESP_ERR_SHIM = r'''
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+'''
+
+# the tick path is placed in IRAM on the target, the host links it like any other code
+ESP_ATTR_SHIM = r'''
+#pragma once
+
+#define IRAM_ATTR
+'''
+
+# runs the simulation backend on a list of intervals, a move or queued moves read from a file
+# and writes the recorded pulses as (rising edge time, width, axes) triples
+DRIVER = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stepper_backend.h"
+#include "stepper_motion.h"
+#include "stepper_planner.h"
+#include "stepper_sim.h"
+
+typedef struct
+{
+    const uint32_t *intervals;
+    size_t count;
+    size_t index;
+} intervals_t;
+
+static bool intervals_next(void *context, stepper_tick_t *tick)
+{
+    intervals_t *intervals = (intervals_t *)context;
+
+    if (intervals->index == intervals->count)
+        return false;
+
+    tick->interval_us = intervals->intervals[intervals->index++];
+    tick->axes = 1;
+
+    return true;
+}
+
+// pushes the moves into the planner, keeps at most ahead moves queued or all of them if ahead is 0
+typedef struct
+{
+    stepper_planner_t *planner;
+    const int32_t *deltas;
+    uint32_t axis_count;
+    uint32_t count;
+    uint32_t pushed;
+    uint32_t ahead;
+    uint32_t ticks;
+    uint32_t stop_tick;
+} feeder_t;
+
+static void feed(feeder_t *feeder)
+{
+    while (feeder->pushed < feeder->count && (feeder->ahead == 0 || stepper_planner_queued(feeder->planner) < feeder->ahead))
+    {
+        const int32_t *deltas = feeder->deltas + feeder->pushed * feeder->axis_count;
+        uint32_t steps[STEPPER_MAX_AXES];
+        uint32_t directions = 0;
+
+        for (uint32_t axis = 0; axis < feeder->axis_count; axis++)
+        {
+            steps[axis] = deltas[axis] >= 0 ? deltas[axis] : -deltas[axis];
+            directions |= (uint32_t)(deltas[axis] >= 0) << axis;
+        }
+
+        if (stepper_planner_push(feeder->planner, steps, directions) != ESP_OK)
+            exit(3);
+
+        feeder->pushed++;
+    }
+}
+
+// streams the moves while the motion runs
+static bool feeder_next(void *context, stepper_tick_t *tick)
+{
+    feeder_t *feeder = (feeder_t *)context;
+
+    feed(feeder);
+
+    // the stop request stays set like the one of the stepper task
+    if (feeder->stop_tick != 0 && feeder->ticks >= feeder->stop_tick)
+        stepper_planner_stop(feeder->planner);
+
+    feeder->ticks++;
+
+    return stepper_planner_next(feeder->planner, tick);
+}
+
+// runs a motion without a step limit until stopped
+typedef struct
+{
+    stepper_motion_t motion;
+    uint32_t ticks;
+    uint32_t stop_tick;
+} run_t;
+
+static bool run_next(void *context, stepper_tick_t *tick)
+{
+    run_t *run = (run_t *)context;
+
+    if (run->ticks++ >= run->stop_tick)
+        stepper_motion_stop(&run->motion);
+
+    return stepper_motion_next(&run->motion, tick);
+}
+
+static int done_calls = 0;
+
+static void done(void *context)
+{
+    done_calls++;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = fopen(argv[2], "rb");
+    static uint32_t values[1 << 18];
+    size_t count = fread(values, sizeof(uint32_t), sizeof(values) / sizeof(uint32_t), input);
+    fclose(input);
+
+    if (strcmp(argv[1], "intervals") == 0)
+    {
+        intervals_t intervals = {.intervals = values, .count = count, .index = 0};
+
+        if (stepper_backend_init(NULL, 1) != ESP_OK)
+            return 2;
+
+        if (stepper_backend_start(intervals_next, done, &intervals) != ESP_OK)
+            return 2;
+    }
+    else if (strcmp(argv[1], "move") == 0)
+    {
+        // max speed, acceleration, jerk, number of axes, steps of each axis
+        static stepper_ramp_table_t table;
+        stepper_motion_t motion;
+
+        if (stepper_backend_init(NULL, values[3]) != ESP_OK)
+            return 2;
+
+        if (stepper_ramp_build(&table, values[0], values[1], values[2]) != ESP_OK)
+            return 2;
+
+        stepper_motion_start(&motion, &table, values + 4, values[3]);
+
+        if (stepper_backend_start(stepper_motion_next, done, &motion) != ESP_OK)
+            return 2;
+    }
+    else if (strcmp(argv[1], "run") == 0)
+    {
+        // max speed, acceleration, tick the stop is requested at
+        static stepper_ramp_table_t table;
+        run_t run = {.ticks = 0, .stop_tick = values[2]};
+
+        if (stepper_backend_init(NULL, 1) != ESP_OK)
+            return 2;
+
+        if (stepper_ramp_build(&table, values[0], values[1], 0) != ESP_OK)
+            return 2;
+
+        stepper_motion_start_continuous(&run.motion, &table, 1);
+
+        if (stepper_backend_start(run_next, done, &run) != ESP_OK)
+            return 2;
+    }
+    else if (strcmp(argv[1], "queue") == 0)
+    {
+        // max speed, acceleration, junction speed, moves queued ahead, tick the stop is requested at (0 to run all moves),
+        // number of axes, signed steps of each axis of each move
+        static stepper_ramp_table_t table;
+        static stepper_planner_t planner;
+        uint32_t axis_count = values[5];
+        feeder_t feeder = {
+            .planner = &planner,
+            .deltas = (const int32_t *)(values + 6),
+            .axis_count = axis_count,
+            .count = (count - 6) / axis_count,
+            .pushed = 0,
+            .ahead = values[3],
+            .ticks = 0,
+            .stop_tick = values[4],
+        };
+        uint32_t directions;
+
+        if (stepper_backend_init(NULL, axis_count) != ESP_OK)
+            return 2;
+
+        if (stepper_ramp_build(&table, values[0], values[1], 0) != ESP_OK)
+            return 2;
+
+        stepper_planner_init(&planner, &table, axis_count, values[2]);
+        feed(&feeder);
+
+        // every change of direction ends a stream, the direction pins are set at rest
+        while (stepper_planner_begin(&planner, &directions))
+        {
+            if (stepper_backend_start(feeder_next, done, &feeder) != ESP_OK)
+                return 2;
+
+            // a stopped stream drops the queued moves
+            if (planner.stopping)
+                break;
+
+            feed(&feeder);
+        }
+    }
+    else
+        return 2;
+
+    size_t pulse_count;
+    const stepper_sim_pulse_t *pulses = stepper_sim_pulses(&pulse_count);
+
+    fprintf(stderr, "%d %llu\n", done_calls, (unsigned long long)stepper_sim_time_us());
+
+    for (size_t i = 0; i < pulse_count; i++)
+    {
+        fwrite(&pulses[i].time_us, sizeof(uint64_t), 1, stdout);
+        fwrite(&pulses[i].width_us, sizeof(uint32_t), 1, stdout);
+        fwrite(&pulses[i].axes, sizeof(uint32_t), 1, stdout);
+    }
+
+    return 0;
+}
+'''
+
+
+def build(args, directory: str) -> str:
+    """Compiles the encoder and the simulation backend with the configuration of the arguments into a host executable"""
+    driver = os.path.join(directory, 'driver.c')
+    executable = os.path.join(directory, 'driver')
+
+    with open(driver, 'w') as file:
+        file.write(DRIVER)
+
+    with open(os.path.join(directory, 'esp_err.h'), 'w') as file:
+        file.write(ESP_ERR_SHIM)
+
+    with open(os.path.join(directory, 'esp_attr.h'), 'w') as file:
+        file.write(ESP_ATTR_SHIM)
+
+    defines = [
+        f'-DCONFIG_STEPPER_PULSE_WIDTH_US={args.pulse_width}',
+        f'-DCONFIG_STEPPER_RMT_BLOCK_SYMBOLS={args.block_symbols}',
+        f'-DCONFIG_STEPPER_RAMP_TABLE_SIZE={args.table_size}',
+        f'-DCONFIG_STEPPER_PLANNER_LENGTH={args.planner_length}',
+    ]
+
+    subprocess.run([args.cc, '-O2', '-std=gnu11', '-Wall', f'-I{directory}', f'-I{STEPPER_INCLUDE}', *defines,
+                    '-o', executable, driver, *STEPPER_SOURCES, '-lm'], check=True)
+
+    return executable
+
+
+def run(executable: str, directory: str, mode: str, values: list) -> tuple:
+    """Runs a motion, returns the pulses, the number of done callbacks and the simulated time"""
+    path = os.path.join(directory, 'input.bin')
+
+    with open(path, 'wb') as file:
+        file.write(struct.pack(f'<{len(values)}I', *(value & 0xffffffff for value in values)))
+
+    result = subprocess.run([executable, mode, path], check=True, capture_output=True)
+    done_calls, time_us = (int(value) for value in result.stderr.split())
+    pulses = list(struct.iter_unpack('<QII', result.stdout))
+
+    return pulses, done_calls, time_us
+
+
+def check_intervals(executable: str, directory: str, args, intervals: list) -> list:
+    """Compares the pulse timeline of the intervals with the expected one, returns the failures"""
+    minimum = args.pulse_width + 1
+    expected = [max(minimum, min(MAX_INTERVAL_US, interval)) for interval in intervals]
+    pulses, done_calls, time_us = run(executable, directory, 'intervals', intervals)
+    failures = []
+
+    if len(pulses) != len(intervals):
+        failures.append(f'{len(pulses)} pulses instead of {len(intervals)}')
+
+    if done_calls != 1:
+        failures.append(f'done called {done_calls} times')
+
+    if time_us != sum(expected):
+        failures.append(f'motion lasted {time_us} us instead of {sum(expected)} us')
+
+    edge = 0
+
+    for index, ((time, width, _), interval) in enumerate(zip(pulses, expected)):
+        if time != edge:
+            failures.append(f'pulse {index} at {time} us instead of {edge} us')
+            break
+
+        if width != args.pulse_width:
+            failures.append(f'pulse {index} is {width} us wide')
+            break
+
+        edge += interval
+
+    return failures
+
+
+def reference_ramp(max_speed: float, acceleration: float, jerk: float, steps: int) -> list:
+    """Times of the steps of an ideal acceleration from rest, integrated in small time steps"""
+    dt = 1e-6
+    t = v = a = position = 0.0
+    times = [0.0]
+
+    while len(times) < steps and v < max_speed:
+        if jerk == 0:
+            a = acceleration
+        elif v + a * a / (2 * jerk) >= max_speed:
+            a = max(0.0, a - jerk * dt)
+        else:
+            a = min(acceleration, a + jerk * dt)
+
+        v = min(max_speed, v + a * dt)
+        position += v * dt
+        t += dt
+
+        if position >= len(times):
+            times.append(t)
+
+    return times
+
+
+def check_ramp(executable: str, directory: str, args, max_speed: int, acceleration: int, jerk: int, steps: int) -> list:
+    """Checks the speed limit, the symmetry and the timing of the acceleration of a move, returns the failures"""
+    pulses, done_calls, time_us = run(executable, directory, 'move', [max_speed, acceleration, jerk, 1, steps])
+    failures = []
+
+    if len(pulses) != steps:
+        return [f'{len(pulses)} pulses instead of {steps}']
+
+    if done_calls != 1:
+        failures.append(f'done called {done_calls} times')
+
+    # the interval after the last pulse is the time the motion lasted after it
+    times = [time for time, _, _ in pulses]
+    intervals = [b - a for a, b in zip(times, times[1:] + [time_us])]
+    cruise = 1000000 // max_speed
+
+    if min(intervals) < cruise:
+        failures.append(f'interval of {min(intervals)} us is faster than the max speed')
+
+    if intervals != intervals[::-1]:
+        failures.append('deceleration does not mirror the acceleration')
+
+    fastest = intervals.index(min(intervals))
+
+    if any(b > a for a, b in zip(intervals[:fastest], intervals[1:fastest + 1])):
+        failures.append('intervals increase while accelerating')
+
+    # the speed of the acceleration against the ideal motion up to the cruise speed, the speed is lowered if the table is too short.
+    # the first steps are skipped, the recurrence converges to the ideal intervals within a few steps
+    reference = reference_ramp(max_speed, acceleration, jerk, (steps + 1) // 2)
+    reference = [(b - a) * 1e6 for a, b in zip(reference, reference[1:])]
+    worst = 0.0
+
+    for index in range(min(fastest, 8), min(fastest, len(reference))):
+        # 1 us of rounding
+        error = max(0.0, abs(intervals[index] - reference[index]) - 1) / reference[index]
+        worst = max(worst, error)
+
+    if worst > args.tolerance:
+        failures.append(f'acceleration speed off by {worst * 100:.1f}%')
+
+    return failures
+
+
+def check_move(executable: str, directory: str, args, max_speed: int, acceleration: int, deltas: list) -> list:
+    """Checks the interpolation of a multi axis move, returns the failures"""
+    pulses, done_calls, _ = run(executable, directory, 'move', [max_speed, acceleration, 0, len(deltas), *deltas])
+    major = max(deltas)
+    failures = []
+
+    if len(pulses) != major:
+        return [f'{len(pulses)} ticks instead of {major}']
+
+    if done_calls != 1:
+        failures.append(f'done called {done_calls} times')
+
+    # the timing follows the ramp of the axis with the most steps
+    single, _, _ = run(executable, directory, 'move', [max_speed, acceleration, 0, 1, major])
+
+    if [time for time, _, _ in pulses] != [time for time, _, _ in single]:
+        failures.append('tick timing differs from the single axis move')
+
+    for axis, delta in enumerate(deltas):
+        steps = 0
+        deviation = 0.0
+
+        for index, (_, _, axes) in enumerate(pulses):
+            steps += (axes >> axis) & 1
+            deviation = max(deviation, abs(steps - (index + 1) * delta / major))
+
+        if steps != delta:
+            failures.append(f'axis {axis} made {steps} steps instead of {delta}')
+
+        # an axis is never more than half a step off the line
+        if deviation > 0.5 + 1e-9:
+            failures.append(f'axis {axis} is {deviation:.2f} steps off the line')
+
+    return failures
+
+
+def ramp_table(executable: str, directory: str, max_speed: int, acceleration: int) -> list:
+    """Intervals of the acceleration from rest to the cruise speed, the last one is the cruise interval"""
+    pulses, _, _ = run(executable, directory, 'move', [max_speed, acceleration, 0, 1, 1000000])
+    times = [time for time, _, _ in pulses]
+    intervals = [b - a for a, b in zip(times, times[1:])]
+    cruise = min(intervals)
+
+    return intervals[:intervals.index(cruise) + 1]
+
+
+def check_queue(executable: str, directory: str, args, max_speed: int, acceleration: int, junction_speed: int, ahead: int,
+                moves: list) -> list:
+    """Checks the steps, the speeds at the junctions and the acceleration of queued moves, returns the failures"""
+    axis_count = len(moves[0])
+    pulses, done_calls, time_us = run(executable, directory, 'queue',
+                                      [max_speed, acceleration, junction_speed, ahead, 0, axis_count, *(d for move in moves for d in move)])
+    moves = [move for move in moves if any(move)]
+    majors = [max(abs(d) for d in move) for move in moves]
+    failures = []
+
+    if len(pulses) != sum(majors):
+        return [f'{len(pulses)} ticks instead of {sum(majors)}']
+
+    # a stream ends at every change of a direction pin, axes that do not move keep their direction
+    directions = [False] * axis_count
+    streams = 0
+
+    for number, move in enumerate(moves):
+        changed = number == 0
+
+        for axis, delta in enumerate(move):
+            if delta != 0:
+                changed = changed or directions[axis] != (delta > 0)
+                directions[axis] = delta > 0
+
+        streams += changed
+
+    if done_calls != max(streams, 1):
+        failures.append(f'{done_calls} streams instead of {streams}')
+
+    times = [time for time, _, _ in pulses]
+    intervals = [b - a for a, b in zip(times, times[1:] + [time_us])]
+    start = 0
+
+    for number, (move, major) in enumerate(zip(moves, majors)):
+        ticks = pulses[start:start + major]
+
+        for axis, delta in enumerate(move):
+            steps = 0
+            deviation = 0.0
+
+            for index, (_, _, axes) in enumerate(ticks):
+                steps += (axes >> axis) & 1
+                deviation = max(deviation, abs(steps - (index + 1) * abs(delta) / major))
+
+            if steps != abs(delta):
+                failures.append(f'move {number} axis {axis} made {steps} steps instead of {abs(delta)}')
+
+            if deviation > 0.5 + 1e-9:
+                failures.append(f'move {number} axis {axis} is {deviation:.2f} steps off the line')
+
+        # the speed of every axis jumps by at most the junction speed, the step clock runs through the junction
+        if number > 0 and intervals[start - 1] != intervals[0]:
+            previous = moves[number - 1]
+            change = max(abs(abs(a) / majors[number - 1] - abs(b) / major) for a, b in zip(previous, move))
+            speed = 1e6 / min(intervals[start - 1], intervals[start])
+
+            if speed * change > junction_speed * 1.001:
+                failures.append(f'speed of an axis jumps by {speed * change:.0f} steps/s at move {number}')
+
+        start += major
+
+    return failures + check_ramp_walk(executable, directory, max_speed, acceleration, intervals)
+
+
+def check_ramp_walk(executable: str, directory: str, max_speed: int, acceleration: int, intervals: list) -> list:
+    """Checks that the step clock walks the ramp one step at a time and ends at rest, returns the failures"""
+    table = ramp_table(executable, directory, max_speed, acceleration)
+    positions = {}
+    failures = []
+
+    for index, interval in enumerate(table):
+        low, high = positions.get(interval, (index, index))
+        positions[interval] = (min(low, index), max(high, index))
+
+    for index, (a, b) in enumerate(zip(intervals, intervals[1:])):
+        if a not in positions or b not in positions:
+            failures.append(f'interval {a if a not in positions else b} us at tick {index} is not on the ramp')
+            break
+
+        if positions[b][0] > positions[a][1] + 1 or positions[b][1] < positions[a][0] - 1:
+            failures.append(f'speed jumps from {a} us to {b} us at tick {index}')
+            break
+
+    # a stream stops with the interval it started with
+    if intervals and intervals[-1] != table[0]:
+        failures.append(f'motion ends with an interval of {intervals[-1]} us')
+
+    return failures
+
+
+def check_stop(executable: str, directory: str, max_speed: int, acceleration: int, stop_tick: int, moves: list) -> list:
+    """Checks a stop requested while the motors run: the steps so far are kept and the motors decelerate at once"""
+    axis_count = len(moves[0]) if moves else 1
+    deltas = [d for move in moves for d in move]
+
+    if moves:
+        pulses, done_calls, time_us = run(executable, directory, 'queue', [max_speed, acceleration, 200, 0, stop_tick, axis_count, *deltas])
+        full, _, _ = run(executable, directory, 'queue', [max_speed, acceleration, 200, 0, 0, axis_count, *deltas])
+    else:
+        pulses, done_calls, time_us = run(executable, directory, 'run', [max_speed, acceleration, stop_tick])
+        full = None
+
+    failures = []
+
+    if done_calls != 1:
+        failures.append(f'done called {done_calls} times')
+
+    if len(pulses) < stop_tick:
+        return failures + [f'{len(pulses)} ticks before the stop at tick {stop_tick}']
+
+    # the ticks are a prefix of the full motion, the interpolation of the axes is not disturbed
+    if full is not None and [axes for _, _, axes in pulses] != [axes for _, _, axes in full[:len(pulses)]]:
+        failures.append('steps differ from the motion without a stop')
+
+    times = [time for time, _, _ in pulses]
+    intervals = [b - a for a, b in zip(times, times[1:] + [time_us])]
+
+    # the deceleration takes as many steps as the acceleration before it
+    table = ramp_table(executable, directory, max_speed, acceleration)
+
+    if len(pulses) - stop_tick > len(table) + 1:
+        failures.append(f'{len(pulses) - stop_tick} ticks after the stop')
+
+    # the speed falls from the stop on
+    if any(b < a for a, b in zip(intervals[stop_tick:], intervals[stop_tick + 1:])):
+        failures.append('speed rises after the stop')
+
+    return failures + check_ramp_walk(executable, directory, max_speed, acceleration, intervals)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Runs the stepper step generation on the host and checks the pulse timeline')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--pulse-width', type=int, default=5, help='CONFIG_STEPPER_PULSE_WIDTH_US')
+    parser.add_argument('--block-symbols', type=int, default=128, help='CONFIG_STEPPER_RMT_BLOCK_SYMBOLS')
+    parser.add_argument('--table-size', type=int, default=1024, help='CONFIG_STEPPER_RAMP_TABLE_SIZE')
+    parser.add_argument('--planner-length', type=int, default=16, help='CONFIG_STEPPER_PLANNER_LENGTH')
+    parser.add_argument('--tolerance', type=float, default=0.03, help='allowed relative error of the acceleration timing')
+    args = parser.parse_args()
+
+    if shutil.which(args.cc) is None:
+        sys.exit(f'Compiler {args.cc} not found')
+
+    # intervals around the limits of a symbol and the block boundaries
+    scenarios = {
+        'constant': [1000] * 1000,
+        'fastest': [args.pulse_width + 1] * 5000,
+        'clamped_short': [0, 1, args.pulse_width, 2, 10],
+        'long': [32767, 32768, 32772, 65535, 65536, 65537, 65540, 300000, MAX_INTERVAL_US],
+        'clamped_long': [MAX_INTERVAL_US + 1, 5000000],
+        'mixed': [100 + (index * 7919) % 70000 for index in range(2000)],
+        'empty': [],
+    }
+
+    # max speed, acceleration, jerk, steps
+    ramps = {
+        'trapezoid': (2000, 4000, 0, 2000),
+        'triangle_even': (5000, 2000, 0, 400),
+        'triangle_odd': (5000, 2000, 0, 401),
+        'single_step': (1000, 1000, 0, 1),
+        'fast': (20000, 400000, 0, 5000),
+        'gentle': (500, 100, 0, 1500),
+        's_curve': (3000, 6000, 30000, 3000),
+        's_curve_short': (3000, 6000, 30000, 300),
+    }
+
+    # max speed, acceleration, steps of each axis
+    moves = {
+        'two_axes': (2000, 4000, [1000, 333]),
+        'three_axes': (3000, 6000, [250, 1000, 999]),
+        'four_axes': (1000, 2000, [7, 500, 0, 499]),
+        'diagonal': (2000, 4000, [640, 640]),
+        'coprime': (5000, 20000, [9973, 7919, 3, 1]),
+    }
+
+    # max speed, acceleration, junction speed, moves queued ahead (0 for all), moves
+    queues = {
+        'collinear': (2000, 4000, 200, 0, [[500], [500], [500], [500]]),
+        'collinear_streamed': (2000, 4000, 200, 2, [[500], [500], [500], [500]]),
+        'short_moves': (2000, 4000, 200, 3, [[37]] * 60),
+        'corner': (3000, 6000, 300, 0, [[2000, 0], [0, 2000], [-2000, 0], [0, -2000]]),
+        'polyline': (3000, 6000, 500, 4, [[1000, 100], [1000, 300], [800, 500], [300, 900], [100, 1000], [0, 40]]),
+        'reversal': (2000, 4000, 200, 0, [[300, 200], [-300, 200], [-100, 0], [100, 0]]),
+        'idle_axis': (2000, 8000, 200, 0, [[400, -100, 0], [400, 0, 0], [400, -50, 10]]),
+        'empty_move': (2000, 4000, 200, 0, [[100, 100], [0, 0], [100, 100]]),
+    }
+
+    # max speed, acceleration, tick the stop is requested at, moves (none to run until stopped)
+    stops = {
+        'stop_cruising': (2000, 4000, 1500, [[500], [500], [500], [500]]),
+        'stop_accelerating': (2000, 4000, 200, [[1000, 300], [1000, 700]]),
+        'stop_at_junction': (3000, 6000, 1000, [[1000, 100], [1000, 300]]),
+        'stop_decelerating': (2000, 4000, 1900, [[2000]]),
+        'stop_continuous': (2000, 4000, 3000, []),
+        'stop_continuous_early': (2000, 4000, 10, []),
+    }
+
+    failed = False
+
+    def report(name: str, steps: int, failures: list):
+        nonlocal failed
+        failed = failed or len(failures) > 0
+
+        print(f'{name}: {"FAIL" if failures else "ok"} ({steps} steps)')
+
+        for failure in failures:
+            print(f'  {failure}')
+
+    with tempfile.TemporaryDirectory() as directory:
+        executable = build(args, directory)
+
+        for name, intervals in scenarios.items():
+            report(name, len(intervals), check_intervals(executable, directory, args, intervals))
+
+        for name, (max_speed, acceleration, jerk, steps) in ramps.items():
+            report(name, steps, check_ramp(executable, directory, args, max_speed, acceleration, jerk, steps))
+
+        for name, (max_speed, acceleration, deltas) in moves.items():
+            report(name, max(deltas), check_move(executable, directory, args, max_speed, acceleration, deltas))
+
+        for name, (max_speed, acceleration, junction_speed, ahead, moves) in queues.items():
+            steps = sum(max(abs(d) for d in move) for move in moves)
+            report(name, steps, check_queue(executable, directory, args, max_speed, acceleration, junction_speed, ahead, moves))
+
+        for name, (max_speed, acceleration, stop_tick, moves) in stops.items():
+            report(name, stop_tick, check_stop(executable, directory, max_speed, acceleration, stop_tick, moves))
+
+        # moves along a line run like a single move
+        single, _, _ = run(executable, directory, 'move', [2000, 4000, 0, 1, 2000])
+
+        for ahead in (0, 3):
+            queued, _, _ = run(executable, directory, 'queue', [2000, 4000, 200, ahead, 0, 1, 500, 500, 500, 500])
+            report(f'gapless_{ahead}', 2000, [] if queued == single else ['queued moves differ from a single move'])
+
+    print(f'max step rate: {1000000 / (args.pulse_width + 1):.0f} steps/s')
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,287 @@
+import argparse
+import os
+import random
+import sys
+import threading
+import time
+import tty
+
+# defaults match the firmware Kconfig defaults of the regulator UART
+BAUDRATE = 9600
+
+# the firmware terminates the commands with CR LF, the regulator answers the same way
+TERMINATOR = b'\r\n'
+
+MAX_VOLTAGE = 60.0
+MAX_CURRENT = 20.0
+
+# execution error codes reported by EER?
+ERROR_NONE = 0
+ERROR_RANGE = 117
+ERROR_UNKNOWN = 102
+
+
+class Regulator:
+    """Model of a single output TTi style regulator, the output follows the setpoint with a limited slew rate"""
+
+    def __init__(self, slew: float, load: float):
+        self.slew = slew
+        self.load = load
+        self.setpoint = 0.0
+        self.current_limit = 1.0
+        self.output_on = True
+        self.output = 0.0
+        self.error = ERROR_NONE
+        self.updated = time.monotonic()
+
+    def update(self):
+        """Moves the output towards the setpoint by the time passed"""
+
+        now = time.monotonic()
+        target = self.setpoint if self.output_on else 0.0
+
+        # constant current mode once the load draws more than the limit
+        if self.load > 0:
+            target = min(target, self.current_limit * self.load)
+
+        if self.slew <= 0:
+            self.output = target
+        else:
+            step = self.slew * (now - self.updated)
+            self.output = min(target, self.output + step) if target > self.output else max(target, self.output - step)
+
+        self.updated = now
+
+    def current(self) -> float:
+        """Returns the output current drawn by the load"""
+
+        return self.output / self.load if self.load > 0 else 0.0
+
+    def set_number(self, argument: str, limit: float) -> float or None:
+        """Parses the argument of a setting command, flags a range error if it is out of range"""
+
+        try:
+            value = float(argument)
+        except ValueError:
+            self.error = ERROR_UNKNOWN
+            return None
+
+        if not 0 <= value <= limit:
+            self.error = ERROR_RANGE
+            return None
+
+        return value
+
+    def handle(self, command: str) -> str or None:
+        """Executes a command, returns the reply line of a query"""
+
+        self.update()
+
+        header, _, argument = command.strip().partition(' ')
+        header = header.upper()
+
+        if header == 'V1' and argument:
+            value = self.set_number(argument, MAX_VOLTAGE)
+
+            if value is not None:
+                self.setpoint = value
+
+        elif header == 'V1?':
+            return f'V1 {self.setpoint:.3f}'
+
+        elif header == 'V1O?':
+            return f'{self.output:.3f}V'
+
+        elif header == 'I1' and argument:
+            value = self.set_number(argument, MAX_CURRENT)
+
+            if value is not None:
+                self.current_limit = value
+
+        elif header == 'I1?':
+            return f'I1 {self.current_limit:.3f}'
+
+        elif header == 'I1O?':
+            return f'{self.current():.3f}A'
+
+        elif header == 'OP1' and argument in ('0', '1'):
+            self.output_on = argument == '1'
+
+        elif header == 'OP1?':
+            return '1' if self.output_on else '0'
+
+        elif header == '*IDN?':
+            return 'ECI, VREG-SIM, 0, 1.0'
+
+        elif header == '*RST':
+            self.setpoint = 0.0
+            self.current_limit = 1.0
+            self.output_on = False
+
+        elif header == 'EER?':
+            error, self.error = self.error, ERROR_NONE
+            return str(error)
+
+        else:
+            self.error = ERROR_UNKNOWN
+
+        return None
+
+
+class Link:
+    """Serial side of the simulator, the replies are paced to the baudrate like on a real line"""
+
+    def __init__(self, regulator: Regulator, args):
+        self.regulator = regulator
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.counters = {'commands': 0, 'queries': 0, 'replies': 0, 'dropped': 0, 'garbled': 0, 'ignored': 0}
+        self.byte_time = 10 / args.baudrate
+
+    def log(self, direction: str, line: str):
+        if self.args.verbose:
+            print(f'{time.monotonic():.3f} {direction} {line}')
+
+    def reply(self, write, line: str):
+        """Writes a reply line unless a fault is injected"""
+
+        if self.random.random() < self.args.drop_rate:
+            self.counters['dropped'] += 1
+            self.log('x', line)
+            return
+
+        data = line.encode() + TERMINATOR
+
+        if self.random.random() < self.args.garble_rate:
+            self.counters['garbled'] += 1
+            position = self.random.randrange(len(line))
+            data = data[:position] + bytes([self.random.randrange(0x21, 0x7f)]) + data[position + 1:]
+
+        self.counters['replies'] += 1
+        self.log('>', data.decode(errors='replace').strip())
+
+        write(data)
+        time.sleep(len(data) * self.byte_time)
+
+    def line(self, write, line: str):
+        """Executes a received line, commands can be chained with ;"""
+
+        self.log('<', line)
+
+        for command in line.split(';'):
+            if not command.strip():
+                continue
+
+            self.counters['commands'] += 1
+
+            # a setpoint lost on the line, the readback shows the old value
+            if command.strip().upper().startswith('V1 ') and self.random.random() < self.args.ignore_rate:
+                self.counters['ignored'] += 1
+                continue
+
+            if self.args.latency > 0:
+                time.sleep(self.args.latency / 1000)
+
+            reply = self.regulator.handle(command)
+
+            if reply is not None:
+                self.counters['queries'] += 1
+                self.reply(write, reply)
+
+    def serve(self, read, write):
+        """Splits the received bytes into lines until the port is closed"""
+
+        buffer = b''
+
+        while True:
+            data = read()
+
+            if data is None:
+                return
+
+            buffer += data
+
+            while b'\n' in buffer:
+                raw, buffer = buffer.split(b'\n', 1)
+                line = raw.replace(b'\r', b'').decode(errors='replace')
+
+                if line:
+                    self.line(write, line)
+
+
+def open_pty():
+    """Opens a pseudo terminal, the firmware side connects to the slave"""
+
+    master, slave = os.openpty()
+
+    # no echo and no line discipline, the slave behaves like a serial port
+    tty.setraw(slave)
+
+    def read():
+        try:
+            return os.read(master, 256)
+        except OSError:
+            return None
+
+    def write(data: bytes):
+        os.write(master, data)
+
+    return os.ttyname(slave), read, write
+
+
+def open_port(url: str, baudrate: int):
+    """Opens a serial port, any pyserial URL works"""
+
+    # only needed without a pty
+    from serial import serial_for_url
+
+    ser = serial_for_url(url, baudrate=baudrate, timeout=0.1)
+
+    def read():
+        return ser.read(ser.in_waiting or 1)
+
+    return url, read, ser.write
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Voltage regulator simulator, answers the firmware regulator commands on a pty or a serial port',
+        epilog='Connect the ESP32 regulator UART through a USB serial adapter with --port, '
+               'or bridge the printed pty, e.g. socat /dev/ttyUSB0,b9600,raw <pty>')
+    parser.add_argument('--port', help='serial port or pyserial URL to answer on, a pty is opened if not given')
+    parser.add_argument('--baudrate', type=int, default=BAUDRATE, help='the replies are paced to this baudrate')
+    parser.add_argument('--latency', type=float, default=5, help='processing time of each command in ms')
+    parser.add_argument('--slew', type=float, default=10, help='slew rate of the output in V/s, 0 for a step')
+    parser.add_argument('--load', type=float, default=0, help='load resistance in ohms, 0 for no load')
+    parser.add_argument('--drop-rate', type=float, default=0, help='share of the replies that are lost')
+    parser.add_argument('--garble-rate', type=float, default=0, help='share of the replies with a corrupted character')
+    parser.add_argument('--ignore-rate', type=float, default=0, help='share of the setpoints that are lost')
+    parser.add_argument('--seed', type=int, help='seed of the fault injection')
+    parser.add_argument('--verbose', action='store_true', help='print every line')
+    args = parser.parse_args()
+
+    regulator = Regulator(args.slew, args.load)
+    link = Link(regulator, args)
+
+    if args.port:
+        name, read, write = open_port(args.port, args.baudrate)
+    else:
+        name, read, write = open_pty()
+
+    print(f'Regulator listening on {name}')
+    sys.stdout.flush()
+
+    worker = threading.Thread(target=link.serve, args=(read, write), daemon=True)
+    worker.start()
+
+    try:
+        while worker.is_alive():
+            worker.join(1)
+    except KeyboardInterrupt:
+        pass
+
+    print(', '.join(f'{name}: {value}' for name, value in link.counters.items()))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,76 @@
+import argparse
+import time
+from websocket import create_connection, WebSocketTimeoutException
+
+HOST = '192.168.0.100'
+
+EVENT_TYPES = {
+    'M': 'measurement',
+    'C': 'command',
+    'R': 'response',
+    'E': 'error',
+}
+
+
+def parse_frame(frame: str):
+    """Splits a telemetry frame "<sequence> <type> <text>" into its parts"""
+    sequence, event_type, text = (frame.split(' ', 2) + [''])[:3]
+
+    return int(sequence), EVENT_TYPES.get(event_type, event_type), text
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Telemetry stream test client')
+    parser.add_argument('--host', default=HOST)
+    parser.add_argument('--duration', type=float, default=10, help='measurement time in seconds')
+    parser.add_argument('--delay', type=float, default=0, help='delay after every frame to simulate a slow client')
+    parser.add_argument('--verbose', action='store_true', help='print every event')
+    args = parser.parse_args()
+
+    url = f'ws://{args.host}/telemetry'
+    print("Connecting to: ", url)
+    ws = create_connection(url, timeout=1)
+
+    received = 0
+    dropped = 0
+    last_sequence = None
+    counts = {}
+
+    start = time.monotonic()
+
+    while time.monotonic() - start < args.duration:
+        try:
+            frame = ws.recv()
+        except WebSocketTimeoutException:
+            continue
+
+        sequence, event_type, text = parse_frame(frame)
+
+        # a gap in the sequence numbers means the device dropped events for this client
+        if last_sequence is not None and sequence > last_sequence + 1:
+            dropped += sequence - last_sequence - 1
+
+        last_sequence = sequence
+        received += 1
+        counts[event_type] = counts.get(event_type, 0) + 1
+
+        if args.verbose:
+            print(f'{sequence:8d} {event_type:12s} {text}')
+
+        if args.delay > 0:
+            time.sleep(args.delay)
+
+    elapsed = time.monotonic() - start
+    ws.close()
+
+    total = received + dropped
+
+    print(f'Delivered: {received} events in {elapsed:.1f} s ({received / elapsed:.1f} events/s)')
+    print(f'Dropped:   {dropped} events ({100 * dropped / total if total else 0:.1f} %)')
+
+    for event_type, count in counts.items():
+        print(f'  {event_type}: {count}')
+
+
+if __name__ == '__main__':
+    main()